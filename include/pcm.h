@@ -71,6 +71,8 @@ typedef struct _snd_pcm_hw_params snd_pcm_hw_params_t;
 typedef struct _snd_pcm_sw_params snd_pcm_sw_params_t;
 /** PCM status container */
  typedef struct _snd_pcm_status snd_pcm_status_t;
+/** PCM hot-path statistics container */
+typedef struct _snd_pcm_stats snd_pcm_stats_t;
 /** PCM access types mask */
 typedef struct _snd_pcm_access_mask snd_pcm_access_mask_t;
 /** PCM formats mask */
@@ -363,6 +365,35 @@ typedef enum _snd_pcm_tstamp_type {
 	SND_PCM_TSTAMP_TYPE_LAST = SND_PCM_TSTAMP_TYPE_MONOTONIC_RAW,
 } snd_pcm_tstamp_type_t;
 
+/** PCM hot-path statistics counter */
+typedef enum _snd_pcm_stats_counter {
+	/** Calls of the write transfer */
+	SND_PCM_STATS_WRITE_AREAS = 0,
+	/** Nanoseconds spent in the write transfer */
+	SND_PCM_STATS_WRITE_AREAS_NSEC,
+	/** Calls of the read transfer */
+	SND_PCM_STATS_READ_AREAS,
+	/** Nanoseconds spent in the read transfer */
+	SND_PCM_STATS_READ_AREAS_NSEC,
+	/** Calls of the mmap commit */
+	SND_PCM_STATS_MMAP_COMMIT,
+	/** Nanoseconds spent in the mmap commit */
+	SND_PCM_STATS_MMAP_COMMIT_NSEC,
+	/** Calls of the avail update */
+	SND_PCM_STATS_AVAIL_UPDATE,
+	/** Nanoseconds spent in the avail update */
+	SND_PCM_STATS_AVAIL_UPDATE_NSEC,
+	/** System calls issued in the streaming path */
+	SND_PCM_STATS_SYSCALLS,
+	/** Bytes converted by the plugin */
+	SND_PCM_STATS_BYTES_CONVERTED,
+	/** Detected xruns */
+	SND_PCM_STATS_XRUNS,
+	/** Wakeups from poll in #snd_pcm_wait() */
+	SND_PCM_STATS_WAKEUPS,
+	SND_PCM_STATS_LAST = SND_PCM_STATS_WAKEUPS
+} snd_pcm_stats_counter_t;
+
 /** PCM audio timestamp type */
 typedef enum _snd_pcm_audio_tstamp_type {
 	/**
@@ -548,6 +579,11 @@ int snd_async_add_pcm_handler(snd_async_handler_t **handler, snd_pcm_t *pcm,
 snd_pcm_t *snd_async_handler_get_pcm(snd_async_handler_t *handler);
 int snd_pcm_info(snd_pcm_t *pcm, snd_pcm_info_t *info);
 int snd_pcm_hw_params_current(snd_pcm_t *pcm, snd_pcm_hw_params_t *params);
+int snd_pcm_hw_params_solve(snd_pcm_t *pcm, snd_pcm_hw_params_t *params,
+			    snd_pcm_access_t access, snd_pcm_format_t format,
+			    unsigned int channels, unsigned int *rate,
+			    snd_pcm_uframes_t *period_size,
+			    snd_pcm_uframes_t *buffer_size);
 int snd_pcm_hw_params(snd_pcm_t *pcm, snd_pcm_hw_params_t *params);
 int snd_pcm_hw_free(snd_pcm_t *pcm);
 int snd_pcm_sw_params_current(snd_pcm_t *pcm, snd_pcm_sw_params_t *params);
@@ -567,6 +603,7 @@ int snd_pcm_htimestamp(snd_pcm_t *pcm, snd_pcm_uframes_t *avail, snd_htimestamp_
 snd_pcm_sframes_t snd_pcm_avail(snd_pcm_t *pcm);
 snd_pcm_sframes_t snd_pcm_avail_update(snd_pcm_t *pcm);
 int snd_pcm_avail_delay(snd_pcm_t *pcm, snd_pcm_sframes_t *availp, snd_pcm_sframes_t *delayp);
+int snd_pcm_status_snapshot_enable(snd_pcm_t *pcm, int enable);
 snd_pcm_sframes_t snd_pcm_rewindable(snd_pcm_t *pcm);
 snd_pcm_sframes_t snd_pcm_rewind(snd_pcm_t *pcm, snd_pcm_uframes_t frames);
 snd_pcm_sframes_t snd_pcm_forwardable(snd_pcm_t *pcm);
@@ -1094,6 +1131,31 @@ snd_pcm_uframes_t snd_pcm_status_get_overrange(const snd_pcm_status_t *obj);
 
 /** \} */
 
+/**
+ * \defgroup PCM_Stats Hot-path Statistics Functions
+ * \ingroup PCM
+ * See the \ref pcm page for more details.
+ * \{
+ */
+
+int snd_pcm_stats_enable(snd_pcm_t *pcm, int enable);
+int snd_pcm_stats(snd_pcm_t *pcm, snd_pcm_stats_t *stats);
+int snd_pcm_stats_reset(snd_pcm_t *pcm);
+size_t snd_pcm_stats_sizeof(void);
+/** \hideinitializer
+ * \brief allocate an invalid #snd_pcm_stats_t using standard alloca
+ * \param ptr returned pointer
+ */
+#define snd_pcm_stats_alloca(ptr) __snd_alloca(ptr, snd_pcm_stats)
+int snd_pcm_stats_malloc(snd_pcm_stats_t **ptr);
+void snd_pcm_stats_free(snd_pcm_stats_t *obj);
+void snd_pcm_stats_copy(snd_pcm_stats_t *dst, const snd_pcm_stats_t *src);
+unsigned long long snd_pcm_stats_get(const snd_pcm_stats_t *obj, snd_pcm_stats_counter_t counter);
+const char *snd_pcm_stats_counter_name(snd_pcm_stats_counter_t counter);
+int snd_pcm_stats_dump(const snd_pcm_stats_t *stats, snd_output_t *out);
+
+/** \} */
+
 /**
  * \defgroup PCM_Description Description Functions
  * \ingroup PCM
@@ -1313,6 +1375,17 @@ int snd_pcm_scope_s16_open(snd_pcm_t *pcm, const char *name,
 			   snd_pcm_scope_t **scopep);
 int16_t *snd_pcm_scope_s16_get_channel_buffer(snd_pcm_scope_t *scope,
 					      unsigned int channel);
+int snd_pcm_scope_rms_open(snd_pcm_t *pcm, const char *name,
+			   snd_pcm_scope_t **scopep);
+int snd_pcm_scope_rms_get_channel(snd_pcm_scope_t *scope, unsigned int channel,
+				  float *rms, float *peak);
+int snd_pcm_scope_loudness_open(snd_pcm_t *pcm, const char *name,
+				snd_pcm_scope_t **scopep);
+int snd_pcm_scope_loudness_get(snd_pcm_scope_t *scope, float *momentary,
+			       float *short_term, float *integrated);
+int snd_pcm_scope_loudness_get_channel(snd_pcm_scope_t *scope,
+				       unsigned int channel,
+				       float *true_peak, float *rms);
 
 /** \} */
 
@@ -192,6 +192,10 @@ int snd_pcm_extplug_set_slave_param_minmax(snd_pcm_extplug_t *extplug, int type,
 int snd_pcm_extplug_set_param_link(snd_pcm_extplug_t *extplug, int type,
 				   int keep_link);
 
+/* block-aligned transfer */
+int snd_pcm_extplug_set_block(snd_pcm_extplug_t *extplug,
+			      snd_pcm_uframes_t block_size, unsigned int align);
+
 /**
  * set the parameter constraint with a single value
  */
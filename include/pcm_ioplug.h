@@ -78,7 +78,7 @@ typedef snd_pcm_ioplug_callback snd_pcm_ioplug_callback_t;
  */
 #define SND_PCM_IOPLUG_VERSION_MAJOR	1	/**< Protocol major version */
 #define SND_PCM_IOPLUG_VERSION_MINOR	0	/**< Protocol minor version */
-#define SND_PCM_IOPLUG_VERSION_TINY	2	/**< Protocol tiny version */
+#define SND_PCM_IOPLUG_VERSION_TINY	3	/**< Protocol tiny version */
 /**
  * IO-plugin protocol version
  */
@@ -86,6 +86,27 @@ typedef snd_pcm_ioplug_callback snd_pcm_ioplug_callback_t;
 					 (SND_PCM_IOPLUG_VERSION_MINOR<<8) |\
 					 (SND_PCM_IOPLUG_VERSION_TINY))
 
+/** Layout version of #snd_pcm_ioplug_shm_ring_t */
+#define SND_PCM_IOPLUG_SHM_RING_VERSION	1
+
+/**
+ * Control block placed at the head of a shared memory ring registered via
+ * #snd_pcm_ioplug_set_shm_ring(); the sample data follows at data_offset.
+ * Positions are free-running frame counters which wrap at the type limit.
+ */
+typedef struct snd_pcm_ioplug_shm_ring {
+	unsigned int version;		/**< #SND_PCM_IOPLUG_SHM_RING_VERSION; set by alsa-lib */
+	unsigned int data_offset;	/**< offset of the sample data in bytes; set by alsa-lib */
+	snd_pcm_access_t access;	/**< access type; set by alsa-lib at hw_params */
+	snd_pcm_format_t format;	/**< sample format; set by alsa-lib at hw_params */
+	unsigned int channels;		/**< number of channels; set by alsa-lib at hw_params */
+	unsigned int rate;		/**< rate; set by alsa-lib at hw_params */
+	snd_pcm_uframes_t buffer_size;	/**< ring size in frames; set by alsa-lib at hw_params */
+	snd_pcm_uframes_t appl_ptr;	/**< application position; written by alsa-lib */
+	snd_pcm_uframes_t hw_ptr;	/**< hw position; written by the transport */
+	int error;			/**< negative error code posted by the transport */
+} snd_pcm_ioplug_shm_ring_t;
+
 /** Handle of ioplug */
 struct snd_pcm_ioplug {
 	/**
@@ -139,7 +160,8 @@ struct snd_pcm_ioplug_callback {
 	 */
 	int (*stop)(snd_pcm_ioplug_t *io);
 	/**
-	 * get the current DMA position; required, called inside mutex lock
+	 * get the current DMA position; required unless a shared memory ring
+	 * is registered (since v1.0.3), called inside mutex lock
 	 * \return buffer position up to buffer_size or
 	 * when #SND_PCM_IOPLUG_FLAG_BOUNDARY_WA flag is set up to boundary or
 	 * a negative error code for Xrun
@@ -229,6 +251,9 @@ int snd_pcm_ioplug_reinit_status(snd_pcm_ioplug_t *ioplug);
 /* get a mmap area (for mmap_rw only) */
 const snd_pcm_channel_area_t *snd_pcm_ioplug_mmap_areas(snd_pcm_ioplug_t *ioplug);
 
+/* register a shared memory ring (memfd) as the mmap buffer */
+int snd_pcm_ioplug_set_shm_ring(snd_pcm_ioplug_t *ioplug, int fd, size_t offset, size_t size);
+
 /* clear hw_parameter setting */
 void snd_pcm_ioplug_params_reset(snd_pcm_ioplug_t *io);
 
@@ -25,43 +25,24 @@
 #define MASK_INLINE static inline
 
 #define MASK_MAX SND_MASK_MAX
-#define MASK_SIZE (MASK_MAX / 32)
 
 #define MASK_OFS(i)	((i) >> 5)
 #define MASK_BIT(i)	(1U << ((i) & 31))
 
-MASK_INLINE unsigned int ld2(uint32_t v)
+/* the whole mask fits in one 64-bit word */
+#define MASK_ALL	(~(uint64_t)0)
+#define MASK_RANGE(from, to) \
+	((MASK_ALL >> (MASK_MAX - 1 - ((to) - (from)))) << (from))
+
+MASK_INLINE uint64_t mask_word(const snd_mask_t *mask)
 {
-	unsigned r = 0;
-
-	if (v >= 0x10000) {
-		v >>= 16;
-		r += 16;
-	}
-	if (v >= 0x100) {
-		v >>= 8;
-		r += 8;
-	}
-	if (v >= 0x10) {
-		v >>= 4;
-		r += 4;
-	}
-	if (v >= 4) {
-		v >>= 2;
-		r += 2;
-	}
-	if (v >= 2)
-		r++;
-	return r;
+	return mask->bits[0] | ((uint64_t)mask->bits[1] << 32);
 }
 
-MASK_INLINE unsigned int hweight32(uint32_t v)
+MASK_INLINE void mask_set_word(snd_mask_t *mask, uint64_t v)
 {
-	v = (v & 0x55555555) + ((v >> 1) & 0x55555555);
-	v = (v & 0x33333333) + ((v >> 2) & 0x33333333);
-	v = (v & 0x0F0F0F0F) + ((v >> 4) & 0x0F0F0F0F);
-	v = (v & 0x00FF00FF) + ((v >> 8) & 0x00FF00FF);
-	return (v & 0x0000FFFF) + ((v >> 16) & 0x0000FFFF);
+	mask->bits[0] = (uint32_t)v;
+	mask->bits[1] = (uint32_t)(v >> 32);
 }
 
 MASK_INLINE size_t snd_mask_sizeof(void)
@@ -76,55 +57,34 @@ MASK_INLINE void snd_mask_none(snd_mask_t *mask)
 
 MASK_INLINE void snd_mask_any(snd_mask_t *mask)
 {
-	memset(mask, 0xff, MASK_SIZE * sizeof(uint32_t));
+	mask_set_word(mask, MASK_ALL);
 }
 
 MASK_INLINE int snd_mask_empty(const snd_mask_t *mask)
 {
-	int i;
-	for (i = 0; i < MASK_SIZE; i++)
-		if (mask->bits[i])
-			return 0;
-	return 1;
+	return !mask_word(mask);
 }
 
 MASK_INLINE int snd_mask_full(const snd_mask_t *mask)
 {
-	int i;
-	for (i = 0; i < MASK_SIZE; i++)
-		if (mask->bits[i] != 0xffffffff)
-			return 0;
-	return 1;
+	return mask_word(mask) == MASK_ALL;
 }
 
 MASK_INLINE unsigned int snd_mask_count(const snd_mask_t *mask)
 {
-	int i, w = 0;
-	for (i = 0; i < MASK_SIZE; i++)
-		w += hweight32(mask->bits[i]);
-	return w;
+	return __builtin_popcountll(mask_word(mask));
 }
 
 MASK_INLINE unsigned int snd_mask_min(const snd_mask_t *mask)
 {
-	int i;
 	assert(!snd_mask_empty(mask));
-	for (i = 0; i < MASK_SIZE; i++) {
-		if (mask->bits[i])
-			return ffs(mask->bits[i]) - 1 + (i << 5);
-	}
-	return 0;
+	return __builtin_ctzll(mask_word(mask));
 }
 
 MASK_INLINE unsigned int snd_mask_max(const snd_mask_t *mask)
 {
-	int i;
 	assert(!snd_mask_empty(mask));
-	for (i = MASK_SIZE - 1; i >= 0; i--) {
-		if (mask->bits[i])
-			return ld2(mask->bits[i]) + (i << 5);
-	}
-	return 0;
+	return MASK_MAX - 1 - __builtin_clzll(mask_word(mask));
 }
 
 MASK_INLINE void snd_mask_set(snd_mask_t *mask, unsigned int val)
@@ -141,46 +101,47 @@ MASK_INLINE void snd_mask_reset(snd_mask_t *mask, unsigned int val)
 
 MASK_INLINE void snd_mask_set_range(snd_mask_t *mask, unsigned int from, unsigned int to)
 {
-	unsigned int i;
 	assert(to <= SND_MASK_MAX && from <= to);
-	for (i = from; i <= to; i++)
-		mask->bits[MASK_OFS(i)] |= MASK_BIT(i);
+	if (from >= MASK_MAX)
+		return;
+	if (to >= MASK_MAX)
+		to = MASK_MAX - 1;
+	mask_set_word(mask, mask_word(mask) | MASK_RANGE(from, to));
 }
 
 MASK_INLINE void snd_mask_reset_range(snd_mask_t *mask, unsigned int from, unsigned int to)
 {
-	unsigned int i;
 	assert(to <= SND_MASK_MAX && from <= to);
-	for (i = from; i <= to; i++)
-		mask->bits[MASK_OFS(i)] &= ~MASK_BIT(i);
+	if (from >= MASK_MAX)
+		return;
+	if (to >= MASK_MAX)
+		to = MASK_MAX - 1;
+	mask_set_word(mask, mask_word(mask) & ~MASK_RANGE(from, to));
 }
 
 MASK_INLINE void snd_mask_leave(snd_mask_t *mask, unsigned int val)
 {
-	unsigned int v;
+	uint64_t v = 0;
 	assert(val <= SND_MASK_MAX);
-	v = mask->bits[MASK_OFS(val)] & MASK_BIT(val);
+	if (val < MASK_MAX)
+		v = mask_word(mask) & ((uint64_t)1 << val);
 	snd_mask_none(mask);
-	mask->bits[MASK_OFS(val)] = v;
+	mask_set_word(mask, v);
 }
 
 MASK_INLINE void snd_mask_intersect(snd_mask_t *mask, const snd_mask_t *v)
 {
-	int i;
-	for (i = 0; i < MASK_SIZE; i++)
-		mask->bits[i] &= v->bits[i];
+	mask_set_word(mask, mask_word(mask) & mask_word(v));
 }
 
 MASK_INLINE void snd_mask_union(snd_mask_t *mask, const snd_mask_t *v)
 {
-	int i;
-	for (i = 0; i < MASK_SIZE; i++)
-		mask->bits[i] |= v->bits[i];
+	mask_set_word(mask, mask_word(mask) | mask_word(v));
 }
 
 MASK_INLINE int snd_mask_eq(const snd_mask_t *mask, const snd_mask_t *v)
 {
-	return ! memcmp(mask, v, MASK_SIZE * 4);
+	return mask_word(mask) == mask_word(v);
 }
 
 MASK_INLINE void snd_mask_copy(snd_mask_t *mask, const snd_mask_t *v)
@@ -196,30 +157,21 @@ MASK_INLINE int snd_mask_test(const snd_mask_t *mask, unsigned int val)
 
 MASK_INLINE int snd_mask_single(const snd_mask_t *mask)
 {
-	int i, c = 0;
-	assert(!snd_mask_empty(mask));
-	for (i = 0; i < MASK_SIZE; i++) {
-		if (! mask->bits[i])
-			continue;
-		if (mask->bits[i] & (mask->bits[i] - 1))
-			return 0;
-		if (c)
-			return 0;
-		c++;
-	}
-	return 1;
+	uint64_t v = mask_word(mask);
+	assert(v);
+	return !(v & (v - 1));
 }
 
 MASK_INLINE int snd_mask_refine(snd_mask_t *mask, const snd_mask_t *v)
 {
-	snd_mask_t old;
-	if (snd_mask_empty(mask))
+	uint64_t old = mask_word(mask), val;
+	if (!old)
 		return -ENOENT;
-	snd_mask_copy(&old, mask);
-	snd_mask_intersect(mask, v);
-	if (snd_mask_empty(mask))
+	val = old & mask_word(v);
+	mask_set_word(mask, val);
+	if (!val)
 		return -EINVAL;
-	return !snd_mask_eq(mask, &old);
+	return val != old;
 }
 
 MASK_INLINE int snd_mask_refine_first(snd_mask_t *mask)
@@ -292,9 +244,5 @@ MASK_INLINE int snd_mask_always_eq(const snd_mask_t *m1, const snd_mask_t *m2)
 
 MASK_INLINE int snd_mask_never_eq(const snd_mask_t *m1, const snd_mask_t *m2)
 {
-	int i;
-	for (i = 0; i < MASK_SIZE; i++)
-		if (m1->bits[i] & m2->bits[i])
-			return 0;
-	return 1;
+	return !(mask_word(m1) & mask_word(m2));
 }
@@ -516,6 +516,62 @@ LIBASOUND_THREAD_SAFE=0 aplay foo.wav
 \endcode
 for making the debugging easier.
 
+\section pcm_stats Hot-path statistics
+
+Each PCM handle (including the slave PCMs in a plugin chain) can optionally
+account the time spent in the transfer, mmap commit and avail update paths,
+the number of system calls, the converted bytes, xruns and wakeups.
+The counters are enabled per handle with #snd_pcm_stats_enable() and
+retrieved with #snd_pcm_stats(). To enable the counters for all PCM handles
+including the internal slaves, set the environment variable
+LIBASOUND_PCM_STATS, e.g.
+\code
+LIBASOUND_PCM_STATS=1 aplay -v foo.wav
+\endcode
+The counters are then printed by #snd_pcm_dump() for each plugin in the chain.
+The times are inclusive, i.e. the time of a plugin contains also the time
+spent in its slaves.
+
+\section pcm_refine_cache Configuration space refinement cache
+
+Each #snd_pcm_hw_params_any(), #snd_pcm_hw_params_test_rate(),
+#snd_pcm_hw_params_set_rate_near() etc. call refines the configuration space
+through the whole plugin chain. The results are remembered by each PCM in the
+chain until the configuration is installed, so the repeated refines issued
+during the negotiation return immediately. The cache can be disabled by
+passing 0 to the environment variable LIBASOUND_PCM_REFINE_CACHE.
+
+The results can also be kept on disk, so that the next process opening the
+same PCM skips the negotiation, too. Set the directory for the cache files
+with the defaults.pcm.refine_cache_dir configuration key or the environment
+variable LIBASOUND_PCM_REFINE_CACHE_DIR. The files are keyed by the PCM name
+and definition, the open mode and the device identity; a stored set is used
+only if refining the whole configuration space still gives the stored result,
+so a changed device or driver invalidates it, and each stored result is
+checked to be a possible refinement of its input. Only the refine results are
+stored: the plugin chain of the plug plugin and the hardware setup of the
+direct plugins are still built at open, but their search for a configuration
+is answered from the cache.
+
+\section pcm_snapshot Lock-free status queries
+
+With the thread-safe API, a thread polling #snd_pcm_delay() or
+#snd_pcm_avail() at a high rate contends for the PCM lock with the thread
+doing the transfers. After #snd_pcm_status_snapshot_enable(), the functions
+#snd_pcm_state(), #snd_pcm_avail(), #snd_pcm_avail_delay(), #snd_pcm_delay()
+and #snd_pcm_htimestamp() are served from a snapshot protected by a sequence
+counter instead. The snapshot is published by the thread operating the stream
+at the end of the transfer, mmap commit, avail update and state changing
+calls; the readers never take the lock nor call into the plugin chain.
+
+For a running stream, avail and delay are extrapolated from the publication
+time using the stream rate, so the values stay close to the ones returned by
+a real query. The part of the delay not covered by the ring buffer pointers
+(e.g. the hardware FIFO or the buffering in the slaves) is measured at most
+once per period. The state is the one seen by the last published operation,
+so an xrun is reported only after the next transfer or #snd_pcm_avail_update()
+call. #snd_pcm_status() and #snd_pcm_avail_update() always query the stream.
+
 \section pcm_dev_names PCM naming conventions
 
 The ALSA library uses a generic string representation for names of devices.
@@ -697,6 +753,75 @@ static int pcm_state_to_error(snd_pcm_state_t state)
 	}
 }
 
+static long long snd_pcm_snapshot_ns(const snd_htimestamp_t *a,
+				     const snd_htimestamp_t *b)
+{
+	return (a->tv_sec - b->tv_sec) * 1000000000LL + a->tv_nsec - b->tv_nsec;
+}
+
+/* lock-free read of the published snapshot */
+static void snd_pcm_snapshot_read(snd_pcm_t *pcm,
+				  struct _snd_pcm_snapshot_data *d)
+{
+	snd_pcm_snapshot_t *snapshot = pcm->snapshot;
+	unsigned int seq;
+
+	do {
+		seq = __atomic_load_n(&snapshot->seq, __ATOMIC_ACQUIRE);
+		*d = snapshot->data;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while ((seq & 1) ||
+		 __atomic_load_n(&snapshot->seq, __ATOMIC_RELAXED) != seq);
+}
+
+/* read the snapshot and advance a running stream to the current time */
+static int snd_pcm_snapshot_get(snd_pcm_t *pcm, snd_pcm_sframes_t *availp,
+				snd_pcm_sframes_t *delayp)
+{
+	struct _snd_pcm_snapshot_data d;
+	snd_htimestamp_t now;
+	snd_pcm_sframes_t avail;
+	long long ns;
+	int err;
+
+	snd_pcm_snapshot_read(pcm, &d);
+	err = pcm_state_to_error(d.state);
+	if (err < 0)
+		return err;
+	if (delayp && (d.state == SND_PCM_STATE_OPEN ||
+		       d.state == SND_PCM_STATE_SETUP))
+		return -EBADFD;
+	avail = d.avail;
+	if (d.state == SND_PCM_STATE_RUNNING ||
+	    d.state == SND_PCM_STATE_DRAINING) {
+		gettimestamp(&now, SND_PCM_TSTAMP_TYPE_MONOTONIC);
+		ns = snd_pcm_snapshot_ns(&now, &d.time);
+		if (ns > 0)
+			avail += ns * pcm->rate / 1000000000LL;
+		if (avail > (snd_pcm_sframes_t)pcm->buffer_size)
+			avail = pcm->buffer_size;
+	}
+	if (availp)
+		*availp = avail;
+	if (delayp) {
+		if (pcm->stream == SND_PCM_STREAM_PLAYBACK)
+			*delayp = pcm->buffer_size - avail + d.delay_extra;
+		else
+			*delayp = avail + d.delay_extra;
+	}
+	return 0;
+}
+
+/* publish the snapshot after an operation doing its own locking */
+static void snd_pcm_snapshot_sync(snd_pcm_t *pcm)
+{
+	if (!pcm->snapshot)
+		return;
+	snd_pcm_lock(pcm->fast_op_arg);
+	__snd_pcm_snapshot_publish(pcm);
+	snd_pcm_unlock(pcm->fast_op_arg);
+}
+
 #define P_STATE(x)	(1U << SND_PCM_STATE_ ## x)
 #define P_STATE_RUNNABLE (P_STATE(PREPARED) | \
 			  P_STATE(RUNNING) | \
@@ -713,7 +838,10 @@ static int bad_pcm_state(snd_pcm_t *pcm, unsigned int supported_states,
 
 	if (pcm->own_state_check)
 		return 0; /* don't care, the plugin checks by itself */
-	state = snd_pcm_state(pcm);
+	/* check the real state, not the published snapshot */
+	snd_pcm_lock(pcm->fast_op_arg);
+	state = __snd_pcm_state(pcm);
+	snd_pcm_unlock(pcm->fast_op_arg);
 	if (noop_states & (1U << state))
 		return 1; /* OK, return immediately */
 	if (supported_states & (1U << state))
@@ -927,6 +1055,116 @@ int snd_pcm_hw_params_current(snd_pcm_t *pcm, snd_pcm_hw_params_t *params)
 	return 0;
 }
 
+#ifndef DOC_HIDDEN
+static int hw_param_set_value(snd_pcm_hw_params_t *params,
+			      snd_pcm_hw_param_t var, snd_pcm_uframes_t val)
+{
+	if (val > UINT_MAX)
+		return -EINVAL;
+	return _snd_pcm_hw_param_set(params, var, val, 0);
+}
+
+static int hw_param_set_near(snd_pcm_t *pcm, snd_pcm_hw_params_t *params,
+			     snd_pcm_hw_param_t var, snd_pcm_uframes_t val)
+{
+	unsigned int _val = val > UINT_MAX ? UINT_MAX : val;
+
+	return snd_pcm_hw_param_set_near(pcm, params, var, &_val, NULL);
+}
+#endif
+
+/** \brief Choose a PCM hardware configuration in a single negotiation
+ * \param pcm PCM handle
+ * \param params Returned configuration
+ * \param access required PCM access
+ * \param format required PCM format or #SND_PCM_FORMAT_UNKNOWN for any
+ * \param channels required PCM channels or 0 for any
+ * \param rate wanted sample rate in Hz (0 = any), returned chosen rate
+ * \param period_size wanted period size in frames (0 = any), returned
+ *                    chosen period size
+ * \param buffer_size wanted buffer size in frames (0 = any), returned
+ *                    chosen buffer size
+ * \return 0 on success otherwise a negative error code
+ *
+ * This is the equivalent of #snd_pcm_hw_params_any() followed by
+ * #snd_pcm_hw_params_set_access(), #snd_pcm_hw_params_set_format(),
+ * #snd_pcm_hw_params_set_channels(), #snd_pcm_hw_params_set_rate_near(),
+ * #snd_pcm_hw_params_set_period_size_near() and
+ * #snd_pcm_hw_params_set_buffer_size_near(), but all the constraints are
+ * applied at once: when the wanted values are available, the whole
+ * configuration space is refined only once. Otherwise the nearest values
+ * are searched in the same order as with the single calls.
+ *
+ * The rate, period_size and buffer_size pointers may be NULL. The
+ * returned configuration has all parameters fixed, see
+ * #snd_pcm_hw_params() for the order used for the remaining ones, and
+ * it can be passed to #snd_pcm_hw_params() to install it.
+ */
+int snd_pcm_hw_params_solve(snd_pcm_t *pcm, snd_pcm_hw_params_t *params,
+			    snd_pcm_access_t access, snd_pcm_format_t format,
+			    unsigned int channels, unsigned int *rate,
+			    snd_pcm_uframes_t *period_size,
+			    snd_pcm_uframes_t *buffer_size)
+{
+	snd_pcm_hw_params_t exact;
+	int err;
+
+	assert(pcm && params);
+	_snd_pcm_hw_params_any(params);
+	err = _snd_pcm_hw_param_set(params, SND_PCM_HW_PARAM_ACCESS, access, 0);
+	if (err >= 0 && format != SND_PCM_FORMAT_UNKNOWN)
+		err = _snd_pcm_hw_param_set(params, SND_PCM_HW_PARAM_FORMAT,
+					    format, 0);
+	if (err >= 0 && channels)
+		err = _snd_pcm_hw_param_set(params, SND_PCM_HW_PARAM_CHANNELS,
+					    channels, 0);
+	if (err < 0)
+		return err;
+
+	/* the wanted values are mostly available, try them all at once */
+	exact = *params;
+	if (rate && *rate)
+		err = hw_param_set_value(&exact, SND_PCM_HW_PARAM_RATE, *rate);
+	if (err >= 0 && period_size && *period_size)
+		err = hw_param_set_value(&exact, SND_PCM_HW_PARAM_PERIOD_SIZE,
+					 *period_size);
+	if (err >= 0 && buffer_size && *buffer_size)
+		err = hw_param_set_value(&exact, SND_PCM_HW_PARAM_BUFFER_SIZE,
+					 *buffer_size);
+	if (err >= 0)
+		err = snd_pcm_hw_refine(pcm, &exact);
+	if (err >= 0) {
+		*params = exact;
+	} else {
+		/* search the nearest values one by one */
+		err = snd_pcm_hw_refine(pcm, params);
+		if (err >= 0 && rate && *rate)
+			err = hw_param_set_near(pcm, params,
+						SND_PCM_HW_PARAM_RATE, *rate);
+		if (err >= 0 && period_size && *period_size)
+			err = hw_param_set_near(pcm, params,
+						SND_PCM_HW_PARAM_PERIOD_SIZE,
+						*period_size);
+		if (err >= 0 && buffer_size && *buffer_size)
+			err = hw_param_set_near(pcm, params,
+						SND_PCM_HW_PARAM_BUFFER_SIZE,
+						*buffer_size);
+		if (err < 0)
+			return err;
+	}
+	err = snd_pcm_hw_params_choose(pcm, params);
+	if (err < 0)
+		return err;
+	if (rate)
+		INTERNAL(snd_pcm_hw_params_get_rate)(params, rate, NULL);
+	if (period_size)
+		INTERNAL(snd_pcm_hw_params_get_period_size)(params, period_size,
+							    NULL);
+	if (buffer_size)
+		INTERNAL(snd_pcm_hw_params_get_buffer_size)(params, buffer_size);
+	return 0;
+}
+
 /** \brief Install one PCM hardware configuration chosen from a configuration space and #snd_pcm_prepare it
  * \param pcm PCM handle
  * \param params Configuration space definition container
@@ -982,6 +1220,8 @@ int snd_pcm_hw_free(snd_pcm_t *pcm)
 	else
 		err = -ENOSYS;
 	pcm->setup = 0;
+	snd_pcm_hw_refine_cache_clear(pcm);
+	snd_pcm_snapshot_sync(pcm);
 	if (err < 0)
 		return err;
 	return 0;
@@ -1085,6 +1325,12 @@ snd_pcm_state_t snd_pcm_state(snd_pcm_t *pcm)
 	snd_pcm_state_t state;
 
 	assert(pcm);
+	if (pcm->snapshot) {
+		struct _snd_pcm_snapshot_data d;
+
+		snd_pcm_snapshot_read(pcm, &d);
+		return d.state;
+	}
 	snd_pcm_lock(pcm->fast_op_arg);
 	state = __snd_pcm_state(pcm);
 	snd_pcm_unlock(pcm->fast_op_arg);
@@ -1158,6 +1404,8 @@ int snd_pcm_delay(snd_pcm_t *pcm, snd_pcm_sframes_t *delayp)
 		snd_check(PCM, "PCM not set up");
 		return -EIO;
 	}
+	if (pcm->snapshot)
+		return snd_pcm_snapshot_get(pcm, NULL, delayp);
 	snd_pcm_lock(pcm->fast_op_arg);
 	err = __snd_pcm_delay(pcm, delayp);
 	snd_pcm_unlock(pcm->fast_op_arg);
@@ -1192,6 +1440,7 @@ int snd_pcm_resume(snd_pcm_t *pcm)
 		err = pcm->fast_ops->resume(pcm->fast_op_arg);
 	else
 		err = -ENOSYS;
+	snd_pcm_snapshot_sync(pcm);
 	return err;
 }
 
@@ -1216,6 +1465,16 @@ int snd_pcm_htimestamp(snd_pcm_t *pcm, snd_pcm_uframes_t *avail, snd_htimestamp_
 		snd_check(PCM, "PCM not set up");
 		return -EIO;
 	}
+	if (pcm->snapshot) {
+		struct _snd_pcm_snapshot_data d;
+
+		snd_pcm_snapshot_read(pcm, &d);
+		if (d.tstamp_err < 0)
+			return d.tstamp_err;
+		*avail = d.tstamp_avail;
+		*tstamp = d.tstamp;
+		return 0;
+	}
 	snd_pcm_lock(pcm->fast_op_arg);
 	if (pcm->fast_ops->htimestamp)
 		err = pcm->fast_ops->htimestamp(pcm->fast_op_arg, avail, tstamp);
@@ -1249,6 +1508,7 @@ int snd_pcm_prepare(snd_pcm_t *pcm)
 		err = pcm->fast_ops->prepare(pcm->fast_op_arg);
 	else
 		err = -ENOSYS;
+	snd_pcm_snapshot_update(pcm);
 	snd_pcm_unlock(pcm->fast_op_arg);
 	return err;
 }
@@ -1276,6 +1536,7 @@ int snd_pcm_reset(snd_pcm_t *pcm)
 		err = pcm->fast_ops->reset(pcm->fast_op_arg);
 	else
 		err = -ENOSYS;
+	snd_pcm_snapshot_update(pcm);
 	snd_pcm_unlock(pcm->fast_op_arg);
 	return err;
 }
@@ -1301,6 +1562,7 @@ int snd_pcm_start(snd_pcm_t *pcm)
 		return err;
 	snd_pcm_lock(pcm->fast_op_arg);
 	err = __snd_pcm_start(pcm);
+	snd_pcm_snapshot_update(pcm);
 	snd_pcm_unlock(pcm->fast_op_arg);
 	return err;
 }
@@ -1336,6 +1598,7 @@ int snd_pcm_drop(snd_pcm_t *pcm)
 		err = pcm->fast_ops->drop(pcm->fast_op_arg);
 	else
 		err = -ENOSYS;
+	snd_pcm_snapshot_update(pcm);
 	snd_pcm_unlock(pcm->fast_op_arg);
 	return err;
 }
@@ -1374,6 +1637,7 @@ int snd_pcm_drain(snd_pcm_t *pcm)
 		err = pcm->fast_ops->drain(pcm->fast_op_arg);
 	else
 		err = -ENOSYS;
+	snd_pcm_snapshot_sync(pcm);
 	return err;
 }
 
@@ -1406,6 +1670,7 @@ int snd_pcm_pause(snd_pcm_t *pcm, int enable)
 		err = pcm->fast_ops->pause(pcm->fast_op_arg, enable);
 	else
 		err = -ENOSYS;
+	snd_pcm_snapshot_update(pcm);
 	snd_pcm_unlock(pcm->fast_op_arg);
 	return err;
 }
@@ -1472,6 +1737,7 @@ snd_pcm_sframes_t snd_pcm_rewind(snd_pcm_t *pcm, snd_pcm_uframes_t frames)
 		result = pcm->fast_ops->rewind(pcm->fast_op_arg, frames);
 	else
 		result = -ENOSYS;
+	snd_pcm_snapshot_update(pcm);
 	snd_pcm_unlock(pcm->fast_op_arg);
 	return result;
 }
@@ -1542,6 +1808,7 @@ snd_pcm_sframes_t snd_pcm_forward(snd_pcm_t *pcm, snd_pcm_uframes_t frames)
 		result = pcm->fast_ops->forward(pcm->fast_op_arg, frames);
 	else
 		result = -ENOSYS;
+	snd_pcm_snapshot_update(pcm);
 	snd_pcm_unlock(pcm->fast_op_arg);
 	return result;
 }
@@ -1568,6 +1835,7 @@ use_default_symbol_version(__snd_pcm_forward, snd_pcm_forward, ALSA_0.9.0rc8);
  */
 snd_pcm_sframes_t snd_pcm_writei(snd_pcm_t *pcm, const void *buffer, snd_pcm_uframes_t size)
 {
+	snd_pcm_sframes_t result;
 	int err;
 
 	assert(pcm);
@@ -1583,7 +1851,9 @@ snd_pcm_sframes_t snd_pcm_writei(snd_pcm_t *pcm, const void *buffer, snd_pcm_ufr
 	err = bad_pcm_state(pcm, P_STATE_RUNNABLE, 0);
 	if (err < 0)
 		return err;
-	return _snd_pcm_writei(pcm, buffer, size);
+	result = _snd_pcm_writei(pcm, buffer, size);
+	snd_pcm_snapshot_sync(pcm);
+	return result;
 }
 
 /**
@@ -1607,6 +1877,7 @@ snd_pcm_sframes_t snd_pcm_writei(snd_pcm_t *pcm, const void *buffer, snd_pcm_ufr
  */
 snd_pcm_sframes_t snd_pcm_writen(snd_pcm_t *pcm, void **bufs, snd_pcm_uframes_t size)
 {
+	snd_pcm_sframes_t result;
 	int err;
 
 	assert(pcm);
@@ -1622,7 +1893,9 @@ snd_pcm_sframes_t snd_pcm_writen(snd_pcm_t *pcm, void **bufs, snd_pcm_uframes_t
 	err = bad_pcm_state(pcm, P_STATE_RUNNABLE, 0);
 	if (err < 0)
 		return err;
-	return _snd_pcm_writen(pcm, bufs, size);
+	result = _snd_pcm_writen(pcm, bufs, size);
+	snd_pcm_snapshot_sync(pcm);
+	return result;
 }
 
 /**
@@ -1646,6 +1919,7 @@ snd_pcm_sframes_t snd_pcm_writen(snd_pcm_t *pcm, void **bufs, snd_pcm_uframes_t
  */
 snd_pcm_sframes_t snd_pcm_readi(snd_pcm_t *pcm, void *buffer, snd_pcm_uframes_t size)
 {
+	snd_pcm_sframes_t result;
 	int err;
 
 	assert(pcm);
@@ -1661,7 +1935,9 @@ snd_pcm_sframes_t snd_pcm_readi(snd_pcm_t *pcm, void *buffer, snd_pcm_uframes_t
 	err = bad_pcm_state(pcm, P_STATE_RUNNABLE, 0);
 	if (err < 0)
 		return err;
-	return _snd_pcm_readi(pcm, buffer, size);
+	result = _snd_pcm_readi(pcm, buffer, size);
+	snd_pcm_snapshot_sync(pcm);
+	return result;
 }
 
 /**
@@ -1685,6 +1961,7 @@ snd_pcm_sframes_t snd_pcm_readi(snd_pcm_t *pcm, void *buffer, snd_pcm_uframes_t
  */
 snd_pcm_sframes_t snd_pcm_readn(snd_pcm_t *pcm, void **bufs, snd_pcm_uframes_t size)
 {
+	snd_pcm_sframes_t result;
 	int err;
 
 	assert(pcm);
@@ -1700,7 +1977,9 @@ snd_pcm_sframes_t snd_pcm_readn(snd_pcm_t *pcm, void **bufs, snd_pcm_uframes_t s
 	err = bad_pcm_state(pcm, P_STATE_RUNNABLE, 0);
 	if (err < 0)
 		return err;
-	return _snd_pcm_readn(pcm, bufs, size);
+	result = _snd_pcm_readn(pcm, bufs, size);
+	snd_pcm_snapshot_sync(pcm);
+	return result;
 }
 
 /**
@@ -2396,6 +2675,8 @@ int snd_pcm_dump_setup(snd_pcm_t *pcm, snd_output_t *out)
 {
 	snd_pcm_dump_hw_setup(pcm, out);
 	snd_pcm_dump_sw_setup(pcm, out);
+	if (pcm->stats)
+		snd_pcm_stats_dump(pcm->stats, out);
 	return 0;
 }
 
@@ -2439,6 +2720,299 @@ int snd_pcm_dump(snd_pcm_t *pcm, snd_output_t *out)
 	return err;
 }
 
+/**
+ * \brief Enable or disable the hot-path statistics for a PCM
+ * \param pcm PCM handle
+ * \param enable 0 = disable, 1 = enable
+ * \return 0 on success otherwise a negative error code
+ *
+ * The counters are reset when enabled. Only this handle is affected,
+ * use the LIBASOUND_PCM_STATS environment variable to enable the counters
+ * for the whole plugin chain.
+ */
+int snd_pcm_stats_enable(snd_pcm_t *pcm, int enable)
+{
+	snd_pcm_stats_t *stats = NULL;
+
+	assert(pcm);
+	if (enable) {
+		stats = calloc(1, sizeof(*stats));
+		if (!stats)
+			return -ENOMEM;
+	}
+	snd_pcm_lock(pcm->fast_op_arg);
+	free(pcm->stats);
+	pcm->stats = stats;
+	snd_pcm_unlock(pcm->fast_op_arg);
+	return 0;
+}
+
+/**
+ * \brief Obtain a snapshot of the hot-path statistics
+ * \param pcm PCM handle
+ * \param stats Returned counters
+ * \return 0 on success, -EINVAL if the statistics are not enabled
+ */
+int snd_pcm_stats(snd_pcm_t *pcm, snd_pcm_stats_t *stats)
+{
+	int err = 0;
+
+	assert(pcm && stats);
+	snd_pcm_lock(pcm->fast_op_arg);
+	if (pcm->stats)
+		*stats = *pcm->stats;
+	else
+		err = -EINVAL;
+	snd_pcm_unlock(pcm->fast_op_arg);
+	return err;
+}
+
+/**
+ * \brief Reset the hot-path statistics counters
+ * \param pcm PCM handle
+ * \return 0 on success, -EINVAL if the statistics are not enabled
+ */
+int snd_pcm_stats_reset(snd_pcm_t *pcm)
+{
+	int err = 0;
+
+	assert(pcm);
+	snd_pcm_lock(pcm->fast_op_arg);
+	if (pcm->stats)
+		memset(pcm->stats, 0, sizeof(*pcm->stats));
+	else
+		err = -EINVAL;
+	snd_pcm_unlock(pcm->fast_op_arg);
+	return err;
+}
+
+/**
+ * \brief get size of #snd_pcm_stats_t
+ * \return size in bytes
+ */
+size_t snd_pcm_stats_sizeof(void)
+{
+	return sizeof(snd_pcm_stats_t);
+}
+
+/**
+ * \brief allocate an invalid #snd_pcm_stats_t using standard malloc
+ * \param ptr returned pointer
+ * \return 0 on success otherwise negative error code
+ */
+int snd_pcm_stats_malloc(snd_pcm_stats_t **ptr)
+{
+	assert(ptr);
+	*ptr = calloc(1, sizeof(snd_pcm_stats_t));
+	if (!*ptr)
+		return -ENOMEM;
+	return 0;
+}
+
+/**
+ * \brief frees a previously allocated #snd_pcm_stats_t
+ * \param obj pointer to object to free
+ */
+void snd_pcm_stats_free(snd_pcm_stats_t *obj)
+{
+	free(obj);
+}
+
+/**
+ * \brief copy one #snd_pcm_stats_t to another
+ * \param dst pointer to destination
+ * \param src pointer to source
+ */
+void snd_pcm_stats_copy(snd_pcm_stats_t *dst, const snd_pcm_stats_t *src)
+{
+	assert(dst && src);
+	*dst = *src;
+}
+
+/**
+ * \brief Get a counter value from a PCM statistics container
+ * \param obj #snd_pcm_stats_t pointer
+ * \param counter Counter (see #snd_pcm_stats_counter_t)
+ * \return counter value
+ */
+unsigned long long snd_pcm_stats_get(const snd_pcm_stats_t *obj, snd_pcm_stats_counter_t counter)
+{
+	assert(obj);
+	if ((unsigned int)counter > SND_PCM_STATS_LAST)
+		return 0;
+	return obj->counter[counter];
+}
+
+#ifndef DOC_HIDDEN
+#define STATS(v) [SND_PCM_STATS_##v] = #v
+static const char *const snd_pcm_stats_counter_names[] = {
+	STATS(WRITE_AREAS),
+	STATS(WRITE_AREAS_NSEC),
+	STATS(READ_AREAS),
+	STATS(READ_AREAS_NSEC),
+	STATS(MMAP_COMMIT),
+	STATS(MMAP_COMMIT_NSEC),
+	STATS(AVAIL_UPDATE),
+	STATS(AVAIL_UPDATE_NSEC),
+	STATS(SYSCALLS),
+	STATS(BYTES_CONVERTED),
+	STATS(XRUNS),
+	STATS(WAKEUPS),
+};
+#undef STATS
+#endif
+
+/**
+ * \brief get name of PCM statistics counter
+ * \param counter Counter (see #snd_pcm_stats_counter_t)
+ * \return ascii name of the counter
+ */
+const char *snd_pcm_stats_counter_name(snd_pcm_stats_counter_t counter)
+{
+	if ((unsigned int)counter > SND_PCM_STATS_LAST)
+		return NULL;
+	return snd_pcm_stats_counter_names[counter];
+}
+
+/**
+ * \brief Dump the hot-path statistics
+ * \param stats Statistics container
+ * \param out Output handle
+ * \return 0 on success otherwise a negative error code
+ */
+int snd_pcm_stats_dump(const snd_pcm_stats_t *stats, snd_output_t *out)
+{
+	unsigned int i;
+
+	assert(stats);
+	for (i = 0; i <= SND_PCM_STATS_LAST; i++)
+		snd_output_printf(out, "  %-17s: %llu\n",
+				  snd_pcm_stats_counter_names[i], stats->counter[i]);
+	return 0;
+}
+
+#ifndef DOC_HIDDEN
+/* locked version of avail_update with the statistics enabled */
+snd_pcm_sframes_t snd_pcm_stats_avail_update(snd_pcm_t *pcm)
+{
+	snd_pcm_stats_t *stats = pcm->stats;
+	unsigned long long t = snd_pcm_stats_clock();
+	snd_pcm_sframes_t result;
+
+	result = pcm->fast_ops->avail_update(pcm->fast_op_arg);
+	stats->counter[SND_PCM_STATS_AVAIL_UPDATE_NSEC] += snd_pcm_stats_clock() - t;
+	stats->counter[SND_PCM_STATS_AVAIL_UPDATE]++;
+	if (result == -EPIPE) {
+		if (!stats->xrun)
+			stats->counter[SND_PCM_STATS_XRUNS]++;
+		stats->xrun = 1;
+	} else if (result >= 0) {
+		stats->xrun = 0;
+	}
+	return result;
+}
+
+/* type is the calls counter, the time counter follows */
+static snd_pcm_sframes_t snd_pcm_stats_xfer_areas(snd_pcm_t *pcm,
+						  snd_pcm_stats_counter_t type,
+						  const snd_pcm_channel_area_t *areas,
+						  snd_pcm_uframes_t offset,
+						  snd_pcm_uframes_t size,
+						  snd_pcm_xfer_areas_func_t func)
+{
+	unsigned long long t = snd_pcm_stats_clock();
+	snd_pcm_sframes_t result;
+
+	result = func(pcm, areas, offset, size);
+	pcm->stats->counter[type + 1] += snd_pcm_stats_clock() - t;
+	pcm->stats->counter[type]++;
+	return result;
+}
+#endif
+
+/**
+ * \brief Serve the status queries of a PCM from a lock-free snapshot
+ * \param pcm PCM handle
+ * \param enable 0 = disable, 1 = enable
+ * \return 0 on success otherwise a negative error code
+ *
+ * When enabled, #snd_pcm_state(), #snd_pcm_avail(), #snd_pcm_avail_delay(),
+ * #snd_pcm_delay() and #snd_pcm_htimestamp() neither take the PCM lock
+ * nor call into the plugin chain. See \ref pcm_snapshot for details.
+ *
+ * The function must not be called while other threads use the handle.
+ */
+int snd_pcm_status_snapshot_enable(snd_pcm_t *pcm, int enable)
+{
+	snd_pcm_snapshot_t *snapshot = NULL;
+
+	assert(pcm);
+	if (enable) {
+		if (pcm->snapshot)
+			return 0;
+		snapshot = calloc(1, sizeof(*snapshot));
+		if (!snapshot)
+			return -ENOMEM;
+	}
+	snd_pcm_lock(pcm->fast_op_arg);
+	free(pcm->snapshot);
+	pcm->snapshot = snapshot;
+	snd_pcm_snapshot_update(pcm);
+	snd_pcm_unlock(pcm->fast_op_arg);
+	return 0;
+}
+
+#ifndef DOC_HIDDEN
+/* publish the current stream status, called with the PCM lock held */
+void __snd_pcm_snapshot_publish(snd_pcm_t *pcm)
+{
+	snd_pcm_snapshot_t *snapshot = pcm->snapshot;
+	struct _snd_pcm_snapshot_data *d = &snapshot->data;
+	unsigned int seq = snapshot->seq;
+	snd_pcm_sframes_t delay;
+
+	__atomic_store_n(&snapshot->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	gettimestamp(&d->time, SND_PCM_TSTAMP_TYPE_MONOTONIC);
+	d->state = __snd_pcm_state(pcm);
+	if (!pcm->setup) {
+		d->avail = 0;
+		d->delay_extra = 0;
+		d->tstamp_err = -EBADFD;
+		goto out;
+	}
+	if (d->state != SND_PCM_STATE_RUNNING &&
+	    d->state != SND_PCM_STATE_DRAINING) {
+		/* measure the extra delay again on the next start */
+		snapshot->extra_time.tv_sec = 0;
+		snapshot->extra_time.tv_nsec = 0;
+	} else if ((!snapshot->extra_time.tv_sec &&
+		    !snapshot->extra_time.tv_nsec) ||
+		   snd_pcm_snapshot_ns(&d->time, &snapshot->extra_time) >=
+		   (long long)pcm->period_size * 1000000000LL / pcm->rate) {
+		/* the latency behind the ring pointers (FIFO, slave
+		 * buffering) hardly moves, a real query once per period
+		 * is enough
+		 */
+		if (__snd_pcm_delay(pcm, &delay) >= 0) {
+			d->delay_extra = delay - snd_pcm_mmap_delay(pcm);
+			snapshot->extra_time = d->time;
+		}
+	}
+	if (pcm->fast_ops->htimestamp)
+		d->tstamp_err = pcm->fast_ops->htimestamp(pcm->fast_op_arg,
+							  &d->tstamp_avail,
+							  &d->tstamp);
+	else
+		d->tstamp_err = -ENOSYS;
+	d->avail = snd_pcm_mmap_avail(pcm);
+ out:
+	__atomic_store_n(&snapshot->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+#endif
+
 /**
  * \brief Convert bytes in frames for a PCM
  * \param pcm PCM handle
@@ -2699,6 +3273,17 @@ static int snd_pcm_open_conf(snd_pcm_t **pcmp, const char *name,
 		err = snd_config_search(pcm_root, "defaults.pcm.minperiodtime", &tmp);
 		if (err >= 0)
 			snd_config_get_integer(tmp, &(*pcmp)->minperiodtime);
+		/* the innermost PCM wins for the init only plugins */
+		if (!(*pcmp)->refine_cache_file) {
+			const char *dir = NULL;
+			err = snd_config_search(pcm_root, "defaults.pcm.refine_cache_dir", &tmp);
+			if (err >= 0)
+				snd_config_get_string(tmp, &dir);
+			else
+				dir = getenv("LIBASOUND_PCM_REFINE_CACHE_DIR");
+			if (dir && *dir)
+				snd_pcm_hw_refine_cache_attach(*pcmp, dir, pcm_conf);
+		}
 		err = 0;
 	}
        _err:
@@ -2851,6 +3436,27 @@ int snd_pcm_new(snd_pcm_t **pcmp, snd_pcm_type_t type, const char *name,
 		pcm->lock_enabled = do_lock_enable;
 	}
 #endif
+	{
+		/* enable statistics depending on $LIBASOUND_PCM_STATS */
+		static int do_stats_enable = -1; /* uninitialized */
+
+		if (do_stats_enable == -1) {
+			char *p = getenv("LIBASOUND_PCM_STATS");
+			do_stats_enable = p && *p && *p != '0';
+		}
+		if (do_stats_enable)
+			pcm->stats = calloc(1, sizeof(*pcm->stats));
+	}
+	{
+		/* $LIBASOUND_PCM_REFINE_CACHE=0 disables the refine memoization */
+		static int do_refine_cache = -1; /* uninitialized */
+
+		if (do_refine_cache == -1) {
+			char *p = getenv("LIBASOUND_PCM_REFINE_CACHE");
+			do_refine_cache = !p || *p != '0';
+		}
+		pcm->no_refine_cache = !do_refine_cache;
+	}
 	*pcmp = pcm;
 	return 0;
 }
@@ -2861,6 +3467,10 @@ int snd_pcm_free(snd_pcm_t *pcm)
 	free(pcm->name);
 	free(pcm->hw.link_dst);
 	free(pcm->appl.link_dst);
+	free(pcm->stats);
+	free(pcm->snapshot);
+	snd_pcm_hw_refine_cache_clear(pcm);
+	free(pcm->refine_cache_file);
 	snd_dlobj_cache_put(pcm->open_func);
 #ifdef THREAD_SAFE_API
 	pthread_mutex_destroy(&pcm->lock);
@@ -3000,6 +3610,7 @@ int snd_pcm_wait_nocheck(snd_pcm_t *pcm, int timeout)
 		}
 		if (! err_poll)
 			break;
+		snd_pcm_stats_add(pcm, SND_PCM_STATS_WAKEUPS, 1);
 		err = __snd_pcm_poll_revents(pcm, pfd, npfds, &revents);
 		if (err < 0)
 			return err;
@@ -3053,6 +3664,7 @@ snd_pcm_sframes_t snd_pcm_avail_update(snd_pcm_t *pcm)
 
 	snd_pcm_lock(pcm->fast_op_arg);
 	result = __snd_pcm_avail_update(pcm);
+	snd_pcm_snapshot_update(pcm);
 	snd_pcm_unlock(pcm->fast_op_arg);
 	return result;
 }
@@ -3081,6 +3693,10 @@ snd_pcm_sframes_t snd_pcm_avail(snd_pcm_t *pcm)
 		snd_check(PCM, "PCM not set up");
 		return -EIO;
 	}
+	if (pcm->snapshot) {
+		err = snd_pcm_snapshot_get(pcm, &result, NULL);
+		return err < 0 ? err : result;
+	}
 	snd_pcm_lock(pcm->fast_op_arg);
 	err = __snd_pcm_hwsync(pcm);
 	if (err < 0)
@@ -3114,6 +3730,8 @@ int snd_pcm_avail_delay(snd_pcm_t *pcm,
 		snd_check(PCM, "PCM not set up");
 		return -EIO;
 	}
+	if (pcm->snapshot)
+		return snd_pcm_snapshot_get(pcm, availp, delayp);
 	snd_pcm_lock(pcm->fast_op_arg);
 	err = __snd_pcm_hwsync(pcm);
 	if (err < 0)
@@ -7558,6 +8176,7 @@ snd_pcm_sframes_t snd_pcm_mmap_commit(snd_pcm_t *pcm,
 		return err;
 	snd_pcm_lock(pcm->fast_op_arg);
 	result = __snd_pcm_mmap_commit(pcm, offset, frames);
+	snd_pcm_snapshot_update(pcm);
 	snd_pcm_unlock(pcm->fast_op_arg);
 	return result;
 }
@@ -7581,10 +8200,18 @@ snd_pcm_sframes_t __snd_pcm_mmap_commit(snd_pcm_t *pcm,
 
 		return -EPIPE;
 	}
-	if (pcm->fast_ops->mmap_commit)
-		return pcm->fast_ops->mmap_commit(pcm->fast_op_arg, offset, frames);
-	else
+	if (!pcm->fast_ops->mmap_commit)
 		return -ENOSYS;
+	if (pcm->stats) {
+		unsigned long long t = snd_pcm_stats_clock();
+		snd_pcm_sframes_t result;
+
+		result = pcm->fast_ops->mmap_commit(pcm->fast_op_arg, offset, frames);
+		pcm->stats->counter[SND_PCM_STATS_MMAP_COMMIT_NSEC] += snd_pcm_stats_clock() - t;
+		pcm->stats->counter[SND_PCM_STATS_MMAP_COMMIT]++;
+		return result;
+	}
+	return pcm->fast_ops->mmap_commit(pcm->fast_op_arg, offset, frames);
 }
 
 int _snd_pcm_poll_descriptor(snd_pcm_t *pcm)
@@ -7685,7 +8312,11 @@ snd_pcm_sframes_t snd_pcm_read_areas(snd_pcm_t *pcm, const snd_pcm_channel_area_
 		if (frames > (snd_pcm_uframes_t) avail)
 			frames = avail;
 		/* frames must be at least 1 here (see while condition) */
-		err = func(pcm, areas, offset, frames);
+		if (pcm->stats)
+			err = snd_pcm_stats_xfer_areas(pcm, SND_PCM_STATS_READ_AREAS,
+						       areas, offset, frames, func);
+		else
+			err = func(pcm, areas, offset, frames);
 		if (err < 0)
 			break;
 		frames = err;
@@ -7762,7 +8393,11 @@ snd_pcm_sframes_t snd_pcm_write_areas(snd_pcm_t *pcm, const snd_pcm_channel_area
 			frames = avail;
 		if (! frames)
 			break;
-		err = func(pcm, areas, offset, frames);
+		if (pcm->stats)
+			err = snd_pcm_stats_xfer_areas(pcm, SND_PCM_STATS_WRITE_AREAS,
+						       areas, offset, frames, func);
+		else
+			err = func(pcm, areas, offset, frames);
 		if (err < 0)
 			break;
 		frames = err;
@@ -103,7 +103,7 @@ static const short StepSize[89] = {
 	15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
 };
 
-static char adpcm_encoder(int sl, snd_pcm_adpcm_state_t * state)
+static inline char adpcm_encoder(int sl, snd_pcm_adpcm_state_t * state)
 {
 	short diff;		/* Difference between sl and predicted sample */
 	short pred_diff;	/* Predicted difference to next sample */
@@ -133,14 +133,13 @@ static char adpcm_encoder(int sl, snd_pcm_adpcm_state_t * state)
 
 	step = StepSize[state->step_idx];
 
-	/* Divide and clamp */
+	/* Divide and clamp; masked instead of branching on the data */
 	pred_diff = step >> 3;
 	for (adjust_idx = 0, i = 0x4; i; i >>= 1, step >>= 1) {
-		if (diff >= step) {
-			adjust_idx |= i;
-			diff -= step;
-			pred_diff += step;
-		}
+		short mask = -(diff >= step);
+		adjust_idx |= i & mask;
+		diff -= step & mask;
+		pred_diff += step & mask;
 	}
 
 	/* Update and clamp previous predicted value */
@@ -164,7 +163,7 @@ static char adpcm_encoder(int sl, snd_pcm_adpcm_state_t * state)
 }
 
 
-static int adpcm_decoder(unsigned char code, snd_pcm_adpcm_state_t * state)
+static inline int adpcm_decoder(unsigned char code, snd_pcm_adpcm_state_t * state)
 {
 	short pred_diff;	/* Predicted difference to next sample */
 	short step;		/* holds previous StepSize value */
@@ -185,11 +184,8 @@ static int adpcm_decoder(unsigned char code, snd_pcm_adpcm_state_t * state)
 
 	/* Compute difference and new predicted value */
 	pred_diff = step >> 3;
-	for (i = 0x4; i; i >>= 1, step >>= 1) {
-		if (code & i) {
-			pred_diff += step;
-		}
-	}
+	for (i = 0x4; i; i >>= 1, step >>= 1)
+		pred_diff += step & -((code & i) != 0);
 	state->pred_val += (sign) ? -pred_diff : pred_diff;
 
 	/* Clamp output value */
@@ -212,6 +208,49 @@ static int adpcm_decoder(unsigned char code, snd_pcm_adpcm_state_t * state)
 
 #ifndef DOC_HIDDEN
 
+/* per-channel position in the ADPCM (nibble) and the linear areas */
+typedef struct {
+	char *adpcm;
+	char *linear;
+	int bit;
+	int adpcm_step, bit_step, linear_step;
+} adpcm_cursor_t;
+
+static void adpcm_cursor_init(adpcm_cursor_t *cursors,
+			      const snd_pcm_channel_area_t *adpcm_areas,
+			      snd_pcm_uframes_t adpcm_offset,
+			      const snd_pcm_channel_area_t *linear_areas,
+			      snd_pcm_uframes_t linear_offset,
+			      unsigned int channels)
+{
+	unsigned int channel;
+
+	for (channel = 0; channel < channels; ++channel) {
+		const snd_pcm_channel_area_t *adpcm_area = &adpcm_areas[channel];
+		const snd_pcm_channel_area_t *linear_area = &linear_areas[channel];
+		adpcm_cursor_t *c = &cursors[channel];
+		int bit = adpcm_area->first + adpcm_area->step * adpcm_offset;
+
+		c->adpcm = (char *) adpcm_area->addr + bit / 8;
+		c->bit = bit % 8;
+		c->adpcm_step = adpcm_area->step / 8;
+		c->bit_step = adpcm_area->step % 8;
+		c->linear = snd_pcm_channel_area_addr(linear_area, linear_offset);
+		c->linear_step = snd_pcm_channel_area_step(linear_area);
+	}
+}
+
+static inline void adpcm_cursor_next(adpcm_cursor_t *c)
+{
+	c->adpcm += c->adpcm_step;
+	c->bit += c->bit_step;
+	if (c->bit == 8) {
+		c->adpcm++;
+		c->bit = 0;
+	}
+	c->linear += c->linear_step;
+}
+
 void snd_pcm_adpcm_decode(const snd_pcm_channel_area_t *dst_areas,
 			  snd_pcm_uframes_t dst_offset,
 			  const snd_pcm_channel_area_t *src_areas,
@@ -224,43 +263,32 @@ void snd_pcm_adpcm_decode(const snd_pcm_channel_area_t *dst_areas,
 #include "plugin_ops.h"
 #undef PUT16_LABELS
 	void *put = put16_labels[putidx];
+	adpcm_cursor_t cursors[channels];
 	unsigned int channel;
-	for (channel = 0; channel < channels; ++channel, ++states) {
-		const char *src;
-		int srcbit;
-		char *dst;
-		int src_step, srcbit_step, dst_step;
-		snd_pcm_uframes_t frames1;
-		const snd_pcm_channel_area_t *src_area = &src_areas[channel];
-		const snd_pcm_channel_area_t *dst_area = &dst_areas[channel];
-		srcbit = src_area->first + src_area->step * src_offset;
-		src = (const char *) src_area->addr + srcbit / 8;
-		srcbit %= 8;
-		src_step = src_area->step / 8;
-		srcbit_step = src_area->step % 8;
-		dst = snd_pcm_channel_area_addr(dst_area, dst_offset);
-		dst_step = snd_pcm_channel_area_step(dst_area);
-		frames1 = frames;
-		while (frames1-- > 0) {
+	adpcm_cursor_init(cursors, src_areas, src_offset, dst_areas, dst_offset,
+			  channels);
+	/*
+	 * walk the frames in the outer loop; the channels are independent,
+	 * so their prediction chains can be overlapped by the CPU
+	 */
+	while (frames-- > 0) {
+		for (channel = 0; channel < channels; ++channel) {
+			adpcm_cursor_t *c = &cursors[channel];
+			const char *src = c->adpcm;
+			char *dst = c->linear;
 			int16_t sample;
 			unsigned char v;
-			if (srcbit)
+			if (c->bit)
 				v = *src & 0x0f;
 			else
 				v = (*src >> 4) & 0x0f;
-			sample = adpcm_decoder(v, states);
+			sample = adpcm_decoder(v, &states[channel]);
 			goto *put;
 #define PUT16_END after
 #include "plugin_ops.h"
 #undef PUT16_END
 		after:
-			src += src_step;
-			srcbit += srcbit_step;
-			if (srcbit == 8) {
-				src++;
-				srcbit = 0;
-			}
-			dst += dst_step;
+			adpcm_cursor_next(c);
 		}
 	}
 }
@@ -277,43 +305,29 @@ void snd_pcm_adpcm_encode(const snd_pcm_channel_area_t *dst_areas,
 #include "plugin_ops.h"
 #undef GET16_LABELS
 	void *get = get16_labels[getidx];
+	adpcm_cursor_t cursors[channels];
 	unsigned int channel;
 	int16_t sample = 0;
-	for (channel = 0; channel < channels; ++channel, ++states) {
-		const char *src;
-		char *dst;
-		int dstbit;
-		int src_step, dst_step, dstbit_step;
-		snd_pcm_uframes_t frames1;
-		const snd_pcm_channel_area_t *src_area = &src_areas[channel];
-		const snd_pcm_channel_area_t *dst_area = &dst_areas[channel];
-		src = snd_pcm_channel_area_addr(src_area, src_offset);
-		src_step = snd_pcm_channel_area_step(src_area);
-		dstbit = dst_area->first + dst_area->step * dst_offset;
-		dst = (char *) dst_area->addr + dstbit / 8;
-		dstbit %= 8;
-		dst_step = dst_area->step / 8;
-		dstbit_step = dst_area->step % 8;
-		frames1 = frames;
-		while (frames1-- > 0) {
+	adpcm_cursor_init(cursors, dst_areas, dst_offset, src_areas, src_offset,
+			  channels);
+	/* frames in the outer loop, see snd_pcm_adpcm_decode() */
+	while (frames-- > 0) {
+		for (channel = 0; channel < channels; ++channel) {
+			adpcm_cursor_t *c = &cursors[channel];
+			const char *src = c->linear;
+			char *dst = c->adpcm;
 			int v;
 			goto *get;
 #define GET16_END after
 #include "plugin_ops.h"
 #undef GET16_END
 		after:
-			v = adpcm_encoder(sample, states);
-			if (dstbit)
+			v = adpcm_encoder(sample, &states[channel]);
+			if (c->bit)
 				*dst = (*dst & 0xf0) | v;
 			else
 				*dst = (*dst & 0x0f) | (v << 4);
-			src += src_step;
-			dst += dst_step;
-			dstbit += dstbit_step;
-			if (dstbit == 8) {
-				dst++;
-				dstbit = 0;
-			}
+			adpcm_cursor_next(c);
 		}
 	}
 }
@@ -56,8 +56,12 @@ typedef struct {
 
 #endif
 
+/* val is the magnitude 0x100..0x7fff */
 static inline int val_seg(int val)
 {
+#if defined(__GNUC__)
+	return 24 - __builtin_clz(val);
+#else
 	int r = 1;
 	val >>= 8;
 	if (val & 0xf0) {
@@ -71,6 +75,7 @@ static inline int val_seg(int val)
 	if (val & 0x02)
 		r += 1;
 	return r;
+#endif
 }
 
 /*
@@ -93,7 +98,7 @@ static inline int val_seg(int val)
  * John Wiley & Sons, pps 98-111 and 472-476.
  */
 
-static unsigned char s16_to_alaw(int pcm_val)
+static inline unsigned char s16_to_alaw(int pcm_val)
 {
 	int		mask;
 	int		seg;
@@ -121,22 +126,57 @@ static unsigned char s16_to_alaw(int pcm_val)
 /*
  * alaw_to_s16() - Convert an A-law value to 16-bit linear PCM
  *
+ * The 256 possible results are tabulated; the table was generated with:
+ *
+ *	a_val ^= 0x55;
+ *	t = a_val & 0x7f;
+ *	if (t < 16)
+ *		t = (t << 4) + 8;
+ *	else {
+ *		seg = (t >> 4) & 0x07;
+ *		t = ((t & 0x0f) << 4) + 0x108;
+ *		t <<= seg -1;
+ *	}
+ *	return ((a_val & 0x80) ? t : -t);
  */
-static int alaw_to_s16(unsigned char a_val)
-{
-	int		t;
-	int		seg;
+static const int16_t alaw_to_s16_table[256] = {
+	-5504, -5248, -6016, -5760, -4480, -4224, -4992, -4736,
+	-7552, -7296, -8064, -7808, -6528, -6272, -7040, -6784,
+	-2752, -2624, -3008, -2880, -2240, -2112, -2496, -2368,
+	-3776, -3648, -4032, -3904, -3264, -3136, -3520, -3392,
+	-22016, -20992, -24064, -23040, -17920, -16896, -19968, -18944,
+	-30208, -29184, -32256, -31232, -26112, -25088, -28160, -27136,
+	-11008, -10496, -12032, -11520, -8960, -8448, -9984, -9472,
+	-15104, -14592, -16128, -15616, -13056, -12544, -14080, -13568,
+	-344, -328, -376, -360, -280, -264, -312, -296,
+	-472, -456, -504, -488, -408, -392, -440, -424,
+	-88, -72, -120, -104, -24, -8, -56, -40,
+	-216, -200, -248, -232, -152, -136, -184, -168,
+	-1376, -1312, -1504, -1440, -1120, -1056, -1248, -1184,
+	-1888, -1824, -2016, -1952, -1632, -1568, -1760, -1696,
+	-688, -656, -752, -720, -560, -528, -624, -592,
+	-944, -912, -1008, -976, -816, -784, -880, -848,
+	5504, 5248, 6016, 5760, 4480, 4224, 4992, 4736,
+	7552, 7296, 8064, 7808, 6528, 6272, 7040, 6784,
+	2752, 2624, 3008, 2880, 2240, 2112, 2496, 2368,
+	3776, 3648, 4032, 3904, 3264, 3136, 3520, 3392,
+	22016, 20992, 24064, 23040, 17920, 16896, 19968, 18944,
+	30208, 29184, 32256, 31232, 26112, 25088, 28160, 27136,
+	11008, 10496, 12032, 11520, 8960, 8448, 9984, 9472,
+	15104, 14592, 16128, 15616, 13056, 12544, 14080, 13568,
+	344, 328, 376, 360, 280, 264, 312, 296,
+	472, 456, 504, 488, 408, 392, 440, 424,
+	88, 72, 120, 104, 24, 8, 56, 40,
+	216, 200, 248, 232, 152, 136, 184, 168,
+	1376, 1312, 1504, 1440, 1120, 1056, 1248, 1184,
+	1888, 1824, 2016, 1952, 1632, 1568, 1760, 1696,
+	688, 656, 752, 720, 560, 528, 624, 592,
+	944, 912, 1008, 976, 816, 784, 880, 848
+};
 
-	a_val ^= 0x55;
-	t = a_val & 0x7f;
-	if (t < 16)
-		t = (t << 4) + 8;
-	else {
-		seg = (t >> 4) & 0x07;
-		t = ((t & 0x0f) << 4) + 0x108;
-		t <<= seg -1;
-	}
-	return ((a_val & 0x80) ? t : -t);
+static inline int alaw_to_s16(unsigned char a_val)
+{
+	return alaw_to_s16_table[a_val];
 }
 
 #ifndef DOC_HIDDEN
@@ -152,6 +192,7 @@ void snd_pcm_alaw_decode(const snd_pcm_channel_area_t *dst_areas,
 #include "plugin_ops.h"
 #undef PUT16_LABELS
 	void *put = put16_labels[putidx];
+	int native = putidx == (unsigned int)snd_pcm_linear_put_index(SND_PCM_FORMAT_S16, SND_PCM_FORMAT_S16);
 	unsigned int channel;
 	for (channel = 0; channel < channels; ++channel) {
 		const unsigned char *src;
@@ -165,6 +206,15 @@ void snd_pcm_alaw_decode(const snd_pcm_channel_area_t *dst_areas,
 		src_step = snd_pcm_channel_area_step(src_area);
 		dst_step = snd_pcm_channel_area_step(dst_area);
 		frames1 = frames;
+		if (native) {
+			/* no conversion of the linear side */
+			while (frames1-- > 0) {
+				*(int16_t *)dst = alaw_to_s16(*src);
+				src += src_step;
+				dst += dst_step;
+			}
+			continue;
+		}
 		while (frames1-- > 0) {
 			int16_t sample = alaw_to_s16(*src);
 			goto *put;
@@ -189,6 +239,7 @@ void snd_pcm_alaw_encode(const snd_pcm_channel_area_t *dst_areas,
 #include "plugin_ops.h"
 #undef GET16_LABELS
 	void *get = get16_labels[getidx];
+	int native = getidx == (unsigned int)snd_pcm_linear_get_index(SND_PCM_FORMAT_S16, SND_PCM_FORMAT_S16);
 	unsigned int channel;
 	int16_t sample = 0;
 	for (channel = 0; channel < channels; ++channel) {
@@ -203,6 +254,15 @@ void snd_pcm_alaw_encode(const snd_pcm_channel_area_t *dst_areas,
 		src_step = snd_pcm_channel_area_step(src_area);
 		dst_step = snd_pcm_channel_area_step(dst_area);
 		frames1 = frames;
+		if (native) {
+			/* no conversion of the linear side */
+			while (frames1-- > 0) {
+				*dst = s16_to_alaw(*(const int16_t *)src);
+				src += src_step;
+				dst += dst_step;
+			}
+			continue;
+		}
 		while (frames1-- > 0) {
 			goto *get;
 #define GET16_END after
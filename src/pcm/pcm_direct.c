@@ -39,6 +39,9 @@
 #include <sys/stat.h>
 #include <sys/un.h>
 #include <sys/mman.h>
+#ifdef HAVE_SYS_TIMERFD_H
+#include <sys/timerfd.h>
+#endif
 #include "pcm_direct.h"
 
 /*
@@ -522,13 +525,19 @@ int snd_pcm_direct_nonblock(snd_pcm_t *pcm ATTRIBUTE_UNUSED, int nonblock ATTRIB
 int snd_pcm_direct_async(snd_pcm_t *pcm, int sig, pid_t pid)
 {
 	snd_pcm_direct_t *dmix = pcm->private_data;
+	if (!dmix->timer)
+		return -ENOSYS;
 	return snd_timer_async(dmix->timer, sig, pid);
 }
 
+static int snd_pcm_direct_clock_clear(snd_pcm_direct_t *dmix);
+
 /* empty the timer read queue */
 int snd_pcm_direct_clear_timer_queue(snd_pcm_direct_t *dmix)
 {
 	int changed = 0;
+	if (!dmix->timer)
+		return snd_pcm_direct_clock_clear(dmix);
 	if (dmix->timer_need_poll) {
 		while (poll(&dmix->timer_fd, 1, 0) > 0) {
 			changed++;
@@ -559,12 +568,231 @@ int snd_pcm_direct_clear_timer_queue(snd_pcm_direct_t *dmix)
 	return changed;
 }
 
+int snd_pcm_direct_timer_start(snd_pcm_direct_t *dmix)
+{
+	if (!dmix->timer)
+		return 0;
+	return snd_timer_start(dmix->timer);
+}
+
 int snd_pcm_direct_timer_stop(snd_pcm_direct_t *dmix)
 {
+#ifdef HAVE_SYS_TIMERFD_H
+	if (!dmix->timer) {
+		struct itimerspec its;
+
+		memset(&its, 0, sizeof(its));
+		timerfd_settime(dmix->poll_fd, 0, &its, NULL);
+		return 0;
+	}
+#endif
 	snd_timer_stop(dmix->timer);
 	return 0;
 }
 
+void snd_pcm_direct_timer_close(snd_pcm_direct_t *dmix)
+{
+	if (dmix->timer) {
+		snd_timer_close(dmix->timer);
+		dmix->timer = NULL;
+	} else if (dmix->poll_fd >= 0) {
+		close(dmix->poll_fd);
+	}
+	dmix->poll_fd = -1;
+}
+
+#ifdef HAVE_SYS_TIMERFD_H
+/*
+ * Shared slave clock
+ *
+ * With the clock wakeup, no slave timer instance is opened. The newest
+ * (slave hw_ptr, timestamp) pair seen by any client is published in the
+ * shared area under a sequence counter, and each client arms its own
+ * timerfd to the time when its avail reaches avail_min. Wakeups are
+ * capped to the period ticks used by the timer mode, so slave state
+ * changes are still noticed in time. A draining playback has avail
+ * above avail_min all the time and wakes on the slave periods instead.
+ */
+
+static long long direct_ts_ns(const snd_htimestamp_t *ts)
+{
+	return ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+
+static long long direct_frames_to_ns(snd_pcm_t *pcm, snd_pcm_uframes_t frames)
+{
+	return (long long)frames * 1000000000LL / pcm->rate;
+}
+
+/* take the newest slave clock sample, publishing ours if it is newer */
+static void direct_clock_sample(snd_pcm_direct_t *dmix,
+				snd_pcm_uframes_t *hw_ptr, long long *tstamp)
+{
+	snd_pcm_direct_share_t *share = dmix->shmptr;
+	snd_pcm_uframes_t ptr1 = -2LL /* invalid value */, ptr2;
+	snd_htimestamp_t ts = { 0, 0 };
+	unsigned long long sh_ptr;
+	long long sh_tstamp;
+	unsigned int seq, sh_recoveries;
+
+	/* loop is required to sync hw.ptr with timestamp */
+	while (1) {
+		ptr2 = *dmix->spcm->hw.ptr;
+		if (ptr1 == ptr2)
+			break;
+		ptr1 = ptr2;
+		ts = snd_pcm_hw_fast_tstamp(dmix->spcm);
+	}
+	*hw_ptr = ptr1;
+	*tstamp = direct_ts_ns(&ts);
+
+	seq = __atomic_load_n(&share->clock.seq, __ATOMIC_ACQUIRE);
+	if (seq & 1)
+		return;
+	sh_ptr = share->clock.hw_ptr;
+	sh_tstamp = share->clock.tstamp;
+	sh_recoveries = share->clock.recoveries;
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if (__atomic_load_n(&share->clock.seq, __ATOMIC_RELAXED) != seq)
+		return;
+	if (sh_recoveries == share->s.recoveries && sh_tstamp > *tstamp) {
+		*hw_ptr = sh_ptr;
+		*tstamp = sh_tstamp;
+		return;
+	}
+	if (*tstamp == 0 || *tstamp == sh_tstamp)
+		return;
+	/* publish, unless another client is doing it right now */
+	if (!__atomic_compare_exchange_n(&share->clock.seq, &seq, seq + 1, 0,
+					 __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		return;
+	share->clock.hw_ptr = *hw_ptr;
+	share->clock.tstamp = *tstamp;
+	share->clock.recoveries = share->s.recoveries;
+	__atomic_store_n(&share->clock.seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/* time from now to the next slave period boundary after the sample */
+static long long direct_clock_period_ns(snd_pcm_t *pcm, snd_pcm_direct_t *dmix,
+					snd_pcm_uframes_t hw_ptr, long long tstamp,
+					const snd_htimestamp_t *now)
+{
+	long long ns;
+
+	ns = tstamp + direct_frames_to_ns(pcm, dmix->slave_period_size -
+					  hw_ptr % dmix->slave_period_size) -
+	     direct_ts_ns(now);
+	/* the position is updated per period only, the boundary is passed
+	 * but not yet seen
+	 */
+	if (ns <= 0)
+		ns = direct_frames_to_ns(pcm, dmix->slave_period_size) / 16;
+	return ns;
+}
+
+static int direct_clock_set(snd_pcm_direct_t *dmix, long long ns)
+{
+	struct itimerspec its;
+
+	memset(&its, 0, sizeof(its));
+	if (ns <= 0) {
+		/* zero it_value disarms the timer */
+		its.it_value.tv_nsec = 1;
+	} else {
+		its.it_value.tv_sec = ns / 1000000000LL;
+		its.it_value.tv_nsec = ns % 1000000000LL;
+	}
+	if (timerfd_settime(dmix->poll_fd, 0, &its, NULL) < 0) {
+		int err = -errno;
+		snd_checknum(PCM, "timerfd_settime failed (%i)", err);
+		return err;
+	}
+	return 0;
+}
+
+/* arm the wakeup timerfd for the next time avail reaches avail_min */
+static int snd_pcm_direct_clock_arm(snd_pcm_t *pcm)
+{
+	snd_pcm_direct_t *dmix = pcm->private_data;
+	snd_htimestamp_t now;
+	snd_pcm_uframes_t avail, need, done, hw_ptr;
+	long long tstamp, tick, ns;
+
+	tick = direct_frames_to_ns(pcm, dmix->slave_period_size *
+				   (dmix->timer_ticks ? dmix->timer_ticks : 1));
+	ns = tick;
+	if (dmix->state == SND_PCM_STATE_DRAINING &&
+	    pcm->stream == SND_PCM_STREAM_PLAYBACK) {
+		/* avail stays at or above avail_min until the drain ends,
+		 * so follow the slave periods instead
+		 */
+		direct_clock_sample(dmix, &hw_ptr, &tstamp);
+		if (tstamp != 0) {
+			gettimestamp(&now, dmix->spcm->tstamp_type);
+			ns = direct_clock_period_ns(pcm, dmix, hw_ptr, tstamp, &now);
+		}
+		goto __cap;
+	}
+	avail = snd_pcm_mmap_avail(pcm);
+	if (avail >= pcm->avail_min)
+		return direct_clock_set(dmix, 0);
+	switch (dmix->state) {
+	case SND_PCM_STATE_RUNNING:
+	case SND_PCM_STATE_DRAINING:
+		break;
+	default:
+		goto __cap;
+	}
+	direct_clock_sample(dmix, &hw_ptr, &tstamp);
+	if (tstamp == 0)
+		goto __cap;
+	need = pcm->avail_min - avail;
+	/* slave frames processed since our last pointer sync */
+	done = pcm_frame_diff(hw_ptr, dmix->slave_hw_ptr, dmix->slave_boundary);
+	if (done >= need)
+		return direct_clock_set(dmix, 0);
+	gettimestamp(&now, dmix->spcm->tstamp_type);
+	ns = tstamp + direct_frames_to_ns(pcm, need - done) - direct_ts_ns(&now);
+	if (ns <= 0)
+		ns = direct_clock_period_ns(pcm, dmix, hw_ptr, tstamp, &now);
+ __cap:
+	if (ns > tick)
+		ns = tick;
+	return direct_clock_set(dmix, ns);
+}
+
+/*
+ * Drop an expired clock wakeup. The timer is one-shot, so it is armed
+ * again for one tick: poll loops which do not ask for the descriptors
+ * again still wake up, and their next poll_revents arms it exactly.
+ */
+static int snd_pcm_direct_clock_clear(snd_pcm_direct_t *dmix)
+{
+	uint64_t expirations;
+	long long ns;
+
+	if (dmix->poll_fd < 0 ||
+	    read(dmix->poll_fd, &expirations, sizeof(expirations)) !=
+	    sizeof(expirations))
+		return 0;
+	ns = (long long)dmix->slave_period_size *
+	     (dmix->timer_ticks ? dmix->timer_ticks : 1) *
+	     1000000000LL / dmix->shmptr->s.rate;
+	direct_clock_set(dmix, ns);
+	return 1;
+}
+#else
+static inline int snd_pcm_direct_clock_arm(snd_pcm_t *pcm ATTRIBUTE_UNUSED)
+{
+	return 0;
+}
+
+static int snd_pcm_direct_clock_clear(snd_pcm_direct_t *dmix ATTRIBUTE_UNUSED)
+{
+	return 0;
+}
+#endif /* HAVE_SYS_TIMERFD_H */
+
 #define RECOVERIES_FLAG_SUSPENDED	(1U << 31)
 #define RECOVERIES_MASK			((1U << 31) - 1)
 
@@ -631,6 +859,8 @@ int snd_pcm_direct_slave_recover(snd_pcm_direct_t *direct)
 		return ret;
 	}
 
+	if (direct->type == SND_PCM_TYPE_DSNOOP)
+		direct->shmptr->u.dsnoop.cache_ptr = 0;
 	if (direct->type == SND_PCM_TYPE_DSHARE) {
 		const snd_pcm_channel_area_t *dst_areas;
 		dst_areas = snd_pcm_mmap_areas(direct->spcm);
@@ -726,6 +956,8 @@ int snd_pcm_direct_check_xrun(snd_pcm_direct_t *direct, snd_pcm_t *pcm)
 int snd_pcm_direct_poll_descriptors(snd_pcm_t *pcm, struct pollfd *pfds,
 				    unsigned int space)
 {
+	snd_pcm_direct_t *dmix = pcm->private_data;
+
 	if (pcm->poll_fd < 0) {
 		snd_check(PCM, "poll_fd < 0");
 		return -EIO;
@@ -745,6 +977,8 @@ int snd_pcm_direct_poll_descriptors(snd_pcm_t *pcm, struct pollfd *pfds,
 	default:
 		break;
 	}
+	if (!dmix->timer)
+		snd_pcm_direct_clock_arm(pcm);
 	return 1;
 }
 
@@ -799,6 +1033,9 @@ timer_changed:
 			}
 		}
 	}
+	/* re-arming also clears the expiration */
+	if (!dmix->timer)
+		snd_pcm_direct_clock_arm(pcm);
 	*revents = events;
 	return 0;
 }
@@ -917,12 +1154,20 @@ int snd_pcm_direct_hw_refine(snd_pcm_t *pcm, snd_pcm_hw_params_t *params)
 			params->cmask |= 1<<SND_PCM_HW_PARAM_ACCESS;
 	}
 	if (params->rmask & (1<<SND_PCM_HW_PARAM_FORMAT)) {
+		snd_mask_t format;
+
 		if (snd_mask_empty(hw_param_mask(params, SND_PCM_HW_PARAM_FORMAT))) {
 			snd_error(PCM, "dshare format mask empty?");
 			return -EINVAL;
 		}
-		if (snd_mask_refine_set(hw_param_mask(params, SND_PCM_HW_PARAM_FORMAT),
-					dshare->shmptr->hw.format))
+		snd_mask_none(&format);
+		snd_mask_set(&format, dshare->shmptr->hw.format);
+		/* dsnoop can also deliver its shared conversion cache */
+		if (dshare->type == SND_PCM_TYPE_DSNOOP &&
+		    dshare->u.dsnoop.cache_format != SND_PCM_FORMAT_UNKNOWN)
+			snd_mask_set(&format, dshare->u.dsnoop.cache_format);
+		if (snd_mask_refine(hw_param_mask(params, SND_PCM_HW_PARAM_FORMAT),
+				    &format))
 			params->cmask |= 1<<SND_PCM_HW_PARAM_FORMAT;
 	}
 	//snd_mask_none(hw_param_mask(params, SND_PCM_HW_PARAM_SUBFORMAT));
@@ -966,25 +1211,37 @@ int snd_pcm_direct_hw_refine(snd_pcm_t *pcm, snd_pcm_hw_params_t *params)
 				    (1<<SND_PCM_HW_PARAM_PERIOD_BYTES))) {
 		snd_interval_t period_size = dshare->shmptr->hw.period_size;
 		snd_interval_t period_time = dshare->shmptr->hw.period_time;
+		snd_interval_t buffer_size = dshare->shmptr->hw.buffer_size;
+		snd_interval_t buffer_time = dshare->shmptr->hw.buffer_time;
+		snd_pcm_uframes_t max_buffer = dshare->slave_buffer_size;
 		int changed;
 		unsigned int max_periods = dshare->max_periods;
+
+		/* a virtual buffer queues the frames which do not fit
+		 * in the slave ring yet
+		 */
+		if (dshare->virtual_buffer > 1) {
+			max_buffer *= dshare->virtual_buffer;
+			buffer_size.max *= dshare->virtual_buffer;
+			buffer_time.max *= dshare->virtual_buffer;
+		}
 		if (max_periods < 2)
-			max_periods = dshare->slave_buffer_size / dshare->slave_period_size;
+			max_periods = max_buffer / dshare->slave_period_size;
 
 		/* make sure buffer size does not exceed slave buffer size */
 		err = hw_param_interval_refine_minmax(params, SND_PCM_HW_PARAM_BUFFER_SIZE,
-					2 * dshare->slave_period_size, dshare->slave_buffer_size);
+					2 * dshare->slave_period_size, max_buffer);
 		if (err < 0)
 			return err;
-		if (dshare->var_periodsize) {
+		if (dshare->var_periodsize || dshare->virtual_buffer > 1) {
 			/* more tolerant settings... */
-			if (dshare->shmptr->hw.buffer_size.max / 2 > period_size.max) {
-				period_size.max = dshare->shmptr->hw.buffer_size.max / 2;
-				period_size.openmax = dshare->shmptr->hw.buffer_size.openmax;
+			if (buffer_size.max / 2 > period_size.max) {
+				period_size.max = buffer_size.max / 2;
+				period_size.openmax = buffer_size.openmax;
 			}
-			if (dshare->shmptr->hw.buffer_time.max / 2 > period_time.max) {
-				period_time.max = dshare->shmptr->hw.buffer_time.max / 2;
-				period_time.openmax = dshare->shmptr->hw.buffer_time.openmax;
+			if (buffer_time.max / 2 > period_time.max) {
+				period_time.max = buffer_time.max / 2;
+				period_time.openmax = buffer_time.openmax;
 			}
 		}
 
@@ -1017,6 +1274,16 @@ int snd_pcm_direct_hw_refine(snd_pcm_t *pcm, snd_pcm_hw_params_t *params)
 		} while (changed);
 	}
 	dshare->timer_ticks = hw_param_interval(params, SND_PCM_HW_PARAM_PERIOD_SIZE)->max / dshare->slave_period_size;
+	if (dshare->max_periods >= 0 && dshare->virtual_buffer > 1) {
+		/* the queued frames are moved into the slave ring on
+		 * wakeups only, so wake up before the ring runs dry
+		 */
+		unsigned int ticks = dshare->slave_buffer_size / dshare->slave_period_size;
+
+		ticks = ticks > 2 ? ticks - 2 : 1;
+		if (dshare->timer_ticks > ticks)
+			dshare->timer_ticks = ticks;
+	}
 	params->info = dshare->shmptr->s.info;
 	params->info &= ~(SND_PCM_INFO_RESUME | SND_PCM_INFO_PAUSE);
 #ifdef REFINE_DEBUG
@@ -1127,6 +1394,8 @@ int snd_pcm_direct_prepare(snd_pcm_t *pcm)
 		err = snd_pcm_prepare(dmix->spcm);
 		if (err < 0)
 			return err;
+		if (dmix->type == SND_PCM_TYPE_DSNOOP)
+			dmix->shmptr->u.dsnoop.cache_ptr = 0;
 		snd_pcm_start(dmix->spcm);
 		break;
 	case SND_PCM_STATE_OPEN:
@@ -1474,6 +1743,19 @@ int snd_pcm_direct_initialize_poll_fd(snd_pcm_direct_t *dmix)
 	dmix->tread = 1;
 	dmix->timer_need_poll = 0;
 	dmix->timer_ticks = 1;
+	if (dmix->wakeup == SND_PCM_DIRECT_WAKEUP_CLOCK) {
+#ifdef HAVE_SYS_TIMERFD_H
+		ret = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		if (ret >= 0) {
+			dmix->poll_fd = ret;
+			return 0;
+		}
+		snd_checknum(PCM, "timerfd_create failed (%i), using slave timer", -errno);
+#else
+		snd_check(PCM, "clock wakeup is not supported, using slave timer");
+#endif
+		dmix->wakeup = SND_PCM_DIRECT_WAKEUP_TIMER;
+	}
 	ret = snd_pcm_info(dmix->spcm, &info);
 	if (ret < 0) {
 		snd_error(PCM, "unable to info for slave pcm");
@@ -1655,6 +1937,8 @@ int snd_pcm_direct_set_timer_params(snd_pcm_direct_t *dmix)
 	unsigned int filter;
 	int ret;
 
+	if (!dmix->timer)
+		return 0;
 	snd_timer_params_set_auto_start(&params, 1);
 	if (dmix->type != SND_PCM_TYPE_DSNOOP)
 		snd_timer_params_set_early_event(&params, 1);
@@ -1945,6 +2229,7 @@ int snd_pcm_direct_parse_open_conf(snd_config_t *root, snd_config_t *conf,
 	rec->slowptr = 1;
 	rec->max_periods = 0;
 	rec->var_periodsize = 0;
+	rec->virtual_buffer = 0;
 #ifdef LOCKLESS_DMIX_DEFAULT
 	rec->direct_memory_access = 1;
 #else
@@ -1952,6 +2237,8 @@ int snd_pcm_direct_parse_open_conf(snd_config_t *root, snd_config_t *conf,
 #endif
 	rec->hw_ptr_alignment = SND_PCM_HW_PTR_ALIGNMENT_AUTO;
 	rec->tstamp_type = -1;
+	rec->wakeup = SND_PCM_DIRECT_WAKEUP_TIMER;
+	rec->cache_format = SND_PCM_FORMAT_UNKNOWN;
 
 	/* read defaults */
 	if (snd_config_search(root, "defaults.pcm.dmix_max_periods", &n) >= 0) {
@@ -2036,6 +2323,41 @@ int snd_pcm_direct_parse_open_conf(snd_config_t *root, snd_config_t *conf,
 			}
 			continue;
 		}
+		if (strcmp(id, "cache_format") == 0) {
+			const char *str;
+			if (stream != SND_PCM_STREAM_CAPTURE) {
+				snd_error(PCM, "The field cache_format is only for dsnoop");
+				return -EINVAL;
+			}
+			err = snd_config_get_string(n, &str);
+			if (err < 0) {
+				snd_error(PCM, "Invalid type for %s", id);
+				return -EINVAL;
+			}
+			rec->cache_format = snd_pcm_format_value(str);
+			if (rec->cache_format == SND_PCM_FORMAT_UNKNOWN) {
+				snd_error(PCM, "The field cache_format is invalid : %s", str);
+				return -EINVAL;
+			}
+			continue;
+		}
+		if (strcmp(id, "wakeup") == 0) {
+			const char *str;
+			err = snd_config_get_string(n, &str);
+			if (err < 0) {
+				snd_error(PCM, "Invalid type for %s", id);
+				return -EINVAL;
+			}
+			if (strcmp(str, "timer") == 0)
+				rec->wakeup = SND_PCM_DIRECT_WAKEUP_TIMER;
+			else if (strcmp(str, "clock") == 0)
+				rec->wakeup = SND_PCM_DIRECT_WAKEUP_CLOCK;
+			else {
+				snd_error(PCM, "The field wakeup is invalid : %s", str);
+				return -EINVAL;
+			}
+			continue;
+		}
 		if (strcmp(id, "ipc_gid") == 0) {
 			char *group;
 			char *endp;
@@ -2108,6 +2430,22 @@ int snd_pcm_direct_parse_open_conf(snd_config_t *root, snd_config_t *conf,
 			rec->var_periodsize = err;
 			continue;
 		}
+		if (strcmp(id, "virtual_buffer") == 0) {
+			long val;
+			if (stream != SND_PCM_STREAM_PLAYBACK) {
+				snd_error(PCM, "The field virtual_buffer is only for playback");
+				return -EINVAL;
+			}
+			err = snd_config_get_integer(n, &val);
+			if (err < 0)
+				return err;
+			if (val < 0 || val > 64) {
+				snd_error(PCM, "The field virtual_buffer is invalid : %ld", val);
+				return -EINVAL;
+			}
+			rec->virtual_buffer = val;
+			continue;
+		}
 		if (strcmp(id, "direct_memory_access") == 0) {
 			err = snd_config_get_bool(n);
 			if (err < 0)
@@ -2176,6 +2514,8 @@ int _snd_pcm_direct_new(snd_pcm_t **pcmp, snd_pcm_direct_t **_dmix, int type,
 	dmix->ipc_perm = opts->ipc_perm;
 	dmix->ipc_gid = opts->ipc_gid;
 	dmix->tstamp_type = opts->tstamp_type;
+	dmix->wakeup = opts->wakeup;
+	dmix->poll_fd = -1;
 	dmix->semid = -1;
 	dmix->shmid = -1;
 	dmix->shmptr = (void *) -1;
@@ -2184,6 +2524,8 @@ int _snd_pcm_direct_new(snd_pcm_t **pcmp, snd_pcm_direct_t **_dmix, int type,
 	ret = snd_pcm_new(pcmp, type, name, stream, mode);
 	if (ret < 0)
 		goto _err_nosem;
+	/* the first client fixes the shared setup */
+	(*pcmp)->volatile_refine = 1;
 
 	while (1) {
 		ret = snd_pcm_direct_semaphore_create_or_connect(dmix);
@@ -62,6 +62,11 @@ typedef enum snd_pcm_direct_hw_ptr_alignment {
 	SND_PCM_HW_PTR_ALIGNMENT_AUTO = 3	/* automatic selection */
 } snd_pcm_direct_hw_ptr_alignment_t;
 
+typedef enum snd_pcm_direct_wakeup {
+	SND_PCM_DIRECT_WAKEUP_TIMER = 0,	/* slave PCM timer instance per client */
+	SND_PCM_DIRECT_WAKEUP_CLOCK = 1		/* timerfd armed from the shared slave clock */
+} snd_pcm_direct_wakeup_t;
+
 struct slave_params {
 	snd_pcm_format_t format;
 	int rate;
@@ -124,7 +129,18 @@ typedef struct {
 		struct {
 			unsigned long long chn_mask;
 		} dshare;
+		struct {
+			int cache_format;		/* format of the conversion cache */
+			unsigned int cache_ptr;		/* slave position converted up to */
+		} dsnoop;
 	} u;
+	struct {
+		/* last observed slave position, published by any client */
+		unsigned int seq;		/* odd while an update is in progress */
+		unsigned int recoveries;	/* s.recoveries at the time of the sample */
+		unsigned long long hw_ptr;	/* slave hw_ptr */
+		long long tstamp;		/* time of hw_ptr in ns (slave tstamp_type) */
+	} clock;
 } snd_pcm_direct_share_t;
 
 typedef struct snd_pcm_direct snd_pcm_direct_t;
@@ -164,10 +180,12 @@ struct snd_pcm_direct {
 	int server_fd;
 	pid_t server_pid;
 	snd_timer_t *timer; 		/* timer used as poll_fd */
+	snd_pcm_direct_wakeup_t wakeup;	/* source of poll_fd wakeups */
 	int interleaved;	 	/* we have interleaved buffer */
 	int slowptr;			/* use slow but more precise ptr updates */
 	int max_periods;		/* max periods (-1 = fixed periods, 0 = max buffer size) */
 	int var_periodsize;		/* allow variable period size if max_periods is != -1*/
+	unsigned int virtual_buffer;	/* max client buffer in slave buffers, 0 = slave buffer */
 	unsigned int channels;		/* client's channels */
 	unsigned int *bindings;
 	unsigned int recoveries;	/* mirror of executed recoveries on slave */
@@ -191,6 +209,17 @@ struct snd_pcm_direct {
 		struct {
 			unsigned long long chn_mask;
 		} dshare;
+		struct {
+			int shmid_cache;		/* IPC conversion cache memory identification */
+			void *cache;			/* shared conversion cache */
+			snd_pcm_channel_area_t *cache_areas;
+			snd_pcm_format_t cache_format;	/* SND_PCM_FORMAT_UNKNOWN = no cache */
+			unsigned int cache_boundary;	/* wrap point of the shared cache_ptr */
+			unsigned int cache_idx;		/* conversion index */
+			unsigned int cache_float_idx;	/* put index for float caches */
+			int use_cache;			/* client format is the cache format */
+			int cache_resync;		/* refresh the whole cache on next update */
+		} dsnoop;
 	} u;
 	void (*server_free)(snd_pcm_direct_t *direct);
 };
@@ -248,8 +277,12 @@ struct snd_pcm_direct {
 	snd1_pcm_direct_prepare
 #define snd_pcm_direct_resume \
 	snd1_pcm_direct_resume
+#define snd_pcm_direct_timer_start \
+	snd1_pcm_direct_timer_start
 #define snd_pcm_direct_timer_stop \
 	snd1_pcm_direct_timer_stop
+#define snd_pcm_direct_timer_close \
+	snd1_pcm_direct_timer_close
 #define snd_pcm_direct_clear_timer_queue \
 	snd1_pcm_direct_clear_timer_queue
 #define snd_pcm_direct_set_timer_params \
@@ -342,7 +375,9 @@ int snd_pcm_direct_mmap(snd_pcm_t *pcm);
 int snd_pcm_direct_munmap(snd_pcm_t *pcm);
 int snd_pcm_direct_prepare(snd_pcm_t *pcm);
 int snd_pcm_direct_resume(snd_pcm_t *pcm);
+int snd_pcm_direct_timer_start(snd_pcm_direct_t *dmix);
 int snd_pcm_direct_timer_stop(snd_pcm_direct_t *dmix);
+void snd_pcm_direct_timer_close(snd_pcm_direct_t *dmix);
 int snd_pcm_direct_clear_timer_queue(snd_pcm_direct_t *dmix);
 int snd_pcm_direct_set_timer_params(snd_pcm_direct_t *dmix);
 int snd_pcm_direct_open_secondary_client(snd_pcm_t **spcmp, snd_pcm_direct_t *dmix, const char *client_name);
@@ -363,9 +398,12 @@ struct snd_pcm_direct_open_conf {
 	int slowptr;
 	int max_periods;
 	int var_periodsize;
+	unsigned int virtual_buffer;
 	int direct_memory_access;
 	snd_pcm_direct_hw_ptr_alignment_t hw_ptr_alignment;
 	int tstamp_type;
+	snd_pcm_direct_wakeup_t wakeup;
+	snd_pcm_format_t cache_format;
 	snd_config_t *slave;
 	snd_config_t *bindings;
 };
@@ -409,7 +409,7 @@ static int snd_pcm_dmix_sync_ptr0(snd_pcm_t *pcm, snd_pcm_uframes_t slave_hw_ptr
 	if (avail > dmix->avail_max)
 		dmix->avail_max = avail;
 	if (avail >= pcm->stop_threshold) {
-		snd_timer_stop(dmix->timer);
+		snd_pcm_direct_timer_stop(dmix);
 		gettimestamp(&dmix->trigger_tstamp, pcm->tstamp_type);
 		if (dmix->state == SND_PCM_STATE_RUNNING) {
 			dmix->state = SND_PCM_STATE_XRUN;
@@ -542,7 +542,7 @@ static int snd_pcm_dmix_start_timer(snd_pcm_t *pcm, snd_pcm_direct_t *dmix)
 
 	snd_pcm_hwsync(dmix->spcm);
 	snd_pcm_direct_reset_slave_ptr(pcm, dmix, *dmix->spcm->hw.ptr);
-	err = snd_timer_start(dmix->timer);
+	err = snd_pcm_direct_timer_start(dmix);
 	if (err < 0)
 		return err;
 	dmix->state = SND_PCM_STATE_RUNNING;
@@ -780,8 +780,7 @@ static int snd_pcm_dmix_close(snd_pcm_t *pcm)
 {
 	snd_pcm_direct_t *dmix = pcm->private_data;
 
-	if (dmix->timer)
-		snd_timer_close(dmix->timer);
+	snd_pcm_direct_timer_close(dmix);
 	snd_pcm_direct_semaphore_down(dmix, DIRECT_IPC_SEM_CLIENT);
 	snd_pcm_close(dmix->spcm);
 	if (dmix->server)
@@ -842,6 +841,12 @@ static snd_pcm_sframes_t snd_pcm_dmix_avail_update(snd_pcm_t *pcm)
 	    dmix->state == SND_PCM_STATE_DRAINING) {
 		if ((err = snd_pcm_dmix_sync_ptr(pcm)) < 0)
 			return err;
+		/* blocking writes and mmap loops see the slave progress
+		 * here, move the queued frames of a virtual buffer along
+		 */
+		if (dmix->state == SND_PCM_STATE_RUNNING &&
+		    pcm->buffer_size > dmix->slave_buffer_size)
+			snd_pcm_dmix_sync_area(pcm);
 	}
 	if (dmix->state == SND_PCM_STATE_XRUN)
 		return -EPIPE;
@@ -874,7 +879,11 @@ static int snd_pcm_dmix_htimestamp(snd_pcm_t *pcm,
 static int snd_pcm_dmix_poll_revents(snd_pcm_t *pcm, struct pollfd *pfds, unsigned int nfds, unsigned short *revents)
 {
 	snd_pcm_direct_t *dmix = pcm->private_data;
-	if (dmix->state == SND_PCM_STATE_RUNNING)
+	/* the fill is limited by the slave position, refresh it first;
+	 * with a virtual buffer this refills the ring on the wakeups
+	 */
+	if (dmix->state == SND_PCM_STATE_RUNNING &&
+	    snd_pcm_dmix_sync_ptr(pcm) >= 0)
 		snd_pcm_dmix_sync_area(pcm);
 	return snd_pcm_direct_poll_revents(pcm, pfds, nfds, revents);
 }
@@ -986,6 +995,7 @@ int snd_pcm_dmix_open(snd_pcm_t **pcmp, const char *name,
 	dmix->slowptr = opts->slowptr;
 	dmix->max_periods = opts->max_periods;
 	dmix->var_periodsize = opts->var_periodsize;
+	dmix->virtual_buffer = opts->virtual_buffer;
 	dmix->hw_ptr_alignment = opts->hw_ptr_alignment;
 	dmix->sync_ptr = snd_pcm_dmix_sync_ptr;
 	dmix->direct_memory_access = opts->direct_memory_access;
@@ -1079,6 +1089,16 @@ int snd_pcm_dmix_open(snd_pcm_t **pcmp, const char *name,
 		goto _err;
 	}
 
+	/* the ring is refilled one period short of full on each wakeup,
+	 * so it needs a period of margin on top
+	 */
+	if (dmix->virtual_buffer > 1 && dmix->max_periods >= 0 &&
+	    dmix->slave_buffer_size < 3 * dmix->slave_period_size) {
+		snd_error(PCM, "virtual_buffer needs a slave buffer of at least three periods");
+		ret = -EINVAL;
+		goto _err;
+	}
+
 	ret = snd_pcm_direct_initialize_poll_fd(dmix);
 	if (ret < 0) {
 		snd_error(PCM, "unable to initialize poll_fd");
@@ -1103,8 +1123,7 @@ int snd_pcm_dmix_open(snd_pcm_t **pcmp, const char *name,
 	return 0;
 
  _err:
-	if (dmix->timer)
-		snd_timer_close(dmix->timer);
+	snd_pcm_direct_timer_close(dmix);
 	if (dmix->server)
 		snd_pcm_direct_server_discard(dmix);
 	if (dmix->client)
@@ -1148,6 +1167,8 @@ pcm.name {
 	tstamp_type STR		# timestamp type
 				# STR can be one of the below strings :
 				# default, gettimeofday, monotonic, monotonic_raw
+	wakeup STR		# poll wakeup source: timer (default) or clock
+	virtual_buffer INT	# max client buffer in slave buffers (0 = off)
 	slave STR
 	# or
 	slave {			# Slave definition
@@ -1201,6 +1222,31 @@ the possible configurations:
   case of a dependency to another sound device (e.g. forwarding of
   microphone to speaker). Else "no" will be chosen.
 
+<code>wakeup</code> selects what wakes up the application in poll().
+With "timer" (default), each client opens its own timer instance on the
+slave PCM. With "clock", the clients share the last observed slave
+position through the IPC memory and each one arms a timerfd to the
+time its avail reaches avail_min, so no slave timer is used.
+Asynchronous notification is not available in the clock mode.
+
+<code>virtual_buffer</code> lets each client choose a buffer larger
+than the slave buffer, up to the given multiple of it.  The frames
+which do not fit in the slave ring yet stay in the client buffer and
+are mixed in at the next wakeup, so the slave can run with a small
+period and buffer for low latency clients while other clients keep a
+long buffer and a large avail_min.  The wakeups of such clients are
+shortened so that the slave ring never runs dry.  It has no effect
+when max_periods is -1, and it needs a slave buffer of at least three
+periods.
+
+The plugin has no thread of its own.  The queued frames are mixed in
+only when the client calls into the PCM: poll, wait, avail update,
+write or commit.  poll() and blocking writes do that on the shortened
+wakeups by themselves.  A client using a buffer larger than the slave
+buffer must not stay away from the PCM longer than the slave buffer
+minus one period, for example sleeping elsewhere after filling its
+buffer; it underruns then although its own buffer still holds data.
+
 Note that the dmix plugin itself supports only a single configuration.
 That is, it supports only the fixed rate (default 48000), format
 (\c S16), channels (2), and period_time (125000).
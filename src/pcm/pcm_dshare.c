@@ -74,6 +74,10 @@ static void do_silence(snd_pcm_t *pcm)
 	}
 }
 
+/*
+ * copy our channels into the slave ring; called without the semaphore,
+ * as the bound channels of the clients never overlap
+ */
 static void share_areas(snd_pcm_direct_t *dshare,
 		      const snd_pcm_channel_area_t *src_areas,
 		      const snd_pcm_channel_area_t *dst_areas,
@@ -188,7 +192,7 @@ static int snd_pcm_dshare_sync_ptr0(snd_pcm_t *pcm, snd_pcm_uframes_t slave_hw_p
 	if (avail > dshare->avail_max)
 		dshare->avail_max = avail;
 	if (avail >= pcm->stop_threshold) {
-		snd_timer_stop(dshare->timer);
+		snd_pcm_direct_timer_stop(dshare);
 		do_silence(pcm);
 		gettimestamp(&dshare->trigger_tstamp, pcm->tstamp_type);
 		if (dshare->state == SND_PCM_STATE_RUNNING) {
@@ -321,7 +325,7 @@ static int snd_pcm_dshare_start_timer(snd_pcm_t *pcm, snd_pcm_direct_t *dshare)
 
 	snd_pcm_hwsync(dshare->spcm);
 	snd_pcm_direct_reset_slave_ptr(pcm, dshare, *dshare->spcm->hw.ptr);
-	err = snd_timer_start(dshare->timer);
+	err = snd_pcm_direct_timer_start(dshare);
 	if (err < 0)
 		return err;
 	dshare->state = SND_PCM_STATE_RUNNING;
@@ -482,8 +486,7 @@ static int snd_pcm_dshare_close(snd_pcm_t *pcm)
 {
 	snd_pcm_direct_t *dshare = pcm->private_data;
 
-	if (dshare->timer)
-		snd_timer_close(dshare->timer);
+	snd_pcm_direct_timer_close(dshare);
 	if (dshare->bindings)
 		do_silence(pcm);
 	snd_pcm_direct_semaphore_down(dshare, DIRECT_IPC_SEM_CLIENT);
@@ -782,6 +785,16 @@ int snd_pcm_dshare_open(snd_pcm_t **pcmp, const char *name,
 		if (dchn != UINT_MAX)
 			dshare->u.dshare.chn_mask |= (1ULL << dchn);
 	}
+	/* clients write their channels without locking, which is only
+	 * safe when no two channels share a byte
+	 */
+	if (dshare->u.dshare.chn_mask &&
+	    dshare->shmptr->s.sample_bits % 8) {
+		snd_error(PCM, "dshare needs a byte aligned slave format");
+		dshare->u.dshare.chn_mask = 0;
+		ret = -EINVAL;
+		goto _err;
+	}
 	if (dshare->shmptr->u.dshare.chn_mask & dshare->u.dshare.chn_mask) {
 		snd_error(PCM, "destination channel specified in bindings is already used");
 		dshare->u.dshare.chn_mask = 0;
@@ -811,8 +824,7 @@ int snd_pcm_dshare_open(snd_pcm_t **pcmp, const char *name,
  _err:
 	if (dshare->shmptr != (void *) -1)
 		dshare->shmptr->u.dshare.chn_mask &= ~dshare->u.dshare.chn_mask;
-	if (dshare->timer)
-		snd_timer_close(dshare->timer);
+	snd_pcm_direct_timer_close(dshare);
 	if (dshare->server)
 		snd_pcm_direct_server_discard(dshare);
 	if (dshare->client)
@@ -857,6 +869,7 @@ pcm.name {
 	tstamp_type STR		# timestamp type
 				# STR can be one of the below strings :
 				# default, gettimeofday, monotonic, monotonic_raw
+	wakeup STR		# poll wakeup source: timer (default) or clock
 	slave STR
 	# or
 	slave {			# Slave definition
@@ -902,6 +915,9 @@ the possible configurations:
   case of a dependency to another sound device (e.g. forwarding of
   microphone to speaker). Else "no" will be chosen.
 
+<code>wakeup</code> selects the poll wakeup source, see the
+\ref pcm_plugins_dmix "dmix plugin".
+
 \subsection pcm_plugins_dshare_funcref Function reference
 
 <UL>
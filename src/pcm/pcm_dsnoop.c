@@ -45,6 +45,7 @@
 #include <sys/un.h>
 #include <sys/mman.h>
 #include "pcm_direct.h"
+#include "pcm_plugin.h"
 
 #ifndef PIC
 /* entry for static linking */
@@ -72,6 +73,351 @@ static int snoop_timestamp(snd_pcm_t *pcm)
 	return 0;
 }
 
+/*
+ *  shared conversion cache
+ *
+ *  When cache_format is set, the slave buffer is converted once into
+ *  a shared ring of the same geometry and clients opened in that format
+ *  read from it instead of converting on their own. cache_ptr tells how
+ *  far the ring is valid; whoever needs more frames converts them and
+ *  moves it forward. Converting a frame twice gives the same result,
+ *  so racing clients only waste some work.
+ */
+
+static int shm_cache_discard(snd_pcm_direct_t *dsnoop);
+
+/*
+ *  The cache segment starts with a header, so that a segment of another
+ *  plugin which happens to use the same key is never taken for a cache.
+ */
+#define DSNOOP_CACHE_MAGIC	(0x43534e44 + sizeof(dsnoop_cache_header_t))
+
+typedef struct {
+	unsigned int magic;
+	unsigned int format;
+	unsigned int channels;
+	unsigned int buffer_size;
+} dsnoop_cache_header_t;
+
+/* the cache key keeps the low bits of ipc_key and a project id on top,
+ * like ftok() does, so that the consecutive ipc_key values users give to
+ * dmix and dsnoop do not meet it
+ */
+static key_t shm_cache_key(snd_pcm_direct_t *dsnoop)
+{
+	return (dsnoop->ipc_key & 0x00ffffff) | ('C' << 24);
+}
+
+static size_t shm_cache_size(snd_pcm_direct_t *dsnoop)
+{
+	return sizeof(dsnoop_cache_header_t) +
+	       (size_t)dsnoop->shmptr->s.channels *
+	       dsnoop->shmptr->s.buffer_size *
+	       (snd_pcm_format_physical_width(dsnoop->u.dsnoop.cache_format) / 8);
+}
+
+static void shm_cache_header(snd_pcm_direct_t *dsnoop, dsnoop_cache_header_t *hdr)
+{
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->magic = DSNOOP_CACHE_MAGIC;
+	hdr->format = dsnoop->u.dsnoop.cache_format;
+	hdr->channels = dsnoop->shmptr->s.channels;
+	hdr->buffer_size = dsnoop->shmptr->s.buffer_size;
+}
+
+static int shm_cache_create_or_connect(snd_pcm_direct_t *dsnoop)
+{
+	struct shmid_ds buf;
+	dsnoop_cache_header_t hdr;
+	key_t key = shm_cache_key(dsnoop);
+	int created, err;
+	size_t size;
+
+	size = shm_cache_size(dsnoop);
+	shm_cache_header(dsnoop, &hdr);
+retryshm:
+	created = 1;
+	dsnoop->u.dsnoop.shmid_cache = shmget(key, size, IPC_CREAT | IPC_EXCL |
+					      dsnoop->ipc_perm);
+	if (dsnoop->u.dsnoop.shmid_cache < 0 && errno == EEXIST) {
+		created = 0;
+		dsnoop->u.dsnoop.shmid_cache = shmget(key, 0, dsnoop->ipc_perm);
+	}
+	if (dsnoop->u.dsnoop.shmid_cache < 0)
+		return -errno;
+	if (shmctl(dsnoop->u.dsnoop.shmid_cache, IPC_STAT, &buf) < 0) {
+		err = -errno;
+		shm_cache_discard(dsnoop);
+		return err;
+	}
+	if (created && dsnoop->ipc_gid >= 0) {
+		buf.shm_perm.gid = dsnoop->ipc_gid;
+		shmctl(dsnoop->u.dsnoop.shmid_cache, IPC_SET, &buf);
+	}
+	dsnoop->u.dsnoop.cache = shmat(dsnoop->u.dsnoop.shmid_cache, 0, 0);
+	if (dsnoop->u.dsnoop.cache == (void *) -1) {
+		err = -errno;
+		shm_cache_discard(dsnoop);
+		return err;
+	}
+	if (created) {
+		memcpy(dsnoop->u.dsnoop.cache, &hdr, sizeof(hdr));
+	} else if (buf.shm_segsz < sizeof(hdr) ||
+		   ((dsnoop_cache_header_t *)dsnoop->u.dsnoop.cache)->magic !=
+		   DSNOOP_CACHE_MAGIC) {
+		/* not ours, leave it alone */
+		shmdt(dsnoop->u.dsnoop.cache);
+		dsnoop->u.dsnoop.cache = (void *) -1;
+		dsnoop->u.dsnoop.shmid_cache = -1;
+		snd_error(PCM, "shared memory key 0x%x of the conversion cache is used by another application",
+			  (unsigned int)key);
+		return -EBUSY;
+	} else if (buf.shm_segsz != size ||
+		   memcmp(dsnoop->u.dsnoop.cache, &hdr, sizeof(hdr))) {
+		/* a stale cache of an older setup, renew it when unused */
+		if (shm_cache_discard(dsnoop) > 0)
+			goto retryshm;
+		dsnoop->u.dsnoop.shmid_cache = -1;
+		snd_error(PCM, "the conversion cache is in use with another setup");
+		return -EBUSY;
+	}
+	mlock(dsnoop->u.dsnoop.cache, size);
+	return 0;
+}
+
+static int shm_cache_discard(snd_pcm_direct_t *dsnoop)
+{
+	struct shmid_ds buf;
+	int ret = 0;
+
+	if (dsnoop->u.dsnoop.shmid_cache < 0)
+		return -EINVAL;
+	if (dsnoop->u.dsnoop.cache != (void *) -1 && shmdt(dsnoop->u.dsnoop.cache) < 0)
+		return -errno;
+	dsnoop->u.dsnoop.cache = (void *) -1;
+	if (shmctl(dsnoop->u.dsnoop.shmid_cache, IPC_STAT, &buf) < 0)
+		return -errno;
+	if (buf.shm_nattch == 0) {	/* we're the last user, destroy the segment */
+		if (shmctl(dsnoop->u.dsnoop.shmid_cache, IPC_RMID, NULL) < 0)
+			return -errno;
+		ret = 1;
+	}
+	dsnoop->u.dsnoop.shmid_cache = -1;
+	return ret;
+}
+
+static void dsnoop_server_free(snd_pcm_direct_t *dsnoop)
+{
+	/* remove the memory region */
+	shm_cache_create_or_connect(dsnoop);
+	shm_cache_discard(dsnoop);
+}
+
+static int dsnoop_cache_float(snd_pcm_format_t format)
+{
+	switch (format) {
+	case SND_PCM_FORMAT_FLOAT_LE:
+	case SND_PCM_FORMAT_FLOAT_BE:
+	case SND_PCM_FORMAT_FLOAT64_LE:
+	case SND_PCM_FORMAT_FLOAT64_BE:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/* decide the cache format, the first instance stores it for the others */
+static int snd_pcm_dsnoop_cache_setup(snd_pcm_direct_t *dsnoop,
+				      snd_pcm_format_t format, int first_instance)
+{
+	snd_pcm_format_t slave_format = dsnoop->shmptr->s.format;
+
+	if (first_instance) {
+		if (format == slave_format)
+			format = SND_PCM_FORMAT_UNKNOWN;
+		if (format != SND_PCM_FORMAT_UNKNOWN) {
+			int ok = snd_pcm_format_linear(slave_format) == 1;
+			if (dsnoop_cache_float(format)) {
+#ifndef BUILD_PCM_PLUGIN_LFLOAT
+				ok = 0;
+#endif
+			} else if (snd_pcm_format_linear(format) != 1) {
+				ok = 0;
+			}
+			if (!ok) {
+				snd_error(PCM, "cannot convert %s to the cache format %s",
+					  snd_pcm_format_name(slave_format),
+					  snd_pcm_format_name(format));
+				return -EINVAL;
+			}
+		}
+		dsnoop->shmptr->u.dsnoop.cache_format = format;
+		dsnoop->shmptr->u.dsnoop.cache_ptr = 0;
+	}
+	dsnoop->u.dsnoop.cache_format = dsnoop->shmptr->u.dsnoop.cache_format;
+	return 0;
+}
+
+static int snd_pcm_dsnoop_cache_init(snd_pcm_direct_t *dsnoop)
+{
+	snd_pcm_format_t format = dsnoop->u.dsnoop.cache_format;
+	snd_pcm_format_t slave_format = dsnoop->shmptr->s.format;
+	unsigned int chn, channels, bits, buffer_size, boundary;
+	int err;
+
+	if (format == SND_PCM_FORMAT_UNKNOWN)
+		return 0;
+	channels = dsnoop->shmptr->s.channels;
+	buffer_size = dsnoop->shmptr->s.buffer_size;
+	bits = snd_pcm_format_physical_width(format);
+#ifdef BUILD_PCM_PLUGIN_LFLOAT
+	if (dsnoop_cache_float(format)) {
+		dsnoop->u.dsnoop.cache_idx = snd_pcm_linear_get_index(slave_format, SND_PCM_FORMAT_S32);
+		dsnoop->u.dsnoop.cache_float_idx = snd_pcm_lfloat_put_s32_index(format);
+	} else
+#endif
+		dsnoop->u.dsnoop.cache_idx = snd_pcm_linear_convert_index(slave_format, format);
+	/* same rule as the slave boundary on 32-bit hosts, so that the
+	 * slave boundary of every client is a multiple of it
+	 */
+	boundary = buffer_size;
+	while (boundary * 2 <= 0x7fffffffU - buffer_size)
+		boundary *= 2;
+	dsnoop->u.dsnoop.cache_boundary = boundary;
+
+	dsnoop->u.dsnoop.cache_areas = calloc(channels, sizeof(snd_pcm_channel_area_t));
+	if (!dsnoop->u.dsnoop.cache_areas)
+		return -ENOMEM;
+	err = shm_cache_create_or_connect(dsnoop);
+	if (err < 0)
+		return err;
+	for (chn = 0; chn < channels; chn++) {
+		dsnoop->u.dsnoop.cache_areas[chn].addr =
+			(char *)dsnoop->u.dsnoop.cache + sizeof(dsnoop_cache_header_t);
+		dsnoop->u.dsnoop.cache_areas[chn].first = chn * bits;
+		dsnoop->u.dsnoop.cache_areas[chn].step = channels * bits;
+	}
+	return 0;
+}
+
+static void snd_pcm_dsnoop_cache_done(snd_pcm_direct_t *dsnoop)
+{
+	if (dsnoop->u.dsnoop.shmid_cache >= 0)
+		shm_cache_discard(dsnoop);
+	free(dsnoop->u.dsnoop.cache_areas);
+	dsnoop->u.dsnoop.cache_areas = NULL;
+}
+
+static void snd_pcm_dsnoop_cache_convert(snd_pcm_direct_t *dsnoop,
+					 snd_pcm_uframes_t ofs,
+					 snd_pcm_uframes_t size)
+{
+	const snd_pcm_channel_area_t *src_areas = snd_pcm_mmap_areas(dsnoop->spcm);
+	const snd_pcm_channel_area_t *dst_areas = dsnoop->u.dsnoop.cache_areas;
+	unsigned int channels = dsnoop->shmptr->s.channels;
+
+#ifdef BUILD_PCM_PLUGIN_LFLOAT
+	if (dsnoop_cache_float(dsnoop->u.dsnoop.cache_format)) {
+		snd_pcm_lfloat_convert_integer_float(dst_areas, ofs, src_areas, ofs,
+						     channels, size,
+						     dsnoop->u.dsnoop.cache_idx,
+						     dsnoop->u.dsnoop.cache_float_idx);
+		return;
+	}
+#endif
+	snd_pcm_linear_convert(dst_areas, ofs, src_areas, ofs, channels, size,
+			       dsnoop->u.dsnoop.cache_idx);
+}
+
+/* frames from the shared cache_ptr to pos, 0 if the cache is already there */
+static unsigned int dsnoop_cache_behind(snd_pcm_direct_t *dsnoop,
+					unsigned int cache_ptr, unsigned int pos)
+{
+	unsigned int boundary = dsnoop->u.dsnoop.cache_boundary;
+	unsigned int diff;
+
+	diff = pos >= cache_ptr ? pos - cache_ptr : pos + boundary - cache_ptr;
+	/* another client may have seen the slave a bit further */
+	if (diff != 0 && boundary - diff <= dsnoop->slave_buffer_size)
+		return 0;
+	return diff;
+}
+
+/* make sure the cache holds the slave frames from slave_ptr on */
+static void snd_pcm_dsnoop_cache_update(snd_pcm_direct_t *dsnoop,
+					snd_pcm_uframes_t slave_ptr,
+					snd_pcm_uframes_t size)
+{
+	unsigned int *shared = &dsnoop->shmptr->u.dsnoop.cache_ptr;
+	unsigned int boundary = dsnoop->u.dsnoop.cache_boundary;
+	unsigned int cache_ptr, pos, behind;
+	snd_pcm_uframes_t ofs, transfer;
+
+	if (size > dsnoop->slave_buffer_size) {
+		slave_ptr += size - dsnoop->slave_buffer_size;
+		size = dsnoop->slave_buffer_size;
+	}
+	pos = (slave_ptr + size) % boundary;
+	cache_ptr = __atomic_load_n(shared, __ATOMIC_ACQUIRE);
+	/* after prepare the shared pointer may have been idle long enough
+	 * to wrap around and look current, so do not trust it once
+	 */
+	if (dsnoop->u.dsnoop.cache_resync)
+		behind = dsnoop->slave_buffer_size;
+	else
+		behind = dsnoop_cache_behind(dsnoop, cache_ptr, pos);
+	if (behind == 0)
+		return;
+	/* too old to be useful: refresh the whole ring, as other clients
+	 * may still need frames before ours
+	 */
+	if (behind > dsnoop->slave_buffer_size)
+		behind = dsnoop->slave_buffer_size;
+	ofs = (pos + boundary - behind) % dsnoop->slave_buffer_size;
+	while (behind > 0) {
+		transfer = ofs + behind > dsnoop->slave_buffer_size ?
+			dsnoop->slave_buffer_size - ofs : behind;
+		snd_pcm_dsnoop_cache_convert(dsnoop, ofs, transfer);
+		behind -= transfer;
+		ofs = (ofs + transfer) % dsnoop->slave_buffer_size;
+	}
+	/* the whole ring is valid up to pos now; moving the pointer back
+	 * only makes the other clients convert some frames twice
+	 */
+	if (dsnoop->u.dsnoop.cache_resync) {
+		dsnoop->u.dsnoop.cache_resync = 0;
+		__atomic_store_n(shared, pos, __ATOMIC_RELEASE);
+		return;
+	}
+	/* publish, never moving the pointer back */
+	while (dsnoop_cache_behind(dsnoop, cache_ptr, pos) != 0) {
+		if (__atomic_compare_exchange_n(shared, &cache_ptr, pos, 0,
+						__ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+			break;
+	}
+}
+
+/* same check as snd_pcm_direct_check_interleave() against the cache */
+static int snd_pcm_dsnoop_cache_interleaved(snd_pcm_t *pcm)
+{
+	snd_pcm_direct_t *dsnoop = pcm->private_data;
+	const snd_pcm_channel_area_t *areas = snd_pcm_mmap_areas(pcm);
+	unsigned int chn, channels = dsnoop->channels;
+	int bits = snd_pcm_format_physical_width(pcm->format);
+
+	if ((bits % 8) != 0 || channels != dsnoop->shmptr->s.channels)
+		return 0;
+	for (chn = 0; chn < channels; chn++) {
+		if (dsnoop->bindings && dsnoop->bindings[chn] != chn)
+			return 0;
+		if (areas[chn].addr != areas[0].addr ||
+		    areas[chn].first != chn * bits ||
+		    areas[chn].step != channels * bits)
+			return 0;
+	}
+	return 1;
+}
+
 static void snoop_areas(snd_pcm_direct_t *dsnoop,
 			const snd_pcm_channel_area_t *src_areas,
 			const snd_pcm_channel_area_t *dst_areas,
@@ -85,7 +431,10 @@ static void snoop_areas(snd_pcm_direct_t *dsnoop,
 	int pwidth;
 
 	channels = dsnoop->channels;
-	format = dsnoop->shmptr->s.format;
+	if (dsnoop->u.dsnoop.use_cache)
+		format = dsnoop->u.dsnoop.cache_format;
+	else
+		format = dsnoop->shmptr->s.format;
 	if (dsnoop->interleaved) {
 		pwidth = snd_pcm_format_physical_width(format);
 		if (pwidth < 0)
@@ -114,7 +463,12 @@ static void snd_pcm_dsnoop_sync_area(snd_pcm_t *pcm, snd_pcm_uframes_t slave_hw_
 
 	/* add sample areas here */
 	dst_areas = snd_pcm_mmap_areas(pcm);
-	src_areas = snd_pcm_mmap_areas(dsnoop->spcm);
+	if (dsnoop->u.dsnoop.use_cache) {
+		snd_pcm_dsnoop_cache_update(dsnoop, slave_hw_ptr, size);
+		src_areas = dsnoop->u.dsnoop.cache_areas;
+	} else {
+		src_areas = snd_pcm_mmap_areas(dsnoop->spcm);
+	}
 	hw_ptr %= pcm->buffer_size;
 	slave_hw_ptr %= dsnoop->slave_buffer_size;
 	while (size > 0) {
@@ -261,6 +615,24 @@ static int snd_pcm_dsnoop_reset(snd_pcm_t *pcm)
 	return 0;
 }
 
+static int snd_pcm_dsnoop_prepare(snd_pcm_t *pcm)
+{
+	snd_pcm_direct_t *dsnoop = pcm->private_data;
+	int err;
+
+	err = snd_pcm_direct_prepare(pcm);
+	if (err < 0)
+		return err;
+	dsnoop->u.dsnoop.use_cache =
+		dsnoop->u.dsnoop.cache_format != SND_PCM_FORMAT_UNKNOWN &&
+		pcm->format == dsnoop->u.dsnoop.cache_format;
+	if (dsnoop->u.dsnoop.use_cache) {
+		dsnoop->interleaved = snd_pcm_dsnoop_cache_interleaved(pcm);
+		dsnoop->u.dsnoop.cache_resync = 1;
+	}
+	return 0;
+}
+
 static int snd_pcm_dsnoop_start(snd_pcm_t *pcm)
 {
 	snd_pcm_direct_t *dsnoop = pcm->private_data;
@@ -271,7 +643,7 @@ static int snd_pcm_dsnoop_start(snd_pcm_t *pcm)
 	snd_pcm_hwsync(dsnoop->spcm);
 	snoop_timestamp(pcm);
 	snd_pcm_direct_reset_slave_ptr(pcm, dsnoop, dsnoop->slave_hw_ptr);
-	err = snd_timer_start(dsnoop->timer);
+	err = snd_pcm_direct_timer_start(dsnoop);
 	if (err < 0)
 		return err;
 	dsnoop->state = SND_PCM_STATE_RUNNING;
@@ -285,7 +657,7 @@ static int snd_pcm_dsnoop_drop(snd_pcm_t *pcm)
 	if (dsnoop->state == SND_PCM_STATE_OPEN)
 		return -EBADFD;
 	dsnoop->state = SND_PCM_STATE_SETUP;
-	snd_timer_stop(dsnoop->timer);
+	snd_pcm_direct_timer_stop(dsnoop);
 	return 0;
 }
 
@@ -374,10 +746,10 @@ static int snd_pcm_dsnoop_close(snd_pcm_t *pcm)
 {
 	snd_pcm_direct_t *dsnoop = pcm->private_data;
 
-	if (dsnoop->timer)
-		snd_timer_close(dsnoop->timer);
+	snd_pcm_direct_timer_close(dsnoop);
 	snd_pcm_direct_semaphore_down(dsnoop, DIRECT_IPC_SEM_CLIENT);
 	snd_pcm_close(dsnoop->spcm);
+	snd_pcm_dsnoop_cache_done(dsnoop);
 	if (dsnoop->server)
 		snd_pcm_direct_server_discard(dsnoop);
 	if (dsnoop->client)
@@ -458,6 +830,10 @@ static void snd_pcm_dsnoop_dump(snd_pcm_t *pcm, snd_output_t *out)
 	snd_pcm_direct_t *dsnoop = pcm->private_data;
 
 	snd_output_printf(out, "Direct Snoop PCM\n");
+	if (dsnoop->u.dsnoop.cache_format != SND_PCM_FORMAT_UNKNOWN)
+		snd_output_printf(out, "  Conversion cache: %s%s\n",
+				  snd_pcm_format_name(dsnoop->u.dsnoop.cache_format),
+				  dsnoop->u.dsnoop.use_cache ? " (in use)" : "");
 	if (pcm->setup) {
 		snd_output_printf(out, "Its setup is:\n");
 		snd_pcm_dump_setup(pcm, out);
@@ -489,7 +865,7 @@ static const snd_pcm_fast_ops_t snd_pcm_dsnoop_fast_ops = {
 	.state = snd_pcm_dsnoop_state,
 	.hwsync = snd_pcm_dsnoop_hwsync,
 	.delay = snd_pcm_dsnoop_delay,
-	.prepare = snd_pcm_direct_prepare,
+	.prepare = snd_pcm_dsnoop_prepare,
 	.reset = snd_pcm_dsnoop_reset,
 	.start = snd_pcm_dsnoop_start,
 	.drop = snd_pcm_dsnoop_drop,
@@ -561,6 +937,8 @@ int snd_pcm_dsnoop_open(snd_pcm_t **pcmp, const char *name,
 	dsnoop->var_periodsize = opts->var_periodsize;
 	dsnoop->sync_ptr = snd_pcm_dsnoop_sync_ptr;
 	dsnoop->hw_ptr_alignment = opts->hw_ptr_alignment;
+	dsnoop->u.dsnoop.shmid_cache = -1;
+	dsnoop->u.dsnoop.cache = (void *) -1;
 
  retry:
 	if (first_instance) {
@@ -586,7 +964,13 @@ int snd_pcm_dsnoop_open(snd_pcm_t **pcmp, const char *name,
 
 		dsnoop->spcm = spcm;
 
+		ret = snd_pcm_dsnoop_cache_setup(dsnoop, opts->cache_format, 1);
+		if (ret < 0)
+			goto _err;
+
 		if (dsnoop->shmptr->use_server) {
+			if (dsnoop->u.dsnoop.cache_format != SND_PCM_FORMAT_UNKNOWN)
+				dsnoop->server_free = dsnoop_server_free;
 			ret = snd_pcm_direct_server_create(dsnoop);
 			if (ret < 0) {
 				snd_error(PCM, "unable to create server");
@@ -641,6 +1025,13 @@ int snd_pcm_dsnoop_open(snd_pcm_t **pcmp, const char *name,
 		}
 
 		dsnoop->spcm = spcm;
+		snd_pcm_dsnoop_cache_setup(dsnoop, opts->cache_format, 0);
+	}
+
+	ret = snd_pcm_dsnoop_cache_init(dsnoop);
+	if (ret < 0) {
+		snd_error(PCM, "unable to initialize conversion cache");
+		goto _err;
 	}
 
 	ret = snd_pcm_direct_initialize_poll_fd(dsnoop);
@@ -665,14 +1056,14 @@ int snd_pcm_dsnoop_open(snd_pcm_t **pcmp, const char *name,
 	return 0;
 
  _err:
-	if (dsnoop->timer)
-		snd_timer_close(dsnoop->timer);
+	snd_pcm_direct_timer_close(dsnoop);
 	if (dsnoop->server)
 		snd_pcm_direct_server_discard(dsnoop);
 	if (dsnoop->client)
 		snd_pcm_direct_client_discard(dsnoop);
 	if (spcm)
 		snd_pcm_close(spcm);
+	snd_pcm_dsnoop_cache_done(dsnoop);
 	if ((dsnoop->shmid >= 0) && (snd_pcm_direct_shm_discard(dsnoop))) {
 		if (snd_pcm_direct_semaphore_discard(dsnoop))
 			snd_pcm_direct_semaphore_final(dsnoop, DIRECT_IPC_SEM_CLIENT);
@@ -711,6 +1102,8 @@ pcm.name {
 	tstamp_type STR		# timestamp type
 				# STR can be one of the below strings :
 				# default, gettimeofday, monotonic, monotonic_raw
+	wakeup STR		# poll wakeup source: timer (default) or clock
+	cache_format STR	# format of the shared conversion cache
 	slave STR
 	# or
 	slave {			# Slave definition
@@ -754,6 +1147,19 @@ the possible configurations:
   requirements. Therefore "rounddown" will be chosen to avoid long
   wakeup times. Else "no" will be chosen.
 
+<code>wakeup</code> selects the poll wakeup source, see the
+\ref pcm_plugins_dmix "dmix plugin".
+
+<code>cache_format</code> enables a conversion cache shared by all
+clients of the same IPC key, for example \c FLOAT_LE or \c S32_LE.
+Clients may then open the PCM in either the slave format or the cache
+format. The captured data is converted to the cache format only once,
+by the first client that needs it, and the other clients in that format
+copy it from the shared memory. The value of the first client opening
+the slave is used by all others. Only the format is converted, the
+rate stays the slave rate. The cache has its own shared memory segment
+whose key replaces the top byte of <code>ipc_key</code> by 0x43.
+
 \subsection pcm_plugins_dsnoop_funcref Function reference
 
 <UL>
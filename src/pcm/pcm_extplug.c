@@ -43,6 +43,18 @@ typedef struct snd_pcm_extplug_priv {
 	snd_pcm_extplug_t *data;
 	struct snd_ext_parm params[SND_PCM_EXTPLUG_HW_PARAMS];
 	struct snd_ext_parm sparams[SND_PCM_EXTPLUG_HW_PARAMS];
+	snd_pcm_fast_ops_t fops;
+	snd_pcm_sframes_t xfer_err;		/* failed transfer, for avail_update */
+	/* block-aligned transfer */
+	snd_pcm_uframes_t block_size;
+	unsigned int block_align;
+	snd_pcm_uframes_t block_pos;
+	snd_pcm_uframes_t block_flushed;	/* frames written out by drain */
+	int block_draining;			/* the padded block is transferred */
+	int block_fed;				/* input since the last reset */
+	void *block_mem;
+	snd_pcm_channel_area_t *block_src;	/* transfer input */
+	snd_pcm_channel_area_t *block_dst;	/* transfer output */
 } extplug_priv_t;
 
 static const int hw_params_type[SND_PCM_EXTPLUG_HW_PARAMS] = {
@@ -286,6 +298,210 @@ static int snd_pcm_extplug_hw_refine(snd_pcm_t *pcm, snd_pcm_hw_params_t *params
 	return err;
 }
 
+/*
+ * block-aligned transfer: the input is accumulated into a block of
+ * block_size frames and the output of the previous block is played
+ * out meanwhile, so the stream is delayed by exactly block_size frames
+ */
+static void snd_pcm_extplug_block_get_format(extplug_priv_t *ext, int src,
+					     snd_pcm_format_t *format,
+					     unsigned int *channels)
+{
+	snd_pcm_extplug_t *data = ext->data;
+
+	if (src == (data->stream == SND_PCM_STREAM_PLAYBACK)) {
+		*format = data->format;
+		*channels = data->channels;
+	} else {
+		*format = data->slave_format;
+		*channels = data->slave_channels;
+	}
+}
+
+static void snd_pcm_extplug_block_free(extplug_priv_t *ext)
+{
+	free(ext->block_mem);
+	free(ext->block_src);
+	ext->block_mem = NULL;
+	ext->block_src = NULL;
+	ext->block_dst = NULL;
+}
+
+static void snd_pcm_extplug_block_reset(extplug_priv_t *ext)
+{
+	snd_pcm_format_t format;
+	unsigned int channels;
+
+	if (!ext->block_mem)
+		return;
+	snd_pcm_extplug_block_get_format(ext, 0, &format, &channels);
+	snd_pcm_areas_silence(ext->block_dst, 0, channels, ext->block_size,
+			      format);
+	ext->block_pos = 0;
+	ext->block_flushed = 0;
+	ext->block_draining = 0;
+	ext->block_fed = 0;
+}
+
+static int snd_pcm_extplug_block_alloc(extplug_priv_t *ext)
+{
+	snd_pcm_format_t sformat, dformat;
+	unsigned int schannels, dchannels, c;
+	size_t sstride, dstride;
+	char *ptr;
+	int err;
+
+	snd_pcm_extplug_block_free(ext);
+	if (!ext->block_size)
+		return 0;
+	snd_pcm_extplug_block_get_format(ext, 1, &sformat, &schannels);
+	snd_pcm_extplug_block_get_format(ext, 0, &dformat, &dchannels);
+	/* one aligned block per channel */
+	sstride = (ext->block_size * snd_pcm_format_physical_width(sformat) + 7) / 8;
+	sstride = (sstride + ext->block_align - 1) & ~((size_t)ext->block_align - 1);
+	dstride = (ext->block_size * snd_pcm_format_physical_width(dformat) + 7) / 8;
+	dstride = (dstride + ext->block_align - 1) & ~((size_t)ext->block_align - 1);
+	err = posix_memalign(&ext->block_mem, ext->block_align,
+			     sstride * schannels + dstride * dchannels);
+	if (err) {
+		ext->block_mem = NULL;
+		return -err;
+	}
+	ext->block_src = malloc((schannels + dchannels) * sizeof(*ext->block_src));
+	if (!ext->block_src) {
+		snd_pcm_extplug_block_free(ext);
+		return -ENOMEM;
+	}
+	ext->block_dst = ext->block_src + schannels;
+	ptr = ext->block_mem;
+	for (c = 0; c < schannels; c++, ptr += sstride) {
+		ext->block_src[c].addr = ptr;
+		ext->block_src[c].first = 0;
+		ext->block_src[c].step = snd_pcm_format_physical_width(sformat);
+	}
+	for (c = 0; c < dchannels; c++, ptr += dstride) {
+		ext->block_dst[c].addr = ptr;
+		ext->block_dst[c].first = 0;
+		ext->block_dst[c].step = snd_pcm_format_physical_width(dformat);
+	}
+	snd_pcm_extplug_block_reset(ext);
+	return 0;
+}
+
+/*
+ * a failed transfer keeps the full block for the next call, so no input
+ * is lost; returns the frames taken before the failure, if any
+ */
+static snd_pcm_sframes_t
+snd_pcm_extplug_block_transfer(extplug_priv_t *ext,
+			       const snd_pcm_channel_area_t *dst_areas,
+			       snd_pcm_uframes_t dst_offset,
+			       const snd_pcm_channel_area_t *src_areas,
+			       snd_pcm_uframes_t src_offset,
+			       snd_pcm_uframes_t size)
+{
+	snd_pcm_format_t sformat, dformat;
+	unsigned int schannels, dchannels;
+	snd_pcm_uframes_t xfer = 0, frames;
+	snd_pcm_sframes_t result;
+
+	snd_pcm_extplug_block_get_format(ext, 1, &sformat, &schannels);
+	snd_pcm_extplug_block_get_format(ext, 0, &dformat, &dchannels);
+	if (size)
+		ext->block_fed = 1;
+	while (xfer < size) {
+		if (ext->block_pos == ext->block_size) {
+			result = ext->data->callback->transfer(ext->data,
+							       ext->block_dst, 0,
+							       ext->block_src, 0,
+							       ext->block_size);
+			if (result < 0)
+				return xfer > 0 ? (snd_pcm_sframes_t)xfer : result;
+			ext->block_pos = 0;
+		}
+		frames = ext->block_size - ext->block_pos;
+		if (frames > size - xfer)
+			frames = size - xfer;
+		snd_pcm_areas_copy(ext->block_src, ext->block_pos,
+				   src_areas, src_offset + xfer,
+				   schannels, frames, sformat);
+		snd_pcm_areas_copy(dst_areas, dst_offset + xfer,
+				   ext->block_dst, ext->block_pos,
+				   dchannels, frames, dformat);
+		ext->block_pos += frames;
+		xfer += frames;
+	}
+	/* hand over a completed block right away */
+	if (ext->block_pos == ext->block_size) {
+		result = ext->data->callback->transfer(ext->data,
+						       ext->block_dst, 0,
+						       ext->block_src, 0,
+						       ext->block_size);
+		if (result >= 0)
+			ext->block_pos = 0;
+	}
+	return size;
+}
+
+/* write block_dst frames to the slave */
+static snd_pcm_sframes_t snd_pcm_extplug_block_write(extplug_priv_t *ext,
+						      snd_pcm_uframes_t offset,
+						      snd_pcm_uframes_t frames)
+{
+	snd_pcm_t *slave = ext->plug.gen.slave;
+	void *bufs[slave->channels];
+	unsigned int c;
+
+	for (c = 0; c < slave->channels; c++)
+		bufs[c] = snd_pcm_channel_area_addr(&ext->block_dst[c], offset);
+	return snd_pcm_mmap_writen(slave, bufs, frames);
+}
+
+/*
+ * write out what is left in the block on drain: the rest of the previous
+ * output, then the output of the pending input padded with silence;
+ * resumed after -EAGAIN
+ */
+static int snd_pcm_extplug_block_flush(extplug_priv_t *ext)
+{
+	snd_pcm_format_t format;
+	unsigned int channels;
+	snd_pcm_sframes_t result;
+
+	while (!ext->block_draining) {
+		snd_pcm_uframes_t ofs = ext->block_pos + ext->block_flushed;
+		if (ofs == ext->block_size) {
+			if (ext->block_pos) {
+				snd_pcm_extplug_block_get_format(ext, 1, &format, &channels);
+				snd_pcm_areas_silence(ext->block_src, ext->block_pos, channels,
+						      ext->block_size - ext->block_pos, format);
+				result = ext->data->callback->transfer(ext->data,
+								       ext->block_dst, 0,
+								       ext->block_src, 0,
+								       ext->block_size);
+				if (result < 0)
+					return result;
+			}
+			ext->block_draining = 1;
+			ext->block_flushed = 0;
+			break;
+		}
+		result = snd_pcm_extplug_block_write(ext, ofs, ext->block_size - ofs);
+		if (result < 0)
+			return result;
+		ext->block_flushed += result;
+	}
+	while (ext->block_flushed < ext->block_pos) {
+		result = snd_pcm_extplug_block_write(ext, ext->block_flushed,
+						     ext->block_pos - ext->block_flushed);
+		if (result < 0)
+			return result;
+		ext->block_flushed += result;
+	}
+	snd_pcm_extplug_block_reset(ext);
+	return 0;
+}
+
 /*
  * hw_params callback
  */
@@ -314,7 +530,7 @@ static int snd_pcm_extplug_hw_params(snd_pcm_t *pcm, snd_pcm_hw_params_t *params
 		if (err < 0)
 			return err;
 	}
-	return 0;
+	return snd_pcm_extplug_block_alloc(ext);
 }
 
 /*
@@ -325,6 +541,7 @@ static int snd_pcm_extplug_hw_free(snd_pcm_t *pcm)
 	extplug_priv_t *ext = pcm->private_data;
 
 	snd_pcm_hw_free(ext->plug.gen.slave);
+	snd_pcm_extplug_block_free(ext);
 	if (ext->data->callback->hw_free)
 		return ext->data->callback->hw_free(ext->data);
 	return 0;
@@ -343,13 +560,22 @@ snd_pcm_extplug_write_areas(snd_pcm_t *pcm,
 			    snd_pcm_uframes_t *slave_sizep)
 {
 	extplug_priv_t *ext = pcm->private_data;
+	snd_pcm_sframes_t result;
 
 	if (size > *slave_sizep)
 		size = *slave_sizep;
-	size = ext->data->callback->transfer(ext->data, slave_areas, slave_offset,
-					     areas, offset, size);
-	*slave_sizep = size;
-	return size;
+	if (ext->block_mem)
+		result = snd_pcm_extplug_block_transfer(ext, slave_areas, slave_offset,
+							areas, offset, size);
+	else
+		result = ext->data->callback->transfer(ext->data, slave_areas, slave_offset,
+						       areas, offset, size);
+	if (result < 0) {
+		ext->xfer_err = result;
+		result = 0;
+	}
+	*slave_sizep = result;
+	return result;
 }
 
 /*
@@ -365,13 +591,22 @@ snd_pcm_extplug_read_areas(snd_pcm_t *pcm,
 			   snd_pcm_uframes_t *slave_sizep)
 {
 	extplug_priv_t *ext = pcm->private_data;
+	snd_pcm_sframes_t result;
 
 	if (size > *slave_sizep)
 		size = *slave_sizep;
-	size = ext->data->callback->transfer(ext->data, areas, offset,
-					     slave_areas, slave_offset, size);
-	*slave_sizep = size;
-	return size;
+	if (ext->block_mem)
+		result = snd_pcm_extplug_block_transfer(ext, areas, offset,
+							slave_areas, slave_offset, size);
+	else
+		result = ext->data->callback->transfer(ext->data, areas, offset,
+						       slave_areas, slave_offset, size);
+	if (result < 0) {
+		ext->xfer_err = result;
+		result = 0;
+	}
+	*slave_sizep = result;
+	return result;
 }
 
 /*
@@ -380,7 +615,114 @@ snd_pcm_extplug_read_areas(snd_pcm_t *pcm,
 static int snd_pcm_extplug_init(snd_pcm_t *pcm)
 {
 	extplug_priv_t *ext = pcm->private_data;
-	return ext->data->callback->init(ext->data);
+
+	snd_pcm_extplug_block_reset(ext);
+	ext->xfer_err = 0;
+	if (ext->data->version >= 0x010001 && ext->data->callback->init)
+		return ext->data->callback->init(ext->data);
+	return 0;
+}
+
+/*
+ * report a transfer failure; the plugin ops can only pass frame counts
+ */
+static snd_pcm_sframes_t snd_pcm_extplug_avail_update(snd_pcm_t *pcm)
+{
+	extplug_priv_t *ext = pcm->private_data;
+	snd_pcm_sframes_t avail;
+
+	avail = snd_pcm_plugin_fast_ops.avail_update(pcm);
+	if (ext->xfer_err < 0) {
+		avail = ext->xfer_err;
+		ext->xfer_err = 0;
+	}
+	return avail;
+}
+
+/*
+ * the block-aligned transfer adds block_size frames of latency
+ */
+static int snd_pcm_extplug_delay(snd_pcm_t *pcm, snd_pcm_sframes_t *delayp)
+{
+	extplug_priv_t *ext = pcm->private_data;
+	int err;
+
+	err = snd_pcm_plugin_fast_ops.delay(pcm, delayp);
+	if (err >= 0 && ext->block_mem)
+		*delayp += ext->block_size;
+	return err;
+}
+
+static int snd_pcm_extplug_status(snd_pcm_t *pcm, snd_pcm_status_t *status)
+{
+	extplug_priv_t *ext = pcm->private_data;
+	int err;
+
+	err = snd_pcm_plugin_fast_ops.status(pcm, status);
+	if (err >= 0 && ext->block_mem)
+		status->delay += ext->block_size;
+	return err;
+}
+
+/*
+ * play out the accumulated block before the slave drains
+ */
+static int snd_pcm_extplug_drain(snd_pcm_t *pcm)
+{
+	extplug_priv_t *ext = pcm->private_data;
+	int err = 0;
+
+	if (ext->block_mem && ext->block_fed &&
+	    pcm->stream == SND_PCM_STREAM_PLAYBACK) {
+		__snd_pcm_lock(pcm);
+		err = snd_pcm_extplug_block_flush(ext);
+		__snd_pcm_unlock(pcm);
+		if (err < 0)
+			return err;
+	}
+	return snd_pcm_drain(ext->plug.gen.slave);
+}
+
+/*
+ * the accumulated block can't be taken back
+ */
+static snd_pcm_sframes_t snd_pcm_extplug_rewindable(snd_pcm_t *pcm)
+{
+	extplug_priv_t *ext = pcm->private_data;
+
+	if (ext->block_mem)
+		return 0;
+	return snd_pcm_plugin_fast_ops.rewindable(pcm);
+}
+
+static snd_pcm_sframes_t snd_pcm_extplug_rewind(snd_pcm_t *pcm, snd_pcm_uframes_t frames)
+{
+	extplug_priv_t *ext = pcm->private_data;
+
+	if (ext->block_mem)
+		return 0;
+	return snd_pcm_plugin_rewind(pcm, frames);
+}
+
+/*
+ * skipped frames would bypass the block and shift its phase
+ */
+static snd_pcm_sframes_t snd_pcm_extplug_forwardable(snd_pcm_t *pcm)
+{
+	extplug_priv_t *ext = pcm->private_data;
+
+	if (ext->block_mem)
+		return 0;
+	return snd_pcm_plugin_fast_ops.forwardable(pcm);
+}
+
+static snd_pcm_sframes_t snd_pcm_extplug_forward(snd_pcm_t *pcm, snd_pcm_uframes_t frames)
+{
+	extplug_priv_t *ext = pcm->private_data;
+
+	if (ext->block_mem)
+		return 0;
+	return snd_pcm_plugin_forward(pcm, frames);
 }
 
 /*
@@ -397,6 +739,9 @@ static void snd_pcm_extplug_dump(snd_pcm_t *pcm, snd_output_t *out)
 			snd_output_printf(out, "%s\n", ext->data->name);
 		else
 			snd_output_printf(out, "External PCM Plugin\n");
+		if (ext->block_size)
+			snd_output_printf(out, "Block size: %lu frames (align %u)\n",
+					  ext->block_size, ext->block_align);
 		if (pcm->setup) {
 			snd_output_printf(out, "Its setup is:\n");
 			snd_pcm_dump_setup(pcm, out);
@@ -421,6 +766,7 @@ static int snd_pcm_extplug_close(snd_pcm_t *pcm)
 
 	snd_pcm_close(ext->plug.gen.slave);
 	clear_ext_params(ext);
+	snd_pcm_extplug_block_free(ext);
 	if (ext->data->callback->close)
 		ext->data->callback->close(ext->data);
 	free(ext);
@@ -624,6 +970,21 @@ The init callback is called when the PCM is at prepare state or any
 initialization is issued.  Use this callback to reset the PCM instance
 to a sane initial state.
 
+By default, the transfer callback receives whatever fragment the
+application or the slave provides, which may be arbitrarily small.
+Plugins working on fixed blocks (e.g. FFT based filters) can call
+#snd_pcm_extplug_set_block() to get the transfer callback invoked
+only with full blocks of the given size, at offset zero of buffers
+with the requested memory alignment.  The input is accumulated
+internally, so the stream is delayed by one block, which is included
+in the delay reported by #snd_pcm_delay() and #snd_pcm_status().
+The block may span several periods.  On #snd_pcm_drain() of a
+playback stream, the last partial block is padded with silence and
+played out.  Rewinding and forwarding are not possible in this mode.
+When the transfer callback fails on a block, the block is kept and
+passed again with the next transfer, and the error is returned by the
+next #snd_pcm_avail_update().
+
 The hw_params constraints can be defined via either
 #snd_pcm_extplug_set_param_minmax() and #snd_pcm_extplug_set_param_list()
 functions after calling #snd_pcm_extplug_create().
@@ -718,8 +1079,16 @@ int snd_pcm_extplug_create(snd_pcm_extplug_t *extplug, const char *name,
 	ext->plug.undo_write = snd_pcm_plugin_undo_write_generic;
 	ext->plug.gen.slave = spcm;
 	ext->plug.gen.close_slave = 1;
-	if (extplug->version >= 0x010001 && extplug->callback->init)
-		ext->plug.init = snd_pcm_extplug_init;
+	ext->plug.init = snd_pcm_extplug_init;
+	ext->fops = snd_pcm_plugin_fast_ops;
+	ext->fops.status = snd_pcm_extplug_status;
+	ext->fops.delay = snd_pcm_extplug_delay;
+	ext->fops.drain = snd_pcm_extplug_drain;
+	ext->fops.rewindable = snd_pcm_extplug_rewindable;
+	ext->fops.rewind = snd_pcm_extplug_rewind;
+	ext->fops.forwardable = snd_pcm_extplug_forwardable;
+	ext->fops.forward = snd_pcm_extplug_forward;
+	ext->fops.avail_update = snd_pcm_extplug_avail_update;
 
 	err = snd_pcm_new(&pcm, SND_PCM_TYPE_EXTPLUG, name, stream, mode);
 	if (err < 0) {
@@ -729,7 +1098,7 @@ int snd_pcm_extplug_create(snd_pcm_extplug_t *extplug, const char *name,
 
 	extplug->pcm = pcm;
 	pcm->ops = &snd_pcm_extplug_ops;
-	pcm->fast_ops = &snd_pcm_plugin_fast_ops;
+	pcm->fast_ops = &ext->fops;
 	pcm->private_data = ext;
 	pcm->poll_fd = spcm->poll_fd;
 	pcm->poll_events = spcm->poll_events;
@@ -862,6 +1231,37 @@ int snd_pcm_extplug_set_param_minmax(snd_pcm_extplug_t *extplug, int type, unsig
 	return snd_ext_parm_set_minmax(&ext->params[type], min, max);
 }
 
+/**
+ * \brief Set the block size for block-aligned transfers
+ * \param extplug the extplug handle
+ * \param block_size the number of frames per transfer, or 0 to disable
+ * \param align the memory alignment of the transfer buffers in bytes,
+ *              a power of two, or 0 for the default
+ * \return 0 if successful, or a negative error code
+ *
+ * When set, the transfer callback is called only with full blocks of
+ * block_size frames, at the cost of block_size frames of latency.
+ * Call this function before the hw_params are set, or from the
+ * hw_params callback.
+ */
+int snd_pcm_extplug_set_block(snd_pcm_extplug_t *extplug,
+			      snd_pcm_uframes_t block_size, unsigned int align)
+{
+	extplug_priv_t *ext = extplug->pcm->private_data;
+
+	if (align < sizeof(void *))
+		align = sizeof(void *);
+	if (align & (align - 1)) {
+		snd_error(PCM, "EXTPLUG: invalid block alignment %u", align);
+		return -EINVAL;
+	}
+	if (extplug->pcm->setup)
+		return -EBUSY;
+	ext->block_size = block_size;
+	ext->block_align = align;
+	return 0;
+}
+
 /**
  * @brief Keep the client and slave format/channels the same if requested. This
  * is for example useful if this extplug does not support any channel
@@ -29,8 +29,14 @@
 #include "pcm_local.h"
 #include "pcm_plugin.h"
 #include "bswap.h"
+#include "pcm_file_flac.h"
 #include <ctype.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#endif
 
 #ifndef PIC
 /* entry for static linking */
@@ -45,15 +51,31 @@ const char *_snd_module_pcm_file = "";
 #define CHANNELS_KEY	'c'
 #define BWIDTH_KEY	'b'
 #define FORMAT_KEY	'f'
+#define INDEX_KEY	'i'
+#define TIME_KEY	't'
 
 /* maximum length of a value */
 #define VALUE_MAXLEN	64
 
+/* alignment of the asynchronous writer ring */
+#define RING_ALIGN	4096
+
+/* how far ahead of a mapped input file the pages are requested */
+#define IFMAP_READAHEAD	(1024 * 1024)
+
 typedef enum _snd_pcm_file_format {
 	SND_PCM_FILE_FORMAT_RAW,
-	SND_PCM_FILE_FORMAT_WAV
+	SND_PCM_FILE_FORMAT_WAV,
+	SND_PCM_FILE_FORMAT_RF64,
+	SND_PCM_FILE_FORMAT_W64,
+	SND_PCM_FILE_FORMAT_FLAC
 } snd_pcm_file_format_t;
 
+/* header sizes, the data chunk starts right after them */
+#define WAV_HEADER_SIZE		44
+#define RF64_HEADER_SIZE	80
+#define W64_HEADER_SIZE		104
+
 /* WAV format chunk */
 struct wav_fmt {
 	short fmt;
@@ -74,6 +96,11 @@ typedef struct {
 	FILE *pipe;
 	char *ifname;
 	int ifd;
+	char *ifmap;			/* mapped input file or NULL */
+	size_t ifmap_size;
+	size_t ifmap_pos;
+	size_t ifmap_advised;		/* end of the WILLNEED range */
+	size_t ifmap_page;		/* page size, madvise() alignment */
 	int format;
 	snd_pcm_uframes_t appl_ptr;
 	snd_pcm_uframes_t file_ptr_bytes;
@@ -88,14 +115,45 @@ typedef struct {
 	snd_pcm_channel_area_t *wbuf_areas;
 	size_t buffer_bytes;
 	struct wav_fmt wav_header;
-	size_t filelen;
+	int header_written;
+	uint64_t filelen;		/* audio data bytes in the current file */
 	char ifmmap_overwritten;
+	/* file rotation */
+	long long rotate_size;		/* bytes per file, 0 = unlimited */
+	long rotate_time;		/* seconds per file, 0 = unlimited */
+	uint64_t rotate_bytes;		/* the resulting limit of filelen */
+	unsigned int index;		/* file number for the %i key */
+	time_t name_time;		/* last time used for the %t key */
+	unsigned int name_seq;		/* files created within name_time */
+	struct flac_enc flac;
+	/* asynchronous writer */
+	int async;			/* write from a separate thread */
+	int async_block;		/* wait for space instead of dropping */
+	snd_pcm_uframes_t async_size;	/* ring size in frames, 0 = default */
+	char *ring;
+	size_t ring_bytes;
+	size_t ring_head;		/* bytes queued, moved by the audio thread */
+	size_t ring_tail;		/* bytes written, moved by the writer */
+	size_t dropped_bytes;
+	int writer_idle;		/* writer waits for data */
+	int producer_waiting;		/* audio thread waits for space */
+	int writer_stop;
+	int writer_err;
+#ifdef HAVE_LIBPTHREAD
+	int writer_started;
+	pthread_t writer;
+	pthread_mutex_t writer_mutex;
+	pthread_cond_t data_cond;
+	pthread_cond_t space_cond;
+#endif
 } snd_pcm_file_t;
 
 #if __BYTE_ORDER == __LITTLE_ENDIAN
+#define TO_LE64(x)	(x)
 #define TO_LE32(x)	(x)
 #define TO_LE16(x)	(x)
 #else
+#define TO_LE64(x)	bswap_64(x)
 #define TO_LE32(x)	bswap_32(x)
 #define TO_LE16(x)	bswap_16(x)
 #endif
@@ -150,6 +208,7 @@ static int snd_pcm_file_replace_fname(snd_pcm_file_t *file, char **new_fname_p)
 	char *new_fname = NULL;
 	char *old_last_ch, *old_index_ch, *new_index_ch;
 	int old_len, new_len, err;
+	int time_done = 0;
 
 	snd_pcm_t *pcm = file->gen.slave;
 
@@ -204,6 +263,41 @@ static int snd_pcm_file_replace_fname(snd_pcm_file_t *file, char **new_fname_p)
 					return err;
 				break;
 
+			case INDEX_KEY:
+				snprintf(value, sizeof(value), "%u",
+						file->index);
+				err = snd_pcm_file_append_value(&new_fname,
+					&new_index_ch, &new_len, value);
+				if (err < 0)
+					return err;
+				break;
+
+			case TIME_KEY: {
+				time_t now = time(NULL);
+				struct tm tm;
+				size_t len;
+				/* rotated files may follow within a second */
+				if (!time_done) {
+					if (now == file->name_time)
+						file->name_seq++;
+					else
+						file->name_seq = 0;
+					file->name_time = now;
+					time_done = 1;
+				}
+				localtime_r(&file->name_time, &tm);
+				len = strftime(value, sizeof(value),
+						"%Y%m%d-%H%M%S", &tm);
+				if (file->name_seq)
+					snprintf(value + len, sizeof(value) - len,
+						 "-%u", file->name_seq);
+				err = snd_pcm_file_append_value(&new_fname,
+					&new_index_ch, &new_len, value);
+				if (err < 0)
+					return err;
+				break;
+			}
+
 			default:
 				/* non-key char, just copying */
 				*(new_index_ch++) = *(old_index_ch);
@@ -288,6 +382,67 @@ static int snd_pcm_file_open_output_file(snd_pcm_file_t *file)
 	return 0;
 }
 
+/* map the regular input file, the read() path stays for anything else */
+static void snd_pcm_file_map_infile(snd_pcm_file_t *file)
+{
+	struct stat st;
+	off_t pos;
+	void *map;
+
+	if (fstat(file->ifd, &st) < 0 || !S_ISREG(st.st_mode) ||
+	    st.st_size <= 0 || (uint64_t)st.st_size > SIZE_MAX)
+		return;
+	pos = lseek(file->ifd, 0, SEEK_CUR);
+	if (pos < 0)
+		pos = 0;
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, file->ifd, 0);
+	if (map == MAP_FAILED) {
+		snd_checknum(PCM, "cannot map %s, using read()", file->ifname);
+		return;
+	}
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+#ifdef POSIX_FADV_SEQUENTIAL
+	posix_fadvise(file->ifd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+	file->ifmap = map;
+	file->ifmap_size = st.st_size;
+	file->ifmap_page = page_size();
+	file->ifmap_pos = file->ifmap_advised = pos < st.st_size ? pos : st.st_size;
+}
+
+/* the mapped file is the source area itself, no read() into rbuf */
+static int snd_pcm_file_areas_read_ifmap(snd_pcm_t *pcm,
+					 const snd_pcm_channel_area_t *areas,
+					 snd_pcm_uframes_t offset,
+					 snd_pcm_uframes_t frames)
+{
+	snd_pcm_file_t *file = pcm->private_data;
+	snd_pcm_channel_area_t areas_if[pcm->channels];
+	snd_pcm_uframes_t avail;
+	ssize_t bytes;
+
+	avail = snd_pcm_bytes_to_frames(pcm, file->ifmap_size - file->ifmap_pos);
+	if (frames > avail)
+		frames = avail;
+	if (!frames)
+		return 0;
+	bytes = snd_pcm_frames_to_bytes(pcm, frames);
+	if (file->ifmap_pos + bytes > file->ifmap_advised &&
+	    file->ifmap_advised < file->ifmap_size) {
+		/* ask for the next window before it is needed */
+		size_t page = file->ifmap_pos & ~(file->ifmap_page - 1);
+		size_t end = file->ifmap_pos + bytes + IFMAP_READAHEAD;
+		if (end > file->ifmap_size)
+			end = file->ifmap_size;
+		madvise(file->ifmap + page, end - page, MADV_WILLNEED);
+		file->ifmap_advised = end;
+	}
+	snd_pcm_areas_from_buf(pcm, areas_if, file->ifmap + file->ifmap_pos);
+	snd_pcm_areas_copy(areas, offset, areas_if, 0, pcm->channels, frames, pcm->format);
+	file->ifmap_pos += bytes;
+	return bytes;
+}
+
 /* fill areas with data from input file, return bytes red */
 static int snd_pcm_file_areas_read_infile(snd_pcm_t *pcm,
 					  const snd_pcm_channel_area_t *areas,
@@ -298,6 +453,9 @@ static int snd_pcm_file_areas_read_infile(snd_pcm_t *pcm,
 	snd_pcm_channel_area_t areas_if[pcm->channels];
 	ssize_t bytes;
 
+	if (file->ifmap)
+		return snd_pcm_file_areas_read_ifmap(pcm, areas, offset, frames);
+
 	if (file->ifd < 0)
 		return -EBADF;
 
@@ -337,40 +495,15 @@ static void setup_wav_header(snd_pcm_t *pcm, struct wav_fmt *fmt)
 	fmt->bits = TO_LE16(fmt->bits);
 }
 
-static int write_wav_header(snd_pcm_t *pcm)
+static int write_header(snd_pcm_t *pcm, const void *header, size_t size)
 {
 	snd_pcm_file_t *file = pcm->private_data;
 	ssize_t res;
 
-	static const char header[] = {
-		'R', 'I', 'F', 'F',
-		0x24, 0, 0, 0,
-		'W', 'A', 'V', 'E',
-		'f', 'm', 't', ' ',
-		0x10, 0, 0, 0,
-	};
-	static const char header2[] = {
-		'd', 'a', 't', 'a',
-		0, 0, 0, 0
-	};
-
-	setup_wav_header(pcm, &file->wav_header);
-
-	res = safe_write(file->fd, header, sizeof(header));
-	if (res != sizeof(header))
-		goto write_error;
-
-	res = safe_write(file->fd, &file->wav_header, sizeof(file->wav_header));
-	if (res != sizeof(file->wav_header))
-		goto write_error;
-
-	res = safe_write(file->fd, header2, sizeof(header2));
-	if (res != sizeof(header2))
-		goto write_error;
+	res = safe_write(file->fd, header, size);
+	if (res == (ssize_t)size)
+		return 0;
 
-	return 0;
-
-write_error:
 	/*
 	 * print real errno if available and return EIO, reason for this is
 	 * to block possible EPIPE in case file->fd is a pipe. EPIPE from
@@ -387,6 +520,85 @@ write_error:
 	return -EIO;
 }
 
+static int write_wav_header(snd_pcm_t *pcm)
+{
+	snd_pcm_file_t *file = pcm->private_data;
+	char header[WAV_HEADER_SIZE] = {
+		'R', 'I', 'F', 'F',
+		0x24, 0, 0, 0,
+		'W', 'A', 'V', 'E',
+		'f', 'm', 't', ' ',
+		0x10, 0, 0, 0,
+	};
+
+	setup_wav_header(pcm, &file->wav_header);
+	memcpy(header + 20, &file->wav_header, sizeof(file->wav_header));
+	memcpy(header + 36, "data", 4);
+	return write_header(pcm, header, sizeof(header));
+}
+
+/*
+ * RF64 (EBU Tech 3306) starts as a plain WAV file with a JUNK chunk
+ * reserving the room for the ds64 chunk, which replaces it only when
+ * the file grows over 4 GiB.
+ */
+static int write_rf64_header(snd_pcm_t *pcm)
+{
+	snd_pcm_file_t *file = pcm->private_data;
+	char header[RF64_HEADER_SIZE] = {
+		'R', 'I', 'F', 'F',
+		0x48, 0, 0, 0,
+		'W', 'A', 'V', 'E',
+		'J', 'U', 'N', 'K',
+		0x1c, 0, 0, 0,
+	};
+
+	setup_wav_header(pcm, &file->wav_header);
+	memcpy(header + 48, "fmt \x10\0\0\0", 8);
+	memcpy(header + 56, &file->wav_header, sizeof(file->wav_header));
+	memcpy(header + 72, "data", 4);
+	return write_header(pcm, header, sizeof(header));
+}
+
+/* Sony Wave64: GUID chunk ids and 64-bit sizes */
+static const unsigned char w64_riff[16] = {
+	'r', 'i', 'f', 'f', 0x2e, 0x91, 0xcf, 0x11,
+	0xa5, 0xd6, 0x28, 0xdb, 0x04, 0xc1, 0x00, 0x00
+};
+static const unsigned char w64_wave[16] = {
+	'w', 'a', 'v', 'e', 0xf3, 0xac, 0xd3, 0x11,
+	0x8c, 0xd1, 0x00, 0xc0, 0x4f, 0x8e, 0xdb, 0x8a
+};
+static const unsigned char w64_fmt[16] = {
+	'f', 'm', 't', ' ', 0xf3, 0xac, 0xd3, 0x11,
+	0x8c, 0xd1, 0x00, 0xc0, 0x4f, 0x8e, 0xdb, 0x8a
+};
+static const unsigned char w64_data[16] = {
+	'd', 'a', 't', 'a', 0xf3, 0xac, 0xd3, 0x11,
+	0x8c, 0xd1, 0x00, 0xc0, 0x4f, 0x8e, 0xdb, 0x8a
+};
+
+static int write_w64_header(snd_pcm_t *pcm)
+{
+	snd_pcm_file_t *file = pcm->private_data;
+	char header[W64_HEADER_SIZE];
+	uint64_t size;
+
+	setup_wav_header(pcm, &file->wav_header);
+	memcpy(header, w64_riff, 16);
+	size = TO_LE64(W64_HEADER_SIZE);
+	memcpy(header + 16, &size, 8);
+	memcpy(header + 24, w64_wave, 16);
+	memcpy(header + 40, w64_fmt, 16);
+	size = TO_LE64(24 + sizeof(file->wav_header));
+	memcpy(header + 56, &size, 8);
+	memcpy(header + 64, &file->wav_header, sizeof(file->wav_header));
+	memcpy(header + 80, w64_data, 16);
+	size = TO_LE64(24);
+	memcpy(header + 96, &size, 8);
+	return write_header(pcm, header, sizeof(header));
+}
+
 /* fix up the length fields in WAV header */
 static void fixup_wav_header(snd_pcm_t *pcm)
 {
@@ -412,10 +624,500 @@ static void fixup_wav_header(snd_pcm_t *pcm)
 			return;
 	}
 }
+
+static void pwrite_le32(int fd, off_t ofs, uint32_t val)
+{
+	val = TO_LE32(val);
+	if (lseek(fd, ofs, SEEK_SET) == ofs)
+		safe_write(fd, &val, 4);
+}
+
+static void pwrite_le64(int fd, off_t ofs, uint64_t val)
+{
+	val = TO_LE64(val);
+	if (lseek(fd, ofs, SEEK_SET) == ofs)
+		safe_write(fd, &val, 8);
+}
+
+/* fix up the sizes, switching to RF64 for more than 4 GiB */
+static void fixup_rf64_header(snd_pcm_t *pcm)
+{
+	snd_pcm_file_t *file = pcm->private_data;
+	uint64_t riff = file->filelen + RF64_HEADER_SIZE - 8;
+	char ds64[48];
+
+	if (riff <= 0xffffffffULL && file->filelen <= 0xffffffffULL) {
+		pwrite_le32(file->fd, 4, riff);
+		pwrite_le32(file->fd, RF64_HEADER_SIZE - 4, file->filelen);
+		return;
+	}
+	memcpy(ds64, "RF64\xff\xff\xff\xffWAVEds64\x1c\0\0\0", 20);
+	riff = TO_LE64(riff);
+	memcpy(ds64 + 20, &riff, 8);
+	memset(ds64 + 28, 0, 20);
+	if (lseek(file->fd, 0, SEEK_SET) != 0 ||
+	    safe_write(file->fd, ds64, sizeof(ds64)) != sizeof(ds64))
+		return;
+	pwrite_le64(file->fd, 28, file->filelen);
+	pwrite_le64(file->fd, 36, file->filelen * 8 / pcm->frame_bits);
+	pwrite_le32(file->fd, RF64_HEADER_SIZE - 4, 0xffffffff);
+}
+
+static void fixup_w64_header(snd_pcm_t *pcm)
+{
+	snd_pcm_file_t *file = pcm->private_data;
+
+	pwrite_le64(file->fd, 16, W64_HEADER_SIZE + file->filelen);
+	pwrite_le64(file->fd, W64_HEADER_SIZE - 8, 24 + file->filelen);
+}
+
+static int write_flac_header(snd_pcm_t *pcm)
+{
+	snd_pcm_file_t *file = pcm->private_data;
+	uint8_t header[8 + FLAC_STREAMINFO_SIZE] = {
+		'f', 'L', 'a', 'C',
+		0x80, 0, 0, FLAC_STREAMINFO_SIZE,	/* last block, STREAMINFO */
+	};
+	int err;
+
+	err = snd_pcm_flac_enc_init(&file->flac, pcm);
+	if (err < 0)
+		return err;
+	snd_pcm_flac_streaminfo(&file->flac, header + 8);
+	err = write_header(pcm, header, sizeof(header));
+	if (err < 0)
+		snd_pcm_flac_enc_free(&file->flac);
+	return err;
+}
+
+static int flac_write_frame(snd_pcm_t *pcm, unsigned int frames)
+{
+	snd_pcm_file_t *file = pcm->private_data;
+	size_t size = snd_pcm_flac_encode_frame(&file->flac, frames);
+	const uint8_t *buf = file->flac.out;
+	ssize_t res;
+
+	while (size > 0) {
+		res = safe_write(file->fd, buf, size);
+		if (res < 0)
+			return res;
+		buf += res;
+		size -= res;
+	}
+	return 0;
+}
+
+/* collect the data to whole blocks and encode them */
+static ssize_t flac_feed(snd_pcm_t *pcm, const char *buf, size_t n)
+{
+	struct flac_enc *enc = &((snd_pcm_file_t *)pcm->private_data)->flac;
+	size_t block = enc->frame_bytes * FLAC_BLOCKSIZE;
+	size_t done = 0;
+	int err;
+
+	while (done < n) {
+		size_t len = n - done;
+		if (len > block - enc->pcm_used)
+			len = block - enc->pcm_used;
+		memcpy(enc->pcm + enc->pcm_used, buf + done, len);
+		enc->pcm_used += len;
+		done += len;
+		if (enc->pcm_used == block) {
+			enc->pcm_used = 0;
+			err = flac_write_frame(pcm, FLAC_BLOCKSIZE);
+			if (err < 0)
+				return err;
+		}
+	}
+	return done;
+}
+
+/* encode the last partial block and store the final STREAMINFO */
+static void fixup_flac_header(snd_pcm_t *pcm, int seekable)
+{
+	snd_pcm_file_t *file = pcm->private_data;
+	struct flac_enc *enc = &file->flac;
+	uint8_t info[FLAC_STREAMINFO_SIZE];
+
+	if (enc->pcm_used >= enc->frame_bytes &&
+	    flac_write_frame(pcm, enc->pcm_used / enc->frame_bytes) < 0)
+		seekable = 0;
+	snd_pcm_flac_streaminfo(enc, info);
+	if (seekable && lseek(file->fd, 8, SEEK_SET) == 8)
+		safe_write(file->fd, info, sizeof(info));
+	snd_pcm_flac_enc_free(enc);
+}
+
+/* write the header of the current output file */
+static int snd_pcm_file_write_header(snd_pcm_t *pcm)
+{
+	snd_pcm_file_t *file = pcm->private_data;
+	int err = 0;
+
+	switch (file->format) {
+	case SND_PCM_FILE_FORMAT_WAV:
+		err = write_wav_header(pcm);
+		break;
+	case SND_PCM_FILE_FORMAT_RF64:
+		err = write_rf64_header(pcm);
+		break;
+	case SND_PCM_FILE_FORMAT_W64:
+		err = write_w64_header(pcm);
+		break;
+	case SND_PCM_FILE_FORMAT_FLAC:
+		err = write_flac_header(pcm);
+		break;
+	}
+	if (err >= 0)
+		file->header_written = 1;
+	return err;
+}
+
+/* complete the current output file, seekable says the header can be rewritten */
+static void snd_pcm_file_finish(snd_pcm_t *pcm, int seekable)
+{
+	snd_pcm_file_t *file = pcm->private_data;
+
+	if (!file->header_written)
+		return;
+	switch (file->format) {
+	case SND_PCM_FILE_FORMAT_WAV:
+		if (seekable)
+			fixup_wav_header(pcm);
+		break;
+	case SND_PCM_FILE_FORMAT_RF64:
+		if (seekable)
+			fixup_rf64_header(pcm);
+		break;
+	case SND_PCM_FILE_FORMAT_W64:
+		if (seekable)
+			fixup_w64_header(pcm);
+		break;
+	case SND_PCM_FILE_FORMAT_FLAC:
+		fixup_flac_header(pcm, seekable);
+		break;
+	}
+	file->header_written = 0;
+}
+
+static void snd_pcm_file_close_output_file(snd_pcm_file_t *file)
+{
+	if (file->pipe)
+		pclose(file->pipe);
+	else if (file->fd >= 0)
+		close(file->fd);
+	file->pipe = NULL;
+	file->fd = -1;
+}
+
+/* the writer thread replaces fd and final_fname when it rotates the files */
+static void snd_pcm_file_lock_output(snd_pcm_file_t *file)
+{
+#ifdef HAVE_LIBPTHREAD
+	if (file->writer_started)
+		pthread_mutex_lock(&file->writer_mutex);
+#endif
+}
+
+static void snd_pcm_file_unlock_output(snd_pcm_file_t *file)
+{
+#ifdef HAVE_LIBPTHREAD
+	if (file->writer_started)
+		pthread_mutex_unlock(&file->writer_mutex);
+#endif
+}
+
+/* continue in the next file */
+static int snd_pcm_file_rotate(snd_pcm_t *pcm)
+{
+	snd_pcm_file_t *file = pcm->private_data;
+	int err;
+
+	snd_pcm_file_finish(pcm, 1);
+	snd_pcm_file_lock_output(file);
+	snd_pcm_file_close_output_file(file);
+	free(file->final_fname);
+	file->final_fname = NULL;
+	file->filelen = 0;
+	file->index++;
+	err = snd_pcm_file_open_output_file(file);
+	snd_pcm_file_unlock_output(file);
+	if (err < 0)
+		snd_error(PCM, "cannot open the next output file for %s: %s",
+			  file->fname, snd_strerror(err));
+	return err;
+}
+
+/* write audio data to the output, return the number of bytes consumed */
+static ssize_t snd_pcm_file_output(snd_pcm_t *pcm, const char *buf, size_t bytes)
+{
+	snd_pcm_file_t *file = pcm->private_data;
+	size_t done = 0;
+	ssize_t res;
+
+	while (done < bytes) {
+		size_t n = bytes - done;
+		if (file->rotate_bytes) {
+			if (file->filelen >= file->rotate_bytes) {
+				res = snd_pcm_file_rotate(pcm);
+				if (res < 0)
+					return res;
+			}
+			if (n > file->rotate_bytes - file->filelen)
+				n = file->rotate_bytes - file->filelen;
+		}
+		if (!file->header_written) {
+			res = snd_pcm_file_write_header(pcm);
+			if (res < 0)
+				return res;
+		}
+		if (file->format == SND_PCM_FILE_FORMAT_FLAC)
+			res = flac_feed(pcm, buf + done, n);
+		else
+			res = safe_write(file->fd, buf + done, n);
+		if (res < 0) {
+			snd_errornum(PCM, "%s write failed, file data may be corrupt", file->fname);
+			return res;
+		}
+		done += res;
+		file->filelen += res;
+		if ((size_t)res != n)
+			break;
+	}
+	return done;
+}
 #endif /* DOC_HIDDEN */
 
 
 
+#ifdef HAVE_LIBPTHREAD
+/*
+ * Asynchronous writer
+ *
+ * The audio thread copies the data leaving wbuf to a single producer,
+ * single consumer ring and a separate thread writes it to the file, so
+ * a slow disk, NFS or a stalled pipe reader never blocks the stream.
+ * The positions are free running byte counters; the mutex is taken only
+ * to sleep and to wake up a sleeping side.
+ */
+
+static size_t ring_used(snd_pcm_file_t *file)
+{
+	return __atomic_load_n(&file->ring_head, __ATOMIC_ACQUIRE) -
+	       __atomic_load_n(&file->ring_tail, __ATOMIC_ACQUIRE);
+}
+
+static void *snd_pcm_file_writer(void *data)
+{
+	snd_pcm_t *pcm = data;
+	snd_pcm_file_t *file = pcm->private_data;
+	size_t tail = file->ring_tail;
+
+	for (;;) {
+		int stop = __atomic_load_n(&file->writer_stop, __ATOMIC_ACQUIRE);
+		size_t head = __atomic_load_n(&file->ring_head, __ATOMIC_ACQUIRE);
+		size_t ofs, n;
+		ssize_t res;
+
+		if (head == tail) {
+			if (stop)
+				break;
+			pthread_mutex_lock(&file->writer_mutex);
+			__atomic_store_n(&file->writer_idle, 1, __ATOMIC_SEQ_CST);
+			while (__atomic_load_n(&file->ring_head, __ATOMIC_SEQ_CST) == tail &&
+			       !__atomic_load_n(&file->writer_stop, __ATOMIC_ACQUIRE))
+				pthread_cond_wait(&file->data_cond, &file->writer_mutex);
+			__atomic_store_n(&file->writer_idle, 0, __ATOMIC_RELAXED);
+			pthread_mutex_unlock(&file->writer_mutex);
+			continue;
+		}
+		ofs = tail % file->ring_bytes;
+		n = head - tail;
+		if (n > file->ring_bytes - ofs)
+			n = file->ring_bytes - ofs;
+		res = n;
+		if (!file->writer_err) {
+			res = snd_pcm_file_output(pcm, file->ring + ofs, n);
+			if (res < 0) {
+				/* discard the rest, the audio thread reports the error */
+				__atomic_store_n(&file->writer_err, (int)res, __ATOMIC_RELEASE);
+				res = n;
+			}
+		}
+		tail += res;
+		__atomic_store_n(&file->ring_tail, tail, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&file->producer_waiting, __ATOMIC_SEQ_CST)) {
+			pthread_mutex_lock(&file->writer_mutex);
+			pthread_cond_broadcast(&file->space_cond);
+			pthread_mutex_unlock(&file->writer_mutex);
+		}
+	}
+	return NULL;
+}
+
+/* wait until the writer has at least min_space bytes free in the ring */
+static void snd_pcm_file_wait_space(snd_pcm_file_t *file, size_t min_space)
+{
+	pthread_mutex_lock(&file->writer_mutex);
+	__atomic_store_n(&file->producer_waiting, 1, __ATOMIC_SEQ_CST);
+	while (file->ring_bytes - ring_used(file) < min_space)
+		pthread_cond_wait(&file->space_cond, &file->writer_mutex);
+	__atomic_store_n(&file->producer_waiting, 0, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&file->writer_mutex);
+}
+
+static void snd_pcm_file_wake_writer(snd_pcm_file_t *file)
+{
+	if (__atomic_load_n(&file->writer_idle, __ATOMIC_SEQ_CST)) {
+		pthread_mutex_lock(&file->writer_mutex);
+		pthread_cond_signal(&file->data_cond);
+		pthread_mutex_unlock(&file->writer_mutex);
+	}
+}
+
+/* move bytes from wbuf to the writer ring, return error code of the writer */
+static int snd_pcm_file_queue_bytes(snd_pcm_t *pcm, size_t bytes)
+{
+	snd_pcm_file_t *file = pcm->private_data;
+	int err = __atomic_load_n(&file->writer_err, __ATOMIC_ACQUIRE);
+
+	if (err < 0) {
+		file->wbuf_used_bytes = 0;
+		file->file_ptr_bytes = 0;
+		return err;
+	}
+	while (bytes > 0) {
+		size_t head = file->ring_head;
+		size_t space = file->ring_bytes - ring_used(file);
+		size_t n = bytes, copy, ofs, cont;
+
+		if (n > file->wbuf_size_bytes - file->file_ptr_bytes)
+			n = file->wbuf_size_bytes - file->file_ptr_bytes;
+		copy = n;
+		if (copy > space && file->async_block) {
+			if (!space) {
+				snd_pcm_file_wake_writer(file);
+				snd_pcm_file_wait_space(file, 1);
+				continue;
+			}
+			/* the rest goes in the next round */
+			n = copy = space;
+		} else if (copy > space) {
+			/* keep whole frames, drop the rest */
+			copy = snd_pcm_frames_to_bytes(pcm,
+					snd_pcm_bytes_to_frames(pcm, space));
+			if (!file->dropped_bytes)
+				snd_check(PCM, "%s: writer too slow, dropping data",
+					  file->fname ? file->fname : "file");
+			file->dropped_bytes += n - copy;
+		}
+		ofs = head % file->ring_bytes;
+		cont = file->ring_bytes - ofs;
+		if (cont > copy)
+			cont = copy;
+		memcpy(file->ring + ofs, file->wbuf + file->file_ptr_bytes, cont);
+		memcpy(file->ring, file->wbuf + file->file_ptr_bytes + cont, copy - cont);
+		__atomic_store_n(&file->ring_head, head + copy, __ATOMIC_SEQ_CST);
+		bytes -= n;
+		file->wbuf_used_bytes -= n;
+		file->file_ptr_bytes += n;
+		if (file->file_ptr_bytes == file->wbuf_size_bytes)
+			file->file_ptr_bytes = 0;
+	}
+	snd_pcm_file_wake_writer(file);
+	return 0;
+}
+
+/* wait until the writer has written out everything queued */
+static int snd_pcm_file_flush_ring(snd_pcm_file_t *file)
+{
+	if (!file->writer_started)
+		return 0;
+	snd_pcm_file_wake_writer(file);
+	snd_pcm_file_wait_space(file, file->ring_bytes);
+	return __atomic_load_n(&file->writer_err, __ATOMIC_ACQUIRE);
+}
+
+static int snd_pcm_file_start_writer(snd_pcm_t *pcm)
+{
+	snd_pcm_file_t *file = pcm->private_data;
+	snd_pcm_t *slave = file->gen.slave;
+	snd_pcm_uframes_t frames = file->async_size;
+	int err;
+
+	/* called from hw_params, so the setup is known only by the slave */
+	if (!frames) {
+		/* two seconds, but never less than the wbuf chunks */
+		frames = slave->rate * 2;
+		if (frames < file->wbuf_size)
+			frames = file->wbuf_size;
+	}
+	file->ring_bytes = snd_pcm_frames_to_bytes(slave, frames);
+	file->ring_bytes = (file->ring_bytes + RING_ALIGN - 1) / RING_ALIGN * RING_ALIGN;
+	if (posix_memalign((void **)&file->ring, RING_ALIGN, file->ring_bytes))
+		return -ENOMEM;
+	file->ring_head = file->ring_tail = 0;
+	file->writer_idle = file->producer_waiting = 0;
+	file->writer_stop = file->writer_err = 0;
+	pthread_mutex_init(&file->writer_mutex, NULL);
+	pthread_cond_init(&file->data_cond, NULL);
+	pthread_cond_init(&file->space_cond, NULL);
+	/* set first, the writer checks it when it rotates the files */
+	file->writer_started = 1;
+	err = pthread_create(&file->writer, NULL, snd_pcm_file_writer, pcm);
+	if (err) {
+		file->writer_started = 0;
+		pthread_mutex_destroy(&file->writer_mutex);
+		pthread_cond_destroy(&file->data_cond);
+		pthread_cond_destroy(&file->space_cond);
+		free(file->ring);
+		file->ring = NULL;
+		return -err;
+	}
+	return 0;
+}
+
+/* the writer empties the ring before it exits */
+static void snd_pcm_file_stop_writer(snd_pcm_t *pcm)
+{
+	snd_pcm_file_t *file = pcm->private_data;
+
+	if (!file->writer_started)
+		return;
+	__atomic_store_n(&file->writer_stop, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_lock(&file->writer_mutex);
+	pthread_cond_signal(&file->data_cond);
+	pthread_mutex_unlock(&file->writer_mutex);
+	pthread_join(file->writer, NULL);
+	pthread_mutex_destroy(&file->writer_mutex);
+	pthread_cond_destroy(&file->data_cond);
+	pthread_cond_destroy(&file->space_cond);
+	file->writer_started = 0;
+	free(file->ring);
+	file->ring = NULL;
+}
+#else /* HAVE_LIBPTHREAD */
+static inline int snd_pcm_file_queue_bytes(snd_pcm_t *pcm ATTRIBUTE_UNUSED,
+					   size_t bytes ATTRIBUTE_UNUSED)
+{
+	return -ENOSYS;
+}
+
+static inline int snd_pcm_file_flush_ring(snd_pcm_file_t *file ATTRIBUTE_UNUSED)
+{
+	return 0;
+}
+
+static inline int snd_pcm_file_start_writer(snd_pcm_t *pcm ATTRIBUTE_UNUSED)
+{
+	return -ENOSYS;
+}
+
+static inline void snd_pcm_file_stop_writer(snd_pcm_t *pcm ATTRIBUTE_UNUSED)
+{
+}
+#endif /* HAVE_LIBPTHREAD */
+
 /* return error code in case write failed */
 static int snd_pcm_file_write_bytes(snd_pcm_t *pcm, size_t bytes)
 {
@@ -423,26 +1125,18 @@ static int snd_pcm_file_write_bytes(snd_pcm_t *pcm, size_t bytes)
 	snd_pcm_sframes_t err = 0;
 	assert(bytes <= file->wbuf_used_bytes);
 
-	if (file->format == SND_PCM_FILE_FORMAT_WAV &&
-	    !file->wav_header.fmt) {
-		err = write_wav_header(pcm);
-		if (err < 0) {
-			file->wbuf_used_bytes = 0;
-			file->file_ptr_bytes = 0;
-			return err;
-		}
-	}
+	if (file->ring)
+		return snd_pcm_file_queue_bytes(pcm, bytes);
 
 	while (bytes > 0) {
 		size_t n = bytes;
 		size_t cont = file->wbuf_size_bytes - file->file_ptr_bytes;
 		if (n > cont)
 			n = cont;
-		err = safe_write(file->fd, file->wbuf + file->file_ptr_bytes, n);
+		err = snd_pcm_file_output(pcm, file->wbuf + file->file_ptr_bytes, n);
 		if (err < 0) {
 			file->wbuf_used_bytes = 0;
 			file->file_ptr_bytes = 0;
-			snd_errornum(PCM, "%s write failed, file data may be corrupt", file->fname);
 			return err;
 		}
 		bytes -= err;
@@ -450,7 +1144,6 @@ static int snd_pcm_file_write_bytes(snd_pcm_t *pcm, size_t bytes)
 		file->file_ptr_bytes += err;
 		if (file->file_ptr_bytes == file->wbuf_size_bytes)
 			file->file_ptr_bytes = 0;
-		file->filelen += err;
 		if ((snd_pcm_uframes_t)err != n)
 			break;
 	}
@@ -502,16 +1195,14 @@ static int snd_pcm_file_add_frames(snd_pcm_t *pcm,
 static int snd_pcm_file_close(snd_pcm_t *pcm)
 {
 	snd_pcm_file_t *file = pcm->private_data;
+	/* the header of a file given by descriptor is not rewritten */
+	snd_pcm_file_finish(pcm, file->fname != NULL);
 	if (file->fname) {
-		if (file->wav_header.fmt)
-			fixup_wav_header(pcm);
 		free((void *)file->fname);
-		if (file->pipe) {
-			pclose(file->pipe);
-		} else if (file->fd >= 0) {
-			close(file->fd);
-		}
+		snd_pcm_file_close_output_file(file);
 	}
+	if (file->ifmap)
+		munmap(file->ifmap, file->ifmap_size);
 	if (file->ifname) {
 		free((void *)file->ifname);
 		close(file->ifd);
@@ -553,6 +1244,8 @@ static int snd_pcm_file_drain(snd_pcm_t *pcm)
 		snd_pcm_file_write_bytes(pcm, file->wbuf_used_bytes);
 		assert(file->wbuf_used_bytes == 0);
 		__snd_pcm_unlock(pcm);
+		/* the file is complete when drain returns */
+		snd_pcm_file_flush_ring(file);
 	}
 	return err;
 }
@@ -763,6 +1456,7 @@ static int snd_pcm_file_mmap_begin(snd_pcm_t *pcm, const snd_pcm_channel_area_t
 static int snd_pcm_file_hw_free(snd_pcm_t *pcm)
 {
 	snd_pcm_file_t *file = pcm->private_data;
+	snd_pcm_file_stop_writer(pcm);
 	free(file->wbuf);
 	free(file->wbuf_areas);
 	free(file->final_fname);
@@ -780,6 +1474,7 @@ static int snd_pcm_file_hw_params(snd_pcm_t *pcm, snd_pcm_hw_params_t * params)
 	unsigned int channel;
 	snd_pcm_t *slave = file->gen.slave;
 	snd_pcm_sframes_t bsize;
+	uint64_t rotate_frames;
 	int err = _snd_pcm_hw_params_internal(slave, params);
 	if (err < 0)
 		return err;
@@ -787,6 +1482,23 @@ static int snd_pcm_file_hw_params(snd_pcm_t *pcm, snd_pcm_hw_params_t * params)
 	if (bsize < 0)
 		return bsize;
 	file->buffer_bytes = bsize;
+	if (file->format == SND_PCM_FILE_FORMAT_FLAC &&
+	    snd_pcm_flac_check_setup(slave) < 0) {
+		snd_error(PCM, "FLAC needs up to 8 channels of integer samples up to 24 bits");
+		return -EINVAL;
+	}
+	/* rotate the output files at whole frames */
+	rotate_frames = 0;
+	if (file->rotate_time)
+		rotate_frames = (uint64_t)file->rotate_time * slave->rate;
+	if (file->rotate_size) {
+		uint64_t frames = file->rotate_size * 8 / slave->frame_bits;
+		if (!frames)
+			frames = 1;
+		if (!rotate_frames || frames < rotate_frames)
+			rotate_frames = frames;
+	}
+	file->rotate_bytes = rotate_frames * slave->frame_bits / 8;
 	file->wbuf_size = slave->buffer_size * 2;
 	file->wbuf_size_bytes = snd_pcm_frames_to_bytes(slave, file->wbuf_size);
 	file->wbuf_used_bytes = 0;
@@ -825,6 +1537,15 @@ static int snd_pcm_file_hw_params(snd_pcm_t *pcm, snd_pcm_hw_params_t * params)
 			return err;
 		}
 	}
+	if (file->async) {
+		err = snd_pcm_file_start_writer(pcm);
+		if (err < 0) {
+			snd_error(PCM, "cannot start the writer thread for %s: %s",
+				  file->fname, snd_strerror(err));
+			snd_pcm_file_hw_free(pcm);
+			return err;
+		}
+	}
 
 	/* pointer may have changed - e.g if plug is used. */
 	snd_pcm_unlink_hw_ptr(pcm, file->gen.slave);
@@ -839,6 +1560,7 @@ static int snd_pcm_file_hw_params(snd_pcm_t *pcm, snd_pcm_hw_params_t * params)
 static void snd_pcm_file_dump(snd_pcm_t *pcm, snd_output_t *out)
 {
 	snd_pcm_file_t *file = pcm->private_data;
+	snd_pcm_file_lock_output(file);
 	if (file->fname)
 		snd_output_printf(out, "File PCM (file=%s)\n", file->fname);
 	else
@@ -846,6 +1568,12 @@ static void snd_pcm_file_dump(snd_pcm_t *pcm, snd_output_t *out)
 	if (file->final_fname)
 		snd_output_printf(out, "Final file PCM (file=%s)\n",
 				file->final_fname);
+	snd_pcm_file_unlock_output(file);
+	if (file->async)
+		snd_output_printf(out, "Asynchronous writer (ring=%zu bytes, overflow=%s, dropped=%zu bytes)\n",
+				  file->ring_bytes,
+				  file->async_block ? "block" : "drop",
+				  file->dropped_bytes);
 
 	if (pcm->setup) {
 		snd_output_printf(out, "Its setup is:\n");
@@ -915,7 +1643,7 @@ static const snd_pcm_fast_ops_t snd_pcm_file_fast_ops = {
  * \param ifd Input file descriptor (if (ifd < 0) && (ifname == NULL), no input
  *            redirection will be performed)
  * \param trunc Truncate the file if it already exists
- * \param fmt File format ("raw" or "wav" are available)
+ * \param fmt File format ("raw", "wav", "rf64", "w64" or "flac")
  * \param perm File permission
  * \param slave Slave PCM handle
  * \param close_slave When set, the slave PCM handle is closed with copy PCM
@@ -943,6 +1671,12 @@ int snd_pcm_file_open(snd_pcm_t **pcmp, const char *name,
 		format = SND_PCM_FILE_FORMAT_RAW;
 	else if (!strcmp(fmt, "wav"))
 		format = SND_PCM_FILE_FORMAT_WAV;
+	else if (!strcmp(fmt, "rf64"))
+		format = SND_PCM_FILE_FORMAT_RF64;
+	else if (!strcmp(fmt, "w64"))
+		format = SND_PCM_FILE_FORMAT_W64;
+	else if (!strcmp(fmt, "flac"))
+		format = SND_PCM_FILE_FORMAT_FLAC;
 	else {
 		snd_error(PCM, "file format %s is unknown", fmt);
 		return -EINVAL;
@@ -979,6 +1713,13 @@ int snd_pcm_file_open(snd_pcm_t **pcmp, const char *name,
 	file->fd = fd;
 	file->ifd = ifd;
 	file->format = format;
+#ifdef HAVE_LIBPTHREAD
+	/* keep the encoder off the audio thread */
+	if (format == SND_PCM_FILE_FORMAT_FLAC) {
+		file->async = 1;
+		file->async_block = 1;
+	}
+#endif
 	file->gen.slave = slave;
 	file->gen.close_slave = close_slave;
 
@@ -1037,17 +1778,59 @@ pcm.name {
 				# %b	bits per sample (replaced with: 16)
 				# %f	sample format string
 				#			(replaced with: S16_LE)
+				# %i	file number, see rotate_size
+				# %t	local time of the file creation
+				#			(replaced with: 20240131-235959,
+				#			 -1, -2... appended for more
+				#			 files in the same second)
 				# %%	replaced with %
 	or
 	file INT		# Output file descriptor number
 	infile STR		# Input filename - only raw format
 	or
 	infile INT		# Input file descriptor number
-	[format STR]		# File format ("raw" or "wav")
+	[infile_mmap BOOL]	# Map the input file instead of reading it
+	[format STR]		# File format ("raw", "wav", "rf64", "w64"
+				# or "flac")
 	[perm INT]		# Output file permission (octal, def. 0600)
+	[async BOOL]		# Write the file from a separate thread
+	[async_buffer_size INT]	# Writer ring size in frames
+				# (def. two seconds of audio)
+	[overflow STR]		# What to do when the ring is full:
+				# "drop" or "block" (default "drop",
+				# "block" for the flac format)
+	[rotate_size INT]	# Start a new file after INT bytes of audio
+	[rotate_time INT]	# Start a new file after INT seconds
 }
 \endcode
 
+The "wav" format keeps writing past 2 GiB, but its size fields stop
+at 2 GiB, so readers may see only that much of the data. "rf64" writes
+a WAV file which is turned into an RF64 file (EBU Tech 3306) when it
+grows over 4 GiB, "w64" writes a Sony Wave64 file. "flac" compresses
+the stream losslessly with a built-in FLAC encoder (integer samples up
+to 24 bits, at most 8 channels); the encoder always runs in the writer
+thread (see \c async below) and the last block is written when the PCM
+is closed.
+As this turns the writer thread on implicitly, the stream waits for the
+writer by default instead of dropping data (see \c overflow).
+
+With \c infile_mmap, a regular input file is mapped to memory and the
+captured data is copied straight from the mapping, with sequential
+readahead hints for the kernel. The input file must not shrink while the
+PCM is open. Other inputs, like pipes, are still read with read().
+
+With \c rotate_size or \c rotate_time, the output is split to several
+files. The file name must contain \c %i or \c %t, so that each file gets
+its own name. \c rotate_size counts the audio data before compression.
+
+With \c async enabled, the stream only copies the data to a ring buffer and
+a writer thread stores it, so a slow disk, a network file system or a stalled
+pipe reader cannot cause xruns on the slave. When the writer falls behind by
+more than the ring size, the new data is dropped (and counted in the PCM
+dump) unless \c overflow is "block", which makes the stream wait for the
+writer instead. snd_pcm_drain() returns only after all data was written.
+
 \subsection pcm_plugins_file_funcref Function reference
 
 <UL>
@@ -1078,10 +1861,16 @@ int _snd_pcm_file_open(snd_pcm_t **pcmp, const char *name,
 	int err;
 	snd_pcm_t *spcm;
 	snd_config_t *slave = NULL, *sconf;
+	snd_pcm_file_t *file;
 	const char *fname = NULL, *ifname = NULL;
 	const char *format = NULL;
 	long fd = -1, ifd = -1, trunc = 1;
 	long perm = 0600;
+	long async_size = 0;
+	int async = 0, async_block = -1;
+	long long rotate_size = 0;
+	long rotate_time = 0;
+	int infile_mmap = 0;
 	snd_config_for_each(i, next, conf) {
 		snd_config_t *n = snd_config_iterator_entry(i);
 		const char *id;
@@ -1123,6 +1912,13 @@ int _snd_pcm_file_open(snd_pcm_t **pcmp, const char *name,
 			}
 			continue;
 		}
+		if (strcmp(id, "infile_mmap") == 0) {
+			err = snd_config_get_bool(n);
+			if (err < 0)
+				return -EINVAL;
+			infile_mmap = err;
+			continue;
+		}
 		if (strcmp(id, "perm") == 0) {
 			err = snd_config_get_integer(n, &perm);
 			if (err < 0) {
@@ -1142,6 +1938,68 @@ int _snd_pcm_file_open(snd_pcm_t **pcmp, const char *name,
 			trunc = err;
 			continue;
 		}
+		if (strcmp(id, "async") == 0) {
+			err = snd_config_get_bool(n);
+			if (err < 0)
+				return -EINVAL;
+			async = err;
+			continue;
+		}
+		if (strcmp(id, "async_buffer_size") == 0) {
+			err = snd_config_get_integer(n, &async_size);
+			if (err < 0) {
+				snd_error(PCM, "Invalid type for %s", id);
+				return err;
+			}
+			if (async_size < 0) {
+				snd_error(PCM, "The field async_buffer_size must not be negative");
+				return -EINVAL;
+			}
+			continue;
+		}
+		if (strcmp(id, "overflow") == 0) {
+			const char *str;
+			err = snd_config_get_string(n, &str);
+			if (err < 0) {
+				snd_error(PCM, "Invalid type for %s", id);
+				return -EINVAL;
+			}
+			if (!strcmp(str, "block"))
+				async_block = 1;
+			else if (!strcmp(str, "drop"))
+				async_block = 0;
+			else {
+				snd_error(PCM, "Invalid overflow mode %s", str);
+				return -EINVAL;
+			}
+			continue;
+		}
+		if (strcmp(id, "rotate_size") == 0) {
+			long size;
+			if (snd_config_get_integer(n, &size) >= 0)
+				rotate_size = size;
+			else if (snd_config_get_integer64(n, &rotate_size) < 0) {
+				snd_error(PCM, "Invalid type for %s", id);
+				return -EINVAL;
+			}
+			if (rotate_size < 0) {
+				snd_error(PCM, "The field rotate_size must not be negative");
+				return -EINVAL;
+			}
+			continue;
+		}
+		if (strcmp(id, "rotate_time") == 0) {
+			err = snd_config_get_integer(n, &rotate_time);
+			if (err < 0) {
+				snd_error(PCM, "Invalid type for %s", id);
+				return err;
+			}
+			if (rotate_time < 0) {
+				snd_error(PCM, "The field rotate_time must not be negative");
+				return -EINVAL;
+			}
+			continue;
+		}
 		snd_error(PCM, "Unknown field %s", id);
 		return -EINVAL;
 	}
@@ -1160,6 +2018,12 @@ int _snd_pcm_file_open(snd_pcm_t **pcmp, const char *name,
 		snd_error(PCM, "slave is not defined");
 		return -EINVAL;
 	}
+#ifndef HAVE_LIBPTHREAD
+	if (async) {
+		snd_error(PCM, "async mode needs thread support");
+		return -EINVAL;
+	}
+#endif
 	err = snd_pcm_slave_conf(root, slave, &sconf, 0);
 	if (err < 0)
 		return err;
@@ -1168,15 +2032,33 @@ int _snd_pcm_file_open(snd_pcm_t **pcmp, const char *name,
 		snd_error(PCM, "file is not defined");
 		return -EINVAL;
 	}
+	if ((rotate_size || rotate_time) &&
+	    (!fname || (!strstr(fname, "%i") && !strstr(fname, "%t")))) {
+		snd_config_delete(sconf);
+		snd_error(PCM, "file rotation needs %%i or %%t in the file name");
+		return -EINVAL;
+	}
 	err = snd_pcm_open_slave(&spcm, root, sconf, stream, mode, conf);
 	snd_config_delete(sconf);
 	if (err < 0)
 		return err;
 	err = snd_pcm_file_open(pcmp, name, fname, fd, ifname, ifd,
 				trunc, format, perm, spcm, 1, stream);
-	if (err < 0)
+	if (err < 0) {
 		snd_pcm_close(spcm);
-	return err;
+		return err;
+	}
+	file = (*pcmp)->private_data;
+	if (async)
+		file->async = 1;
+	if (async_block >= 0)
+		file->async_block = async_block;
+	file->async_size = async_size;
+	file->rotate_size = rotate_size;
+	file->rotate_time = rotate_time;
+	if (infile_mmap && file->ifd >= 0 && stream == SND_PCM_STREAM_CAPTURE)
+		snd_pcm_file_map_infile(file);
+	return 0;
 }
 #ifndef DOC_HIDDEN
 SND_DLSYM_BUILD_VERSION(_snd_pcm_file_open, SND_PCM_DLSYM_VERSION);
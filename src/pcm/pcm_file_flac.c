@@ -0,0 +1,449 @@
+/*
+ *  PCM - File plugin - FLAC encoder
+ *
+ *   This library is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as
+ *   published by the Free Software Foundation; either version 2.1 of
+ *   the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * A small FLAC encoder: fixed blocks, the FIXED (polynomial) predictors
+ * of order 0-4, partitioned Rice coding of the residual and stereo
+ * decorrelation.  The output is a plain FLAC stream, so any decoder can
+ * read it.  It runs in the writer thread of the file plugin.
+ */
+
+#include "pcm_local.h"
+#include "pcm_file_flac.h"
+
+#define FLAC_MAX_ORDER		4
+#define FLAC_MAX_PARTITION	8
+
+#define FLAC_SUBFRAME_CONSTANT	0
+#define FLAC_SUBFRAME_VERBATIM	1
+#define FLAC_SUBFRAME_FIXED	8
+
+#define FLAC_CHANNEL_LEFT_SIDE	8
+#define FLAC_CHANNEL_RIGHT_SIDE	9
+#define FLAC_CHANNEL_MID_SIDE	10
+
+struct flac_bits {
+	uint8_t *buf;
+	size_t pos;
+	uint64_t acc;
+	unsigned int n;
+};
+
+/* the coding chosen for one subframe */
+struct flac_plan {
+	unsigned int type;
+	unsigned int order;
+	unsigned int porder;
+	unsigned int method;
+	unsigned int param[1 << FLAC_MAX_PARTITION];
+	uint64_t bits;
+};
+
+static void flac_put(struct flac_bits *b, uint32_t val, unsigned int bits)
+{
+	if (!bits)
+		return;
+	if (bits < 32)
+		val &= (1U << bits) - 1;
+	b->acc = (b->acc << bits) | val;
+	b->n += bits;
+	while (b->n >= 8) {
+		b->n -= 8;
+		b->buf[b->pos++] = b->acc >> b->n;
+	}
+}
+
+static void flac_put_unary(struct flac_bits *b, uint32_t zeros)
+{
+	while (zeros >= 32) {
+		flac_put(b, 0, 32);
+		zeros -= 32;
+	}
+	flac_put(b, 1, zeros + 1);
+}
+
+static void flac_align(struct flac_bits *b)
+{
+	if (b->n)
+		flac_put(b, 0, 8 - b->n);
+}
+
+static void flac_put_utf8(struct flac_bits *b, uint64_t val)
+{
+	unsigned int bytes, shift;
+
+	if (val < 0x80) {
+		flac_put(b, val, 8);
+		return;
+	}
+	for (bytes = 2; bytes < 7; bytes++)
+		if (val < (1ULL << (5 * bytes + 1)))
+			break;
+	shift = (bytes - 1) * 6;
+	flac_put(b, ((0xff00 >> bytes) & 0xff) | (val >> shift), 8);
+	while (shift) {
+		shift -= 6;
+		flac_put(b, 0x80 | ((val >> shift) & 0x3f), 8);
+	}
+}
+
+static uint8_t flac_crc8(const uint8_t *buf, size_t len)
+{
+	uint8_t crc = 0;
+	unsigned int i;
+
+	while (len--) {
+		crc ^= *buf++;
+		for (i = 0; i < 8; i++)
+			crc = crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1;
+	}
+	return crc;
+}
+
+static uint16_t flac_crc16(const uint8_t *buf, size_t len)
+{
+	uint16_t crc = 0;
+	unsigned int i;
+
+	while (len--) {
+		crc ^= *buf++ << 8;
+		for (i = 0; i < 8; i++)
+			crc = crc & 0x8000 ? (crc << 1) ^ 0x8005 : crc << 1;
+	}
+	return crc;
+}
+
+static inline int32_t flac_residual(const int32_t *x, unsigned int i,
+				    unsigned int order)
+{
+	switch (order) {
+	case 0:
+		return x[i];
+	case 1:
+		return x[i] - x[i - 1];
+	case 2:
+		return x[i] - 2 * x[i - 1] + x[i - 2];
+	case 3:
+		return x[i] - 3 * x[i - 1] + 3 * x[i - 2] - x[i - 3];
+	default:
+		return x[i] - 4 * x[i - 1] + 6 * x[i - 2] - 4 * x[i - 3] + x[i - 4];
+	}
+}
+
+static inline uint32_t flac_fold(int32_t r)
+{
+	return ((uint32_t)r << 1) ^ (uint32_t)(r >> 31);
+}
+
+/* cheapest Rice parameter for count values summing up to sum */
+static unsigned int flac_rice_param(uint64_t sum, unsigned int count,
+				    uint64_t *bits)
+{
+	unsigned int k, best_k = 0;
+	uint64_t cost, best = (uint64_t)-1;
+
+	for (k = 0; k <= 30; k++) {
+		cost = (uint64_t)count * (k + 1) + (sum >> k);
+		if (cost > best)
+			break;
+		best = cost;
+		best_k = k;
+	}
+	*bits = best;
+	return best_k;
+}
+
+static void flac_plan_fixed(const int32_t *x, unsigned int n, unsigned int order,
+			    struct flac_plan *plan, unsigned int bps)
+{
+	uint64_t sums[1 << FLAC_MAX_PARTITION];
+	unsigned int pmax, p, i, part, parts;
+
+	for (pmax = 0; pmax < FLAC_MAX_PARTITION; pmax++)
+		if ((n & ((2U << pmax) - 1)) || (n >> (pmax + 1)) <= order)
+			break;
+	parts = 1 << pmax;
+	memset(sums, 0, sizeof(sums));
+	for (i = order; i < n; i++)
+		sums[i / (n >> pmax)] += flac_fold(flac_residual(x, i, order));
+
+	plan->type = FLAC_SUBFRAME_FIXED;
+	plan->order = order;
+	plan->bits = (uint64_t)-1;
+	for (p = pmax + 1; p-- > 0; parts >>= 1) {
+		unsigned int param[1 << FLAC_MAX_PARTITION];
+		unsigned int method = 0;
+		uint64_t bits = 8 + 2 + 4 + (uint64_t)order * bps;
+		for (part = 0; part < parts; part++) {
+			unsigned int count = n >> p;
+			uint64_t pbits;
+			if (!part)
+				count -= order;
+			param[part] = flac_rice_param(sums[part], count, &pbits);
+			if (param[part] > 14)
+				method = 1;
+			bits += pbits;
+		}
+		bits += parts * (method ? 5 : 4);
+		if (bits < plan->bits) {
+			plan->bits = bits;
+			plan->porder = p;
+			plan->method = method;
+			memcpy(plan->param, param, parts * sizeof(*param));
+		}
+		/* merge the partitions for the next lower order */
+		for (part = 0; part < parts / 2; part++)
+			sums[part] = sums[2 * part] + sums[2 * part + 1];
+	}
+}
+
+static void flac_plan_subframe(const int32_t *x, unsigned int n,
+			       unsigned int bps, struct flac_plan *plan)
+{
+	struct flac_plan fixed;
+	unsigned int i, order;
+
+	for (i = 1; i < n; i++)
+		if (x[i] != x[0])
+			break;
+	if (i == n) {
+		plan->type = FLAC_SUBFRAME_CONSTANT;
+		plan->bits = 8 + bps;
+		return;
+	}
+	plan->type = FLAC_SUBFRAME_VERBATIM;
+	plan->bits = 8 + (uint64_t)n * bps;
+	for (order = 0; order <= FLAC_MAX_ORDER && order < n; order++) {
+		flac_plan_fixed(x, n, order, &fixed, bps);
+		if (fixed.bits < plan->bits)
+			*plan = fixed;
+	}
+}
+
+static void flac_put_subframe(struct flac_bits *b, const int32_t *x,
+			      unsigned int n, unsigned int bps,
+			      const struct flac_plan *plan)
+{
+	unsigned int i, part, parts, k;
+
+	switch (plan->type) {
+	case FLAC_SUBFRAME_CONSTANT:
+		flac_put(b, 0, 8);
+		flac_put(b, x[0], bps);
+		return;
+	case FLAC_SUBFRAME_VERBATIM:
+		flac_put(b, 1 << 1, 8);
+		for (i = 0; i < n; i++)
+			flac_put(b, x[i], bps);
+		return;
+	}
+	flac_put(b, (FLAC_SUBFRAME_FIXED | plan->order) << 1, 8);
+	for (i = 0; i < plan->order; i++)
+		flac_put(b, x[i], bps);
+	flac_put(b, plan->method, 2);
+	flac_put(b, plan->porder, 4);
+	parts = 1 << plan->porder;
+	i = plan->order;
+	for (part = 0; part < parts; part++) {
+		unsigned int end = (part + 1) * (n >> plan->porder);
+		k = plan->param[part];
+		flac_put(b, k, plan->method ? 5 : 4);
+		for (; i < end; i++) {
+			uint32_t u = flac_fold(flac_residual(x, i, plan->order));
+			flac_put_unary(b, u >> k);
+			flac_put(b, u, k);
+		}
+	}
+}
+
+/* convert the interleaved block to one array per channel */
+static void flac_deinterleave(struct flac_enc *enc, unsigned int n)
+{
+	unsigned int shift = 32 - enc->bps;
+	unsigned int i, c, j;
+
+	for (i = 0; i < n; i++) {
+		const uint8_t *p = (const uint8_t *)enc->pcm + i * enc->frame_bytes;
+		for (c = 0; c < enc->channels; c++, p += enc->phys_bytes) {
+			uint32_t v = 0;
+			if (enc->big_endian)
+				for (j = 0; j < enc->phys_bytes; j++)
+					v = (v << 8) | p[j];
+			else
+				for (j = enc->phys_bytes; j-- > 0; )
+					v = (v << 8) | p[j];
+			if (enc->is_unsigned)
+				v ^= 1U << (enc->bps - 1);
+			enc->samples[c * FLAC_BLOCKSIZE + i] = (int32_t)(v << shift) >> shift;
+		}
+	}
+}
+
+/* encode one block of n frames to enc->out, return the frame size */
+size_t snd_pcm_flac_encode_frame(struct flac_enc *enc, unsigned int n)
+{
+	struct flac_plan plans[8];
+	struct flac_plan *plan[8];
+	const int32_t *x[8];
+	struct flac_bits b = { .buf = enc->out };
+	unsigned int c, assignment = enc->channels - 1, size_code;
+	unsigned int bits[8];
+	size_t header;
+	uint16_t crc;
+
+	flac_deinterleave(enc, n);
+	for (c = 0; c < enc->channels; c++) {
+		x[c] = enc->samples + c * FLAC_BLOCKSIZE;
+		bits[c] = enc->bps;
+		flac_plan_subframe(x[c], n, enc->bps, &plans[c]);
+		plan[c] = &plans[c];
+	}
+	if (enc->channels == 2) {
+		int32_t *mid = enc->samples + 2 * FLAC_BLOCKSIZE;
+		int32_t *side = enc->samples + 3 * FLAC_BLOCKSIZE;
+		struct flac_plan *pm = &plans[2];
+		struct flac_plan *ps = &plans[3];
+		uint64_t lr, ls, rs, ms;
+		unsigned int i;
+
+		for (i = 0; i < n; i++) {
+			mid[i] = (x[0][i] + x[1][i]) >> 1;
+			side[i] = x[0][i] - x[1][i];
+		}
+		flac_plan_subframe(mid, n, enc->bps, pm);
+		flac_plan_subframe(side, n, enc->bps + 1, ps);
+		lr = plans[0].bits + plans[1].bits;
+		ls = plans[0].bits + ps->bits;
+		rs = ps->bits + plans[1].bits;
+		ms = pm->bits + ps->bits;
+		if (ls < lr && ls <= rs && ls <= ms) {
+			assignment = FLAC_CHANNEL_LEFT_SIDE;
+			x[1] = side;
+			plan[1] = ps;
+			bits[1]++;
+		} else if (rs < lr && rs <= ms) {
+			assignment = FLAC_CHANNEL_RIGHT_SIDE;
+			x[0] = side;
+			plan[0] = ps;
+			bits[0]++;
+		} else if (ms < lr) {
+			assignment = FLAC_CHANNEL_MID_SIDE;
+			x[0] = mid;
+			plan[0] = pm;
+			x[1] = side;
+			plan[1] = ps;
+			bits[1]++;
+		}
+	}
+
+	switch (enc->bps) {
+	case 8: size_code = 1; break;
+	case 12: size_code = 2; break;
+	case 16: size_code = 4; break;
+	case 20: size_code = 5; break;
+	case 24: size_code = 6; break;
+	default: size_code = 0; break;	/* from STREAMINFO */
+	}
+	flac_put(&b, 0x3ffe, 14);
+	flac_put(&b, 0, 2);		/* reserved, fixed block size */
+	flac_put(&b, 7, 4);		/* 16 bit block size at the end */
+	flac_put(&b, 0, 4);		/* rate from STREAMINFO */
+	flac_put(&b, assignment, 4);
+	flac_put(&b, size_code, 3);
+	flac_put(&b, 0, 1);
+	flac_put_utf8(&b, enc->frame_number);
+	flac_put(&b, n - 1, 16);
+	header = b.pos;
+	flac_put(&b, flac_crc8(b.buf, header), 8);
+
+	for (c = 0; c < enc->channels; c++)
+		flac_put_subframe(&b, x[c], n, bits[c], plan[c]);
+	flac_align(&b);
+	crc = flac_crc16(b.buf, b.pos);
+	flac_put(&b, crc, 16);
+
+	enc->frame_number++;
+	enc->total_samples += n;
+	if (!enc->min_frame || b.pos < enc->min_frame)
+		enc->min_frame = b.pos;
+	if (b.pos > enc->max_frame)
+		enc->max_frame = b.pos;
+	return b.pos;
+}
+
+void snd_pcm_flac_streaminfo(struct flac_enc *enc, uint8_t *buf)
+{
+	struct flac_bits b = { .buf = buf };
+
+	flac_put(&b, FLAC_BLOCKSIZE, 16);
+	flac_put(&b, FLAC_BLOCKSIZE, 16);
+	flac_put(&b, enc->min_frame, 24);
+	flac_put(&b, enc->max_frame, 24);
+	flac_put(&b, enc->rate, 20);
+	flac_put(&b, enc->channels - 1, 3);
+	flac_put(&b, enc->bps - 1, 5);
+	flac_put(&b, enc->total_samples >> 32, 4);
+	flac_put(&b, enc->total_samples, 32);
+	memset(buf + b.pos, 0, 16);	/* MD5 not computed */
+}
+
+void snd_pcm_flac_enc_free(struct flac_enc *enc)
+{
+	free(enc->pcm);
+	free(enc->samples);
+	free(enc->out);
+	memset(enc, 0, sizeof(*enc));
+}
+
+/* FLAC takes up to 8 channels of integer samples with up to 24 bits */
+int snd_pcm_flac_check_setup(snd_pcm_t *pcm)
+{
+	int width = snd_pcm_format_width(pcm->format);
+
+	if (!snd_pcm_format_linear(pcm->format) ||
+	    width < 8 || width > 24 ||
+	    snd_pcm_format_physical_width(pcm->format) % 8 ||
+	    pcm->channels > 8 || pcm->rate >= (1 << 20))
+		return -EINVAL;
+	return 0;
+}
+
+int snd_pcm_flac_enc_init(struct flac_enc *enc, snd_pcm_t *pcm)
+{
+	if (snd_pcm_flac_check_setup(pcm) < 0)
+		return -EINVAL;
+	memset(enc, 0, sizeof(*enc));
+	enc->channels = pcm->channels;
+	enc->bps = snd_pcm_format_width(pcm->format);
+	enc->phys_bytes = snd_pcm_format_physical_width(pcm->format) / 8;
+	enc->rate = pcm->rate;
+	enc->big_endian = snd_pcm_format_big_endian(pcm->format) > 0;
+	enc->is_unsigned = snd_pcm_format_unsigned(pcm->format) > 0;
+	enc->frame_bytes = enc->phys_bytes * enc->channels;
+	enc->pcm = malloc(enc->frame_bytes * FLAC_BLOCKSIZE);
+	/* two more channels for the stereo decorrelation */
+	enc->samples = malloc(sizeof(int32_t) * (enc->channels + 2) * FLAC_BLOCKSIZE);
+	/* verbatim subframes with one more bit for side, plus headers */
+	enc->out = malloc(enc->channels * (FLAC_BLOCKSIZE * 4 + 8) + 32);
+	if (!enc->pcm || !enc->samples || !enc->out) {
+		snd_pcm_flac_enc_free(enc);
+		return -ENOMEM;
+	}
+	return 0;
+}
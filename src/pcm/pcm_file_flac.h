@@ -0,0 +1,59 @@
+/*
+ *  PCM - File plugin - FLAC encoder
+ *
+ *   This library is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as
+ *   published by the Free Software Foundation; either version 2.1 of
+ *   the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdint.h>
+
+#define FLAC_BLOCKSIZE		4096
+#define FLAC_STREAMINFO_SIZE	34
+
+struct flac_enc {
+	unsigned int channels;
+	unsigned int bps;		/* significant bits of the samples */
+	unsigned int phys_bytes;	/* bytes of a sample in the stream */
+	unsigned int rate;
+	int big_endian;
+	int is_unsigned;
+	size_t frame_bytes;
+	char *pcm;			/* interleaved input of one block */
+	size_t pcm_used;
+	int32_t *samples;		/* per channel, plus mid and side */
+	uint8_t *out;
+	uint64_t frame_number;
+	uint64_t total_samples;
+	unsigned int min_frame;
+	unsigned int max_frame;
+};
+
+/* make local functions really local */
+#define snd_pcm_flac_check_setup \
+	snd1_pcm_flac_check_setup
+#define snd_pcm_flac_enc_init \
+	snd1_pcm_flac_enc_init
+#define snd_pcm_flac_enc_free \
+	snd1_pcm_flac_enc_free
+#define snd_pcm_flac_encode_frame \
+	snd1_pcm_flac_encode_frame
+#define snd_pcm_flac_streaminfo \
+	snd1_pcm_flac_streaminfo
+
+int snd_pcm_flac_check_setup(snd_pcm_t *pcm);
+int snd_pcm_flac_enc_init(struct flac_enc *enc, snd_pcm_t *pcm);
+void snd_pcm_flac_enc_free(struct flac_enc *enc);
+size_t snd_pcm_flac_encode_frame(struct flac_enc *enc, unsigned int n);
+void snd_pcm_flac_streaminfo(struct flac_enc *enc, uint8_t *buf);
@@ -40,6 +40,9 @@
 #include <fcntl.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#ifdef HAVE_SYS_TIMERFD_H
+#include <sys/timerfd.h>
+#endif
 
 //#define DEBUG_RW		/* use to debug readi/writei/readn/writen */
 //#define DEBUG_MMAP		/* debug mmap_commit */
@@ -82,6 +85,11 @@ static int use_old_hw_params_ioctl(int fd, unsigned int cmd, snd_pcm_hw_params_t
 static snd_pcm_sframes_t snd_pcm_hw_avail_update(snd_pcm_t *pcm);
 static const snd_pcm_fast_ops_t snd_pcm_hw_fast_ops;
 static const snd_pcm_fast_ops_t snd_pcm_hw_fast_ops_timer;
+#ifdef HAVE_SYS_TIMERFD_H
+static const snd_pcm_fast_ops_t snd_pcm_hw_fast_ops_tsched;
+static int snd_pcm_hw_tsched_enable(snd_pcm_t *pcm);
+static void snd_pcm_hw_tsched_disable(snd_pcm_t *pcm);
+#endif
 
 /*
  *
@@ -105,6 +113,14 @@ typedef struct {
 	snd_timer_t *period_timer;
 	struct pollfd period_timer_pfd;
 	int period_timer_need_poll;
+	/* timer-based scheduling (period wakeups disabled in driver) */
+	int tsched;			/* tsched requested by configuration */
+	int tsched_active;		/* NO_PERIOD_WAKEUP negotiated */
+	int tsched_fd;			/* timerfd */
+	unsigned int tsched_watermark_min; /* configured watermark in us */
+	unsigned int tsched_watermark;	/* current (adaptive) watermark in us */
+	unsigned int tsched_clean_wakeups;
+	snd_pcm_uframes_t tsched_period_mark;
 	/* restricted parameters */
 	snd_pcm_format_t format;
 	struct {
@@ -260,10 +276,9 @@ static int snd_pcm_hw_poll_revents(snd_pcm_t *pcm, struct pollfd *pfds, unsigned
 	return 0;
 }
 
-static int snd_pcm_hw_nonblock(snd_pcm_t *pcm, int nonblock)
+static int hw_set_nonblock(snd_pcm_hw_t *hw, int nonblock)
 {
 	long flags;
-	snd_pcm_hw_t *hw = pcm->private_data;
 	int fd = hw->fd, err;
 
 	if ((flags = fcntl(fd, F_GETFL)) < 0) {
@@ -283,6 +298,14 @@ static int snd_pcm_hw_nonblock(snd_pcm_t *pcm, int nonblock)
 	return 0;
 }
 
+static int snd_pcm_hw_nonblock(snd_pcm_t *pcm, int nonblock)
+{
+	snd_pcm_hw_t *hw = pcm->private_data;
+
+	/* without period wakeups the kernel must never sleep on its own */
+	return hw_set_nonblock(hw, nonblock || hw->tsched_active);
+}
+
 static int snd_pcm_hw_async(snd_pcm_t *pcm, int sig, pid_t pid)
 {
 	long flags;
@@ -408,9 +431,27 @@ static int hw_params_call(snd_pcm_hw_t *pcm_hw, snd_pcm_hw_params_t *params)
 static int snd_pcm_hw_hw_params(snd_pcm_t *pcm, snd_pcm_hw_params_t * params)
 {
 	snd_pcm_hw_t *hw = pcm->private_data;
+	int tsched = 0;
 	int err;
+
+#ifdef HAVE_SYS_TIMERFD_H
+	if (hw->tsched && hw->tsched_fd < 0) {
+		hw->tsched_fd = timerfd_create(CLOCK_MONOTONIC,
+					       TFD_NONBLOCK | TFD_CLOEXEC);
+		if (hw->tsched_fd < 0)
+			snd_checknum(PCM, "timerfd_create failed (%i)", -errno);
+	}
+	/* the application may disable period wakeups on its own */
+	if (hw->tsched && hw->tsched_fd >= 0 &&
+	    !(params->flags & SND_PCM_HW_PARAMS_NO_PERIOD_WAKEUP)) {
+		params->flags |= SND_PCM_HW_PARAMS_NO_PERIOD_WAKEUP;
+		tsched = 1;
+	}
+#endif
 	if (hw_params_call(hw, params) < 0) {
 		err = -errno;
+		if (tsched)
+			params->flags &= ~SND_PCM_HW_PARAMS_NO_PERIOD_WAKEUP;
 		snd_checknum(PCM, "SNDRV_PCM_IOCTL_HW_PARAMS failed (%i)", err);
 		return err;
 	}
@@ -419,6 +460,20 @@ static int snd_pcm_hw_hw_params(snd_pcm_t *pcm, snd_pcm_hw_params_t * params)
 		params->info |= SND_PCM_INFO_MONOTONIC;
 	hw->perfect_drain = !!(params->info & SND_PCM_INFO_PERFECT_DRAIN) ||
 			    !!(params->flags & SND_PCM_HW_PARAMS_NO_DRAIN_SILENCE);
+#ifdef HAVE_SYS_TIMERFD_H
+	if (tsched) {
+		/* wakeups are emulated, upper layers see the usual behavior */
+		params->flags &= ~SND_PCM_HW_PARAMS_NO_PERIOD_WAKEUP;
+		/* the driver ignores the flag if it cannot disable interrupts */
+		if (params->info & SND_PCM_INFO_NO_PERIOD_WAKEUP) {
+			err = snd_pcm_hw_tsched_enable(pcm);
+			if (err < 0)
+				return err;
+		} else
+			snd_pcm_hw_tsched_disable(pcm);
+	} else
+		snd_pcm_hw_tsched_disable(pcm);
+#endif
 	return query_status_data(hw);
 }
 
@@ -510,11 +565,236 @@ static int snd_pcm_hw_change_timer(snd_pcm_t *pcm, int enable)
 	return 0;
 }
 
+#ifdef HAVE_SYS_TIMERFD_H
+/*
+ *  Timer-based scheduling
+ *
+ *  The driver is asked to skip the period interrupts and the wakeups are
+ *  driven by a timerfd instead. The timer is armed to the time when
+ *  avail_min is reached (or the next period boundary if period events are
+ *  requested), but never later than the watermark before the ring buffer
+ *  runs out (playback) or overflows (capture). The watermark grows on
+ *  xruns and slowly returns back to the configured value.
+ */
+
+static int snd_pcm_hw_hwsync(snd_pcm_t *pcm);
+
+static inline snd_pcm_uframes_t tsched_us_to_frames(snd_pcm_t *pcm,
+						    unsigned long long us)
+{
+	return (us * pcm->rate) / 1000000ULL;
+}
+
+static inline unsigned long long tsched_frames_to_us(snd_pcm_t *pcm,
+						     snd_pcm_uframes_t frames)
+{
+	return (frames * 1000000ULL) / pcm->rate;
+}
+
+/* frames until the next wakeup is due (zero = now) */
+static snd_pcm_uframes_t snd_pcm_hw_tsched_remain(snd_pcm_t *pcm,
+						  snd_pcm_uframes_t avail,
+						  snd_pcm_uframes_t hw_ptr)
+{
+	snd_pcm_hw_t *hw = pcm->private_data;
+	snd_pcm_uframes_t remain, headroom, wm;
+
+	if (avail >= pcm->buffer_size)
+		return 0;
+	headroom = pcm->buffer_size - avail;
+	if (FAST_PCM_STATE(hw) == SND_PCM_STATE_DRAINING)
+		return headroom;
+	remain = pcm->avail_min > avail ? pcm->avail_min - avail : 0;
+	if (hw->period_event) {
+		snd_pcm_uframes_t boundary;
+		if (hw_ptr / pcm->period_size != hw->tsched_period_mark)
+			return 0;
+		boundary = pcm->period_size - hw_ptr % pcm->period_size;
+		if (boundary < remain)
+			remain = boundary;
+	}
+	wm = tsched_us_to_frames(pcm, hw->tsched_watermark);
+	if (headroom <= wm)
+		return 0;
+	if (headroom - wm < remain)
+		remain = headroom - wm;
+	return remain;
+}
+
+/* frames elapsed since the last driver timestamp; returns false if unknown */
+static bool snd_pcm_hw_tsched_predict(snd_pcm_t *pcm, snd_pcm_uframes_t *elapsed)
+{
+	snd_htimestamp_t now, tstamp;
+	long long ns;
+
+	if (pcm->tstamp_mode != SND_PCM_TSTAMP_ENABLE)
+		return false;
+	tstamp = snd_pcm_hw_fast_tstamp(pcm);
+	if (tstamp.tv_sec == 0 && tstamp.tv_nsec == 0)
+		return false;
+	gettimestamp(&now, pcm->tstamp_type);
+	ns = (now.tv_sec - tstamp.tv_sec) * 1000000000LL +
+	     (now.tv_nsec - tstamp.tv_nsec);
+	*elapsed = ns > 0 ? (ns * pcm->rate) / 1000000000LL : 0;
+	return true;
+}
+
+static int snd_pcm_hw_tsched_arm(snd_pcm_t *pcm)
+{
+	snd_pcm_hw_t *hw = pcm->private_data;
+	struct itimerspec its;
+	snd_pcm_uframes_t avail, remain, elapsed = 0;
+	unsigned long long us;
+	int err;
+
+	memset(&its, 0, sizeof(its));
+	switch (FAST_PCM_STATE(hw)) {
+	case SND_PCM_STATE_RUNNING:
+	case SND_PCM_STATE_DRAINING:
+		break;
+	default:
+		/* disarm */
+		goto __set;
+	}
+	if (!snd_pcm_hw_tsched_predict(pcm, &elapsed))
+		snd_pcm_hw_hwsync(pcm);
+	avail = snd_pcm_mmap_avail(pcm) + elapsed;
+	if (avail > pcm->buffer_size)
+		avail = pcm->buffer_size;
+	remain = snd_pcm_hw_tsched_remain(pcm, avail, *pcm->hw.ptr + elapsed);
+	us = tsched_frames_to_us(pcm, remain);
+	if (us == 0) {
+		/* zero it_value disarms the timer */
+		its.it_value.tv_nsec = 1;
+	} else {
+		its.it_value.tv_sec = us / 1000000;
+		its.it_value.tv_nsec = (us % 1000000) * 1000;
+	}
+ __set:
+	snd_pcm_stats_add(pcm, SND_PCM_STATS_SYSCALLS, 1);
+	if (timerfd_settime(hw->tsched_fd, 0, &its, NULL) < 0) {
+		err = -errno;
+		snd_checknum(PCM, "timerfd_settime failed (%i)", err);
+		return err;
+	}
+	return 0;
+}
+
+static void snd_pcm_hw_tsched_xrun(snd_pcm_t *pcm)
+{
+	snd_pcm_hw_t *hw = pcm->private_data;
+	unsigned long long max = tsched_frames_to_us(pcm, pcm->buffer_size / 2);
+
+	hw->tsched_watermark *= 2;
+	if (hw->tsched_watermark > max)
+		hw->tsched_watermark = max;
+	hw->tsched_clean_wakeups = 0;
+}
+
+/* poll events after a timer wakeup, the hw pointer must be synced */
+static unsigned int snd_pcm_hw_tsched_events(snd_pcm_t *pcm)
+{
+	snd_pcm_hw_t *hw = pcm->private_data;
+
+	switch (FAST_PCM_STATE(hw)) {
+	case SND_PCM_STATE_RUNNING:
+		if (snd_pcm_hw_tsched_remain(pcm, snd_pcm_mmap_avail(pcm),
+					     *pcm->hw.ptr) > 0)
+			return 0;
+		hw->tsched_period_mark = *pcm->hw.ptr / pcm->period_size;
+		if (hw->tsched_watermark > hw->tsched_watermark_min &&
+		    ++hw->tsched_clean_wakeups >= 64) {
+			hw->tsched_clean_wakeups = 0;
+			hw->tsched_watermark -= (hw->tsched_watermark -
+						 hw->tsched_watermark_min + 7) / 8;
+		}
+		return pcm->poll_events;
+	case SND_PCM_STATE_PREPARED:
+	case SND_PCM_STATE_PAUSED:
+	case SND_PCM_STATE_DRAINING:
+		return 0;
+	default:
+		return pcm->poll_events | POLLERR;
+	}
+}
+
+static int snd_pcm_hw_tsched_poll_descriptors(snd_pcm_t *pcm, struct pollfd *pfds, unsigned int space)
+{
+	snd_pcm_hw_t *hw = pcm->private_data;
+
+	if (space < 2)
+		return -ENOMEM;
+	pfds[0].fd = hw->fd;
+	pfds[0].events = pcm->poll_events | POLLERR | POLLNVAL;
+	pfds[1].fd = hw->tsched_fd;
+	pfds[1].events = POLLIN | POLLERR | POLLNVAL;
+	snd_pcm_hw_tsched_arm(pcm);
+	return 2;
+}
+
+static int snd_pcm_hw_tsched_poll_revents(snd_pcm_t *pcm, struct pollfd *pfds, unsigned nfds, unsigned short *revents)
+{
+	snd_pcm_hw_t *hw = pcm->private_data;
+	unsigned int events;
+	uint64_t expirations;
+
+	if (nfds != 2 || pfds[0].fd != hw->fd || pfds[1].fd != hw->tsched_fd)
+		return -EINVAL;
+	events = pfds[0].revents;
+	if (pfds[1].revents & POLLIN) {
+		if (read(hw->tsched_fd, &expirations, sizeof(expirations)) < 0 &&
+		    errno != EAGAIN)
+			snd_checknum(PCM, "timerfd read failed (%i)", -errno);
+		snd_pcm_hw_hwsync(pcm);
+		events |= snd_pcm_hw_tsched_events(pcm);
+		snd_pcm_hw_tsched_arm(pcm);
+	}
+	*revents = events;
+	return 0;
+}
+
+static int snd_pcm_hw_tsched_enable(snd_pcm_t *pcm)
+{
+	snd_pcm_hw_t *hw = pcm->private_data;
+	int err;
+
+	err = hw_set_nonblock(hw, 1);
+	if (err < 0)
+		return err;
+	snd_pcm_hw_close_timer(hw);
+	hw->period_event = 0;
+	hw->tsched_active = 1;
+	hw->tsched_watermark = hw->tsched_watermark_min;
+	hw->tsched_clean_wakeups = 0;
+	hw->tsched_period_mark = 0;
+	pcm->fast_ops = &snd_pcm_hw_fast_ops_tsched;
+	return 0;
+}
+
+static void snd_pcm_hw_tsched_disable(snd_pcm_t *pcm)
+{
+	snd_pcm_hw_t *hw = pcm->private_data;
+	struct itimerspec its;
+
+	if (!hw->tsched_active)
+		return;
+	hw->tsched_active = 0;
+	memset(&its, 0, sizeof(its));
+	timerfd_settime(hw->tsched_fd, 0, &its, NULL);
+	hw_set_nonblock(hw, !!(pcm->mode & SND_PCM_NONBLOCK));
+	if (pcm->fast_ops == &snd_pcm_hw_fast_ops_tsched)
+		pcm->fast_ops = &snd_pcm_hw_fast_ops;
+}
+#endif /* HAVE_SYS_TIMERFD_H */
+
 static int snd_pcm_hw_hw_free(snd_pcm_t *pcm)
 {
 	snd_pcm_hw_t *hw = pcm->private_data;
 	int fd = hw->fd, err;
 	snd_pcm_hw_change_timer(pcm, 0);
+#ifdef HAVE_SYS_TIMERFD_H
+	snd_pcm_hw_tsched_disable(pcm);
+#endif
 	if (ioctl(fd, SNDRV_PCM_IOCTL_HW_FREE) < 0) {
 		err = -errno;
 		snd_checknum(PCM, "SNDRV_PCM_IOCTL_HW_FREE failed (%i)", err);
@@ -573,9 +853,12 @@ static int snd_pcm_hw_sw_params(snd_pcm_t *pcm, snd_pcm_sw_params_t * params)
 	}
 	hw->mmap_control->avail_min = params->avail_min;
 	if (hw->period_event != old_period_event) {
-		err = snd_pcm_hw_change_timer(pcm, old_period_event);
-		if (err < 0)
-			goto out;
+		/* period events are emulated by the tsched timer */
+		if (!hw->tsched_active) {
+			err = snd_pcm_hw_change_timer(pcm, old_period_event);
+			if (err < 0)
+				goto out;
+		}
 		hw->period_event = old_period_event;
 	}
  out:
@@ -608,6 +891,7 @@ static int snd_pcm_hw_status(snd_pcm_t *pcm, snd_pcm_status_t * status)
 {
 	snd_pcm_hw_t *hw = pcm->private_data;
 	int fd = hw->fd, err;
+	snd_pcm_stats_add(pcm, SND_PCM_STATS_SYSCALLS, 1);
 	if (SNDRV_PROTOCOL_VERSION(2, 0, 13) > hw->version) {
 		if (ioctl(fd, SNDRV_PCM_IOCTL_STATUS, status) < 0) {
 			err = -errno;
@@ -642,6 +926,7 @@ static int snd_pcm_hw_delay(snd_pcm_t *pcm, snd_pcm_sframes_t *delayp)
 {
 	snd_pcm_hw_t *hw = pcm->private_data;
 	int fd = hw->fd, err;
+	snd_pcm_stats_add(pcm, SND_PCM_STATS_SYSCALLS, 1);
 	if (ioctl(fd, SNDRV_PCM_IOCTL_DELAY, delayp) < 0) {
 		err = -errno;
 		snd_checknum(PCM, "SNDRV_PCM_IOCTL_DELAY failed (%i)", err);
@@ -655,6 +940,7 @@ static int snd_pcm_hw_hwsync(snd_pcm_t *pcm)
 	snd_pcm_hw_t *hw = pcm->private_data;
 	int fd = hw->fd, err;
 	if (SNDRV_PROTOCOL_VERSION(2, 0, 3) <= hw->version) {
+		snd_pcm_stats_add(pcm, SND_PCM_STATS_SYSCALLS, 1);
 		if (hw->mmap_status_fallbacked) {
 			err = request_hwsync(hw);
 			if (err < 0)
@@ -697,6 +983,14 @@ static int snd_pcm_hw_prepare(snd_pcm_t *pcm)
 		}
 		hw->prepare_reset_sw_params = false;
 	}
+#ifdef HAVE_SYS_TIMERFD_H
+	if (hw->tsched_active) {
+		query_status_data(hw);
+		if (FAST_PCM_STATE(hw) == SND_PCM_STATE_XRUN)
+			snd_pcm_hw_tsched_xrun(pcm);
+		hw->tsched_period_mark = 0;
+	}
+#endif
 	if (ioctl(fd, SNDRV_PCM_IOCTL_PREPARE) < 0) {
 		err = -errno;
 		snd_checknum(PCM, "SNDRV_PCM_IOCTL_PREPARE failed (%i)", err);
@@ -945,6 +1239,7 @@ static snd_pcm_sframes_t snd_pcm_hw_writei(snd_pcm_t *pcm, const void *buffer, s
 	xferi.buf = (char*) buffer;
 	xferi.frames = size;
 	xferi.result = 0; /* make valgrind happy */
+	snd_pcm_stats_add(pcm, SND_PCM_STATS_SYSCALLS, 1);
 	if (ioctl(fd, SNDRV_PCM_IOCTL_WRITEI_FRAMES, &xferi) < 0)
 		err = -errno;
 	else
@@ -966,6 +1261,7 @@ static snd_pcm_sframes_t snd_pcm_hw_writen(snd_pcm_t *pcm, void **bufs, snd_pcm_
 	memset(&xfern, 0, sizeof(xfern)); /* make valgrind happy */
 	xfern.bufs = bufs;
 	xfern.frames = size;
+	snd_pcm_stats_add(pcm, SND_PCM_STATS_SYSCALLS, 1);
 	if (ioctl(fd, SNDRV_PCM_IOCTL_WRITEN_FRAMES, &xfern) < 0)
 		err = -errno;
 	else
@@ -987,6 +1283,7 @@ static snd_pcm_sframes_t snd_pcm_hw_readi(snd_pcm_t *pcm, void *buffer, snd_pcm_
 	xferi.buf = buffer;
 	xferi.frames = size;
 	xferi.result = 0; /* make valgrind happy */
+	snd_pcm_stats_add(pcm, SND_PCM_STATS_SYSCALLS, 1);
 	if (ioctl(fd, SNDRV_PCM_IOCTL_READI_FRAMES, &xferi) < 0)
 		err = -errno;
 	else
@@ -1008,6 +1305,7 @@ static snd_pcm_sframes_t snd_pcm_hw_readn(snd_pcm_t *pcm, void **bufs, snd_pcm_u
 	memset(&xfern, 0, sizeof(xfern)); /* make valgrind happy */
 	xfern.bufs = bufs;
 	xfern.frames = size;
+	snd_pcm_stats_add(pcm, SND_PCM_STATS_SYSCALLS, 1);
 	if (ioctl(fd, SNDRV_PCM_IOCTL_READN_FRAMES, &xfern) < 0)
 		err = -errno;
 	else
@@ -1179,6 +1477,8 @@ static int snd_pcm_hw_close(snd_pcm_t *pcm)
 
 	unmap_status_and_control_data(hw);
 
+	if (hw->tsched_fd >= 0)
+		close(hw->tsched_fd);
 	free(hw);
 	return err;
 }
@@ -1190,6 +1490,7 @@ static snd_pcm_sframes_t snd_pcm_hw_mmap_commit(snd_pcm_t *pcm,
 	snd_pcm_hw_t *hw = pcm->private_data;
 
 	snd_pcm_mmap_appl_forward(pcm, size);
+	snd_pcm_stats_add(pcm, SND_PCM_STATS_SYSCALLS, hw->mmap_control_fallbacked);
 	issue_applptr(hw);
 #ifdef DEBUG_MMAP
 	fprintf(stderr, "appl_forward: hw_ptr = %li, appl_ptr = %li, size = %li\n", *pcm->hw.ptr, *pcm->appl.ptr, size);
@@ -1202,6 +1503,7 @@ static snd_pcm_sframes_t snd_pcm_hw_avail_update(snd_pcm_t *pcm)
 	snd_pcm_hw_t *hw = pcm->private_data;
 	snd_pcm_uframes_t avail;
 
+	snd_pcm_stats_add(pcm, SND_PCM_STATS_SYSCALLS, hw->mmap_status_fallbacked);
 	query_status_data(hw);
 	avail = snd_pcm_mmap_avail(pcm);
 	switch (FAST_PCM_STATE(hw)) {
@@ -1209,6 +1511,7 @@ static snd_pcm_sframes_t snd_pcm_hw_avail_update(snd_pcm_t *pcm)
 		if (avail >= pcm->stop_threshold) {
 			/* SNDRV_PCM_IOCTL_XRUN ioctl has been implemented since PCM kernel API 2.0.1 */
 			if (SNDRV_PROTOCOL_VERSION(2, 0, 1) <= hw->version) {
+				snd_pcm_stats_add(pcm, SND_PCM_STATS_SYSCALLS, 1);
 				if (ioctl(hw->fd, SNDRV_PCM_IOCTL_XRUN) < 0)
 					return -errno;
 			}
@@ -1244,6 +1547,182 @@ static int snd_pcm_hw_htimestamp(snd_pcm_t *pcm, snd_pcm_uframes_t *avail,
 	return 0;
 }
 
+#ifdef HAVE_SYS_TIMERFD_H
+typedef snd_pcm_sframes_t (*hw_tsched_xfer_t)(snd_pcm_t *pcm, void *data,
+					      snd_pcm_uframes_t offset,
+					      snd_pcm_uframes_t size);
+
+static snd_pcm_sframes_t hw_tsched_writei(snd_pcm_t *pcm, void *data,
+					  snd_pcm_uframes_t offset,
+					  snd_pcm_uframes_t size)
+{
+	return snd_pcm_hw_writei(pcm, (char *)data + snd_pcm_frames_to_bytes(pcm, offset), size);
+}
+
+static snd_pcm_sframes_t hw_tsched_readi(snd_pcm_t *pcm, void *data,
+					 snd_pcm_uframes_t offset,
+					 snd_pcm_uframes_t size)
+{
+	return snd_pcm_hw_readi(pcm, (char *)data + snd_pcm_frames_to_bytes(pcm, offset), size);
+}
+
+static void **hw_tsched_offset_bufs(snd_pcm_t *pcm, void **bufs, void **obufs,
+				    snd_pcm_uframes_t offset)
+{
+	unsigned int c;
+
+	for (c = 0; c < pcm->channels; c++)
+		obufs[c] = bufs[c] ? (char *)bufs[c] + snd_pcm_samples_to_bytes(pcm, offset) : NULL;
+	return obufs;
+}
+
+static snd_pcm_sframes_t hw_tsched_writen(snd_pcm_t *pcm, void *data,
+					  snd_pcm_uframes_t offset,
+					  snd_pcm_uframes_t size)
+{
+	void **obufs = alloca(sizeof(void *) * pcm->channels);
+
+	return snd_pcm_hw_writen(pcm, hw_tsched_offset_bufs(pcm, data, obufs, offset), size);
+}
+
+static snd_pcm_sframes_t hw_tsched_readn(snd_pcm_t *pcm, void *data,
+					 snd_pcm_uframes_t offset,
+					 snd_pcm_uframes_t size)
+{
+	void **obufs = alloca(sizeof(void *) * pcm->channels);
+
+	return snd_pcm_hw_readn(pcm, hw_tsched_offset_bufs(pcm, data, obufs, offset), size);
+}
+
+/*
+ * the file descriptor is always non-blocking in the tsched mode,
+ * the blocking behavior is emulated using the timer wakeups
+ */
+static snd_pcm_sframes_t snd_pcm_hw_tsched_xfer(snd_pcm_t *pcm, void *data,
+						snd_pcm_uframes_t size,
+						hw_tsched_xfer_t func)
+{
+	snd_pcm_uframes_t xfer = 0;
+	snd_pcm_sframes_t frames = 0;
+	int err;
+
+	while (size > 0) {
+		frames = func(pcm, data, xfer, size);
+		if (frames > 0) {
+			xfer += frames;
+			size -= frames;
+			continue;
+		}
+		if (frames != -EAGAIN || (pcm->mode & SND_PCM_NONBLOCK))
+			break;
+		err = snd_pcm_wait_nocheck(pcm, SND_PCM_WAIT_IO);
+		if (err < 0) {
+			frames = err;
+			break;
+		}
+	}
+	snd_pcm_hw_tsched_arm(pcm);
+	return xfer > 0 ? (snd_pcm_sframes_t)xfer : frames;
+}
+
+static snd_pcm_sframes_t snd_pcm_hw_tsched_writei(snd_pcm_t *pcm, const void *buffer, snd_pcm_uframes_t size)
+{
+	return snd_pcm_hw_tsched_xfer(pcm, (void *)buffer, size, hw_tsched_writei);
+}
+
+static snd_pcm_sframes_t snd_pcm_hw_tsched_writen(snd_pcm_t *pcm, void **bufs, snd_pcm_uframes_t size)
+{
+	return snd_pcm_hw_tsched_xfer(pcm, bufs, size, hw_tsched_writen);
+}
+
+static snd_pcm_sframes_t snd_pcm_hw_tsched_readi(snd_pcm_t *pcm, void *buffer, snd_pcm_uframes_t size)
+{
+	return snd_pcm_hw_tsched_xfer(pcm, buffer, size, hw_tsched_readi);
+}
+
+static snd_pcm_sframes_t snd_pcm_hw_tsched_readn(snd_pcm_t *pcm, void **bufs, snd_pcm_uframes_t size)
+{
+	return snd_pcm_hw_tsched_xfer(pcm, bufs, size, hw_tsched_readn);
+}
+
+static snd_pcm_sframes_t snd_pcm_hw_tsched_mmap_commit(snd_pcm_t *pcm,
+						       snd_pcm_uframes_t offset,
+						       snd_pcm_uframes_t size)
+{
+	snd_pcm_sframes_t result = snd_pcm_hw_mmap_commit(pcm, offset, size);
+
+	snd_pcm_hw_tsched_arm(pcm);
+	return result;
+}
+
+static int snd_pcm_hw_tsched_start(snd_pcm_t *pcm)
+{
+	snd_pcm_hw_t *hw = pcm->private_data;
+	int err = snd_pcm_hw_start(pcm);
+
+	if (err < 0)
+		return err;
+	hw->tsched_period_mark = *pcm->hw.ptr / pcm->period_size;
+	return snd_pcm_hw_tsched_arm(pcm);
+}
+
+static int snd_pcm_hw_tsched_pause(snd_pcm_t *pcm, int enable)
+{
+	int err = snd_pcm_hw_pause(pcm, enable);
+
+	if (err < 0)
+		return err;
+	return snd_pcm_hw_tsched_arm(pcm);
+}
+
+static int snd_pcm_hw_tsched_resume(snd_pcm_t *pcm)
+{
+	int err = snd_pcm_hw_resume(pcm);
+
+	if (err < 0)
+		return err;
+	return snd_pcm_hw_tsched_arm(pcm);
+}
+
+static int snd_pcm_hw_tsched_drain(snd_pcm_t *pcm)
+{
+	snd_pcm_hw_t *hw = pcm->private_data;
+	struct pollfd pfd;
+	uint64_t expirations;
+	int err;
+
+	/* returns -EAGAIN when the stream enters the draining state */
+	err = snd_pcm_hw_drain(pcm);
+	if (err != -EAGAIN)
+		return err;
+	if (pcm->mode & SND_PCM_NONBLOCK) {
+		snd_pcm_hw_tsched_arm(pcm);
+		return err;
+	}
+	/* no period interrupt finishes the drain, sync the hw pointer */
+	pfd.fd = hw->tsched_fd;
+	pfd.events = POLLIN;
+	while (1) {
+		snd_pcm_hw_hwsync(pcm);
+		if (FAST_PCM_STATE(hw) != SND_PCM_STATE_DRAINING)
+			break;
+		err = snd_pcm_hw_tsched_arm(pcm);
+		if (err < 0)
+			return err;
+		if (poll(&pfd, 1, -1) < 0) {
+			err = -errno;
+			if (err == -EINTR && !(pcm->mode & SND_PCM_EINTR))
+				continue;
+			return err;
+		}
+		if (read(hw->tsched_fd, &expirations, sizeof(expirations)) < 0 &&
+		    errno != EAGAIN)
+			snd_checknum(PCM, "timerfd read failed (%i)", -errno);
+	}
+	return 0;
+}
+#endif /* HAVE_SYS_TIMERFD_H */
+
 static void __fill_chmap_ctl_id(snd_ctl_elem_id_t *id, int dev, int subdev,
 				int stream)
 {
@@ -1521,6 +2000,8 @@ static void snd_pcm_hw_dump(snd_pcm_t *pcm, snd_output_t *out)
 		snd_pcm_dump_setup(pcm, out);
 		snd_output_printf(out, "  appl_ptr     : %li\n", hw->mmap_control->appl_ptr);
 		snd_output_printf(out, "  hw_ptr       : %li\n", hw->mmap_status->hw_ptr);
+		if (hw->tsched_active)
+			snd_output_printf(out, "  tsched wmark : %u us\n", hw->tsched_watermark);
 	}
 }
 
@@ -1604,6 +2085,39 @@ static const snd_pcm_fast_ops_t snd_pcm_hw_fast_ops_timer = {
 	.poll_revents = snd_pcm_hw_poll_revents,
 };
 
+#ifdef HAVE_SYS_TIMERFD_H
+static const snd_pcm_fast_ops_t snd_pcm_hw_fast_ops_tsched = {
+	.status = snd_pcm_hw_status,
+	.state = snd_pcm_hw_state,
+	.hwsync = snd_pcm_hw_hwsync,
+	.delay = snd_pcm_hw_delay,
+	.prepare = snd_pcm_hw_prepare,
+	.reset = snd_pcm_hw_reset,
+	.start = snd_pcm_hw_tsched_start,
+	.drop = snd_pcm_hw_drop,
+	.drain = snd_pcm_hw_tsched_drain,
+	.pause = snd_pcm_hw_tsched_pause,
+	.rewindable = snd_pcm_hw_rewindable,
+	.rewind = snd_pcm_hw_rewind,
+	.forwardable = snd_pcm_hw_forwardable,
+	.forward = snd_pcm_hw_forward,
+	.resume = snd_pcm_hw_tsched_resume,
+	.link = snd_pcm_hw_link,
+	.link_slaves = snd_pcm_hw_link_slaves,
+	.unlink = snd_pcm_hw_unlink,
+	.writei = snd_pcm_hw_tsched_writei,
+	.writen = snd_pcm_hw_tsched_writen,
+	.readi = snd_pcm_hw_tsched_readi,
+	.readn = snd_pcm_hw_tsched_readn,
+	.avail_update = snd_pcm_hw_avail_update,
+	.mmap_commit = snd_pcm_hw_tsched_mmap_commit,
+	.htimestamp = snd_pcm_hw_htimestamp,
+	.poll_descriptors = snd_pcm_hw_tsched_poll_descriptors,
+	.poll_descriptors_count = snd_pcm_hw_poll_descriptors_count,
+	.poll_revents = snd_pcm_hw_tsched_poll_revents,
+};
+#endif
+
 /**
  * \brief Creates a new hw PCM
  * \param pcmp Returns created PCM handle
@@ -1709,6 +2223,7 @@ int snd_pcm_hw_open_fd(snd_pcm_t **pcmp, const char *name, int fd,
 	hw->format = SND_PCM_FORMAT_UNKNOWN;
 	hw->rates.min = hw->rates.max = 0;
 	hw->channels = 0;
+	hw->tsched_fd = -1;
 
 	ret = snd_pcm_new(&pcm, SND_PCM_TYPE_HW, name, info.stream, mode);
 	if (ret < 0) {
@@ -1727,6 +2242,7 @@ int snd_pcm_hw_open_fd(snd_pcm_t **pcmp, const char *name, int fd,
 	pcm->need_lock = 0;	/* hw plugin is thread-safe */
 #endif
 	pcm->own_state_check = 1; /* skip the common state check */
+	pcm->volatile_refine = 1; /* other streams may lock the device */
 
 	ret = map_status_and_control_data(pcm, !!sync_ptr_ioctl);
 	if (ret < 0) {
@@ -1857,9 +2373,20 @@ pcm.name {
 	  or [rate [INT INT]]	# Restrict only to the given rate range (min max)
 	[chmap MAP]		# Override channel maps; MAP is a string array
 	[drain_silence INT]	# Add silence in drain (-1 = auto /default/, 0 = off, > 0 milliseconds)
+	[tsched BOOL]		# Timer-based scheduling (default off)
+	[tsched_watermark INT]	# Minimal wakeup margin in milliseconds, > 0 (default 20)
 }
 \endcode
 
+With the tsched option, the driver is asked to disable the period
+interrupts (if supported) and the wakeups are driven by a timer which
+predicts the hardware position from the driver timestamps. The wakeup
+is scheduled at the avail_min point, but never later than the watermark
+before the ring buffer runs out (playback) or overflows (capture). The
+watermark is raised after each xrun. This mode saves the CPU and power
+with large buffers and rare wakeups. The blocking mode, poll, drain and
+the period events work as usual for the application.
+
 \subsection pcm_plugins_hw_funcref Function reference
 
 <UL>
@@ -1890,6 +2417,7 @@ int _snd_pcm_hw_open(snd_pcm_t **pcmp, const char *name,
 	const char *str;
 	int err, sync_ptr_ioctl = 0;
 	int min_rate = 0, max_rate = 0, channels = 0, drain_silence = -1;
+	int tsched = 0, tsched_watermark = 20;
 	snd_pcm_format_t format = SND_PCM_FORMAT_UNKNOWN;
 	snd_config_t *n;
 	int nonblock = 1; /* non-block per default */
@@ -2040,6 +2568,25 @@ int _snd_pcm_hw_open(snd_pcm_t **pcmp, const char *name,
 			drain_silence = val;
 			continue;
 		}
+		if (strcmp(id, "tsched") == 0) {
+			err = snd_config_get_bool(n);
+			if (err < 0)
+				continue;
+			tsched = err;
+			continue;
+		}
+		if (strcmp(id, "tsched_watermark") == 0) {
+			long val;
+			err = snd_config_get_integer(n, &val);
+			/* a zero margin would never grow on xruns */
+			if (err < 0 || val <= 0) {
+				snd_error(PCM, "Invalid value for %s", id);
+				err = -EINVAL;
+				goto fail;
+			}
+			tsched_watermark = val;
+			continue;
+		}
 		snd_error(PCM, "Unknown field %s", id);
 		err = -EINVAL;
 		goto fail;
@@ -2083,6 +2630,13 @@ int _snd_pcm_hw_open(snd_pcm_t **pcmp, const char *name,
 	if (chmap)
 		hw->chmap_override = chmap;
 	hw->drain_silence = drain_silence;
+#ifdef HAVE_SYS_TIMERFD_H
+	hw->tsched = tsched;
+	hw->tsched_watermark_min = tsched_watermark * 1000;
+#else
+	if (tsched)
+		snd_warn(PCM, "timer-based scheduling is not supported");
+#endif
 
 	return 0;
 
@@ -63,6 +63,10 @@ struct snd_pcm_iec958 {
 	unsigned char preamble[3];	/* B/M/W or Z/X/Y */
 	snd_pcm_fast_ops_t fops;
 	int hdmi_mode;
+	/* preamble and channel status bit of each frame in the block,
+	 * for the first (X/Z) and the other (Y) sub frames
+	 */
+	uint32_t block_bits[2][192];
 };
 
 enum { PREAMBLE_Z, PREAMBLE_X, PREAMBLE_Y };
@@ -74,19 +78,19 @@ enum { PREAMBLE_Z, PREAMBLE_X, PREAMBLE_Y };
  * to be sure that bit 4 upt 31 will carry
  * an even number of ones and zeros.
  */
-static unsigned int iec958_parity(unsigned int data)
+static inline unsigned int iec958_parity(unsigned int data)
 {
-	unsigned int parity;
-	int bit;
-
-	data >>= 4;     /* start from bit 4 */
-	parity = 0;
-	for (bit = 4; bit <= 30; bit++) {
-		if (data & 1)
-			parity++;
-		data >>= 1;
-	}
-	return (parity & 1);
+	data &= 0x7ffffff0;
+#if defined(__GNUC__)
+	return __builtin_parity(data);
+#else
+	data ^= data >> 16;
+	data ^= data >> 8;
+	data ^= data >> 4;
+	data ^= data >> 2;
+	data ^= data >> 1;
+	return data & 1;
+#endif
 }
 
 /*
@@ -102,33 +106,39 @@ static unsigned int iec958_parity(unsigned int data)
  *     31   = parity
  */
 
-static inline uint32_t iec958_subframe(snd_pcm_iec958_t *iec, uint32_t data, int channel)
+/*
+ * Precompute the preamble and the channel status bit (up to 192 bits)
+ * of each sub frame in a block; called whenever the status changes
+ */
+static void iec958_build_block(snd_pcm_iec958_t *iec)
 {
-	unsigned int byte = iec->counter >> 3;
-	unsigned int mask = 1 << (iec->counter - (byte << 3));
+	unsigned int counter;
+	uint32_t status;
+
+	for (counter = 0; counter < 192; counter++) {
+		status = 0;
+		if (iec->status[counter >> 3] & (1 << (counter & 7)))
+			status = 0x40000000;
+		if (counter)
+			iec->block_bits[0][counter] = status | iec->preamble[PREAMBLE_X];	/* even sub frame, 'X' */
+		else
+			iec->block_bits[0][counter] = status | iec->preamble[PREAMBLE_Z];	/* Block start, 'Z' */
+		iec->block_bits[1][counter] = status | iec->preamble[PREAMBLE_Y];	/* odd sub frame, 'Y' */
+	}
+}
 
+static inline uint32_t iec958_subframe(uint32_t data, uint32_t bits)
+{
 	/* bit 4-27 */
 	data >>= 4;
 	data &= ~0xf;
 
-	/* set IEC status bits (up to 192 bits) */
-	if (iec->status[byte] & mask)
-		data |= 0x40000000;
+	/* preamble and status bit */
+	data |= bits;
 
 	if (iec958_parity(data))	/* parity bit 4-30 */
 		data |= 0x80000000;
 
-	/* Preamble */
-	if (channel)
-		data |= iec->preamble[PREAMBLE_Y];	/* odd sub frame, 'Y' */
-	else if (! iec->counter)
-		data |= iec->preamble[PREAMBLE_Z];	/* Block start, 'Z' */
-	else
-		data |= iec->preamble[PREAMBLE_X];	/* even sub frame, 'X' */
-
-	if (iec->byteswap)
-		data = bswap_32(data);
-
 	return data;
 }
 
@@ -192,11 +202,12 @@ static void snd_pcm_iec958_encode(snd_pcm_iec958_t *iec,
 	void *get = get32_labels[iec->getput_idx];
 	unsigned int channel;
 	int32_t sample = 0;
-	int counter = iec->counter;
+	unsigned int counter = iec->counter;
 	int single_stream = iec->hdmi_mode &&
 			    (iec->status[0] & IEC958_AES0_NONAUDIO) &&
 			    (channels == 8);
-	int counter_step = single_stream ? ((channels + 1) >> 1) : 1;
+	unsigned int counter_step = single_stream ? ((channels + 1) >> 1) : 1;
+	unsigned int byteswap = iec->byteswap;
 	for (channel = 0; channel < channels; ++channel) {
 		const char *src;
 		uint32_t *dst;
@@ -204,6 +215,8 @@ static void snd_pcm_iec958_encode(snd_pcm_iec958_t *iec,
 		snd_pcm_uframes_t frames1;
 		const snd_pcm_channel_area_t *src_area = &src_areas[channel];
 		const snd_pcm_channel_area_t *dst_area = &dst_areas[channel];
+		const uint32_t *bits = iec->block_bits[channel ? 1 : 0];
+		unsigned int c;
 		src = snd_pcm_channel_area_addr(src_area, src_offset);
 		dst = snd_pcm_channel_area_addr(dst_area, dst_offset);
 		src_step = snd_pcm_channel_area_step(src_area);
@@ -211,27 +224,29 @@ static void snd_pcm_iec958_encode(snd_pcm_iec958_t *iec,
 		frames1 = frames;
 
 		if (single_stream)
-			iec->counter = (counter + (channel >> 1)) % 192;
+			c = (counter + (channel >> 1)) % 192;
 		else
-			iec->counter = counter;
+			c = counter;
 
 		while (frames1-- > 0) {
+			uint32_t data;
 			goto *get;
 #define GET32_END after
 #include "plugin_ops.h"
 #undef GET32_END
 		after:
-			sample = iec958_subframe(iec, sample, channel);
-			// fprintf(stderr, "%d:%08x\n", frames1, sample);
-			*dst = sample;
+			data = iec958_subframe(sample, bits[c]);
+			if (byteswap)
+				data = bswap_32(data);
+			*dst = data;
 			src += src_step;
 			dst += dst_step;
-			iec->counter += counter_step;
-			iec->counter %= 192;
+			c += counter_step;
+			if (c >= 192)
+				c -= 192;
 		}
-		if (single_stream) /* set counter to ch0 value for next iteration */
-			iec->counter = (counter + frames * counter_step) % 192;
 	}
+	iec->counter = (counter + frames * counter_step) % 192;
 }
 #endif /* DOC_HIDDEN */
 
@@ -438,6 +453,7 @@ static int snd_pcm_iec958_hw_params(snd_pcm_t *pcm, snd_pcm_hw_params_t * params
 			iec->status[4] |= ws;
 		}
 	}
+	iec958_build_block(iec);
 	return 0;
 }
 
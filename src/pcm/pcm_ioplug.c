@@ -30,6 +30,7 @@
 #include "pcm_ioplug.h"
 #include "pcm_ext_parm.h"
 #include "pcm_generic.h"
+#include <sys/mman.h>
 
 #ifndef PIC
 /* entry for static linking */
@@ -45,6 +46,13 @@ typedef struct snd_pcm_ioplug_priv {
 	snd_pcm_uframes_t last_hw;
 	snd_pcm_uframes_t avail_max;
 	snd_htimestamp_t trigger_tstamp;
+	/* shared memory ring registered by the plugin */
+	snd_pcm_ioplug_shm_ring_t *ring;
+	int ring_fd;
+	size_t ring_offset;
+	size_t ring_size;
+	snd_pcm_uframes_t ring_hw;	/* last seen free-running hw position */
+	snd_pcm_uframes_t ring_appl;	/* published free-running appl position */
 } ioplug_priv_t;
 
 static int snd_pcm_ioplug_drop(snd_pcm_t *pcm);
@@ -52,26 +60,73 @@ static int snd_pcm_ioplug_poll_descriptors_count(snd_pcm_t *pcm);
 static int snd_pcm_ioplug_poll_descriptors(snd_pcm_t *pcm, struct pollfd *pfds, unsigned int space);
 static int snd_pcm_ioplug_poll_revents(snd_pcm_t *pcm, struct pollfd *pfds, unsigned int nfds, unsigned short *revents);
 
+/* publish the application position to the shared ring */
+/* called in lock */
+static void snd_pcm_ioplug_ring_appl_forward(ioplug_priv_t *io,
+					     snd_pcm_sframes_t frames)
+{
+	if (!io->ring)
+		return;
+	io->ring_appl += frames;
+	__atomic_store_n(&io->ring->appl_ptr, io->ring_appl, __ATOMIC_RELEASE);
+}
+
+/* resynchronize the ring positions; the transport must be stopped */
+static void snd_pcm_ioplug_ring_reset(ioplug_priv_t *io)
+{
+	if (!io->ring)
+		return;
+	io->ring_hw = __atomic_load_n(&io->ring->hw_ptr, __ATOMIC_ACQUIRE);
+	io->ring_appl = io->ring_hw;
+	__atomic_store_n(&io->ring->error, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&io->ring->appl_ptr, io->ring_appl, __ATOMIC_RELEASE);
+}
+
+static void snd_pcm_ioplug_ring_unmap(ioplug_priv_t *io)
+{
+	if (!io->ring)
+		return;
+	munmap(io->ring, page_align(sizeof(*io->ring)));
+	io->ring = NULL;
+}
+
 /* update the hw pointer */
 /* called in lock */
 static void snd_pcm_ioplug_hw_ptr_update(snd_pcm_t *pcm)
 {
 	ioplug_priv_t *io = pcm->private_data;
+	snd_pcm_uframes_t delta = 0;
 	snd_pcm_sframes_t hw;
 
-	hw = io->data->callback->pointer(io->data);
+	if (io->ring) {
+		/* read the position published by the transport, no callback */
+		hw = __atomic_load_n(&io->ring->error, __ATOMIC_ACQUIRE);
+		if (hw >= 0) {
+			snd_pcm_uframes_t pos;
+
+			pos = __atomic_load_n(&io->ring->hw_ptr, __ATOMIC_ACQUIRE);
+			delta = pos - io->ring_hw;
+			io->ring_hw = pos;
+		}
+	} else {
+		if (!io->data->callback->pointer)
+			return;
+		hw = io->data->callback->pointer(io->data);
+		if (hw >= 0) {
+			if ((snd_pcm_uframes_t)hw >= io->last_hw)
+				delta = hw - io->last_hw;
+			else {
+				const snd_pcm_uframes_t wrap_point =
+					(io->data->flags & SND_PCM_IOPLUG_FLAG_BOUNDARY_WA) ?
+						pcm->boundary : pcm->buffer_size;
+				delta = wrap_point + hw - io->last_hw;
+			}
+			io->last_hw = (snd_pcm_uframes_t)hw;
+		}
+	}
 	if (hw >= 0) {
-		snd_pcm_uframes_t delta;
 		snd_pcm_uframes_t avail;
 
-		if ((snd_pcm_uframes_t)hw >= io->last_hw)
-			delta = hw - io->last_hw;
-		else {
-			const snd_pcm_uframes_t wrap_point =
-				(io->data->flags & SND_PCM_IOPLUG_FLAG_BOUNDARY_WA) ?
-					pcm->boundary : pcm->buffer_size;
-			delta = wrap_point + hw - io->last_hw;
-		}
 		snd_pcm_mmap_hw_forward(io->data->pcm, delta);
 		/* stop the stream if all samples are drained */
 		if (io->data->state == SND_PCM_STATE_DRAINING) {
@@ -79,7 +134,6 @@ static void snd_pcm_ioplug_hw_ptr_update(snd_pcm_t *pcm)
 			if (avail >= pcm->buffer_size)
 				snd_pcm_ioplug_drop(pcm);
 		}
-		io->last_hw = (snd_pcm_uframes_t)hw;
 	} else {
 		if (io->data->state == SND_PCM_STATE_DRAINING)
 			snd_pcm_ioplug_drop(pcm);
@@ -104,7 +158,20 @@ static int snd_pcm_ioplug_info(snd_pcm_t *pcm, snd_pcm_info_t *info)
 
 static int snd_pcm_ioplug_channel_info(snd_pcm_t *pcm, snd_pcm_channel_info_t *info)
 {
-	return snd_pcm_channel_info_shm(pcm, info, -1);
+	ioplug_priv_t *io = pcm->private_data;
+	int err;
+
+	err = snd_pcm_channel_info_shm(pcm, info, -1);
+	if (err < 0 || !io->ring)
+		return err;
+	/* map the sample data of the shared ring directly */
+	if (pcm->access == SND_PCM_ACCESS_MMAP_NONINTERLEAVED ||
+	    pcm->access == SND_PCM_ACCESS_RW_NONINTERLEAVED)
+		info->first = info->channel * pcm->buffer_size * pcm->sample_bits;
+	info->type = SND_PCM_AREA_MMAP;
+	info->u.mmap.fd = io->ring_fd;
+	info->u.mmap.offset = io->ring_offset + io->ring->data_offset;
+	return 0;
 }
 
 static int snd_pcm_ioplug_delay(snd_pcm_t *pcm, snd_pcm_sframes_t *delayp)
@@ -161,6 +228,7 @@ static int snd_pcm_ioplug_reset(snd_pcm_t *pcm)
 	io->data->hw_ptr = 0;
 	io->last_hw = 0;
 	io->avail_max = 0;
+	snd_pcm_ioplug_ring_reset(io);
 	return 0;
 }
 
@@ -450,6 +518,26 @@ static int snd_pcm_ioplug_hw_params(snd_pcm_t *pcm, snd_pcm_hw_params_t *params)
 		INTERNAL(snd_pcm_hw_params_get_period_size)(params, &io->data->period_size, 0);
 		INTERNAL(snd_pcm_hw_params_get_buffer_size)(params, &io->data->buffer_size);
 	}
+	if (io->ring) {
+		snd_pcm_ioplug_shm_ring_t *ring = io->ring;
+		size_t bytes;
+
+		bytes = ((size_t)snd_pcm_format_physical_width(io->data->format) *
+			 io->data->channels * io->data->buffer_size + 7) / 8;
+		if (io->ring_size < ring->data_offset + bytes) {
+			snd_error(PCM, "ioplug: shm ring too small (%zu < %zu)",
+				  io->ring_size, ring->data_offset + bytes);
+			return -EINVAL;
+		}
+		ring->access = io->data->access;
+		ring->format = io->data->format;
+		ring->channels = io->data->channels;
+		ring->rate = io->data->rate;
+		ring->buffer_size = io->data->buffer_size;
+	} else if (!io->data->callback->pointer) {
+		snd_error(PCM, "ioplug: neither pointer callback nor shm ring");
+		return -EINVAL;
+	}
 	return 0;
 }
 
@@ -605,6 +693,7 @@ static snd_pcm_sframes_t snd_pcm_ioplug_rewindable(snd_pcm_t *pcm)
 static snd_pcm_sframes_t snd_pcm_ioplug_rewind(snd_pcm_t *pcm, snd_pcm_uframes_t frames)
 {
 	snd_pcm_mmap_appl_backward(pcm, frames);
+	snd_pcm_ioplug_ring_appl_forward(pcm->private_data, -(snd_pcm_sframes_t)frames);
 	return frames;
 }
 
@@ -616,6 +705,7 @@ static snd_pcm_sframes_t snd_pcm_ioplug_forwardable(snd_pcm_t *pcm)
 static snd_pcm_sframes_t snd_pcm_ioplug_forward(snd_pcm_t *pcm, snd_pcm_uframes_t frames)
 {
 	snd_pcm_mmap_appl_forward(pcm, frames);
+	snd_pcm_ioplug_ring_appl_forward(pcm->private_data, frames);
 	return frames;
 }
 
@@ -644,8 +734,10 @@ static snd_pcm_sframes_t ioplug_priv_transfer_areas(snd_pcm_t *pcm,
 		result = io->data->callback->transfer(io->data, areas, offset, size);
 	else
 		result = size;
-	if (result > 0)
+	if (result > 0) {
 		snd_pcm_mmap_appl_forward(pcm, result);
+		snd_pcm_ioplug_ring_appl_forward(io, result);
+	}
 	return result;
 }
 
@@ -709,7 +801,7 @@ static int snd_pcm_ioplug_mmap_begin_capture(snd_pcm_t *pcm,
 	if (err < 0)
 		return err;
 
-	if (io->data->callback->transfer &&
+	if (io->data->callback->transfer && !io->ring &&
 	    pcm->access != SND_PCM_ACCESS_RW_INTERLEAVED &&
 	    pcm->access != SND_PCM_ACCESS_RW_NONINTERLEAVED) {
 		snd_pcm_sframes_t result;
@@ -733,6 +825,14 @@ static snd_pcm_sframes_t snd_pcm_ioplug_mmap_commit(snd_pcm_t *pcm,
 						    snd_pcm_uframes_t offset,
 						    snd_pcm_uframes_t size)
 {
+	ioplug_priv_t *io = pcm->private_data;
+
+	if (io->ring) {
+		/* the data is already in the shared ring */
+		snd_pcm_mmap_appl_forward(pcm, size);
+		snd_pcm_ioplug_ring_appl_forward(io, size);
+		return size;
+	}
 	if (pcm->stream == SND_PCM_STREAM_PLAYBACK &&
 	    pcm->access != SND_PCM_ACCESS_RW_INTERLEAVED &&
 	    pcm->access != SND_PCM_ACCESS_RW_NONINTERLEAVED) {
@@ -881,6 +981,9 @@ static void snd_pcm_ioplug_dump(snd_pcm_t *pcm, snd_output_t *out)
 			snd_output_printf(out, "%s\n", io->data->name);
 		else
 			snd_output_printf(out, "IO-PCM Plugin\n");
+		if (io->ring)
+			snd_output_printf(out, "Shared memory ring: fd %d, offset %zu, size %zu\n",
+					  io->ring_fd, io->ring_offset, io->ring_size);
 		if (pcm->setup) {
 			snd_output_printf(out, "Its setup is:\n");
 			snd_pcm_dump_setup(pcm, out);
@@ -900,6 +1003,7 @@ static int snd_pcm_ioplug_close(snd_pcm_t *pcm)
 	ioplug_priv_t *io = pcm->private_data;
 
 	clear_io_params(io);
+	snd_pcm_ioplug_ring_unmap(io);
 	if (io->data->callback->close)
 		io->data->callback->close(io->data);
 	free(io);
@@ -1002,6 +1106,20 @@ When poll_fd, poll_events and mmap_rw fields are changed after
 #snd_pcm_ioplug_create(), call #snd_pcm_ioplug_reinit_status() to
 reflect the changes.
 
+Alternatively, a plugin bridging to another process can register a
+shared memory ring via #snd_pcm_ioplug_set_shm_ring(), typically a
+memfd which is also mapped by the peer.  The ring begins with a
+#snd_pcm_ioplug_shm_ring_t control block, and the sample data follows
+at its data_offset, either interleaved or, for non-interleaved access,
+as consecutive per-channel blocks of buffer_size samples.  The mmap
+areas of the PCM are mapped from the ring itself, so the application
+reads or writes the shared memory without an intermediate copy, and
+the transfer callback is not called.  alsa-lib publishes the
+application position in appl_ptr, and the peer publishes its position
+in hw_ptr; both are free-running frame counters updated with release
+semantics, so no pointer callback is needed.  The peer may store a
+negative error code to the error field to report an XRUN.
+
 The driver can set an arbitrary value (pointer) to private_data
 field to refer its own data in the callbacks.
 
@@ -1068,7 +1186,9 @@ To clear the parameter constraints, call #snd_pcm_ioplug_params_reset() function
  * Creates the ioplug instance.
  *
  * The callback is the mandatory field of ioplug handle.  At least, start, stop and
- * pointer callbacks must be set before calling this function.
+ * pointer callbacks must be set before calling this function.  The pointer
+ * callback may be omitted when the plugin registers a shared memory ring via
+ * #snd_pcm_ioplug_set_shm_ring() before the hw_params are set.
  *
  */
 int snd_pcm_ioplug_create(snd_pcm_ioplug_t *ioplug, const char *name,
@@ -1080,8 +1200,9 @@ int snd_pcm_ioplug_create(snd_pcm_ioplug_t *ioplug, const char *name,
 
 	assert(ioplug && ioplug->callback);
 	assert(ioplug->callback->start &&
-	       ioplug->callback->stop &&
-	       ioplug->callback->pointer);
+	       ioplug->callback->stop);
+	/* pointer may be replaced by a shared memory ring since 1.0.3 */
+	assert(ioplug->callback->pointer || ioplug->version >= 0x010003);
 
 	/* We support 1.0.0 to current */
 	if (ioplug->version < 0x010000 ||
@@ -1204,13 +1325,15 @@ int snd_pcm_ioplug_set_param_minmax(snd_pcm_ioplug_t *ioplug, int type, unsigned
  */
 int snd_pcm_ioplug_reinit_status(snd_pcm_ioplug_t *ioplug)
 {
+	ioplug_priv_t *io = ioplug->pcm->private_data;
+
 	ioplug->pcm->poll_fd = ioplug->poll_fd;
 	ioplug->pcm->poll_events = ioplug->poll_events;
 	if (ioplug->flags & SND_PCM_IOPLUG_FLAG_MONOTONIC)
 		ioplug->pcm->tstamp_type = SND_PCM_TSTAMP_TYPE_MONOTONIC;
 	else
 		ioplug->pcm->tstamp_type = SND_PCM_TSTAMP_TYPE_GETTIMEOFDAY;
-	ioplug->pcm->mmap_rw = ioplug->mmap_rw;
+	ioplug->pcm->mmap_rw = ioplug->mmap_rw || io->ring;
 	return 0;
 }
 
@@ -1219,16 +1342,70 @@ int snd_pcm_ioplug_reinit_status(snd_pcm_ioplug_t *ioplug)
  * \param ioplug the ioplug handle
  * \return the mmap channel areas if available, or NULL
  *
- * Returns the mmap channel areas if available.  When mmap_rw field is not set,
- * this function always returns NULL.
+ * Returns the mmap channel areas if available.  When neither mmap_rw field is
+ * set nor a shared memory ring is registered, this function always returns NULL.
  */
 const snd_pcm_channel_area_t *snd_pcm_ioplug_mmap_areas(snd_pcm_ioplug_t *ioplug)
 {
-	if (ioplug->mmap_rw)
+	ioplug_priv_t *io = ioplug->pcm->private_data;
+
+	if (ioplug->mmap_rw || io->ring)
 		return snd_pcm_mmap_areas(ioplug->pcm);
 	return NULL;
 }
 
+/**
+ * \brief Register a shared memory ring as the PCM buffer
+ * \param ioplug the ioplug handle
+ * \param fd file descriptor of the shared memory (e.g. memfd), or -1 to unregister
+ * \param offset page-aligned offset of the ring in the file
+ * \param size size of the ring in bytes
+ * \return 0 if successful, or a negative error code
+ *
+ * The ring starts with a #snd_pcm_ioplug_shm_ring_t control block followed
+ * by the sample data at its data_offset.  The application's mmap areas and
+ * the read/write paths use the data area directly, and the hw pointer is
+ * taken from the control block instead of the pointer callback.
+ * The fd stays owned by the plugin and must be kept open while registered.
+ *
+ * The function can be called at open or from the hw_params callback; the
+ * size is checked against the buffer size when the hw_params are set.
+ */
+int snd_pcm_ioplug_set_shm_ring(snd_pcm_ioplug_t *ioplug, int fd,
+				size_t offset, size_t size)
+{
+	ioplug_priv_t *io = ioplug->pcm->private_data;
+	size_t hdr_size = page_align(sizeof(snd_pcm_ioplug_shm_ring_t));
+	snd_pcm_ioplug_shm_ring_t *ring;
+	int err;
+
+	if (ioplug->pcm->mmap_channels)
+		return -EBUSY;
+	snd_pcm_ioplug_ring_unmap(io);
+	if (fd < 0)
+		return snd_pcm_ioplug_reinit_status(ioplug);
+	if (offset % page_size() || size <= hdr_size) {
+		snd_error(PCM, "ioplug: invalid shm ring offset %zu or size %zu",
+			  offset, size);
+		return -EINVAL;
+	}
+	ring = mmap(NULL, hdr_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		    fd, offset);
+	if (ring == MAP_FAILED) {
+		err = -errno;
+		snd_errornum(PCM, "ioplug: cannot map shm ring");
+		return err;
+	}
+	ring->version = SND_PCM_IOPLUG_SHM_RING_VERSION;
+	ring->data_offset = hdr_size;
+	io->ring = ring;
+	io->ring_fd = fd;
+	io->ring_offset = offset;
+	io->ring_size = size;
+	snd_pcm_ioplug_ring_reset(io);
+	return snd_pcm_ioplug_reinit_status(ioplug);
+}
+
 /**
  * \brief Change the ioplug PCM status
  * \param ioplug the ioplug handle
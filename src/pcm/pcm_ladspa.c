@@ -37,6 +37,10 @@
 #include <dirent.h>
 #include <locale.h>
 #include <math.h>
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 #include "ladspa.h"
 
@@ -54,6 +58,17 @@ typedef enum _snd_pcm_ladspa_policy {
 	SND_PCM_LADSPA_POLICY_DUPLICATE		/* duplicate bindings for all channels */
 } snd_pcm_ladspa_policy_t;
 
+struct snd_pcm_ladspa_instance;
+
+typedef struct {
+	struct snd_pcm_ladspa_instance **tasks;	/* instances in chain order */
+	unsigned int ntasks;
+#ifdef HAVE_LIBPTHREAD
+	pthread_t thread;
+	int cpu;				/* CPU to pin to, -1 = any */
+#endif
+} snd_pcm_ladspa_worker_t;
+
 typedef struct {
 	/* This field need to be the first */
 	snd_pcm_plugin_t plug;
@@ -63,6 +78,23 @@ typedef struct {
 	unsigned int channels;			/* forced input channels, 0 = auto */
 	unsigned int allocated;			/* count of allocated samples */
 	LADSPA_Data *zero[2];			/* zero input or dummy output */
+	/* parallel processing, worker 0 is the calling thread */
+	unsigned int threads;			/* configured workers, 0 or 1 = serial */
+	int *cpus;				/* CPUs for the workers */
+	unsigned int cpus_size;
+	unsigned int nworkers;			/* workers in use, 0 = serial */
+	snd_pcm_ladspa_worker_t *workers;
+	struct snd_pcm_ladspa_instance **sched;	/* all instances grouped by worker */
+#ifdef HAVE_LIBPTHREAD
+	unsigned int started;			/* running worker threads */
+	pthread_mutex_t pool_mutex;
+	pthread_cond_t pool_start;
+	pthread_cond_t pool_done;
+	unsigned int pool_gen;			/* incremented for each dispatch */
+	unsigned int pool_pending;		/* workers still running */
+	unsigned int pool_size;			/* frames to run */
+	int pool_stop;
+#endif
 } snd_pcm_ladspa_t;
 
 typedef struct {
@@ -192,10 +224,20 @@ static void snd_pcm_ladspa_free_plugins(struct list_head *plugins)
 	}
 }
 
+static void snd_pcm_ladspa_stop_workers(snd_pcm_ladspa_t *ladspa);
+
 static void snd_pcm_ladspa_free(snd_pcm_ladspa_t *ladspa)
 {
 	unsigned int idx;
 
+	snd_pcm_ladspa_stop_workers(ladspa);
+#ifdef HAVE_LIBPTHREAD
+	pthread_mutex_destroy(&ladspa->pool_mutex);
+	pthread_cond_destroy(&ladspa->pool_start);
+	pthread_cond_destroy(&ladspa->pool_done);
+#endif
+	free(ladspa->cpus);
+	ladspa->cpus = NULL;
 	snd_pcm_ladspa_free_plugins(&ladspa->pplugins);
 	snd_pcm_ladspa_free_plugins(&ladspa->cplugins);
 	for (idx = 0; idx < 2; idx++) {
@@ -683,6 +725,31 @@ static LADSPA_Data *snd_pcm_ladspa_allocate_zero(snd_pcm_ladspa_t *ladspa, unsig
 	return ladspa->zero[idx];
 }
 
+/*
+ * An output can be written in place of the input bound to the same channel
+ * when that input is an intermediate buffer (not an ALSA area nor the zero
+ * buffer) and no other output of the instance got it already.
+ */
+static LADSPA_Data *snd_pcm_ladspa_inplace_buffer(snd_pcm_ladspa_t *ladspa,
+						  snd_pcm_ladspa_instance_t *instance,
+						  unsigned int oidx)
+{
+	unsigned int chn = instance->output.channels.array[oidx];
+	unsigned int idx, idx1;
+
+	for (idx = 0; idx < instance->input.channels.size; idx++) {
+		LADSPA_Data *data = instance->input.data[idx];
+		if (instance->input.channels.array[idx] != chn ||
+		    data == NULL || data == ladspa->zero[0])
+			continue;
+		for (idx1 = 0; idx1 < oidx; idx1++)
+			if (instance->output.data[idx1] == data)
+				return NULL;
+		return data;
+	}
+	return NULL;
+}
+
 static int snd_pcm_ladspa_allocate_memory(snd_pcm_t *pcm, snd_pcm_ladspa_t *ladspa)
 {
 	struct list_head *list, *pos, *pos1;
@@ -690,6 +757,9 @@ static int snd_pcm_ladspa_allocate_memory(snd_pcm_t *pcm, snd_pcm_ladspa_t *lads
 	unsigned int channels = 16, nchannels;
 	unsigned int ichannels, ochannels;
 	void **pchannels, **npchannels;
+	LADSPA_Data **pool;			/* buffers nobody reads anymore */
+	snd_pcm_ladspa_instance_t **order;
+	unsigned int npool = 0, ndead, outputs = 0, ninstances = 0;
 	unsigned int idx, chn;
 
 	ladspa->allocated = 2048;
@@ -706,6 +776,22 @@ static int snd_pcm_ladspa_allocate_memory(snd_pcm_t *pcm, snd_pcm_ladspa_t *lads
 	if (pchannels == NULL)
 		return -ENOMEM;
 	list = pcm->stream == SND_PCM_STREAM_PLAYBACK ? &ladspa->pplugins : &ladspa->cplugins;
+	/* each output may release one buffer, so this is enough for the pool */
+	list_for_each(pos, list) {
+		snd_pcm_ladspa_plugin_t *plugin = list_entry(pos, snd_pcm_ladspa_plugin_t, list);
+		list_for_each(pos1, &plugin->instances) {
+			instance = list_entry(pos1, snd_pcm_ladspa_instance_t, list);
+			outputs += instance->output.channels.size;
+			ninstances++;
+		}
+	}
+	pool = malloc(sizeof(*pool) * (outputs + 1) + sizeof(*order) * ninstances);
+	if (pool == NULL) {
+		free(pchannels);
+		return -ENOMEM;
+	}
+	order = (snd_pcm_ladspa_instance_t **)(pool + outputs + 1);
+	ninstances = 0;
 	list_for_each(pos, list) {
 		snd_pcm_ladspa_plugin_t *plugin = list_entry(pos, snd_pcm_ladspa_plugin_t, list);
 		list_for_each(pos1, &plugin->instances) {
@@ -726,6 +812,7 @@ static int snd_pcm_ladspa_allocate_memory(snd_pcm_t *pcm, snd_pcm_ladspa_t *lads
 			if (nchannels != channels) {
 				npchannels = realloc(pchannels, nchannels * sizeof(void *));
 				if (npchannels == NULL) {
+					free(pool);
 					free(pchannels);
 					return -ENOMEM;
 				}
@@ -745,6 +832,7 @@ static int snd_pcm_ladspa_allocate_memory(snd_pcm_t *pcm, snd_pcm_ladspa_t *lads
 			    instance->input.m_data == NULL ||
 			    instance->output.data == NULL ||
 			    instance->output.m_data == NULL) {
+				free(pool);
 				free(pchannels);
 				return -ENOMEM;
 			}
@@ -758,50 +846,75 @@ static int snd_pcm_ladspa_allocate_memory(snd_pcm_t *pcm, snd_pcm_ladspa_t *lads
 				if (instance->input.data[idx] == NULL) {
 					instance->input.data[idx] = snd_pcm_ladspa_allocate_zero(ladspa, 0);
 					if (instance->input.data[idx] == NULL) {
+						free(pool);
 						free(pchannels);
 						return -ENOMEM;
 					}
 				}
 			}
+			order[ninstances++] = instance;
+			ndead = 0;
 			for (idx = 0; idx < instance->output.channels.size; idx++) {
+				LADSPA_Data *old, *data;
 				chn = instance->output.channels.array[idx];
-				/* FIXME/OPTIMIZE: check if we can remove double alloc */
-				/* if LADSPA plugin has no broken inplace */
-				instance->output.data[idx] = malloc(sizeof(LADSPA_Data) * ladspa->allocated);
-				if (instance->output.data[idx] == NULL) {
-					free(pchannels);
-					return -ENOMEM;
+				old = pchannels[chn];
+				data = NULL;
+				if (!LADSPA_IS_INPLACE_BROKEN(instance->desc->Properties))
+					data = snd_pcm_ladspa_inplace_buffer(ladspa, instance, idx);
+				if (data == NULL && npool > 0)
+					data = pool[--npool];
+				if (data == NULL) {
+					data = malloc(sizeof(LADSPA_Data) * ladspa->allocated);
+					if (data == NULL) {
+						free(pool);
+						free(pchannels);
+						return -ENOMEM;
+					}
+					instance->output.m_data[idx] = data;
 				}
-				pchannels[chn] = instance->output.m_data[idx] = instance->output.data[idx];
+				instance->output.data[idx] = data;
+				pchannels[chn] = data;
+				/* nobody reads the overwritten buffer after this instance */
+				if (old != NULL && old != data &&
+				    old != ladspa->zero[0] && old != ladspa->zero[1])
+					pool[npool + ndead++] = old;
 			}
+			/*
+			 * Reusing buffers across channels would link otherwise
+			 * independent instances for the parallel processing.
+			 */
+			if (ladspa->threads < 2)
+				npool += ndead;
 		}
 	}
 	/* OPTIMIZE: we have already allocated areas for ALSA output channels */
 	/* next loop deallocates the last output LADSPA areas and connects */
 	/* them to ALSA areas (NULL) or dummy area ladpsa->free[1] ; */
 	/* this algorithm might be optimized to not allocate the last LADSPA outputs */
-	list_for_each(pos, list) {
-		snd_pcm_ladspa_plugin_t *plugin = list_entry(pos, snd_pcm_ladspa_plugin_t, list);
-		list_for_each(pos1, &plugin->instances) {
-			instance = list_entry(pos1, snd_pcm_ladspa_instance_t, list);
-			for (idx = 0; idx < instance->output.channels.size; idx++) {
-				chn = instance->output.channels.array[idx];
-				if (instance->output.data[idx] == pchannels[chn]) {
-					free(instance->output.m_data[idx]);
-					instance->output.m_data[idx] = NULL;
-					if (chn < ochannels) {
-						instance->output.data[idx] = NULL;
-					} else {
-						instance->output.data[idx] = snd_pcm_ladspa_allocate_zero(ladspa, 1);
-						if (instance->output.data[idx] == NULL) {
-							free(pchannels);
-							return -ENOMEM;
-						}
+	/* walk backwards: with in-place processing, earlier writers of a channel */
+	/* may share the buffer of the last one */
+	while (ninstances-- > 0) {
+		instance = order[ninstances];
+		for (idx = 0; idx < instance->output.channels.size; idx++) {
+			chn = instance->output.channels.array[idx];
+			if (instance->output.data[idx] == pchannels[chn]) {
+				pchannels[chn] = NULL;
+				free(instance->output.m_data[idx]);
+				instance->output.m_data[idx] = NULL;
+				if (chn < ochannels) {
+					instance->output.data[idx] = NULL;
+				} else {
+					instance->output.data[idx] = snd_pcm_ladspa_allocate_zero(ladspa, 1);
+					if (instance->output.data[idx] == NULL) {
+						free(pool);
+						free(pchannels);
+						return -ENOMEM;
 					}
 				}
 			}
 		}
 	}
+	free(pool);
 #if 0
 	printf("zero[0] = %p\n", ladspa->zero[0]);
 	printf("zero[1] = %p\n", ladspa->zero[1]);
@@ -820,6 +933,333 @@ static int snd_pcm_ladspa_allocate_memory(snd_pcm_t *pcm, snd_pcm_ladspa_t *lads
 	return 0;
 }
 
+/*
+ * Parallel processing
+ *
+ * Two instances depend on each other when one of them writes a buffer the
+ * other one reads or writes. The instances are split in the groups linked
+ * by such dependencies (for example the chains of the duplicated plugins
+ * of each channel); the groups are independent, so they are distributed
+ * over the workers and each worker runs its instances in the chain order.
+ * The calling thread is worker 0 and waits for the others at the end of
+ * each chunk.
+ */
+
+#define LADSPA_BUF_MEM		0	/* buffer allocated by the plugin */
+#define LADSPA_BUF_SRC		1	/* ALSA source area (channel) */
+#define LADSPA_BUF_DST		2	/* ALSA destination area (channel) */
+
+typedef struct {
+	unsigned int type;
+	unsigned int chn;
+	const void *ptr;
+} snd_pcm_ladspa_buf_t;
+
+static int snd_pcm_ladspa_get_buf(snd_pcm_ladspa_t *ladspa,
+				  snd_pcm_ladspa_eps_t *eps, unsigned int idx,
+				  unsigned int type, snd_pcm_ladspa_buf_t *buf)
+{
+	LADSPA_Data *data = eps->data[idx];
+
+	/* zero input is never written, dummy output never read */
+	if (data != NULL && (data == ladspa->zero[0] || data == ladspa->zero[1]))
+		return 0;
+	buf->type = data ? LADSPA_BUF_MEM : type;
+	buf->chn = data ? 0 : eps->channels.array[idx];
+	buf->ptr = data;
+	return 1;
+}
+
+static int snd_pcm_ladspa_buf_eq(const snd_pcm_ladspa_buf_t *a,
+				 const snd_pcm_ladspa_buf_t *b)
+{
+	return a->type == b->type && a->chn == b->chn && a->ptr == b->ptr;
+}
+
+static int snd_pcm_ladspa_touches(snd_pcm_ladspa_t *ladspa,
+				  snd_pcm_ladspa_instance_t *instance,
+				  const snd_pcm_ladspa_buf_t *buf, int write)
+{
+	snd_pcm_ladspa_buf_t b;
+	unsigned int idx;
+
+	for (idx = 0; idx < instance->output.channels.size; idx++)
+		if (snd_pcm_ladspa_get_buf(ladspa, &instance->output, idx,
+					   LADSPA_BUF_DST, &b) &&
+		    snd_pcm_ladspa_buf_eq(&b, buf))
+			return 1;
+	if (!write)
+		return 0;
+	for (idx = 0; idx < instance->input.channels.size; idx++)
+		if (snd_pcm_ladspa_get_buf(ladspa, &instance->input, idx,
+					   LADSPA_BUF_SRC, &b) &&
+		    snd_pcm_ladspa_buf_eq(&b, buf))
+			return 1;
+	return 0;
+}
+
+/* instance a runs before b; does b depend on a? */
+static int snd_pcm_ladspa_depends(snd_pcm_ladspa_t *ladspa,
+				  snd_pcm_ladspa_instance_t *a,
+				  snd_pcm_ladspa_instance_t *b)
+{
+	snd_pcm_ladspa_buf_t buf;
+	unsigned int idx;
+
+	/* a writes what b reads or writes */
+	for (idx = 0; idx < a->output.channels.size; idx++)
+		if (snd_pcm_ladspa_get_buf(ladspa, &a->output, idx,
+					   LADSPA_BUF_DST, &buf) &&
+		    snd_pcm_ladspa_touches(ladspa, b, &buf, 1))
+			return 1;
+	/* a reads what b writes */
+	for (idx = 0; idx < a->input.channels.size; idx++)
+		if (snd_pcm_ladspa_get_buf(ladspa, &a->input, idx,
+					   LADSPA_BUF_SRC, &buf) &&
+		    snd_pcm_ladspa_touches(ladspa, b, &buf, 0))
+			return 1;
+	return 0;
+}
+
+static unsigned int snd_pcm_ladspa_group(unsigned int *group, unsigned int idx)
+{
+	while (group[idx] != idx)
+		idx = group[idx] = group[group[idx]];
+	return idx;
+}
+
+static int snd_pcm_ladspa_schedule(snd_pcm_t *pcm, snd_pcm_ladspa_t *ladspa)
+{
+	struct list_head *list, *pos, *pos1;
+	snd_pcm_ladspa_instance_t **all;
+	unsigned int *group, *load, *owner;
+	unsigned int count = 0, ngroups = 0, nworkers, idx, idx1, w;
+	int err = 0;
+
+	ladspa->nworkers = 0;
+	if (ladspa->threads < 2)
+		return 0;
+	list = pcm->stream == SND_PCM_STREAM_PLAYBACK ? &ladspa->pplugins : &ladspa->cplugins;
+	list_for_each(pos, list) {
+		snd_pcm_ladspa_plugin_t *plugin = list_entry(pos, snd_pcm_ladspa_plugin_t, list);
+		list_for_each(pos1, &plugin->instances)
+			count++;
+	}
+	all = calloc(count, sizeof(*all));
+	group = calloc(count, sizeof(*group));
+	load = calloc(count, sizeof(*load));
+	owner = calloc(count, sizeof(*owner));
+	if (!all || !group || !load || !owner) {
+		err = -ENOMEM;
+		goto _end;
+	}
+	count = 0;
+	list_for_each(pos, list) {
+		snd_pcm_ladspa_plugin_t *plugin = list_entry(pos, snd_pcm_ladspa_plugin_t, list);
+		list_for_each(pos1, &plugin->instances) {
+			group[count] = count;
+			all[count++] = list_entry(pos1, snd_pcm_ladspa_instance_t, list);
+		}
+	}
+	for (idx = 0; idx < count; idx++)
+		for (idx1 = idx + 1; idx1 < count; idx1++)
+			if (snd_pcm_ladspa_depends(ladspa, all[idx], all[idx1]))
+				group[snd_pcm_ladspa_group(group, idx1)] =
+					snd_pcm_ladspa_group(group, idx);
+	/* size of each group, indexed by its root */
+	for (idx = 0; idx < count; idx++) {
+		if (load[snd_pcm_ladspa_group(group, idx)]++ == 0)
+			ngroups++;
+	}
+	nworkers = ladspa->threads < ngroups ? ladspa->threads : ngroups;
+	if (nworkers < 2)
+		goto _end;
+	if (!ladspa->workers) {
+		ladspa->workers = calloc(ladspa->threads, sizeof(*ladspa->workers));
+		if (!ladspa->workers) {
+			err = -ENOMEM;
+			goto _end;
+		}
+	}
+	free(ladspa->sched);
+	ladspa->sched = malloc(count * sizeof(*ladspa->sched));
+	if (!ladspa->sched) {
+		err = -ENOMEM;
+		goto _end;
+	}
+	/* the largest group first to the least loaded worker */
+	for (w = 0; w < nworkers; w++)
+		ladspa->workers[w].ntasks = 0;
+	for (;;) {
+		unsigned int best = count, wbest = 0;
+		for (idx = 0; idx < count; idx++)
+			if (group[idx] == idx && load[idx] > 0 &&
+			    (best == count || load[idx] > load[best]))
+				best = idx;
+		if (best == count)
+			break;
+		for (w = 1; w < nworkers; w++)
+			if (ladspa->workers[w].ntasks < ladspa->workers[wbest].ntasks)
+				wbest = w;
+		ladspa->workers[wbest].ntasks += load[best];
+		owner[best] = wbest;
+		load[best] = 0;
+	}
+	idx1 = 0;
+	for (w = 0; w < nworkers; w++) {
+		ladspa->workers[w].tasks = ladspa->sched + idx1;
+		for (idx = 0; idx < count; idx++)
+			if (owner[snd_pcm_ladspa_group(group, idx)] == w)
+				ladspa->sched[idx1++] = all[idx];
+		assert(ladspa->workers[w].tasks + ladspa->workers[w].ntasks ==
+		       ladspa->sched + idx1);
+	}
+	ladspa->nworkers = nworkers;
+ _end:
+	free(all);
+	free(group);
+	free(load);
+	free(owner);
+	return err;
+}
+
+#ifdef HAVE_LIBPTHREAD
+static void snd_pcm_ladspa_run_tasks(snd_pcm_ladspa_worker_t *worker,
+				     unsigned long size)
+{
+	unsigned int idx;
+
+	for (idx = 0; idx < worker->ntasks; idx++) {
+		struct snd_pcm_ladspa_instance *instance = worker->tasks[idx];
+		instance->desc->run(instance->handle, size);
+	}
+}
+
+static void *snd_pcm_ladspa_worker(void *arg)
+{
+	snd_pcm_ladspa_t *ladspa = arg;
+	snd_pcm_ladspa_worker_t *worker;
+	unsigned int gen, index;
+
+	pthread_mutex_lock(&ladspa->pool_mutex);
+	index = ladspa->started++;
+	worker = &ladspa->workers[index];
+	gen = ladspa->pool_gen;
+	pthread_cond_broadcast(&ladspa->pool_done);
+#ifdef CPU_SET
+	if (worker->cpu >= 0) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(worker->cpu, &set);
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	}
+#endif
+	for (;;) {
+		while (ladspa->pool_gen == gen && !ladspa->pool_stop)
+			pthread_cond_wait(&ladspa->pool_start, &ladspa->pool_mutex);
+		if (ladspa->pool_stop)
+			break;
+		gen = ladspa->pool_gen;
+		if (index < ladspa->nworkers) {
+			unsigned int size = ladspa->pool_size;
+			pthread_mutex_unlock(&ladspa->pool_mutex);
+			snd_pcm_ladspa_run_tasks(worker, size);
+			pthread_mutex_lock(&ladspa->pool_mutex);
+			if (--ladspa->pool_pending == 0)
+				pthread_cond_signal(&ladspa->pool_done);
+		}
+	}
+	pthread_mutex_unlock(&ladspa->pool_mutex);
+	return NULL;
+}
+
+static int snd_pcm_ladspa_start_workers(snd_pcm_ladspa_t *ladspa)
+{
+	int err;
+
+	pthread_mutex_lock(&ladspa->pool_mutex);
+	ladspa->pool_stop = 0;
+	if (ladspa->started == 0)
+		ladspa->started = 1;	/* the caller */
+	while (ladspa->started < ladspa->nworkers) {
+		snd_pcm_ladspa_worker_t *worker = &ladspa->workers[ladspa->started];
+		unsigned int started = ladspa->started;
+		worker->cpu = ladspa->cpus_size > 0 ?
+			ladspa->cpus[(started - 1) % ladspa->cpus_size] : -1;
+		err = pthread_create(&worker->thread, NULL,
+				     snd_pcm_ladspa_worker, ladspa);
+		if (err) {
+			pthread_mutex_unlock(&ladspa->pool_mutex);
+			snd_error(PCM, "Unable to create LADSPA worker thread");
+			return -err;
+		}
+		/* wait until the thread picks up its index */
+		while (ladspa->started == started)
+			pthread_cond_wait(&ladspa->pool_done, &ladspa->pool_mutex);
+	}
+	pthread_mutex_unlock(&ladspa->pool_mutex);
+	return 0;
+}
+
+static void snd_pcm_ladspa_stop_workers(snd_pcm_ladspa_t *ladspa)
+{
+	unsigned int idx, started;
+
+	if (ladspa->started < 2)
+		goto _free;
+	pthread_mutex_lock(&ladspa->pool_mutex);
+	ladspa->pool_stop = 1;
+	pthread_cond_broadcast(&ladspa->pool_start);
+	started = ladspa->started;
+	pthread_mutex_unlock(&ladspa->pool_mutex);
+	for (idx = 1; idx < started; idx++)
+		pthread_join(ladspa->workers[idx].thread, NULL);
+ _free:
+	ladspa->started = 0;
+	ladspa->nworkers = 0;
+	free(ladspa->workers);
+	ladspa->workers = NULL;
+	free(ladspa->sched);
+	ladspa->sched = NULL;
+}
+
+static void snd_pcm_ladspa_run_parallel(snd_pcm_ladspa_t *ladspa,
+					unsigned int size)
+{
+	pthread_mutex_lock(&ladspa->pool_mutex);
+	ladspa->pool_size = size;
+	ladspa->pool_pending = ladspa->nworkers - 1;
+	ladspa->pool_gen++;
+	pthread_cond_broadcast(&ladspa->pool_start);
+	pthread_mutex_unlock(&ladspa->pool_mutex);
+	snd_pcm_ladspa_run_tasks(&ladspa->workers[0], size);
+	pthread_mutex_lock(&ladspa->pool_mutex);
+	while (ladspa->pool_pending > 0)
+		pthread_cond_wait(&ladspa->pool_done, &ladspa->pool_mutex);
+	pthread_mutex_unlock(&ladspa->pool_mutex);
+}
+#else
+static int snd_pcm_ladspa_start_workers(snd_pcm_ladspa_t *ladspa)
+{
+	ladspa->nworkers = 0;
+	return 0;
+}
+
+static void snd_pcm_ladspa_stop_workers(snd_pcm_ladspa_t *ladspa)
+{
+	ladspa->nworkers = 0;
+	free(ladspa->workers);
+	ladspa->workers = NULL;
+	free(ladspa->sched);
+	ladspa->sched = NULL;
+}
+
+static void snd_pcm_ladspa_run_parallel(snd_pcm_ladspa_t *ladspa ATTRIBUTE_UNUSED,
+					unsigned int size ATTRIBUTE_UNUSED)
+{
+}
+#endif
+
 static int snd_pcm_ladspa_init(snd_pcm_t *pcm)
 {
 	snd_pcm_ladspa_t *ladspa = pcm->private_data;
@@ -836,6 +1276,14 @@ static int snd_pcm_ladspa_init(snd_pcm_t *pcm)
 		snd_pcm_ladspa_free_instances(pcm, ladspa, 1);
 		return err;
 	}
+	err = snd_pcm_ladspa_schedule(pcm, ladspa);
+	if (err >= 0 && ladspa->nworkers > 1)
+		err = snd_pcm_ladspa_start_workers(ladspa);
+	if (err < 0) {
+		snd_pcm_ladspa_stop_workers(ladspa);
+		snd_pcm_ladspa_free_instances(pcm, ladspa, 1);
+		return err;
+	}
 	return 0;
 }
 
@@ -843,6 +1291,7 @@ static int snd_pcm_ladspa_hw_free(snd_pcm_t *pcm)
 {
 	snd_pcm_ladspa_t *ladspa = pcm->private_data;
 
+	snd_pcm_ladspa_stop_workers(ladspa);
 	snd_pcm_ladspa_free_instances(pcm, ladspa, 1);
 	return snd_pcm_generic_hw_free(pcm);
 }
@@ -896,9 +1345,12 @@ snd_pcm_ladspa_write_areas(snd_pcm_t *pcm,
 					}
 					instance->desc->connect_port(instance->handle, instance->output.ports.array[idx], data);
 				}
-				instance->desc->run(instance->handle, size1);
+				if (ladspa->nworkers < 2)
+					instance->desc->run(instance->handle, size1);
 			}
 		}
+		if (ladspa->nworkers > 1)
+			snd_pcm_ladspa_run_parallel(ladspa, size1);
 		offset += size1;
 		slave_offset += size1;
 		size -= size1;
@@ -957,9 +1409,12 @@ snd_pcm_ladspa_read_areas(snd_pcm_t *pcm,
 					}
 					instance->desc->connect_port(instance->handle, instance->output.ports.array[idx], data);
 				}
-				instance->desc->run(instance->handle, size1);
+				if (ladspa->nworkers < 2)
+					instance->desc->run(instance->handle, size1);
 			}
 		}
+		if (ladspa->nworkers > 1)
+			snd_pcm_ladspa_run_parallel(ladspa, size1);
 		offset += size1;
 		slave_offset += size1;
 		size -= size1;
@@ -1057,6 +1512,9 @@ static void snd_pcm_ladspa_dump(snd_pcm_t *pcm, snd_output_t *out)
 	snd_pcm_ladspa_plugins_dump(&ladspa->pplugins, out);
 	snd_output_printf(out, "  Capture:\n");
 	snd_pcm_ladspa_plugins_dump(&ladspa->cplugins, out);
+	if (ladspa->threads > 1)
+		snd_output_printf(out, "  Threads: %u (%u in use)\n",
+				  ladspa->threads, ladspa->nworkers);
 	if (pcm->setup) {
 		snd_output_printf(out, "Its setup is:\n");
 		snd_pcm_dump_setup(pcm, out);
@@ -1568,6 +2026,37 @@ static int snd_pcm_ladspa_build_plugins(struct list_head *list,
 	return 0;
 }
 
+static int snd_pcm_ladspa_set_threads(snd_pcm_ladspa_t *ladspa, long threads,
+				      snd_config_t *cpus)
+{
+	snd_config_iterator_t i, next;
+	unsigned int count = 0;
+
+#ifndef HAVE_LIBPTHREAD
+	if (threads > 1)
+		snd_error(PCM, "threads are not supported, processing serially");
+	threads = 0;
+#endif
+	ladspa->threads = threads;
+	if (!cpus)
+		return 0;
+	snd_config_for_each(i, next, cpus)
+		count++;
+	ladspa->cpus = calloc(count, sizeof(*ladspa->cpus));
+	if (!ladspa->cpus)
+		return -ENOMEM;
+	snd_config_for_each(i, next, cpus) {
+		snd_config_t *n = snd_config_iterator_entry(i);
+		long cpu;
+		if (snd_config_get_integer(n, &cpu) < 0 || cpu < 0) {
+			snd_error(PCM, "Invalid CPU number in cpus");
+			return -EINVAL;
+		}
+		ladspa->cpus[ladspa->cpus_size++] = cpu;
+	}
+	return 0;
+}
+
 /**
  * \brief Creates a new LADSPA<->ALSA Plugin
  * \param pcmp Returns created PCM handle
@@ -1602,6 +2091,11 @@ int snd_pcm_ladspa_open(snd_pcm_t **pcmp, const char *name,
 	if (!ladspa)
 		return -ENOMEM;
 	snd_pcm_plugin_init(&ladspa->plug);
+#ifdef HAVE_LIBPTHREAD
+	pthread_mutex_init(&ladspa->pool_mutex, NULL);
+	pthread_cond_init(&ladspa->pool_start, NULL);
+	pthread_cond_init(&ladspa->pool_done, NULL);
+#endif
 	ladspa->plug.init = snd_pcm_ladspa_init;
 	ladspa->plug.read = snd_pcm_ladspa_read_areas;
 	ladspa->plug.write = snd_pcm_ladspa_write_areas;
@@ -1672,6 +2166,22 @@ connected to a dummy sample area.
 
 Instances of LADSPA plugins are created dynamically.
 
+The plugins are chained without copies: each input port is connected to
+the buffer of the previous output of its channel. Unless a plugin sets
+LADSPA_PROPERTY_INPLACE_BROKEN, its outputs are written in place of the
+inputs of the same channels, and the buffers nobody reads anymore are
+reused by the following plugins, so a chain needs about one buffer per
+channel. The first plugins read the ALSA areas directly and the last ones
+write to them.
+
+With threads greater than one, the instances are split in groups which
+don't share any buffer (typically the chain of plugins of each channel
+with the duplicate policy), and the groups are distributed over a pool of
+threads. The calling thread processes one share itself and waits for the
+others at the end of each chunk. Instances sharing buffers, such as a
+stereo-linked compressor, stay in the same group and run in the chain
+order. The LADSPA plugins must not share state between their instances.
+
 \code
 pcm.name {
 	type ladspa             # ALSA<->LADSPA PCM
@@ -1684,6 +2194,8 @@ pcm.name {
 	}
 	[channels INT]		# count input channels (input to LADSPA plugin chain)
 	[path STR]		# Path (directory) with LADSPA plugins
+	[threads INT]		# Run independent instances on INT threads (default 1)
+	[cpus [ INT ... ]]	# Pin the additional threads to these CPUs
 	plugins |		# Definition for both directions
 	playback_plugins |	# Definition for playback direction
 	capture_plugins {	# Definition for capture direction
@@ -1739,8 +2251,9 @@ int _snd_pcm_ladspa_open(snd_pcm_t **pcmp, const char *name,
 	snd_pcm_t *spcm;
 	snd_config_t *slave = NULL, *sconf;
 	const char *path = NULL;
-	long channels = 0;
+	long channels = 0, threads = 0;
 	snd_config_t *plugins = NULL, *pplugins = NULL, *cplugins = NULL;
+	snd_config_t *cpus = NULL;
 	snd_config_for_each(i, next, conf) {
 		snd_config_t *n = snd_config_iterator_entry(i);
 		const char *id;
@@ -1768,6 +2281,26 @@ int _snd_pcm_ladspa_open(snd_pcm_t **pcmp, const char *name,
 				channels = 0;
 			continue;
 		}
+		if (strcmp(id, "threads") == 0) {
+			err = snd_config_get_integer(n, &threads);
+			if (err < 0) {
+				snd_error(PCM, "Invalid type for %s", id);
+				return err;
+			}
+			if (threads > 64)
+				threads = 64;
+			if (threads < 0)
+				threads = 0;
+			continue;
+		}
+		if (strcmp(id, "cpus") == 0) {
+			if (snd_config_get_type(n) != SND_CONFIG_TYPE_COMPOUND) {
+				snd_error(PCM, "Invalid type for %s", id);
+				return -EINVAL;
+			}
+			cpus = n;
+			continue;
+		}
 		if (strcmp(id, "plugins") == 0) {
 			plugins = n;
 			continue;
@@ -1803,9 +2336,18 @@ int _snd_pcm_ladspa_open(snd_pcm_t **pcmp, const char *name,
 	if (err < 0)
 		return err;
 	err = snd_pcm_ladspa_open(pcmp, name, path, channels, pplugins, cplugins, spcm, 1);
-	if (err < 0)
+	if (err < 0) {
 		snd_pcm_close(spcm);
-	return err;
+		return err;
+	}
+	if (threads > 1 || cpus) {
+		err = snd_pcm_ladspa_set_threads((*pcmp)->private_data, threads, cpus);
+		if (err < 0) {
+			snd_pcm_close(*pcmp);
+			return err;
+		}
+	}
+	return 0;
 }
 #ifndef DOC_HIDDEN
 SND_DLSYM_BUILD_VERSION(_snd_pcm_ladspa_open, SND_PCM_DLSYM_VERSION);
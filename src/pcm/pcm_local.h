@@ -110,6 +110,9 @@
 
 #define SND_PCM_INFO_MONOTONIC	0x80000000
 
+typedef struct _snd_pcm_snapshot snd_pcm_snapshot_t;
+typedef struct _snd_pcm_refine_cache snd_pcm_refine_cache_t;
+
 typedef struct _snd_pcm_rbptr {
 	snd_pcm_t *master;
 	volatile snd_pcm_uframes_t *ptr;
@@ -241,9 +244,15 @@ struct _snd_pcm {
 					 */
 	unsigned int donot_close: 1;	/* don't close this PCM */
 	unsigned int own_state_check:1; /* plugin has own PCM state check */
+	unsigned int no_refine_cache:1; /* don't memoize hw_refine results */
+	unsigned int volatile_refine:1; /* hw_refine depends on the driver or shared state */
 	snd_pcm_channel_info_t *mmap_channels;
 	snd_pcm_channel_area_t *running_areas;
 	snd_pcm_channel_area_t *stopped_areas;
+	snd_pcm_stats_t *stats;		/* hot-path counters, NULL = disabled */
+	snd_pcm_snapshot_t *snapshot;	/* lock-free status snapshot, NULL = disabled */
+	snd_pcm_refine_cache_t *refine_cache; /* memoized hw_refine results */
+	char *refine_cache_file;	/* on-disk refine cache, NULL = disabled */
 	const snd_pcm_ops_t *ops;
 	const snd_pcm_fast_ops_t *fast_ops;
 	snd_pcm_t *op_arg;
@@ -350,6 +359,8 @@ struct _snd_pcm {
 	snd1_pcm_hw_param_set_last
 #define snd_pcm_hw_param_set_near \
 	snd1_pcm_hw_param_set_near
+#define snd_pcm_hw_params_choose \
+	snd1_pcm_hw_params_choose
 #define snd_pcm_hw_param_set_min \
 	snd1_pcm_hw_param_set_min
 #define snd_pcm_hw_param_set_max \
@@ -370,6 +381,14 @@ struct _snd_pcm {
 	snd1_pcm_hw_param_name
 #define snd_pcm_sw_params_current_no_lock \
 	snd1_pcm_sw_params_current_no_lock
+#define snd_pcm_stats_avail_update \
+	snd1_pcm_stats_avail_update
+#define __snd_pcm_snapshot_publish \
+	snd1_pcm_snapshot_publish
+#define snd_pcm_hw_refine_cache_clear \
+	snd1_pcm_hw_refine_cache_clear
+#define snd_pcm_hw_refine_cache_attach \
+	snd1_pcm_hw_refine_cache_attach
 
 int snd_pcm_new(snd_pcm_t **pcmp, snd_pcm_type_t type, const char *name,
 		snd_pcm_stream_t stream, int mode);
@@ -436,11 +455,14 @@ snd_pcm_sframes_t __snd_pcm_mmap_commit(snd_pcm_t *pcm,
 					snd_pcm_uframes_t offset,
 					snd_pcm_uframes_t frames);
 int __snd_pcm_wait_in_lock(snd_pcm_t *pcm, int timeout);
+snd_pcm_sframes_t snd_pcm_stats_avail_update(snd_pcm_t *pcm);
 
 static inline snd_pcm_sframes_t __snd_pcm_avail_update(snd_pcm_t *pcm)
 {
 	if (!pcm->fast_ops->avail_update)
 		return -ENOSYS;
+	if (pcm->stats)
+		return snd_pcm_stats_avail_update(pcm);
 	return pcm->fast_ops->avail_update(pcm->fast_op_arg);
 }
 
@@ -710,6 +732,9 @@ static inline int muldiv_near(int a, int b, int c)
 }
 
 int snd_pcm_hw_refine(snd_pcm_t *pcm, snd_pcm_hw_params_t *params);
+void snd_pcm_hw_refine_cache_clear(snd_pcm_t *pcm);
+int snd_pcm_hw_refine_cache_attach(snd_pcm_t *pcm, const char *dir,
+				   snd_config_t *conf);
 int _snd_pcm_hw_params_internal(snd_pcm_t *pcm, snd_pcm_hw_params_t *params);
 #undef _snd_pcm_hw_params
 int snd_pcm_hw_refine_soft(snd_pcm_t *pcm, snd_pcm_hw_params_t *params);
@@ -813,6 +838,7 @@ int snd_pcm_hw_param_set_last(snd_pcm_t *pcm, snd_pcm_hw_params_t *params,
 			      snd_pcm_hw_param_t var, unsigned int *rval, int *dir);
 int snd_pcm_hw_param_set_near(snd_pcm_t *pcm, snd_pcm_hw_params_t *params,
 			      snd_pcm_hw_param_t var, unsigned int *val, int *dir);
+int snd_pcm_hw_params_choose(snd_pcm_t *pcm, snd_pcm_hw_params_t *params);
 int snd_pcm_hw_param_set_min(snd_pcm_t *pcm, snd_pcm_hw_params_t *params,
 			     snd_set_mode_t mode,
 			     snd_pcm_hw_param_t var,
@@ -1134,6 +1160,55 @@ static inline void gettimestamp(snd_htimestamp_t *tstamp,
 }
 #endif /* HAVE_CLOCK_GETTIME */
 
+/* lock-free status snapshot (seqlock)
+ *
+ * The writer side is serialized by the PCM lock; readers never take it
+ * and simply retry while the sequence number is odd or has changed.
+ */
+struct _snd_pcm_snapshot_data {
+	snd_pcm_state_t state;
+	snd_pcm_sframes_t avail;	/* avail at publication time */
+	snd_pcm_sframes_t delay_extra;	/* delay not covered by the ring pointers */
+	snd_pcm_uframes_t tstamp_avail;	/* avail at the last position update */
+	snd_htimestamp_t tstamp;	/* last position update timestamp */
+	int tstamp_err;			/* htimestamp error, if any */
+	snd_htimestamp_t time;		/* monotonic time of publication */
+};
+
+struct _snd_pcm_snapshot {
+	unsigned int seq;		/* odd while an update is in progress */
+	struct _snd_pcm_snapshot_data data;
+	snd_htimestamp_t extra_time;	/* when delay_extra was last measured */
+};
+
+void __snd_pcm_snapshot_publish(snd_pcm_t *pcm);
+
+/* call with the PCM lock held */
+static inline void snd_pcm_snapshot_update(snd_pcm_t *pcm)
+{
+	if (pcm->snapshot)
+		__snd_pcm_snapshot_publish(pcm);
+}
+
+/* hot-path statistics */
+struct _snd_pcm_stats {
+	unsigned long long counter[SND_PCM_STATS_LAST + 1];
+	int xrun;		/* xrun already accounted */
+};
+
+#define snd_pcm_stats_add(pcm, type, val) do { \
+	if ((pcm)->stats) \
+		(pcm)->stats->counter[type] += (val); \
+} while (0)
+
+static inline unsigned long long snd_pcm_stats_clock(void)
+{
+	snd_htimestamp_t ts;
+
+	gettimestamp(&ts, SND_PCM_TSTAMP_TYPE_MONOTONIC);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 snd_pcm_chmap_query_t **
 _snd_pcm_make_single_query_chmaps(const snd_pcm_chmap_t *src);
 snd_pcm_chmap_t *_snd_pcm_copy_chmap(const snd_pcm_chmap_t *src);
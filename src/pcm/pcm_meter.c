@@ -31,8 +31,11 @@
 #include "pcm_plugin.h"
 #include "bswap.h"
 #include <time.h>
+#include <math.h>
+#include <sound/tlv.h>
 #include <pthread.h>
 #include <dlfcn.h>
+#include "pcm_meter.h"
 
 #ifndef DOC_HIDDEN
 #define atomic_read(ptr)    __atomic_load_n(ptr, __ATOMIC_SEQ_CST )
@@ -48,33 +51,6 @@ const char *_snd_module_pcm_meter = "";
 #ifndef DOC_HIDDEN
 #define FREQUENCY 50
 
-struct _snd_pcm_scope {
-	int enabled;
-	char *name;
-	const snd_pcm_scope_ops_t *ops;
-	void *private_data;
-	struct list_head list;
-};
-
-typedef struct _snd_pcm_meter {
-	snd_pcm_generic_t gen;
-	snd_pcm_uframes_t rptr;
-	snd_pcm_uframes_t buf_size;
-	snd_pcm_channel_area_t *buf_areas;
-	snd_pcm_uframes_t now;
-	unsigned char *buf;
-	struct list_head scopes;
-	int closed;
-	int running;
-	int reset;
-	pthread_t thread;
-	pthread_mutex_t update_mutex;
-	pthread_mutex_t running_mutex;
-	pthread_cond_t running_cond;
-	struct timespec delay;
-	void *dl_handle;
-} snd_pcm_meter_t;
-
 static void snd_pcm_meter_add_frames(snd_pcm_t *pcm,
 				     const snd_pcm_channel_area_t *areas,
 				     snd_pcm_uframes_t ptr,
@@ -103,59 +79,28 @@ static void snd_pcm_meter_add_frames(snd_pcm_t *pcm,
 	}
 }
 
-static void snd_pcm_meter_update_main(snd_pcm_t *pcm)
+static void snd_pcm_meter_publish(snd_pcm_meter_t *meter,
+				  snd_pcm_uframes_t rptr)
 {
-	snd_pcm_meter_t *meter = pcm->private_data;
-	snd_pcm_sframes_t frames;
-	snd_pcm_uframes_t rptr, old_rptr;
-	const snd_pcm_channel_area_t *areas;
-	int locked;
-	locked = (pthread_mutex_trylock(&meter->update_mutex) >= 0);
-	areas = snd_pcm_mmap_areas(pcm);
-	rptr = *pcm->hw.ptr;
-	old_rptr = meter->rptr;
-	meter->rptr = rptr;
-	frames = rptr - old_rptr;
-	if (frames < 0)
-		frames += pcm->boundary;
-	if (frames > 0) {
-		assert((snd_pcm_uframes_t) frames <= pcm->buffer_size);
-		snd_pcm_meter_add_frames(pcm, areas, old_rptr,
-					 (snd_pcm_uframes_t) frames);
-	}
-	if (locked)
-		pthread_mutex_unlock(&meter->update_mutex);
+	__atomic_store_n(&meter->rptr, rptr, __ATOMIC_RELEASE);
 }
 
-static int snd_pcm_meter_update_scope(snd_pcm_t *pcm)
+static void snd_pcm_meter_update_main(snd_pcm_t *pcm)
 {
 	snd_pcm_meter_t *meter = pcm->private_data;
 	snd_pcm_sframes_t frames;
 	snd_pcm_uframes_t rptr, old_rptr;
-	const snd_pcm_channel_area_t *areas;
-	int reset = 0;
-	/* Wait main thread */
-	pthread_mutex_lock(&meter->update_mutex);
-	areas = snd_pcm_mmap_areas(pcm);
- _again:
 	rptr = *pcm->hw.ptr;
 	old_rptr = meter->rptr;
-	if (atomic_read(&meter->reset)) {
-		reset = 1;
-		atomic_dec(&meter->reset);
-		goto _again;
-	}
-	meter->rptr = rptr;
 	frames = rptr - old_rptr;
 	if (frames < 0)
 		frames += pcm->boundary;
 	if (frames > 0) {
 		assert((snd_pcm_uframes_t) frames <= pcm->buffer_size);
-		snd_pcm_meter_add_frames(pcm, areas, old_rptr,
+		snd_pcm_meter_add_frames(pcm, snd_pcm_mmap_areas(pcm), old_rptr,
 					 (snd_pcm_uframes_t) frames);
 	}
-	pthread_mutex_unlock(&meter->update_mutex);
-	return reset;
+	snd_pcm_meter_publish(meter, rptr);
 }
 
 static int snd_pcm_scope_remove(snd_pcm_scope_t *scope)
@@ -197,7 +142,8 @@ static void *snd_pcm_meter_thread(void *data)
 		snd_pcm_scope_enable(scope);
 	}
 	while (!meter->closed) {
-		snd_pcm_sframes_t now;
+		snd_pcm_sframes_t now, ahead;
+		snd_pcm_uframes_t rptr;
 		snd_pcm_status_t status;
 		int err;
 		pthread_mutex_lock(&meter->running_mutex);
@@ -228,15 +174,18 @@ static void *snd_pcm_meter_thread(void *data)
 			if ((snd_pcm_uframes_t) now >= pcm->boundary)
 				now -= pcm->boundary;
 		}
+		/* never hand out frames the producer has not published yet */
+		rptr = __atomic_load_n(&meter->rptr, __ATOMIC_ACQUIRE);
+		ahead = now - rptr;
+		if (ahead < 0)
+			ahead += pcm->boundary;
+		if (ahead > 0 && (snd_pcm_uframes_t) ahead <= pcm->buffer_size)
+			now = rptr;
 		meter->now = now;
-		if (pcm->stream == SND_PCM_STREAM_CAPTURE)
-			reset = snd_pcm_meter_update_scope(pcm);
-		else {
-			reset = 0;
-			while (atomic_read(&meter->reset)) {
-				reset = 1;
-				atomic_dec(&meter->reset);
-			}
+		reset = 0;
+		while (atomic_read(&meter->reset)) {
+			reset = 1;
+			atomic_dec(&meter->reset);
 		}
 		if (reset) {
 			list_for_each(pos, &meter->scopes) {
@@ -274,7 +223,6 @@ static int snd_pcm_meter_close(snd_pcm_t *pcm)
 	snd_pcm_meter_t *meter = pcm->private_data;
 	struct list_head *pos, *npos;
 	int err = 0;
-	pthread_mutex_destroy(&meter->update_mutex);
 	pthread_mutex_destroy(&meter->running_mutex);
 	pthread_cond_destroy(&meter->running_cond);
 	if (meter->gen.close_slave)
@@ -298,9 +246,9 @@ static int snd_pcm_meter_prepare(snd_pcm_t *pcm)
 	err = snd_pcm_prepare(meter->gen.slave);
 	if (err >= 0) {
 		if (pcm->stream == SND_PCM_STREAM_PLAYBACK)
-			meter->rptr = *pcm->appl.ptr;
+			snd_pcm_meter_publish(meter, *pcm->appl.ptr);
 		else
-			meter->rptr = *pcm->hw.ptr;
+			snd_pcm_meter_publish(meter, *pcm->hw.ptr);
 	}
 	return err;
 }
@@ -311,7 +259,7 @@ static int snd_pcm_meter_reset(snd_pcm_t *pcm)
 	int err = snd_pcm_reset(meter->gen.slave);
 	if (err >= 0) {
 		if (pcm->stream == SND_PCM_STREAM_PLAYBACK)
-			meter->rptr = *pcm->appl.ptr;
+			snd_pcm_meter_publish(meter, *pcm->appl.ptr);
 	}
 	return err;
 }
@@ -333,7 +281,7 @@ static snd_pcm_sframes_t snd_pcm_meter_rewind(snd_pcm_t *pcm, snd_pcm_uframes_t
 	snd_pcm_meter_t *meter = pcm->private_data;
 	snd_pcm_sframes_t err = snd_pcm_rewind(meter->gen.slave, frames);
 	if (err > 0 && pcm->stream == SND_PCM_STREAM_PLAYBACK)
-		meter->rptr = *pcm->appl.ptr;
+		snd_pcm_meter_publish(meter, *pcm->appl.ptr);
 	return err;
 }
 
@@ -342,7 +290,7 @@ static snd_pcm_sframes_t snd_pcm_meter_forward(snd_pcm_t *pcm, snd_pcm_uframes_t
 	snd_pcm_meter_t *meter = pcm->private_data;
 	snd_pcm_sframes_t err = INTERNAL(snd_pcm_forward)(meter->gen.slave, frames);
 	if (err > 0 && pcm->stream == SND_PCM_STREAM_PLAYBACK)
-		meter->rptr = *pcm->appl.ptr;
+		snd_pcm_meter_publish(meter, *pcm->appl.ptr);
 	return err;
 }
 
@@ -357,7 +305,7 @@ static snd_pcm_sframes_t snd_pcm_meter_mmap_commit(snd_pcm_t *pcm,
 		return result;
 	if (pcm->stream == SND_PCM_STREAM_PLAYBACK) {
 		snd_pcm_meter_add_frames(pcm, snd_pcm_mmap_areas(pcm), old_rptr, result);
-		meter->rptr = *pcm->appl.ptr;
+		snd_pcm_meter_publish(meter, *pcm->appl.ptr);
 	}
 	return result;
 }
@@ -452,8 +400,8 @@ static int snd_pcm_meter_hw_params(snd_pcm_t *pcm, snd_pcm_hw_params_t * params)
 				      snd_pcm_meter_hw_params_slave);
 	if (err < 0)
 		return err;
-	/* more than 1 second of buffer */
-	meter->buf_size = slave->buffer_size;
+	/* more than 1 second of buffer and at least two slave buffers */
+	meter->buf_size = slave->buffer_size * 2;
 	while (meter->buf_size < slave->rate)
 		meter->buf_size *= 2;
 	buf_size_bytes = snd_pcm_frames_to_bytes(slave, meter->buf_size);
@@ -601,7 +549,6 @@ int snd_pcm_meter_open(snd_pcm_t **pcmp, const char *name, unsigned int frequenc
 	snd_pcm_link_appl_ptr(pcm, slave);
 	*pcmp = pcm;
 
-	pthread_mutex_init(&meter->update_mutex, NULL);
 	pthread_mutex_init(&meter->running_mutex, NULL);
 	pthread_cond_init(&meter->running_cond, NULL);
 	return 0;
@@ -735,11 +682,47 @@ pcm.name {
 }
 \endcode
 
+The frames are copied to the meter buffer by the thread doing the
+transfers and handed to the scopes by a separate meter thread. The two
+threads don't share any lock: the transfer thread publishes its position
+atomically after each commit and the scopes only read up to it.
+
+The built-in scope type \c rms measures the RMS and the sample peak level
+of each channel (see #snd_pcm_scope_rms_open()):
+
+\code
+pcm.levels {
+	type meter
+	slave.pcm "hw:0"
+	scopes.0.type rms
+}
+\endcode
+
+The built-in scope type \c loudness measures the momentary, short-term and
+integrated loudness (ITU-R BS.1770-4, EBU R128), and the true peak and RMS
+level of each channel (see #snd_pcm_scope_loudness_open()). The results can
+also be exported as mixer controls named "NAME Loudness" (momentary,
+short-term, integrated), "NAME True Peak" and "NAME RMS", in 0.01 dB steps
+with a dB scale, which only the meter writes:
+
+\code
+pcm_scope.r128 {
+	type loudness
+	[control {
+		name STR	# Base name of the controls
+		[card INT]	# Card of the controls (default card of the slave)
+		[index INT]	# Index of the controls
+	}]
+}
+\endcode
+
 \subsection pcm_plugins_meter_funcref Function reference
 
 <UL>
   <LI>snd_pcm_meter_open()
   <LI>_snd_pcm_meter_open()
+  <LI>snd_pcm_scope_rms_open()
+  <LI>snd_pcm_scope_loudness_open()
 </UL>
 
 */
@@ -1226,6 +1209,376 @@ int16_t *snd_pcm_scope_s16_get_channel_buffer(snd_pcm_scope_t *scope,
 	return s16->buf_areas[channel].addr;
 }
 
+#ifndef DOC_HIDDEN
+#define RMS_SNAPSHOTS	8
+#define RMS_LANES	8
+
+typedef struct _snd_pcm_scope_rms {
+	snd_pcm_t *pcm;
+	snd_pcm_uframes_t old;
+	snd_pcm_format_t format;	/* format of the kernel input */
+	int index;			/* conversion to S32 or -1 */
+	int32_t *conv;
+	snd_pcm_channel_area_t conv_area;
+	/*
+	 * Ring of per update snapshots, written only by the meter thread.
+	 * seq counts the published snapshots; a reader takes the latest one
+	 * and retries if the writer came close enough to reuse its slot.
+	 */
+	float *snapshots;		/* RMS_SNAPSHOTS * channels * 2 */
+	unsigned int seq;
+} snd_pcm_scope_rms_t;
+
+/*
+ * The kernels keep RMS_LANES independent accumulators so that the
+ * compiler can map them on vector registers without having to reorder
+ * the floating point additions.  The sums are kept in double (int64
+ * for s16), as a float lane loses the quiet samples once a buffer of
+ * loud ones has been added.
+ */
+static void rms_kernel_s16(const int16_t *src, snd_pcm_uframes_t frames,
+			   double *sum, float *peak)
+{
+	int64_t acc[RMS_LANES] = { 0 };
+	int32_t max[RMS_LANES] = { 0 };
+	int64_t total = 0;
+	int32_t m = 0;
+	snd_pcm_uframes_t i = 0;
+	unsigned int l;
+	for (; i + RMS_LANES <= frames; i += RMS_LANES) {
+		for (l = 0; l < RMS_LANES; l++) {
+			int32_t v = src[i + l];
+			int32_t a = v < 0 ? -v : v;
+			acc[l] += v * v;
+			max[l] = a > max[l] ? a : max[l];
+		}
+	}
+	for (; i < frames; i++) {
+		int32_t v = src[i];
+		int32_t a = v < 0 ? -v : v;
+		total += v * v;
+		m = a > m ? a : m;
+	}
+	for (l = 0; l < RMS_LANES; l++) {
+		total += acc[l];
+		m = max[l] > m ? max[l] : m;
+	}
+	*sum += (double) total / (32768.0 * 32768.0);
+	if (m / 32768.0f > *peak)
+		*peak = m / 32768.0f;
+}
+
+static void rms_kernel_s32(const int32_t *src, snd_pcm_uframes_t frames,
+			   double *sum, float *peak)
+{
+	double acc[RMS_LANES] = { 0 };
+	double max[RMS_LANES] = { 0 };
+	double total = 0;
+	double m = 0;
+	snd_pcm_uframes_t i = 0;
+	unsigned int l;
+	const double scale = 1.0 / 2147483648.0;
+	for (; i + RMS_LANES <= frames; i += RMS_LANES) {
+		for (l = 0; l < RMS_LANES; l++) {
+			double v = src[i + l] * scale;
+			double a = fabs(v);
+			acc[l] += v * v;
+			max[l] = a > max[l] ? a : max[l];
+		}
+	}
+	for (; i < frames; i++) {
+		double v = src[i] * scale;
+		total += v * v;
+		m = fabs(v) > m ? fabs(v) : m;
+	}
+	for (l = 0; l < RMS_LANES; l++) {
+		total += acc[l];
+		m = max[l] > m ? max[l] : m;
+	}
+	*sum += total;
+	if (m > *peak)
+		*peak = m;
+}
+
+static void rms_kernel_float(const float *src, snd_pcm_uframes_t frames,
+			     double *sum, float *peak)
+{
+	double acc[RMS_LANES] = { 0 };
+	float max[RMS_LANES] = { 0 };
+	double total = 0;
+	float m = 0;
+	snd_pcm_uframes_t i = 0;
+	unsigned int l;
+	for (; i + RMS_LANES <= frames; i += RMS_LANES) {
+		for (l = 0; l < RMS_LANES; l++) {
+			double v = src[i + l];
+			float a = fabsf(src[i + l]);
+			acc[l] += v * v;
+			max[l] = a > max[l] ? a : max[l];
+		}
+	}
+	for (; i < frames; i++) {
+		double v = src[i];
+		total += v * v;
+		m = fabsf(src[i]) > m ? fabsf(src[i]) : m;
+	}
+	for (l = 0; l < RMS_LANES; l++) {
+		total += acc[l];
+		m = max[l] > m ? max[l] : m;
+	}
+	*sum += total;
+	if (m > *peak)
+		*peak = m;
+}
+
+static int rms_enable(snd_pcm_scope_t *scope)
+{
+	snd_pcm_scope_rms_t *rms = scope->private_data;
+	snd_pcm_meter_t *meter = rms->pcm->private_data;
+	snd_pcm_t *spcm = meter->gen.slave;
+	if (spcm->format == SND_PCM_FORMAT_S16 ||
+	    spcm->format == SND_PCM_FORMAT_S32 ||
+	    spcm->format == SND_PCM_FORMAT_FLOAT) {
+		rms->format = spcm->format;
+		rms->index = -1;
+	} else if (snd_pcm_format_linear(spcm->format) > 0 &&
+		   snd_pcm_format_physical_width(spcm->format) <= 32) {
+		rms->format = SND_PCM_FORMAT_S32;
+		rms->index = snd_pcm_linear_convert_index(spcm->format,
+							  SND_PCM_FORMAT_S32);
+		rms->conv = malloc(meter->buf_size * sizeof(*rms->conv));
+		if (!rms->conv)
+			return -ENOMEM;
+		rms->conv_area.addr = rms->conv;
+		rms->conv_area.first = 0;
+		rms->conv_area.step = 32;
+	} else
+		return -EINVAL;
+	rms->snapshots = calloc(RMS_SNAPSHOTS * spcm->channels * 2,
+				sizeof(*rms->snapshots));
+	if (!rms->snapshots) {
+		free(rms->conv);
+		rms->conv = NULL;
+		return -ENOMEM;
+	}
+	__atomic_store_n(&rms->seq, 0, __ATOMIC_RELEASE);
+	return 0;
+}
+
+static void rms_disable(snd_pcm_scope_t *scope)
+{
+	snd_pcm_scope_rms_t *rms = scope->private_data;
+	free(rms->conv);
+	rms->conv = NULL;
+	free(rms->snapshots);
+	rms->snapshots = NULL;
+}
+
+static void rms_close(snd_pcm_scope_t *scope)
+{
+	snd_pcm_scope_rms_t *rms = scope->private_data;
+	free(rms);
+}
+
+static void rms_start(snd_pcm_scope_t *scope ATTRIBUTE_UNUSED)
+{
+}
+
+static void rms_stop(snd_pcm_scope_t *scope ATTRIBUTE_UNUSED)
+{
+}
+
+static void rms_channel(snd_pcm_scope_rms_t *rms, unsigned int channel,
+			snd_pcm_uframes_t offset, snd_pcm_uframes_t frames,
+			double *sum, float *peak)
+{
+	snd_pcm_meter_t *meter = rms->pcm->private_data;
+	const snd_pcm_channel_area_t *area = &meter->buf_areas[channel];
+	const void *src;
+	if (rms->index >= 0) {
+		snd_pcm_linear_convert(&rms->conv_area, offset, area, offset,
+				       1, frames, rms->index);
+		area = &rms->conv_area;
+	}
+	src = snd_pcm_channel_area_addr(area, offset);
+	switch (rms->format) {
+	case SND_PCM_FORMAT_S16:
+		rms_kernel_s16(src, frames, sum, peak);
+		break;
+	case SND_PCM_FORMAT_S32:
+		rms_kernel_s32(src, frames, sum, peak);
+		break;
+	default:
+		rms_kernel_float(src, frames, sum, peak);
+		break;
+	}
+}
+
+static void rms_update(snd_pcm_scope_t *scope)
+{
+	snd_pcm_scope_rms_t *rms = scope->private_data;
+	snd_pcm_meter_t *meter = rms->pcm->private_data;
+	snd_pcm_t *spcm = meter->gen.slave;
+	snd_pcm_sframes_t size;
+	snd_pcm_uframes_t start, offset;
+	unsigned int c, seq = rms->seq;
+	float *snap = rms->snapshots + (seq % RMS_SNAPSHOTS) * spcm->channels * 2;
+	size = meter->now - rms->old;
+	if (size < 0)
+		size += spcm->boundary;
+	if (size > (snd_pcm_sframes_t)rms->pcm->buffer_size)
+		size = rms->pcm->buffer_size;
+	if (size == 0)
+		return;
+	/* after a long pause only the last buffer is still in the ring */
+	start = meter->now >= (snd_pcm_uframes_t)size ?
+		meter->now - size : meter->now + spcm->boundary - size;
+	for (c = 0; c < spcm->channels; c++) {
+		snd_pcm_uframes_t frames = size;
+		double sum = 0;
+		float peak = 0;
+		offset = start % meter->buf_size;
+		while (frames > 0) {
+			snd_pcm_uframes_t n = frames;
+			snd_pcm_uframes_t cont = meter->buf_size - offset;
+			if (n > cont)
+				n = cont;
+			rms_channel(rms, c, offset, n, &sum, &peak);
+			offset = n == cont ? 0 : offset + n;
+			frames -= n;
+		}
+		snap[c * 2] = sqrt(sum / size);
+		snap[c * 2 + 1] = peak;
+	}
+	__atomic_store_n(&rms->seq, seq + 1, __ATOMIC_RELEASE);
+	rms->old = meter->now;
+}
+
+static void rms_reset(snd_pcm_scope_t *scope)
+{
+	snd_pcm_scope_rms_t *rms = scope->private_data;
+	snd_pcm_meter_t *meter = rms->pcm->private_data;
+	rms->old = meter->now;
+}
+
+static const snd_pcm_scope_ops_t rms_ops = {
+	.enable = rms_enable,
+	.disable = rms_disable,
+	.close = rms_close,
+	.start = rms_start,
+	.stop = rms_stop,
+	.update = rms_update,
+	.reset = rms_reset,
+};
+
+#endif
+
+/**
+ * \brief Add a RMS and peak level scope to a #SND_PCM_TYPE_METER PCM
+ * \param pcm The pcm handle
+ * \param name Scope name
+ * \param scopep Pointer to newly created and added scope
+ * \return 0 on success otherwise a negative error code
+ *
+ * The scope measures the RMS and the sample peak level of each channel
+ * over the frames played or captured since its previous update, directly
+ * on the meter buffer. The levels can be read from any thread with
+ * #snd_pcm_scope_rms_get_channel().
+ */
+int snd_pcm_scope_rms_open(snd_pcm_t *pcm, const char *name,
+			   snd_pcm_scope_t **scopep)
+{
+	snd_pcm_meter_t *meter;
+	snd_pcm_scope_t *scope;
+	snd_pcm_scope_rms_t *rms;
+	assert(pcm->type == SND_PCM_TYPE_METER);
+	meter = pcm->private_data;
+	scope = calloc(1, sizeof(*scope));
+	if (!scope)
+		return -ENOMEM;
+	rms = calloc(1, sizeof(*rms));
+	if (!rms) {
+		free(scope);
+		return -ENOMEM;
+	}
+	if (name)
+		scope->name = strdup(name);
+	rms->pcm = pcm;
+	scope->ops = &rms_ops;
+	scope->private_data = rms;
+	list_add_tail(&scope->list, &meter->scopes);
+	*scopep = scope;
+	return 0;
+}
+
+/**
+ * \brief Get the latest levels of a channel from a RMS scope
+ * \param scope RMS scope handle
+ * \param channel Channel
+ * \param rms Returned RMS level (1.0 is full scale)
+ * \param peak Returned sample peak level (1.0 is full scale)
+ * \return 0 on success, -EAGAIN when no level was measured yet
+ *
+ * This function does not take any lock and can be called from any thread
+ * while the stream is running.
+ */
+int snd_pcm_scope_rms_get_channel(snd_pcm_scope_t *scope, unsigned int channel,
+				  float *rms, float *peak)
+{
+	snd_pcm_scope_rms_t *r;
+	snd_pcm_meter_t *meter;
+	unsigned int seq, channels;
+	const float *snap;
+	float v_rms, v_peak;
+	assert(scope->ops == &rms_ops);
+	r = scope->private_data;
+	meter = r->pcm->private_data;
+	assert(meter->gen.slave->setup);
+	channels = meter->gen.slave->channels;
+	assert(channel < channels);
+	do {
+		seq = __atomic_load_n(&r->seq, __ATOMIC_ACQUIRE);
+		if (seq == 0 || !r->snapshots)
+			return -EAGAIN;
+		snap = r->snapshots + ((seq - 1) % RMS_SNAPSHOTS) * channels * 2;
+		v_rms = snap[channel * 2];
+		v_peak = snap[channel * 2 + 1];
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (__atomic_load_n(&r->seq, __ATOMIC_RELAXED) - seq >= RMS_SNAPSHOTS - 1);
+	*rms = v_rms;
+	*peak = v_peak;
+	return 0;
+}
+
+/**
+ * \brief Add a RMS scope to a #SND_PCM_TYPE_METER PCM from configuration
+ * \param pcm The pcm handle
+ * \param name Scope name
+ * \param root Root configuration node
+ * \param conf Scope configuration node
+ * \return 0 on success otherwise a negative error code
+ */
+int _snd_pcm_scope_rms_open(snd_pcm_t *pcm, const char *name,
+			    snd_config_t *root ATTRIBUTE_UNUSED,
+			    snd_config_t *conf)
+{
+	snd_config_iterator_t i, next;
+	snd_pcm_scope_t *scope;
+	snd_config_for_each(i, next, conf) {
+		snd_config_t *n = snd_config_iterator_entry(i);
+		const char *id;
+		if (snd_config_get_id(n, &id) < 0)
+			continue;
+		if (strcmp(id, "comment") == 0)
+			continue;
+		if (strcmp(id, "type") == 0)
+			continue;
+		snd_error(PCM, "Unknown field %s", id);
+		return -EINVAL;
+	}
+	return snd_pcm_scope_rms_open(pcm, name, &scope);
+}
+
 /**
  * \brief allocate an invalid #snd_pcm_scope_t using standard malloc
  * \param ptr returned pointer
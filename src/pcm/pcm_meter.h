@@ -0,0 +1,55 @@
+/*
+ *  PCM - Meter plugin - private definitions
+ *
+ *   This library is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as
+ *   published by the Free Software Foundation; either version 2.1 of
+ *   the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <pthread.h>
+
+struct _snd_pcm_scope {
+	int enabled;
+	char *name;
+	const snd_pcm_scope_ops_t *ops;
+	void *private_data;
+	struct list_head list;
+};
+
+/*
+ * The meter buffer is a single producer, multiple consumer ring. The
+ * thread doing the transfers is the only one writing to it: it copies the
+ * committed (playback) or captured frames in and then publishes the new
+ * position with a release store to rptr. The meter thread loads rptr and
+ * hands the frames up to it to the scopes without any lock; the buffer
+ * holds at least two slave buffers, so the producer never overwrites the
+ * frames a scope is still reading.
+ */
+typedef struct _snd_pcm_meter {
+	snd_pcm_generic_t gen;
+	snd_pcm_uframes_t rptr;		/* published write position */
+	snd_pcm_uframes_t buf_size;
+	snd_pcm_channel_area_t *buf_areas;
+	snd_pcm_uframes_t now;
+	unsigned char *buf;
+	struct list_head scopes;
+	int closed;
+	int running;
+	int reset;
+	pthread_t thread;
+	pthread_mutex_t running_mutex;
+	pthread_cond_t running_cond;
+	struct timespec delay;
+	void *dl_handle;
+} snd_pcm_meter_t;
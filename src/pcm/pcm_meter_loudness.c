@@ -0,0 +1,809 @@
+/*
+ *  PCM - Meter plugin - loudness and true peak scope
+ *
+ *   This library is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as
+ *   published by the Free Software Foundation; either version 2.1 of
+ *   the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Loudness measurement following ITU-R BS.1770-4 / EBU R128: the signal is
+ * K-weighted (high shelf + high pass biquads), the mean square is taken
+ * over 100 ms sub-blocks, the momentary loudness over the last 4 of them
+ * (400 ms), the short-term loudness over the last 30 (3 s) and the
+ * integrated loudness over all the 400 ms blocks of the stream with the
+ * -70 LUFS absolute and -10 LU relative gates.  The gated blocks are kept
+ * in a histogram of 0.1 LU bins, so the memory use does not grow with the
+ * stream.  The true peak is the maximum of the signal oversampled by a
+ * windowed sinc polyphase interpolator.  Everything runs in the meter
+ * thread.
+ */
+
+#include "pcm_local.h"
+#include "pcm_plugin.h"
+#include "pcm_meter.h"
+#include <math.h>
+#include <sound/tlv.h>
+
+#ifndef DOC_HIDDEN
+#define LOUD_SNAPSHOTS		8
+#define LOUD_SHORT_BLOCKS	30	/* 3 s of 100 ms sub-blocks */
+#define LOUD_MOMENTARY_BLOCKS	4	/* 400 ms */
+#define LOUD_HIST_MIN		-70.0	/* absolute gate, LUFS */
+#define LOUD_HIST_BINS		1000	/* 0.1 LU bins up to +30 LUFS */
+#define LOUD_TP_TAPS		12	/* taps per phase */
+#define LOUD_CTL_OFFSET		14400	/* ctl value of -144 dB */
+#define LOUD_CTL_MAX		(LOUD_CTL_OFFSET + 2000)
+#define LOUD_MAX_CHANNELS	128	/* values of a control element */
+
+struct loud_channel {
+	double z[4];			/* K-weighting filter states */
+	double weight;			/* BS.1770 channel weight */
+	double ksum;			/* K-weighted sum of squares */
+	double rsum;			/* plain sum of squares */
+	float tp_hist[LOUD_TP_TAPS - 1];
+	float true_peak;
+};
+
+typedef struct _snd_pcm_scope_loudness {
+	snd_pcm_t *pcm;
+	snd_pcm_uframes_t old;
+	unsigned int channels;
+	int index;			/* conversion to S32 or -1 */
+	int32_t *conv;
+	snd_pcm_channel_area_t conv_area;
+	float *in;			/* history + converted frames */
+	double kb[2][3], ka[2][3];	/* K-weighting biquads */
+	unsigned int oversample;
+	float *tp_coef;			/* oversample * LOUD_TP_TAPS */
+	struct loud_channel *ch;
+	snd_pcm_uframes_t block_len;
+	snd_pcm_uframes_t block_fill;
+	unsigned int blocks;		/* completed sub-blocks */
+	double block_energy[LOUD_SHORT_BLOCKS];
+	double *block_rms;		/* LOUD_MOMENTARY_BLOCKS * channels */
+	double hist_energy[LOUD_HIST_BINS];
+	unsigned int hist_count[LOUD_HIST_BINS];
+	/*
+	 * Published results: 3 loudness values followed by the true peak
+	 * and RMS of each channel, all in dB. Same single writer ring as
+	 * the RMS scope.
+	 */
+	float *snapshots;
+	unsigned int seq;
+	/* optional read-only control elements */
+	int ctl_card;
+	char *ctl_name;
+	int ctl_index;
+	snd_ctl_t *ctl;
+	snd_ctl_elem_id_t ctl_id[3];
+	unsigned int ctl_added;
+	int ctl_dirty;
+} snd_pcm_scope_loudness_t;
+
+static double loud_db(double energy, double offset)
+{
+	if (energy <= 0)
+		return -INFINITY;
+	return offset + 10 * log10(energy);
+}
+
+static void loud_setup_filter(snd_pcm_scope_loudness_t *loud, unsigned int rate)
+{
+	double f0, G, Q, K, Vh, Vb, a0;
+
+	/* stage 1: high shelf modelling the head */
+	f0 = 1681.974450955533;
+	G = 3.999843853973347;
+	Q = 0.7071752369554196;
+	K = tan(M_PI * f0 / rate);
+	Vh = pow(10.0, G / 20.0);
+	Vb = pow(Vh, 0.4996667741545416);
+	a0 = 1.0 + K / Q + K * K;
+	loud->kb[0][0] = (Vh + Vb * K / Q + K * K) / a0;
+	loud->kb[0][1] = 2.0 * (K * K - Vh) / a0;
+	loud->kb[0][2] = (Vh - Vb * K / Q + K * K) / a0;
+	loud->ka[0][1] = 2.0 * (K * K - 1.0) / a0;
+	loud->ka[0][2] = (1.0 - K / Q + K * K) / a0;
+
+	/* stage 2: RLB high pass */
+	f0 = 38.13547087602444;
+	Q = 0.5003270373238773;
+	K = tan(M_PI * f0 / rate);
+	a0 = 1.0 + K / Q + K * K;
+	loud->kb[1][0] = 1.0;
+	loud->kb[1][1] = -2.0;
+	loud->kb[1][2] = 1.0;
+	loud->ka[1][1] = 2.0 * (K * K - 1.0) / a0;
+	loud->ka[1][2] = (1.0 - K / Q + K * K) / a0;
+}
+
+/*
+ * Phase p of the interpolator estimates the signal p / oversample samples
+ * after x[n - LOUD_TP_TAPS / 2]; phase 0 is the sample itself. The
+ * coefficients are stored reversed, so that the dot product runs forward
+ * over the input.
+ */
+static void loud_setup_true_peak(snd_pcm_scope_loudness_t *loud)
+{
+	unsigned int p, k;
+	const double half = LOUD_TP_TAPS / 2;
+	for (p = 0; p < loud->oversample; p++) {
+		double d = (double) p / loud->oversample;
+		for (k = 0; k < LOUD_TP_TAPS; k++) {
+			double x = half - k - d;
+			double c;
+			if (p == 0)
+				c = k == LOUD_TP_TAPS / 2;
+			else
+				c = sin(M_PI * x) / (M_PI * x) *
+					0.5 * (1.0 + cos(M_PI * x / half));
+			loud->tp_coef[p * LOUD_TP_TAPS + LOUD_TP_TAPS - 1 - k] = c;
+		}
+	}
+}
+
+static void loud_setup_weights(snd_pcm_scope_loudness_t *loud, snd_pcm_t *spcm)
+{
+	snd_pcm_chmap_t *map = snd_pcm_get_chmap(spcm);
+	unsigned int c;
+	for (c = 0; c < loud->channels; c++) {
+		loud->ch[c].weight = 1.0;
+		if (!map || c >= map->channels)
+			continue;
+		switch (map->pos[c] & SND_CHMAP_POSITION_MASK) {
+		case SND_CHMAP_LFE:
+		case SND_CHMAP_LLFE:
+		case SND_CHMAP_RLFE:
+			loud->ch[c].weight = 0.0;
+			break;
+		case SND_CHMAP_RL:
+		case SND_CHMAP_RR:
+		case SND_CHMAP_SL:
+		case SND_CHMAP_SR:
+			loud->ch[c].weight = 1.41;
+			break;
+		default:
+			break;
+		}
+	}
+	free(map);
+}
+
+/* K-weighting filter, plain and weighted sums of squares of a channel */
+static void loud_filter(snd_pcm_scope_loudness_t *loud, struct loud_channel *ch,
+			const float *x, snd_pcm_uframes_t frames)
+{
+	double z0 = ch->z[0], z1 = ch->z[1], z2 = ch->z[2], z3 = ch->z[3];
+	double b00 = loud->kb[0][0], b01 = loud->kb[0][1], b02 = loud->kb[0][2];
+	double a01 = loud->ka[0][1], a02 = loud->ka[0][2];
+	double a11 = loud->ka[1][1], a12 = loud->ka[1][2];
+	double ksum = 0, rsum = 0;
+	snd_pcm_uframes_t i;
+	for (i = 0; i < frames; i++) {
+		double v = x[i], y;
+		rsum += v * v;
+		/* transposed direct form II */
+		y = b00 * v + z0;
+		z0 = b01 * v - a01 * y + z1;
+		z1 = b02 * v - a02 * y;
+		v = y;
+		y = v + z2;
+		z2 = -2.0 * v - a11 * y + z3;
+		z3 = v - a12 * y;
+		ksum += y * y;
+	}
+	ch->z[0] = z0;
+	ch->z[1] = z1;
+	ch->z[2] = z2;
+	ch->z[3] = z3;
+	ch->ksum += ksum;
+	ch->rsum += rsum;
+}
+
+/* x points after LOUD_TP_TAPS - 1 history samples */
+static void loud_true_peak(snd_pcm_scope_loudness_t *loud, struct loud_channel *ch,
+			   const float *x, snd_pcm_uframes_t frames)
+{
+	const float *h = x - (LOUD_TP_TAPS - 1);
+	float max = ch->true_peak;
+	snd_pcm_uframes_t i;
+	unsigned int p, k;
+	for (i = 0; i < frames; i++) {
+		for (p = 0; p < loud->oversample; p++) {
+			const float *c = loud->tp_coef + p * LOUD_TP_TAPS;
+			float acc = 0;
+			for (k = 0; k < LOUD_TP_TAPS; k++)
+				acc += c[k] * h[i + k];
+			acc = fabsf(acc);
+			max = acc > max ? acc : max;
+		}
+	}
+	ch->true_peak = max;
+}
+
+/* convert frames of a channel to float after its interpolator history */
+static float *loud_input(snd_pcm_scope_loudness_t *loud, unsigned int channel,
+			 snd_pcm_uframes_t offset, snd_pcm_uframes_t frames)
+{
+	snd_pcm_meter_t *meter = loud->pcm->private_data;
+	const snd_pcm_channel_area_t *area = &meter->buf_areas[channel];
+	float *x = loud->in + LOUD_TP_TAPS - 1;
+	snd_pcm_uframes_t i;
+	memcpy(loud->in, loud->ch[channel].tp_hist, sizeof(loud->ch[channel].tp_hist));
+	if (loud->index < 0) {
+		memcpy(x, snd_pcm_channel_area_addr(area, offset), frames * sizeof(float));
+	} else {
+		const float scale = 1.0f / 2147483648.0f;
+		snd_pcm_linear_convert(&loud->conv_area, 0, area, offset,
+				       1, frames, loud->index);
+		for (i = 0; i < frames; i++)
+			x[i] = loud->conv[i] * scale;
+	}
+	memcpy(loud->ch[channel].tp_hist, x + frames - (LOUD_TP_TAPS - 1),
+	       sizeof(loud->ch[channel].tp_hist));
+	return x;
+}
+
+static double loud_integrated(snd_pcm_scope_loudness_t *loud)
+{
+	double energy = 0, gate;
+	unsigned int count = 0, i, first;
+	for (i = 0; i < LOUD_HIST_BINS; i++) {
+		energy += loud->hist_energy[i];
+		count += loud->hist_count[i];
+	}
+	if (!count)
+		return -INFINITY;
+	gate = loud_db(energy / count, -0.691) - 10.0;
+	if (gate <= LOUD_HIST_MIN)
+		first = 0;
+	else
+		first = (gate - LOUD_HIST_MIN) * 10 + 0.5;
+	energy = 0;
+	count = 0;
+	for (i = first; i < LOUD_HIST_BINS; i++) {
+		energy += loud->hist_energy[i];
+		count += loud->hist_count[i];
+	}
+	if (!count)
+		return -INFINITY;
+	return loud_db(energy / count, -0.691);
+}
+
+static void loud_end_block(snd_pcm_scope_loudness_t *loud)
+{
+	unsigned int c, slot = loud->blocks % LOUD_SHORT_BLOCKS;
+	double energy = 0;
+	for (c = 0; c < loud->channels; c++) {
+		struct loud_channel *ch = &loud->ch[c];
+		energy += ch->weight * ch->ksum;
+		loud->block_rms[(loud->blocks % LOUD_MOMENTARY_BLOCKS) * loud->channels + c] =
+			ch->rsum / loud->block_len;
+		ch->ksum = 0;
+		ch->rsum = 0;
+	}
+	loud->block_energy[slot] = energy / loud->block_len;
+	loud->blocks++;
+	loud->block_fill = 0;
+	if (loud->blocks >= LOUD_MOMENTARY_BLOCKS) {
+		double z = 0, l;
+		unsigned int i;
+		for (i = 1; i <= LOUD_MOMENTARY_BLOCKS; i++)
+			z += loud->block_energy[(loud->blocks - i) % LOUD_SHORT_BLOCKS];
+		z /= LOUD_MOMENTARY_BLOCKS;
+		l = loud_db(z, -0.691);
+		if (l > LOUD_HIST_MIN) {
+			int bin = (l - LOUD_HIST_MIN) * 10;
+			if (bin >= LOUD_HIST_BINS)
+				bin = LOUD_HIST_BINS - 1;
+			loud->hist_energy[bin] += z;
+			loud->hist_count[bin]++;
+		}
+	}
+	loud->ctl_dirty = 1;
+}
+
+static void loud_publish(snd_pcm_scope_loudness_t *loud)
+{
+	unsigned int seq = loud->seq, c, i, n;
+	float *snap = loud->snapshots + (seq % LOUD_SNAPSHOTS) * (3 + 2 * loud->channels);
+	double z;
+
+	n = loud->blocks < LOUD_MOMENTARY_BLOCKS ? loud->blocks : LOUD_MOMENTARY_BLOCKS;
+	for (i = 1, z = 0; i <= n; i++)
+		z += loud->block_energy[(loud->blocks - i) % LOUD_SHORT_BLOCKS];
+	snap[0] = n ? loud_db(z / n, -0.691) : -INFINITY;
+	n = loud->blocks < LOUD_SHORT_BLOCKS ? loud->blocks : LOUD_SHORT_BLOCKS;
+	for (i = 1, z = 0; i <= n; i++)
+		z += loud->block_energy[(loud->blocks - i) % LOUD_SHORT_BLOCKS];
+	snap[1] = n ? loud_db(z / n, -0.691) : -INFINITY;
+	snap[2] = loud_integrated(loud);
+	n = loud->blocks < LOUD_MOMENTARY_BLOCKS ? loud->blocks : LOUD_MOMENTARY_BLOCKS;
+	for (c = 0; c < loud->channels; c++) {
+		snap[3 + c * 2] = loud->ch[c].true_peak > 0 ?
+			20 * log10(loud->ch[c].true_peak) : -INFINITY;
+		for (i = 1, z = 0; i <= n; i++)
+			z += loud->block_rms[((loud->blocks - i) % LOUD_MOMENTARY_BLOCKS) * loud->channels + c];
+		snap[3 + c * 2 + 1] = n ? loud_db(z / n, 0) : -INFINITY;
+	}
+	__atomic_store_n(&loud->seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+static long loud_ctl_value(float db)
+{
+	long v;
+	if (!(db > -144.0f))
+		return 0;
+	v = lrintf(db * 100) + LOUD_CTL_OFFSET;
+	return v > LOUD_CTL_MAX ? LOUD_CTL_MAX : v;
+}
+
+static void loud_ctl_update(snd_pcm_scope_loudness_t *loud)
+{
+	const float *snap;
+	snd_ctl_elem_value_t val = {0};
+	unsigned int c, i;
+	if (!loud->ctl_added || !loud->ctl_dirty)
+		return;
+	loud->ctl_dirty = 0;
+	snap = loud->snapshots + ((loud->seq - 1) % LOUD_SNAPSHOTS) * (3 + 2 * loud->channels);
+	val.id = loud->ctl_id[0];
+	for (i = 0; i < 3; i++)
+		val.value.integer.value[i] = loud_ctl_value(snap[i]);
+	snd_ctl_elem_write(loud->ctl, &val);
+	for (i = 1; i < 3; i++) {
+		val.id = loud->ctl_id[i];
+		for (c = 0; c < loud->channels; c++)
+			val.value.integer.value[c] = loud_ctl_value(snap[3 + c * 2 + i - 1]);
+		snd_ctl_elem_write(loud->ctl, &val);
+	}
+}
+
+static void loud_ctl_remove(snd_pcm_scope_loudness_t *loud)
+{
+	unsigned int i;
+	for (i = 0; i < loud->ctl_added; i++)
+		snd_ctl_elem_remove(loud->ctl, &loud->ctl_id[i]);
+	loud->ctl_added = 0;
+}
+
+static int loud_ctl_add(snd_pcm_scope_loudness_t *loud, snd_pcm_t *spcm)
+{
+	static const char *const suffix[3] = { "Loudness", "True Peak", "RMS" };
+	unsigned int tlv[4];
+	char name[44];
+	unsigned int i;
+	int err;
+
+	if (!loud->ctl) {
+		int card = loud->ctl_card;
+		if (card < 0) {
+			snd_pcm_info_t info = {0};
+			err = snd_pcm_info(spcm, &info);
+			if (err < 0)
+				return err;
+			card = snd_pcm_info_get_card(&info);
+			if (card < 0) {
+				snd_error(PCM, "No card defined for loudness controls");
+				return -EINVAL;
+			}
+		}
+		snprintf(name, sizeof(name), "hw:%d", card);
+		err = snd_ctl_open(&loud->ctl, name, 0);
+		if (err < 0) {
+			snd_error(PCM, "Cannot open CTL %s", name);
+			return err;
+		}
+	}
+	tlv[SNDRV_CTL_TLVO_TYPE] = SND_CTL_TLVT_DB_SCALE;
+	tlv[SNDRV_CTL_TLVO_LEN] = 2 * sizeof(int);
+	tlv[SNDRV_CTL_TLVO_DB_SCALE_MIN] = -LOUD_CTL_OFFSET;
+	tlv[SNDRV_CTL_TLVO_DB_SCALE_MUTE_AND_STEP] = 1;
+	for (i = 0; i < 3; i++) {
+		snd_ctl_elem_info_t cinfo = {0};
+		snd_ctl_elem_id_t *id = &loud->ctl_id[i];
+		memset(id, 0, sizeof(*id));
+		snprintf(name, sizeof(name), "%s %s", loud->ctl_name, suffix[i]);
+		snd_ctl_elem_id_set_interface(id, SND_CTL_ELEM_IFACE_MIXER);
+		snd_ctl_elem_id_set_name(id, name);
+		snd_ctl_elem_id_set_index(id, loud->ctl_index);
+		snd_ctl_elem_info_set_id(&cinfo, id);
+		err = snd_ctl_add_integer_elem_set(loud->ctl, &cinfo, 1,
+						   i ? loud->channels : 3,
+						   0, LOUD_CTL_MAX, 0);
+		if (err < 0) {
+			snd_error(PCM, "Cannot add control %s", name);
+			loud_ctl_remove(loud);
+			return err;
+		}
+		snd_ctl_elem_info_get_id(&cinfo, id);
+		loud->ctl_added++;
+		snd_ctl_elem_tlv_write(loud->ctl, id, tlv);
+	}
+	return 0;
+}
+
+static void loud_clear(snd_pcm_scope_loudness_t *loud)
+{
+	unsigned int c;
+	for (c = 0; c < loud->channels; c++) {
+		struct loud_channel *ch = &loud->ch[c];
+		double weight = ch->weight;
+		memset(ch, 0, sizeof(*ch));
+		ch->weight = weight;
+	}
+	loud->block_fill = 0;
+	loud->blocks = 0;
+	memset(loud->hist_energy, 0, sizeof(loud->hist_energy));
+	memset(loud->hist_count, 0, sizeof(loud->hist_count));
+}
+
+static void loudness_disable(snd_pcm_scope_t *scope);
+
+static int loudness_enable(snd_pcm_scope_t *scope)
+{
+	snd_pcm_scope_loudness_t *loud = scope->private_data;
+	snd_pcm_meter_t *meter = loud->pcm->private_data;
+	snd_pcm_t *spcm = meter->gen.slave;
+	int err;
+
+	/* the per-channel control values are written in one element */
+	if (spcm->channels > LOUD_MAX_CHANNELS) {
+		snd_error(PCM, "Loudness scope supports at most %d channels",
+			  LOUD_MAX_CHANNELS);
+		return -EINVAL;
+	}
+	if (spcm->format == SND_PCM_FORMAT_FLOAT) {
+		loud->index = -1;
+	} else if (snd_pcm_format_linear(spcm->format) > 0 &&
+		   snd_pcm_format_physical_width(spcm->format) <= 32) {
+		loud->index = snd_pcm_linear_convert_index(spcm->format,
+							   SND_PCM_FORMAT_S32);
+		loud->conv = malloc(meter->buf_size * sizeof(*loud->conv));
+		if (!loud->conv)
+			return -ENOMEM;
+		loud->conv_area.addr = loud->conv;
+		loud->conv_area.first = 0;
+		loud->conv_area.step = 32;
+	} else
+		return -EINVAL;
+	loud->channels = spcm->channels;
+	loud->block_len = spcm->rate / 10;
+	if (spcm->rate <= 48000)
+		loud->oversample = 4;
+	else if (spcm->rate <= 96000)
+		loud->oversample = 2;
+	else
+		loud->oversample = 1;
+	loud->in = malloc((meter->buf_size + LOUD_TP_TAPS - 1) * sizeof(*loud->in));
+	loud->tp_coef = malloc(loud->oversample * LOUD_TP_TAPS * sizeof(*loud->tp_coef));
+	loud->ch = calloc(loud->channels, sizeof(*loud->ch));
+	loud->block_rms = calloc(LOUD_MOMENTARY_BLOCKS * loud->channels,
+				 sizeof(*loud->block_rms));
+	loud->snapshots = calloc(LOUD_SNAPSHOTS * (3 + 2 * loud->channels),
+				 sizeof(*loud->snapshots));
+	if (!loud->in || !loud->tp_coef || !loud->ch || !loud->block_rms ||
+	    !loud->snapshots) {
+		loudness_disable(scope);
+		return -ENOMEM;
+	}
+	loud_setup_filter(loud, spcm->rate);
+	loud_setup_true_peak(loud);
+	loud_setup_weights(loud, spcm);
+	loud_clear(loud);
+	__atomic_store_n(&loud->seq, 0, __ATOMIC_RELEASE);
+	if (loud->ctl_name) {
+		err = loud_ctl_add(loud, spcm);
+		if (err < 0) {
+			loudness_disable(scope);
+			return err;
+		}
+	}
+	return 0;
+}
+
+static void loudness_disable(snd_pcm_scope_t *scope)
+{
+	snd_pcm_scope_loudness_t *loud = scope->private_data;
+	loud_ctl_remove(loud);
+	free(loud->conv);
+	loud->conv = NULL;
+	free(loud->in);
+	loud->in = NULL;
+	free(loud->tp_coef);
+	loud->tp_coef = NULL;
+	free(loud->ch);
+	loud->ch = NULL;
+	free(loud->block_rms);
+	loud->block_rms = NULL;
+	free(loud->snapshots);
+	loud->snapshots = NULL;
+}
+
+static void loudness_close(snd_pcm_scope_t *scope)
+{
+	snd_pcm_scope_loudness_t *loud = scope->private_data;
+	if (loud->ctl)
+		snd_ctl_close(loud->ctl);
+	free(loud->ctl_name);
+	free(loud);
+}
+
+static void loudness_start(snd_pcm_scope_t *scope ATTRIBUTE_UNUSED)
+{
+}
+
+static void loudness_stop(snd_pcm_scope_t *scope ATTRIBUTE_UNUSED)
+{
+}
+
+static void loudness_update(snd_pcm_scope_t *scope)
+{
+	snd_pcm_scope_loudness_t *loud = scope->private_data;
+	snd_pcm_meter_t *meter = loud->pcm->private_data;
+	snd_pcm_t *spcm = meter->gen.slave;
+	snd_pcm_sframes_t size;
+	snd_pcm_uframes_t offset;
+	unsigned int c;
+	size = meter->now - loud->old;
+	if (size < 0)
+		size += spcm->boundary;
+	if (size > (snd_pcm_sframes_t)loud->pcm->buffer_size)
+		size = loud->pcm->buffer_size;
+	if (size == 0)
+		return;
+	/* after a long pause only the last buffer is still in the ring */
+	offset = meter->now >= (snd_pcm_uframes_t)size ?
+		 meter->now - size : meter->now + spcm->boundary - size;
+	offset %= meter->buf_size;
+	while (size > 0) {
+		snd_pcm_uframes_t frames = size;
+		snd_pcm_uframes_t cont = meter->buf_size - offset;
+		if (frames > cont)
+			frames = cont;
+		if (frames > loud->block_len - loud->block_fill)
+			frames = loud->block_len - loud->block_fill;
+		for (c = 0; c < loud->channels; c++) {
+			float *x = loud_input(loud, c, offset, frames);
+			loud_filter(loud, &loud->ch[c], x, frames);
+			loud_true_peak(loud, &loud->ch[c], x, frames);
+		}
+		loud->block_fill += frames;
+		if (loud->block_fill == loud->block_len)
+			loud_end_block(loud);
+		offset = frames == cont ? 0 : offset + frames;
+		size -= frames;
+	}
+	loud->old = meter->now;
+	loud_publish(loud);
+	loud_ctl_update(loud);
+}
+
+static void loudness_reset(snd_pcm_scope_t *scope)
+{
+	snd_pcm_scope_loudness_t *loud = scope->private_data;
+	snd_pcm_meter_t *meter = loud->pcm->private_data;
+	loud->old = meter->now;
+	loud_clear(loud);
+}
+
+static const snd_pcm_scope_ops_t loudness_ops = {
+	.enable = loudness_enable,
+	.disable = loudness_disable,
+	.close = loudness_close,
+	.start = loudness_start,
+	.stop = loudness_stop,
+	.update = loudness_update,
+	.reset = loudness_reset,
+};
+
+static int loudness_open(snd_pcm_t *pcm, const char *name,
+			 const char *ctl_name, int ctl_card, int ctl_index,
+			 snd_pcm_scope_t **scopep)
+{
+	snd_pcm_meter_t *meter;
+	snd_pcm_scope_t *scope;
+	snd_pcm_scope_loudness_t *loud;
+	assert(pcm->type == SND_PCM_TYPE_METER);
+	meter = pcm->private_data;
+	scope = calloc(1, sizeof(*scope));
+	if (!scope)
+		return -ENOMEM;
+	loud = calloc(1, sizeof(*loud));
+	if (!loud) {
+		free(scope);
+		return -ENOMEM;
+	}
+	if (ctl_name) {
+		loud->ctl_name = strdup(ctl_name);
+		if (!loud->ctl_name) {
+			free(loud);
+			free(scope);
+			return -ENOMEM;
+		}
+	}
+	loud->ctl_card = ctl_card;
+	loud->ctl_index = ctl_index;
+	if (name)
+		scope->name = strdup(name);
+	loud->pcm = pcm;
+	scope->ops = &loudness_ops;
+	scope->private_data = loud;
+	list_add_tail(&scope->list, &meter->scopes);
+	*scopep = scope;
+	return 0;
+}
+
+static const float *loudness_snapshot(snd_pcm_scope_t *scope, float *dst,
+				      unsigned int first, unsigned int count)
+{
+	snd_pcm_scope_loudness_t *loud;
+	unsigned int seq, i;
+	const float *snap;
+	assert(scope->ops == &loudness_ops);
+	loud = scope->private_data;
+	do {
+		seq = __atomic_load_n(&loud->seq, __ATOMIC_ACQUIRE);
+		if (seq == 0 || !loud->snapshots)
+			return NULL;
+		snap = loud->snapshots + ((seq - 1) % LOUD_SNAPSHOTS) * (3 + 2 * loud->channels);
+		for (i = 0; i < count; i++)
+			dst[i] = snap[first + i];
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (__atomic_load_n(&loud->seq, __ATOMIC_RELAXED) - seq >= LOUD_SNAPSHOTS - 1);
+	return dst;
+}
+#endif
+
+/**
+ * \brief Add a loudness scope to a #SND_PCM_TYPE_METER PCM
+ * \param pcm The pcm handle
+ * \param name Scope name
+ * \param scopep Pointer to newly created and added scope
+ * \return 0 on success otherwise a negative error code
+ *
+ * The scope measures the loudness of the stream as specified by
+ * ITU-R BS.1770-4 and EBU R128 (momentary, short-term and integrated
+ * loudness), and the true peak and RMS level of each channel. The
+ * integrated loudness and the true peaks cover the stream since it was
+ * prepared. The results can be read from any thread with
+ * #snd_pcm_scope_loudness_get() and #snd_pcm_scope_loudness_get_channel().
+ * Streams with more than 128 channels are not measured.
+ */
+int snd_pcm_scope_loudness_open(snd_pcm_t *pcm, const char *name,
+				snd_pcm_scope_t **scopep)
+{
+	return loudness_open(pcm, name, NULL, -1, 0, scopep);
+}
+
+/**
+ * \brief Get the latest loudness values from a loudness scope
+ * \param scope Loudness scope handle
+ * \param momentary Returned momentary loudness (400 ms) in LUFS
+ * \param short_term Returned short-term loudness (3 s) in LUFS
+ * \param integrated Returned gated integrated loudness in LUFS
+ * \return 0 on success, -EAGAIN when nothing was measured yet
+ *
+ * A value is -INFINITY while there is no (ungated) signal to measure.
+ * This function does not take any lock and can be called from any thread.
+ */
+int snd_pcm_scope_loudness_get(snd_pcm_scope_t *scope, float *momentary,
+			       float *short_term, float *integrated)
+{
+	float v[3];
+	if (!loudness_snapshot(scope, v, 0, 3))
+		return -EAGAIN;
+	*momentary = v[0];
+	*short_term = v[1];
+	*integrated = v[2];
+	return 0;
+}
+
+/**
+ * \brief Get the latest levels of a channel from a loudness scope
+ * \param scope Loudness scope handle
+ * \param channel Channel
+ * \param true_peak Returned true peak since the stream start in dBTP
+ * \param rms Returned RMS level over the last 400 ms in dBFS
+ * \return 0 on success, -EAGAIN when nothing was measured yet
+ *
+ * This function does not take any lock and can be called from any thread.
+ */
+int snd_pcm_scope_loudness_get_channel(snd_pcm_scope_t *scope,
+				       unsigned int channel,
+				       float *true_peak, float *rms)
+{
+	snd_pcm_scope_loudness_t *loud = scope->private_data;
+	float v[2];
+	assert(channel < loud->channels);
+	if (!loudness_snapshot(scope, v, 3 + channel * 2, 2))
+		return -EAGAIN;
+	*true_peak = v[0];
+	*rms = v[1];
+	return 0;
+}
+
+/**
+ * \brief Add a loudness scope to a #SND_PCM_TYPE_METER PCM from configuration
+ * \param pcm The pcm handle
+ * \param name Scope name
+ * \param root Root configuration node
+ * \param conf Scope configuration node
+ * \return 0 on success otherwise a negative error code
+ */
+int _snd_pcm_scope_loudness_open(snd_pcm_t *pcm, const char *name,
+				 snd_config_t *root ATTRIBUTE_UNUSED,
+				 snd_config_t *conf)
+{
+	snd_config_iterator_t i, next;
+	snd_pcm_scope_t *scope;
+	const char *ctl_name = NULL;
+	long ctl_index = 0;
+	int ctl_card = -1;
+	int err;
+	snd_config_for_each(i, next, conf) {
+		snd_config_t *n = snd_config_iterator_entry(i);
+		const char *id;
+		if (snd_config_get_id(n, &id) < 0)
+			continue;
+		if (strcmp(id, "comment") == 0)
+			continue;
+		if (strcmp(id, "type") == 0)
+			continue;
+		if (strcmp(id, "control") == 0) {
+			snd_config_iterator_t j, jnext;
+			if (snd_config_get_type(n) != SND_CONFIG_TYPE_COMPOUND) {
+				snd_error(PCM, "Invalid type for %s", id);
+				return -EINVAL;
+			}
+			snd_config_for_each(j, jnext, n) {
+				snd_config_t *m = snd_config_iterator_entry(j);
+				if (snd_config_get_id(m, &id) < 0)
+					continue;
+				if (strcmp(id, "card") == 0) {
+					err = snd_config_get_card(m);
+					if (err < 0)
+						return err;
+					ctl_card = err;
+					continue;
+				}
+				if (strcmp(id, "name") == 0) {
+					if (snd_config_get_string(m, &ctl_name) < 0) {
+						snd_error(PCM, "field %s is not a string", id);
+						return -EINVAL;
+					}
+					continue;
+				}
+				if (strcmp(id, "index") == 0) {
+					if (snd_config_get_integer(m, &ctl_index) < 0) {
+						snd_error(PCM, "field %s is not an integer", id);
+						return -EINVAL;
+					}
+					continue;
+				}
+				snd_error(PCM, "Unknown field %s", id);
+				return -EINVAL;
+			}
+			if (!ctl_name) {
+				snd_error(PCM, "control name is not defined");
+				return -EINVAL;
+			}
+			continue;
+		}
+		snd_error(PCM, "Unknown field %s", id);
+		return -EINVAL;
+	}
+	return loudness_open(pcm, name, ctl_name, ctl_card, ctl_index, &scope);
+}
@@ -55,8 +55,12 @@ typedef struct {
 
 #endif
 
+/* val is the biased magnitude 0x84..0x7fff, so bit 7 is always set */
 static inline int val_seg(int val)
 {
+#if defined(__GNUC__)
+	return 24 - __builtin_clz(val);
+#else
 	int r = 0;
 	val >>= 7;
 	if (val & 0xf0) {
@@ -70,6 +74,7 @@ static inline int val_seg(int val)
 	if (val & 0x02)
 		r += 1;
 	return r;
+#endif
 }
 
 /*
@@ -102,7 +107,7 @@ static inline int val_seg(int val)
  * John Wiley & Sons, pps 98-111 and 472-476.
  */
 
-static unsigned char s16_to_ulaw(int pcm_val)	/* 2's complement (16-bit range) */
+static inline unsigned char s16_to_ulaw(int pcm_val)	/* 2's complement (16-bit range) */
 {
 	int mask;
 	int seg;
@@ -137,22 +142,52 @@ static unsigned char s16_to_ulaw(int pcm_val)	/* 2's complement (16-bit range) *
  *
  * Note that this function expects to be passed the complement of the
  * original code word. This is in keeping with ISDN conventions.
+ *
+ * The 256 possible results are tabulated; the table was generated with:
+ *
+ *	u_val = ~u_val;
+ *	t = ((u_val & 0x0f) << 3) + 0x84;
+ *	t <<= (u_val & 0x70) >> 4;
+ *	return ((u_val & 0x80) ? (0x84 - t) : (t - 0x84));
  */
-static int ulaw_to_s16(unsigned char u_val)
-{
-	int t;
-
-	/* Complement to obtain normal u-law value. */
-	u_val = ~u_val;
-
-	/*
-	 * Extract and bias the quantization bits. Then
-	 * shift up by the segment number and subtract out the bias.
-	 */
-	t = ((u_val & 0x0f) << 3) + 0x84;
-	t <<= (u_val & 0x70) >> 4;
+static const int16_t ulaw_to_s16_table[256] = {
+	-32124, -31100, -30076, -29052, -28028, -27004, -25980, -24956,
+	-23932, -22908, -21884, -20860, -19836, -18812, -17788, -16764,
+	-15996, -15484, -14972, -14460, -13948, -13436, -12924, -12412,
+	-11900, -11388, -10876, -10364, -9852, -9340, -8828, -8316,
+	-7932, -7676, -7420, -7164, -6908, -6652, -6396, -6140,
+	-5884, -5628, -5372, -5116, -4860, -4604, -4348, -4092,
+	-3900, -3772, -3644, -3516, -3388, -3260, -3132, -3004,
+	-2876, -2748, -2620, -2492, -2364, -2236, -2108, -1980,
+	-1884, -1820, -1756, -1692, -1628, -1564, -1500, -1436,
+	-1372, -1308, -1244, -1180, -1116, -1052, -988, -924,
+	-876, -844, -812, -780, -748, -716, -684, -652,
+	-620, -588, -556, -524, -492, -460, -428, -396,
+	-372, -356, -340, -324, -308, -292, -276, -260,
+	-244, -228, -212, -196, -180, -164, -148, -132,
+	-120, -112, -104, -96, -88, -80, -72, -64,
+	-56, -48, -40, -32, -24, -16, -8, 0,
+	32124, 31100, 30076, 29052, 28028, 27004, 25980, 24956,
+	23932, 22908, 21884, 20860, 19836, 18812, 17788, 16764,
+	15996, 15484, 14972, 14460, 13948, 13436, 12924, 12412,
+	11900, 11388, 10876, 10364, 9852, 9340, 8828, 8316,
+	7932, 7676, 7420, 7164, 6908, 6652, 6396, 6140,
+	5884, 5628, 5372, 5116, 4860, 4604, 4348, 4092,
+	3900, 3772, 3644, 3516, 3388, 3260, 3132, 3004,
+	2876, 2748, 2620, 2492, 2364, 2236, 2108, 1980,
+	1884, 1820, 1756, 1692, 1628, 1564, 1500, 1436,
+	1372, 1308, 1244, 1180, 1116, 1052, 988, 924,
+	876, 844, 812, 780, 748, 716, 684, 652,
+	620, 588, 556, 524, 492, 460, 428, 396,
+	372, 356, 340, 324, 308, 292, 276, 260,
+	244, 228, 212, 196, 180, 164, 148, 132,
+	120, 112, 104, 96, 88, 80, 72, 64,
+	56, 48, 40, 32, 24, 16, 8, 0
+};
 
-	return ((u_val & 0x80) ? (0x84 - t) : (t - 0x84));
+static inline int ulaw_to_s16(unsigned char u_val)
+{
+	return ulaw_to_s16_table[u_val];
 }
 
 #ifndef DOC_HIDDEN
@@ -168,6 +203,7 @@ void snd_pcm_mulaw_decode(const snd_pcm_channel_area_t *dst_areas,
 #include "plugin_ops.h"
 #undef PUT16_LABELS
 	void *put = put16_labels[putidx];
+	int native = putidx == (unsigned int)snd_pcm_linear_put_index(SND_PCM_FORMAT_S16, SND_PCM_FORMAT_S16);
 	unsigned int channel;
 	for (channel = 0; channel < channels; ++channel) {
 		const unsigned char *src;
@@ -181,6 +217,15 @@ void snd_pcm_mulaw_decode(const snd_pcm_channel_area_t *dst_areas,
 		src_step = snd_pcm_channel_area_step(src_area);
 		dst_step = snd_pcm_channel_area_step(dst_area);
 		frames1 = frames;
+		if (native) {
+			/* no conversion of the linear side */
+			while (frames1-- > 0) {
+				*(int16_t *)dst = ulaw_to_s16(*src);
+				src += src_step;
+				dst += dst_step;
+			}
+			continue;
+		}
 		while (frames1-- > 0) {
 			int16_t sample = ulaw_to_s16(*src);
 			goto *put;
@@ -205,6 +250,7 @@ void snd_pcm_mulaw_encode(const snd_pcm_channel_area_t *dst_areas,
 #include "plugin_ops.h"
 #undef GET16_LABELS
 	void *get = get16_labels[getidx];
+	int native = getidx == (unsigned int)snd_pcm_linear_get_index(SND_PCM_FORMAT_S16, SND_PCM_FORMAT_S16);
 	unsigned int channel;
 	int16_t sample = 0;
 	for (channel = 0; channel < channels; ++channel) {
@@ -219,6 +265,15 @@ void snd_pcm_mulaw_encode(const snd_pcm_channel_area_t *dst_areas,
 		src_step = snd_pcm_channel_area_step(src_area);
 		dst_step = snd_pcm_channel_area_step(dst_area);
 		frames1 = frames;
+		if (native) {
+			/* no conversion of the linear side */
+			while (frames1-- > 0) {
+				*dst = s16_to_ulaw(*(const int16_t *)src);
+				src += src_step;
+				dst += dst_step;
+			}
+			continue;
+		}
 		while (frames1-- > 0) {
 			goto *get;
 #define GET16_END after
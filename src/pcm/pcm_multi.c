@@ -28,11 +28,19 @@
 
 #include "pcm_local.h"
 #include "pcm_generic.h"
+#include "pcm_rate_converter.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include <math.h>
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#include <fcntl.h>
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
+#endif
 
 #ifndef PIC
 /* entry for static linking */
@@ -41,13 +49,63 @@ const char *_snd_module_pcm_multi = "";
 
 #ifndef DOC_HIDDEN
 
+/* clock measurement window for the drift compensation */
+#define DRIFT_MEASURE_MIN_NS	1000000000LL	/* first estimate */
+#define DRIFT_MEASURE_MAX_NS	10000000000LL	/* restart the window */
+#define DRIFT_RATIO_MAX		0.01		/* sane clock deviation */
+#define DRIFT_TAU		4.0		/* position error settle time (s) */
+#define DRIFT_CORRECTION_MAX	0.002		/* max correction of the ratio */
+
+typedef struct {
+	/*
+	 * The converters pick expansion or shrinking at init, so there is
+	 * one instance for each direction; both keep their history.
+	 */
+	void *obj[2];			/* rate converters, [1] expands */
+	snd_pcm_rate_ops_t ops;
+	void *open_func[2];
+	snd_pcm_rate_info_t info[2];
+	int expand;			/* the converter in use, -1 = none yet */
+	snd_pcm_channel_area_t *areas;	/* local ring, client positions */
+	snd_pcm_channel_area_t *scratch; /* one frame, primes the expander */
+	snd_pcm_uframes_t ptr;		/* client frames passed to the slave */
+	double frac;			/* carried fraction of a slave frame */
+	double ratio;			/* measured slave / master clock */
+	double applied;			/* ratio used for the conversion */
+	int ref_valid;
+	snd_pcm_uframes_t ref_mhw, ref_shw;
+	long long ref_mts, ref_sts;
+} snd_pcm_multi_drift_t;
+
+typedef struct snd_pcm_multi_worker snd_pcm_multi_worker_t;
+
 typedef struct {
 	snd_pcm_t *pcm;
 	unsigned int channels_count;
 	int close_slave;
 	snd_pcm_t *linked;
+	snd_pcm_multi_drift_t *drift;	/* resampled to the master clock */
+	snd_pcm_multi_worker_t *worker;	/* serviced by an own thread */
 } snd_pcm_multi_slave_t;
 
+#ifdef HAVE_LIBPTHREAD
+struct snd_pcm_multi_worker {
+	pthread_t thread;
+	int wake_fd[2];			/* eventfd (both) or pipe */
+	pthread_mutex_t mutex;		/* only for sleeping on done_cond */
+	pthread_cond_t done_cond;	/* kick handled */
+	unsigned int kicks, done;	/* atomic, kicks only by the client */
+	int sleeping;			/* atomic, worker blocks on wake_fd */
+	int waiters;			/* atomic, clients on done_cond */
+	int quit;			/* atomic */
+	int err;			/* atomic, first failure since prepare */
+	snd_pcm_t *pcm;			/* the multi PCM */
+	snd_pcm_multi_slave_t *slave;
+	snd_pcm_uframes_t committed;	/* client frames passed to the slave */
+	snd_pcm_sframes_t avail;	/* slave avail after the last kick */
+};
+#endif
+
 typedef struct {
 	int slave_idx;
 	unsigned int slave_channel;
@@ -60,15 +118,699 @@ typedef struct {
 	snd_pcm_multi_slave_t *slaves;
 	unsigned int channels_count;
 	snd_pcm_multi_channel_t *channels;
+	int drift;			/* some slaves are drift compensated */
+	int workers;			/* slaves are serviced by own threads */
+	snd_pcm_uframes_t published;	/* appl_ptr handed to the workers */
 } snd_pcm_multi_t;
 
 #endif
 
+static void snd_pcm_multi_drift_free(snd_pcm_multi_drift_t *drift)
+{
+	int i;
+
+	if (!drift)
+		return;
+	for (i = 0; i < 2; i++) {
+		if (drift->obj[i] && drift->ops.close)
+			drift->ops.close(drift->obj[i]);
+		if (drift->open_func[i])
+			snd_dlobj_cache_put(drift->open_func[i]);
+	}
+	free(drift);
+}
+
+/* load a rate converter the same way as the rate plugin does */
+static int snd_pcm_multi_drift_open(snd_pcm_multi_drift_t *drift,
+				    const char *type)
+{
+#ifdef BUILD_PCM_PLUGIN_RATE
+	unsigned int version;
+	int i, err;
+
+	for (i = 0; i < 2; i++) {
+		err = snd_pcm_rate_open_converter(type, NULL, 1,
+						  &drift->obj[i], &drift->ops,
+						  &drift->open_func[i],
+						  &version);
+		if (err < 0) {
+			snd_error(PCM, "Cannot find rate converter %s", type);
+			return err;
+		}
+	}
+	/* the ratio is changed on the fly through adjust_pitch */
+	if (!drift->ops.convert || !drift->ops.adjust_pitch) {
+		snd_error(PCM, "Rate converter %s cannot follow a drift", type);
+		return -EINVAL;
+	}
+	drift->ratio = drift->applied = 1.0;
+	return 0;
+#else
+	snd_error(PCM, "Rate converter %s is not available", type);
+	return -ENOENT;
+#endif
+}
+
+static void snd_pcm_multi_drift_reset(snd_pcm_multi_drift_t *drift)
+{
+	drift->ptr = 0;
+	drift->frac = 0;
+	drift->ref_valid = 0;
+	/* the clocks keep their ratio over a restart */
+	drift->applied = drift->ratio;
+	drift->expand = -1;
+	if (drift->ops.reset) {
+		drift->ops.reset(drift->obj[0]);
+		drift->ops.reset(drift->obj[1]);
+	}
+}
+
+/* set up the converter and the local ring for the current hw_params */
+static int snd_pcm_multi_drift_init(snd_pcm_t *pcm, snd_pcm_multi_slave_t *slave)
+{
+	snd_pcm_multi_drift_t *drift = slave->drift;
+	snd_pcm_t *spcm = slave->pcm;
+	unsigned int flags = 0, chn;
+	int width = snd_pcm_format_physical_width(pcm->format);
+	size_t frame_bytes = spcm->channels * width / 8;
+	int i, err;
+
+	if (drift->ops.get_supported_formats) {
+		uint64_t in_formats, out_formats;
+
+		err = drift->ops.get_supported_formats(drift->obj[0], &in_formats,
+						       &out_formats, &flags);
+		if (err < 0)
+			return err;
+		if (!(in_formats & out_formats & (1ULL << pcm->format)))
+			return -EINVAL;
+	} else if (!snd_pcm_format_linear(pcm->format)) {
+		return -EINVAL;
+	}
+	if ((flags & SND_PCM_RATE_FLAG_INTERLEAVED) &&
+	    spcm->access != SND_PCM_ACCESS_MMAP_INTERLEAVED &&
+	    spcm->access != SND_PCM_ACCESS_RW_INTERLEAVED)
+		return -EINVAL;
+
+	for (i = 0; i < 2; i++) {
+		snd_pcm_rate_info_t *info = &drift->info[i];
+
+		info->in.format = info->out.format = pcm->format;
+		info->in.rate = pcm->rate;
+		/* only the direction matters, adjust_pitch sets the ratio */
+		info->out.rate = pcm->rate + (i ? 1 : -1);
+		info->in.buffer_size = info->out.buffer_size = pcm->buffer_size;
+		info->in.period_size = info->out.period_size = pcm->period_size;
+		info->channels = spcm->channels;
+		err = drift->ops.init(drift->obj[i], info);
+		if (err < 0) {
+			if (i && drift->ops.free)
+				drift->ops.free(drift->obj[0]);
+			return err;
+		}
+		/* no pitch set yet */
+		info->in.period_size = info->out.period_size = 0;
+	}
+
+	/* interleaved, like the temporary buffers of the rate plugin */
+	drift->areas = malloc(sizeof(*drift->areas) * spcm->channels * 2);
+	if (!drift->areas)
+		goto _nomem;
+	drift->scratch = drift->areas + spcm->channels;
+	drift->areas[0].addr = malloc((pcm->buffer_size + 1) * frame_bytes);
+	if (!drift->areas[0].addr) {
+		free(drift->areas);
+		drift->areas = NULL;
+		goto _nomem;
+	}
+	for (chn = 0; chn < spcm->channels; chn++) {
+		drift->areas[chn].addr = (char *)drift->areas[0].addr + (chn * width) / 8;
+		drift->areas[chn].first = 0;
+		drift->areas[chn].step = width * spcm->channels;
+		drift->scratch[chn] = drift->areas[chn];
+		drift->scratch[chn].addr = (char *)drift->areas[chn].addr +
+					   pcm->buffer_size * frame_bytes;
+	}
+	snd_pcm_areas_silence(drift->areas, 0, spcm->channels,
+			      pcm->buffer_size, pcm->format);
+	snd_pcm_multi_drift_reset(drift);
+	return 0;
+
+ _nomem:
+	if (drift->ops.free) {
+		drift->ops.free(drift->obj[0]);
+		drift->ops.free(drift->obj[1]);
+	}
+	return -ENOMEM;
+}
+
+static void snd_pcm_multi_drift_done(snd_pcm_multi_drift_t *drift)
+{
+	if (drift->areas) {
+		free(drift->areas[0].addr);
+		free(drift->areas);
+		drift->areas = NULL;
+		drift->scratch = NULL;
+		if (drift->ops.free) {
+			drift->ops.free(drift->obj[0]);
+			drift->ops.free(drift->obj[1]);
+		}
+	}
+}
+
+static long long drift_ts_ns(const snd_htimestamp_t *ts)
+{
+	return ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+
+/*
+ * Measure the slave clock against the master one from their position
+ * timestamps, and correct the ratio with the error between the played
+ * positions, so the slave keeps playing the same client frames.
+ */
+static void snd_pcm_multi_drift_update(snd_pcm_t *pcm, snd_pcm_multi_slave_t *slave)
+{
+	snd_pcm_multi_t *multi = pcm->private_data;
+	snd_pcm_multi_drift_t *drift = slave->drift;
+	snd_pcm_t *master = multi->slaves[multi->master_slave].pcm;
+	snd_pcm_t *spcm = slave->pcm;
+	snd_pcm_uframes_t mavail, savail, mhw, shw;
+	snd_htimestamp_t mtstamp, ststamp;
+	long long mts, sts;
+	double err, corr;
+
+	if (snd_pcm_state(master) != SND_PCM_STATE_RUNNING ||
+	    snd_pcm_state(spcm) != SND_PCM_STATE_RUNNING)
+		return;
+	if (snd_pcm_htimestamp(master, &mavail, &mtstamp) < 0 ||
+	    snd_pcm_htimestamp(spcm, &savail, &ststamp) < 0)
+		return;
+	mts = drift_ts_ns(&mtstamp);
+	sts = drift_ts_ns(&ststamp);
+	if (mts == 0 || sts == 0)
+		return;
+	mhw = *master->hw.ptr;
+	shw = *spcm->hw.ptr;
+	if (!drift->ref_valid) {
+		drift->ref_mhw = mhw;
+		drift->ref_shw = shw;
+		drift->ref_mts = mts;
+		drift->ref_sts = sts;
+		drift->ref_valid = 1;
+	} else if (mts - drift->ref_mts >= DRIFT_MEASURE_MIN_NS &&
+		   sts - drift->ref_sts >= DRIFT_MEASURE_MIN_NS) {
+		snd_pcm_uframes_t mframes, sframes;
+		double ratio;
+
+		mframes = pcm_frame_diff(mhw, drift->ref_mhw, master->boundary);
+		sframes = pcm_frame_diff(shw, drift->ref_shw, spcm->boundary);
+		if (mframes && sframes) {
+			ratio = ((double)sframes / (sts - drift->ref_sts)) /
+				((double)mframes / (mts - drift->ref_mts));
+			if (ratio > 1.0 - DRIFT_RATIO_MAX &&
+			    ratio < 1.0 + DRIFT_RATIO_MAX)
+				drift->ratio = ratio;
+		}
+		if (mts - drift->ref_mts >= DRIFT_MEASURE_MAX_NS)
+			drift->ref_valid = 0;
+	}
+
+	/* played client frame of the slave minus the one of the master,
+	 * both taken at the master timestamp
+	 */
+	err = (double)(master->buffer_size - mavail) -
+	      pcm_frame_diff(multi->appl_ptr, drift->ptr, pcm->boundary) -
+	      (spcm->buffer_size - savail) / drift->applied +
+	      (double)(mts - sts) * pcm->rate / 1000000000.0;
+	corr = err / (pcm->rate * DRIFT_TAU);
+	if (corr > DRIFT_CORRECTION_MAX)
+		corr = DRIFT_CORRECTION_MAX;
+	else if (corr < -DRIFT_CORRECTION_MAX)
+		corr = -DRIFT_CORRECTION_MAX;
+	drift->applied = drift->ratio * (1.0 + corr);
+}
+
+static int snd_pcm_multi_drift_pitch(snd_pcm_multi_drift_t *drift,
+				     snd_pcm_uframes_t dst_frames,
+				     snd_pcm_uframes_t src_frames)
+{
+	snd_pcm_rate_info_t *info = &drift->info[drift->expand];
+
+	if (info->in.period_size == src_frames &&
+	    info->out.period_size == dst_frames)
+		return 0;
+	info->in.period_size = src_frames;
+	info->out.period_size = dst_frames;
+	return drift->ops.adjust_pitch(drift->obj[drift->expand], info);
+}
+
+static int snd_pcm_multi_drift_convert(snd_pcm_t *pcm,
+				       snd_pcm_multi_drift_t *drift,
+				       const snd_pcm_channel_area_t *dst_areas,
+				       snd_pcm_uframes_t dst_offset,
+				       snd_pcm_uframes_t dst_frames,
+				       snd_pcm_uframes_t src_offset,
+				       snd_pcm_uframes_t src_frames)
+{
+	int expand = dst_frames > src_frames;
+	int err;
+
+	if (drift->expand < 0) {
+		/* fresh start, the history is silence */
+		drift->expand = expand;
+	} else if (dst_frames != src_frames && expand != drift->expand) {
+		drift->expand = expand;
+		if (expand) {
+			/* the expander continues from the last frame it
+			 * got, give it the last frame of the shrinker
+			 */
+			snd_pcm_uframes_t last = (src_offset + pcm->buffer_size - 1) %
+						 pcm->buffer_size;
+			err = snd_pcm_multi_drift_pitch(drift, 1, 1);
+			if (err < 0)
+				return err;
+			drift->ops.convert(drift->obj[1], drift->scratch, 0, 1,
+					   drift->areas, last, 1);
+		}
+	}
+	err = snd_pcm_multi_drift_pitch(drift, dst_frames, src_frames);
+	if (err < 0)
+		return err;
+	drift->ops.convert(drift->obj[drift->expand], dst_areas, dst_offset,
+			   dst_frames, drift->areas, src_offset, src_frames);
+	return 0;
+}
+
+/* resample the client frames up to appl_ptr into the slave */
+static int snd_pcm_multi_drift_pump(snd_pcm_t *pcm, snd_pcm_multi_slave_t *slave,
+				    snd_pcm_uframes_t appl_ptr)
+{
+	snd_pcm_multi_drift_t *drift = slave->drift;
+	snd_pcm_t *spcm = slave->pcm;
+	const snd_pcm_channel_area_t *sareas;
+	snd_pcm_uframes_t in, out, cofs, sofs, sframes;
+	snd_pcm_sframes_t avail, result;
+	double exact;
+	int err;
+
+	for (;;) {
+		in = pcm_frame_diff(appl_ptr, drift->ptr, pcm->boundary);
+		if (!in)
+			return 0;
+		avail = snd_pcm_avail_update(spcm);
+		if (avail < 0)
+			return avail;
+		if (!avail)
+			return 0;
+		cofs = drift->ptr % pcm->buffer_size;
+		if (cofs + in > pcm->buffer_size)
+			in = pcm->buffer_size - cofs;
+		sframes = avail;
+		err = snd_pcm_mmap_begin(spcm, &sareas, &sofs, &sframes);
+		if (err < 0)
+			return err;
+		exact = in * drift->applied + drift->frac;
+		if (exact >= sframes + 1) {
+			/* fill what fits, the rest waits for room */
+			in = (sframes - drift->frac) / drift->applied;
+			exact = in * drift->applied + drift->frac;
+		}
+		out = exact;
+		if (out > sframes)
+			out = sframes;
+		if (!in || !out)
+			return 0;
+		err = snd_pcm_multi_drift_convert(pcm, drift, sareas, sofs, out,
+						  cofs, in);
+		if (err < 0)
+			return err;
+		result = snd_pcm_mmap_commit(spcm, sofs, out);
+		if (result < 0)
+			return result;
+		if ((snd_pcm_uframes_t)result != out)
+			return -EIO;
+		drift->frac = exact - out;
+		drift->ptr = (drift->ptr + in) % pcm->boundary;
+	}
+}
+
+/* on drain, keep feeding the slave until it got all client frames */
+static int snd_pcm_multi_drift_flush(snd_pcm_t *pcm, snd_pcm_multi_slave_t *slave)
+{
+	snd_pcm_multi_t *multi = pcm->private_data;
+	snd_pcm_t *spcm = slave->pcm;
+	int err;
+
+	for (;;) {
+		err = snd_pcm_multi_drift_pump(pcm, slave, multi->appl_ptr);
+		if (err < 0)
+			return err;
+		if (slave->drift->ptr == multi->appl_ptr)
+			return 0;
+		/* a stopped slave frees no room, its drain starts it */
+		if (snd_pcm_state(spcm) != SND_PCM_STATE_RUNNING)
+			return 0;
+		if (pcm->mode & SND_PCM_NONBLOCK)
+			return -EAGAIN;
+		err = snd_pcm_wait(spcm, -1);
+		if (err < 0)
+			return err;
+	}
+}
+
+#ifdef HAVE_LIBPTHREAD
+/* pass the published client frames to the slave and refresh its avail */
+static int snd_pcm_multi_worker_run(snd_pcm_multi_worker_t *w)
+{
+	snd_pcm_t *pcm = w->pcm;
+	snd_pcm_multi_t *multi = pcm->private_data;
+	snd_pcm_t *spcm = w->slave->pcm;
+	snd_pcm_uframes_t appl_ptr, size, offset, frames;
+	snd_pcm_sframes_t result;
+
+	appl_ptr = __atomic_load_n(&multi->published, __ATOMIC_ACQUIRE);
+	if (w->slave->drift)
+		return snd_pcm_multi_drift_pump(pcm, w->slave, appl_ptr);
+	size = pcm_frame_diff(appl_ptr, w->committed, pcm->boundary);
+	while (size > 0) {
+		offset = w->committed % pcm->buffer_size;
+		frames = pcm->buffer_size - offset;
+		if (frames > size)
+			frames = size;
+		result = snd_pcm_mmap_commit(spcm, offset, frames);
+		if (result < 0)
+			return result;
+		if ((snd_pcm_uframes_t)result != frames)
+			return -EIO;
+		w->committed = (w->committed + frames) % pcm->boundary;
+		size -= frames;
+	}
+	result = snd_pcm_avail_update(spcm);
+	if (result < 0)
+		return result;
+	w->avail = result;
+	return 0;
+}
+
+static int snd_pcm_multi_worker_wake_open(snd_pcm_multi_worker_t *w)
+{
+#ifdef HAVE_SYS_EVENTFD_H
+	int fd = eventfd(0, EFD_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+	w->wake_fd[0] = w->wake_fd[1] = fd;
+#else
+	if (pipe(w->wake_fd) < 0)
+		return -errno;
+	/* the worker blocks on reading, the client never blocks on writing */
+	fcntl(w->wake_fd[1], F_SETFL, O_NONBLOCK);
+#endif
+	return 0;
+}
+
+static void snd_pcm_multi_worker_wake_close(snd_pcm_multi_worker_t *w)
+{
+	close(w->wake_fd[0]);
+	if (w->wake_fd[1] != w->wake_fd[0])
+		close(w->wake_fd[1]);
+}
+
+static void snd_pcm_multi_worker_wake(snd_pcm_multi_worker_t *w)
+{
+	uint64_t val = 1;
+	ssize_t s;
+	/* a full pipe or counter has a wakeup pending anyway */
+#ifdef HAVE_SYS_EVENTFD_H
+	s = write(w->wake_fd[1], &val, sizeof(val));
+#else
+	s = write(w->wake_fd[1], &val, 1);
+#endif
+	(void)s;
+}
+
+static void snd_pcm_multi_worker_sleep(snd_pcm_multi_worker_t *w)
+{
+	uint64_t val;
+	ssize_t s;
+	s = read(w->wake_fd[0], &val, sizeof(val));
+	(void)s;
+}
+
+/*
+ * The client and the worker meet without a lock: the client bumps kicks
+ * and writes the wake fd only when the worker announced to sleep, the
+ * worker announces that before it checks kicks the last time.  With
+ * sequentially consistent accesses at least one of them sees the other.
+ */
+static void *snd_pcm_multi_worker_thread(void *data)
+{
+	snd_pcm_multi_worker_t *w = data;
+	unsigned int kicks;
+	int err, none;
+
+	for (;;) {
+		kicks = __atomic_load_n(&w->kicks, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&w->quit, __ATOMIC_SEQ_CST))
+			break;
+		if (kicks == w->done) {
+			__atomic_store_n(&w->sleeping, 1, __ATOMIC_SEQ_CST);
+			if (__atomic_load_n(&w->kicks, __ATOMIC_SEQ_CST) == w->done &&
+			    !__atomic_load_n(&w->quit, __ATOMIC_SEQ_CST))
+				snd_pcm_multi_worker_sleep(w);
+			__atomic_store_n(&w->sleeping, 0, __ATOMIC_SEQ_CST);
+			continue;
+		}
+		/* kicks arriving meanwhile are covered by this run */
+		err = snd_pcm_multi_worker_run(w);
+		if (err < 0) {
+			none = 0;
+			__atomic_compare_exchange_n(&w->err, &none, err, 0,
+						    __ATOMIC_SEQ_CST,
+						    __ATOMIC_SEQ_CST);
+		}
+		__atomic_store_n(&w->done, kicks, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&w->waiters, __ATOMIC_SEQ_CST)) {
+			pthread_mutex_lock(&w->mutex);
+			pthread_cond_broadcast(&w->done_cond);
+			pthread_mutex_unlock(&w->mutex);
+		}
+	}
+	return NULL;
+}
+
+/* called on every commit, so no lock and a syscall only for a sleeper */
+static void snd_pcm_multi_workers_kick(snd_pcm_multi_t *multi)
+{
+	unsigned int i;
+
+	for (i = 0; i < multi->slaves_count; ++i) {
+		snd_pcm_multi_worker_t *w = multi->slaves[i].worker;
+		__atomic_add_fetch(&w->kicks, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&w->sleeping, __ATOMIC_SEQ_CST))
+			snd_pcm_multi_worker_wake(w);
+	}
+}
+
+static int snd_pcm_multi_worker_idle(snd_pcm_multi_worker_t *w)
+{
+	return __atomic_load_n(&w->done, __ATOMIC_SEQ_CST) ==
+		__atomic_load_n(&w->kicks, __ATOMIC_SEQ_CST);
+}
+
+/* wait until all workers are idle, return the first failure */
+static int snd_pcm_multi_workers_wait(snd_pcm_multi_t *multi)
+{
+	unsigned int i;
+	int err = 0, werr;
+
+	for (i = 0; i < multi->slaves_count; ++i) {
+		snd_pcm_multi_worker_t *w = multi->slaves[i].worker;
+		if (!snd_pcm_multi_worker_idle(w)) {
+			pthread_mutex_lock(&w->mutex);
+			__atomic_add_fetch(&w->waiters, 1, __ATOMIC_SEQ_CST);
+			while (!snd_pcm_multi_worker_idle(w))
+				pthread_cond_wait(&w->done_cond, &w->mutex);
+			__atomic_sub_fetch(&w->waiters, 1, __ATOMIC_SEQ_CST);
+			pthread_mutex_unlock(&w->mutex);
+		}
+		werr = __atomic_load_n(&w->err, __ATOMIC_SEQ_CST);
+		if (werr && !err)
+			err = werr;
+	}
+	return err;
+}
+
+static snd_pcm_sframes_t snd_pcm_multi_worker_avail(snd_pcm_multi_worker_t *w)
+{
+	return w->avail;
+}
+
+/* failure of a previous kick, without waiting for the running ones */
+static int snd_pcm_multi_workers_error(snd_pcm_multi_t *multi)
+{
+	unsigned int i;
+	int err = 0;
+
+	for (i = 0; i < multi->slaves_count && !err; ++i)
+		err = __atomic_load_n(&multi->slaves[i].worker->err,
+				      __ATOMIC_SEQ_CST);
+	return err;
+}
+
+/* the slave pointers were moved by the client thread, follow them */
+static void snd_pcm_multi_workers_resync(snd_pcm_multi_t *multi, int clear_err)
+{
+	unsigned int i;
+
+	for (i = 0; i < multi->slaves_count; ++i) {
+		snd_pcm_multi_worker_t *w = multi->slaves[i].worker;
+		w->committed = multi->appl_ptr;
+		if (clear_err)
+			__atomic_store_n(&w->err, 0, __ATOMIC_SEQ_CST);
+	}
+	__atomic_store_n(&multi->published, multi->appl_ptr, __ATOMIC_RELEASE);
+}
+
+static void snd_pcm_multi_workers_stop(snd_pcm_multi_t *multi)
+{
+	unsigned int i;
+
+	for (i = 0; i < multi->slaves_count; ++i) {
+		snd_pcm_multi_worker_t *w = multi->slaves[i].worker;
+		if (!w)
+			continue;
+		if (w->pcm) {
+			__atomic_store_n(&w->quit, 1, __ATOMIC_SEQ_CST);
+			snd_pcm_multi_worker_wake(w);
+			pthread_join(w->thread, NULL);
+			pthread_cond_destroy(&w->done_cond);
+			pthread_mutex_destroy(&w->mutex);
+			snd_pcm_multi_worker_wake_close(w);
+		}
+		free(w);
+		multi->slaves[i].worker = NULL;
+	}
+	multi->workers = 0;
+}
+
+static int snd_pcm_multi_worker_start(snd_pcm_t *pcm, snd_pcm_multi_worker_t *w,
+				      int priority)
+{
+	pthread_attr_t attr;
+	struct sched_param param;
+	int err;
+
+	pthread_attr_init(&attr);
+	if (priority > 0) {
+		pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+		pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+		param.sched_priority = priority;
+		pthread_attr_setschedparam(&attr, &param);
+	} else {
+		/* run with the scheduling of the opening thread */
+		pthread_attr_setinheritsched(&attr, PTHREAD_INHERIT_SCHED);
+	}
+	err = pthread_create(&w->thread, &attr, snd_pcm_multi_worker_thread, w);
+	if (err == EPERM && priority > 0) {
+		snd_warn(PCM, "Cannot use SCHED_FIFO for the multi workers");
+		pthread_attr_setinheritsched(&attr, PTHREAD_INHERIT_SCHED);
+		err = pthread_create(&w->thread, &attr,
+				     snd_pcm_multi_worker_thread, w);
+	}
+	pthread_attr_destroy(&attr);
+	if (err)
+		return -err;
+	w->pcm = pcm;
+	return 0;
+}
+
+/* give every slave an own thread committing the client frames */
+static int snd_pcm_multi_workers_setup(snd_pcm_t *pcm, int priority)
+{
+	snd_pcm_multi_t *multi = pcm->private_data;
+	unsigned int i;
+	int err;
+
+	for (i = 0; i < multi->slaves_count; ++i) {
+		snd_pcm_multi_worker_t *w = calloc(1, sizeof(*w));
+		if (!w)
+			return -ENOMEM;
+		multi->slaves[i].worker = w;
+		w->slave = &multi->slaves[i];
+		err = snd_pcm_multi_worker_wake_open(w);
+		if (err < 0) {
+			snd_errornum(PCM, "Cannot create the wakeup for slave #%u", i);
+			return err;
+		}
+		pthread_mutex_init(&w->mutex, NULL);
+		pthread_cond_init(&w->done_cond, NULL);
+		err = snd_pcm_multi_worker_start(pcm, w, priority);
+		if (err < 0) {
+			pthread_cond_destroy(&w->done_cond);
+			pthread_mutex_destroy(&w->mutex);
+			snd_pcm_multi_worker_wake_close(w);
+			snd_error(PCM, "Cannot start the worker for slave #%u", i);
+			return err;
+		}
+	}
+	multi->workers = 1;
+	return 0;
+}
+#else
+static void snd_pcm_multi_workers_kick(snd_pcm_multi_t *multi ATTRIBUTE_UNUSED)
+{
+}
+
+static int snd_pcm_multi_workers_wait(snd_pcm_multi_t *multi ATTRIBUTE_UNUSED)
+{
+	return 0;
+}
+
+static snd_pcm_sframes_t snd_pcm_multi_worker_avail(snd_pcm_multi_worker_t *w ATTRIBUTE_UNUSED)
+{
+	return 0;
+}
+
+static int snd_pcm_multi_workers_error(snd_pcm_multi_t *multi ATTRIBUTE_UNUSED)
+{
+	return 0;
+}
+
+static void snd_pcm_multi_workers_resync(snd_pcm_multi_t *multi ATTRIBUTE_UNUSED,
+					 int clear_err ATTRIBUTE_UNUSED)
+{
+}
+
+static void snd_pcm_multi_workers_stop(snd_pcm_multi_t *multi ATTRIBUTE_UNUSED)
+{
+}
+
+static int snd_pcm_multi_workers_setup(snd_pcm_t *pcm ATTRIBUTE_UNUSED,
+				       int priority ATTRIBUTE_UNUSED)
+{
+	snd_error(PCM, "Multi workers need the thread support");
+	return -ENOSYS;
+}
+#endif
+
+/* the slaves may be touched by the client thread only when the workers
+ * are idle
+ */
+static void snd_pcm_multi_sync(snd_pcm_t *pcm)
+{
+	snd_pcm_multi_t *multi = pcm->private_data;
+
+	if (multi->workers)
+		snd_pcm_multi_workers_wait(multi);
+}
+
 static int snd_pcm_multi_close(snd_pcm_t *pcm)
 {
 	snd_pcm_multi_t *multi = pcm->private_data;
 	unsigned int i;
 	int ret = 0;
+	snd_pcm_multi_sync(pcm);
+	snd_pcm_multi_workers_stop(multi);
 	for (i = 0; i < multi->slaves_count; ++i) {
 		snd_pcm_multi_slave_t *slave = &multi->slaves[i];
 		if (slave->close_slave) {
@@ -76,6 +818,7 @@ static int snd_pcm_multi_close(snd_pcm_t *pcm)
 			if (err < 0)
 				ret = err;
 		}
+		snd_pcm_multi_drift_free(slave->drift);
 	}
 	free(multi->slaves);
 	free(multi->channels);
@@ -126,6 +869,7 @@ static int snd_pcm_multi_poll_revents(snd_pcm_t *pcm, struct pollfd *pfds, unsig
 {
 	snd_pcm_multi_t *multi = pcm->private_data;
 	snd_pcm_t *slave_0 = multi->slaves[multi->master_slave].pcm;
+	snd_pcm_multi_sync(pcm);
 	return snd_pcm_poll_descriptors_revents(slave_0, pfds, nfds, revents);
 }
 
@@ -339,6 +1083,7 @@ static int snd_pcm_multi_hw_params(snd_pcm_t *pcm, snd_pcm_hw_params_t *params)
 	unsigned int i;
 	snd_pcm_hw_params_t sparams[multi->slaves_count];
 	int err;
+	snd_pcm_multi_sync(pcm);
 	for (i = 0; i < multi->slaves_count; ++i) {
 		err = snd_pcm_multi_hw_refine_sprepare(pcm, i, &sparams[i]);
 		assert(err >= 0);
@@ -359,6 +1104,7 @@ static int snd_pcm_multi_hw_free(snd_pcm_t *pcm)
 	snd_pcm_multi_t *multi = pcm->private_data;
 	unsigned int i;
 	int err = 0;
+	snd_pcm_multi_sync(pcm);
 	for (i = 0; i < multi->slaves_count; ++i) {
 		snd_pcm_t *slave = multi->slaves[i].pcm;
 		int e = snd_pcm_hw_free(slave);
@@ -379,6 +1125,7 @@ static int snd_pcm_multi_sw_params(snd_pcm_t *pcm, snd_pcm_sw_params_t *params)
 	snd_pcm_multi_t *multi = pcm->private_data;
 	unsigned int i;
 	int err;
+	snd_pcm_multi_sync(pcm);
 	for (i = 0; i < multi->slaves_count; ++i) {
 		snd_pcm_t *slave = multi->slaves[i].pcm;
 		err = snd_pcm_sw_params(slave, params);
@@ -393,8 +1140,10 @@ static int snd_pcm_multi_status(snd_pcm_t *pcm, snd_pcm_status_t *status)
 {
 	snd_pcm_multi_t *multi = pcm->private_data;
 	snd_pcm_t *slave = multi->slaves[multi->master_slave].pcm;
+	int err;
 
-	int err = snd_pcm_status(slave, status);
+	snd_pcm_multi_sync(pcm);
+	err = snd_pcm_status(slave, status);
 	if (err < 0)
 		return err;
 	snd_pcm_sframes_t avail = snd_pcm_multi_avail_update(pcm);
@@ -409,6 +1158,7 @@ static snd_pcm_state_t snd_pcm_multi_state(snd_pcm_t *pcm)
 {
 	snd_pcm_multi_t *multi = pcm->private_data;
 	snd_pcm_t *slave = multi->slaves[multi->master_slave].pcm;
+	snd_pcm_multi_sync(pcm);
 	return snd_pcm_state(slave);
 }
 
@@ -421,7 +1171,13 @@ static void snd_pcm_multi_hwptr_update(snd_pcm_t *pcm)
 	if (pcm->stream == SND_PCM_STREAM_PLAYBACK) {
 		last_avail = 0;
 		for (i = 0; i < multi->slaves_count; ++i) {
-			slave_hw_ptr = *multi->slaves[i].pcm->hw.ptr;
+			/* the local ring of a resampled slave is freed only
+			 * once its frames are converted
+			 */
+			if (multi->slaves[i].drift)
+				slave_hw_ptr = multi->slaves[i].drift->ptr;
+			else
+				slave_hw_ptr = *multi->slaves[i].pcm->hw.ptr;
 			avail = __snd_pcm_playback_avail(pcm, multi->hw_ptr, slave_hw_ptr);
 			if (avail > last_avail) {
 				hw_ptr = slave_hw_ptr;
@@ -447,6 +1203,7 @@ static int snd_pcm_multi_hwsync(snd_pcm_t *pcm)
 	snd_pcm_multi_t *multi = pcm->private_data;
 	unsigned int i;
 	int err;
+	snd_pcm_multi_sync(pcm);
 	for (i = 0; i < multi->slaves_count; ++i) {
 		err = snd_pcm_hwsync(multi->slaves[i].pcm);
 		if (err < 0)
@@ -462,10 +1219,15 @@ static int snd_pcm_multi_delay(snd_pcm_t *pcm, snd_pcm_sframes_t *delayp)
 	snd_pcm_sframes_t d, dr = 0;
 	unsigned int i;
 	int err;
+	snd_pcm_multi_sync(pcm);
 	for (i = 0; i < multi->slaves_count; ++i) {
 		err = snd_pcm_delay(multi->slaves[i].pcm, &d);
 		if (err < 0)
 			return err;
+		if (multi->slaves[i].drift)
+			d += pcm_frame_diff(multi->appl_ptr,
+					    multi->slaves[i].drift->ptr,
+					    pcm->boundary);
 		if (dr < d)
 			dr = d;
 	}
@@ -478,11 +1240,36 @@ static snd_pcm_sframes_t snd_pcm_multi_avail_update(snd_pcm_t *pcm)
 	snd_pcm_multi_t *multi = pcm->private_data;
 	snd_pcm_sframes_t ret = LONG_MAX;
 	unsigned int i;
+	int err;
+	if (multi->workers) {
+		/* the slaves are serviced in parallel */
+		snd_pcm_multi_workers_kick(multi);
+		err = snd_pcm_multi_workers_wait(multi);
+		if (err < 0)
+			return err;
+	}
 	for (i = 0; i < multi->slaves_count; ++i) {
+		snd_pcm_multi_slave_t *slave = &multi->slaves[i];
 		snd_pcm_sframes_t avail;
-		avail = snd_pcm_avail_update(multi->slaves[i].pcm);
-		if (avail < 0)
-			return avail;
+		if (slave->drift) {
+			snd_pcm_multi_drift_update(pcm, slave);
+			if (!multi->workers) {
+				err = snd_pcm_multi_drift_pump(pcm, slave,
+							       multi->appl_ptr);
+				if (err < 0)
+					return err;
+			}
+			avail = pcm->buffer_size -
+				pcm_frame_diff(multi->appl_ptr,
+					       slave->drift->ptr,
+					       pcm->boundary);
+		} else if (multi->workers) {
+			avail = snd_pcm_multi_worker_avail(slave->worker);
+		} else {
+			avail = snd_pcm_avail_update(slave->pcm);
+			if (avail < 0)
+				return avail;
+		}
 		if (ret > avail)
 			ret = avail;
 	}
@@ -495,6 +1282,7 @@ static int snd_pcm_multi_htimestamp(snd_pcm_t *pcm, snd_pcm_uframes_t *avail,
 {
 	snd_pcm_multi_t *multi = pcm->private_data;
 	snd_pcm_t *slave = multi->slaves[multi->master_slave].pcm;
+	snd_pcm_multi_sync(pcm);
 	return snd_pcm_htimestamp(slave, avail, tstamp);
 }
 
@@ -503,6 +1291,7 @@ static int snd_pcm_multi_prepare(snd_pcm_t *pcm)
 	snd_pcm_multi_t *multi = pcm->private_data;
 	int result = 0, err;
 	unsigned int i;
+	snd_pcm_multi_sync(pcm);
 	for (i = 0; i < multi->slaves_count; ++i) {
 		/* We call prepare to each slave even if it's linked.
 		 * This is to make sure to sync non-mmaped control/status.
@@ -510,8 +1299,12 @@ static int snd_pcm_multi_prepare(snd_pcm_t *pcm)
 		err = snd_pcm_prepare(multi->slaves[i].pcm);
 		if (err < 0)
 			result = err;
+		if (multi->slaves[i].drift)
+			snd_pcm_multi_drift_reset(multi->slaves[i].drift);
 	}
 	multi->hw_ptr = multi->appl_ptr = 0;
+	if (multi->workers)
+		snd_pcm_multi_workers_resync(multi, 1);
 	return result;
 }
 
@@ -520,13 +1313,18 @@ static int snd_pcm_multi_reset(snd_pcm_t *pcm)
 	snd_pcm_multi_t *multi = pcm->private_data;
 	int result = 0, err;
 	unsigned int i;
+	snd_pcm_multi_sync(pcm);
 	for (i = 0; i < multi->slaves_count; ++i) {
 		/* Reset each slave, as well as in prepare */
 		err = snd_pcm_reset(multi->slaves[i].pcm);
 		if (err < 0)
 			result = err;
+		if (multi->slaves[i].drift)
+			snd_pcm_multi_drift_reset(multi->slaves[i].drift);
 	}
 	multi->hw_ptr = multi->appl_ptr = 0;
+	if (multi->workers)
+		snd_pcm_multi_workers_resync(multi, 1);
 	return result;
 }
 
@@ -539,6 +1337,7 @@ static int snd_pcm_multi_start(snd_pcm_t *pcm)
 	snd_pcm_multi_t *multi = pcm->private_data;
 	int err = 0;
 	unsigned int i;
+	snd_pcm_multi_sync(pcm);
 	if (multi->slaves[0].linked)
 		return snd_pcm_start(multi->slaves[0].linked);
 	for (i = 0; i < multi->slaves_count; ++i) {
@@ -556,6 +1355,7 @@ static int snd_pcm_multi_drop(snd_pcm_t *pcm)
 	snd_pcm_multi_t *multi = pcm->private_data;
 	int err = 0;
 	unsigned int i;
+	snd_pcm_multi_sync(pcm);
 	if (multi->slaves[0].linked)
 		return snd_pcm_drop(multi->slaves[0].linked);
 	for (i = 0; i < multi->slaves_count; ++i) {
@@ -573,6 +1373,15 @@ static int snd_pcm_multi_drain(snd_pcm_t *pcm)
 	snd_pcm_multi_t *multi = pcm->private_data;
 	int err = 0;
 	unsigned int i;
+	snd_pcm_multi_sync(pcm);
+	/* the resampled slaves take the rest only as they play */
+	for (i = 0; i < multi->slaves_count; ++i) {
+		if (!multi->slaves[i].drift)
+			continue;
+		err = snd_pcm_multi_drift_flush(pcm, &multi->slaves[i]);
+		if (err < 0)
+			return err;
+	}
 	if (multi->slaves[0].linked)
 		return snd_pcm_drain(multi->slaves[0].linked);
 	for (i = 0; i < multi->slaves_count; ++i) {
@@ -590,6 +1399,7 @@ static int snd_pcm_multi_pause(snd_pcm_t *pcm, int enable)
 	snd_pcm_multi_t *multi = pcm->private_data;
 	int err = 0;
 	unsigned int i;
+	snd_pcm_multi_sync(pcm);
 	if (multi->slaves[0].linked)
 		return snd_pcm_pause(multi->slaves[0].linked, enable);
 	for (i = 0; i < multi->slaves_count; ++i) {
@@ -610,6 +1420,12 @@ static int snd_pcm_multi_channel_info(snd_pcm_t *pcm, snd_pcm_channel_info_t *in
 	int err;
 	if (c->slave_idx < 0)
 		return -ENXIO;
+	if (multi->slaves[c->slave_idx].drift) {
+		if (!pcm->mmap_channels)
+			return -EBADFD;
+		*info = pcm->mmap_channels[channel];
+		return 0;
+	}
 	info->channel = c->slave_channel;
 	err = snd_pcm_channel_info(multi->slaves[c->slave_idx].pcm, info);
 	info->channel = channel;
@@ -622,6 +1438,10 @@ static snd_pcm_sframes_t snd_pcm_multi_rewindable(snd_pcm_t *pcm)
 	unsigned int i;
 	snd_pcm_sframes_t frames = LONG_MAX;
 
+	/* resampled frames cannot be taken back */
+	if (multi->drift)
+		return 0;
+	snd_pcm_multi_sync(pcm);
 	for (i = 0; i < multi->slaves_count; ++i) {
 		snd_pcm_sframes_t f = snd_pcm_rewindable(multi->slaves[i].pcm);
 		if (f <= 0)
@@ -640,6 +1460,9 @@ static snd_pcm_sframes_t snd_pcm_multi_forwardable(snd_pcm_t *pcm)
 	unsigned int i;
 	snd_pcm_sframes_t frames = LONG_MAX;
 
+	if (multi->drift)
+		return 0;
+	snd_pcm_multi_sync(pcm);
 	for (i = 0; i < multi->slaves_count; ++i) {
 		snd_pcm_sframes_t f = snd_pcm_forwardable(multi->slaves[i].pcm);
 		if (f <= 0)
@@ -657,6 +1480,9 @@ static snd_pcm_sframes_t snd_pcm_multi_rewind(snd_pcm_t *pcm, snd_pcm_uframes_t
 	snd_pcm_multi_t *multi = pcm->private_data;
 	unsigned int i;
 	snd_pcm_uframes_t pos[multi->slaves_count];
+	if (multi->drift)
+		return 0;
+	snd_pcm_multi_sync(pcm);
 	memset(pos, 0, sizeof(pos));
 	for (i = 0; i < multi->slaves_count; ++i) {
 		snd_pcm_t *slave_i = multi->slaves[i].pcm;
@@ -680,6 +1506,8 @@ static snd_pcm_sframes_t snd_pcm_multi_rewind(snd_pcm_t *pcm, snd_pcm_uframes_t
 		}
 	}
 	snd_pcm_mmap_appl_backward(pcm, frames);
+	if (multi->workers)
+		snd_pcm_multi_workers_resync(multi, 0);
 	return frames;
 }
 
@@ -688,6 +1516,9 @@ static snd_pcm_sframes_t snd_pcm_multi_forward(snd_pcm_t *pcm, snd_pcm_uframes_t
 	snd_pcm_multi_t *multi = pcm->private_data;
 	unsigned int i;
 	snd_pcm_uframes_t pos[multi->slaves_count];
+	if (multi->drift)
+		return 0;
+	snd_pcm_multi_sync(pcm);
 	memset(pos, 0, sizeof(pos));
 	for (i = 0; i < multi->slaves_count; ++i) {
 		snd_pcm_t *slave_i = multi->slaves[i].pcm;
@@ -711,6 +1542,8 @@ static snd_pcm_sframes_t snd_pcm_multi_forward(snd_pcm_t *pcm, snd_pcm_uframes_t
 		}
 	}
 	snd_pcm_mmap_appl_forward(pcm, frames);
+	if (multi->workers)
+		snd_pcm_multi_workers_resync(multi, 0);
 	return frames;
 }
 
@@ -719,6 +1552,7 @@ static int snd_pcm_multi_resume(snd_pcm_t *pcm)
 	snd_pcm_multi_t *multi = pcm->private_data;
 	int err = 0;
 	unsigned int i;
+	snd_pcm_multi_sync(pcm);
 	if (multi->slaves[0].linked)
 		return snd_pcm_resume(multi->slaves[0].linked);
 	for (i = 0; i < multi->slaves_count; ++i) {
@@ -740,6 +1574,7 @@ static int snd_pcm_multi_link_slaves(snd_pcm_t *pcm, snd_pcm_t *master)
 	unsigned int i;
 	int err;
 
+	snd_pcm_multi_sync(pcm);
 	for (i = 0; i < multi->slaves_count; ++i) {
 		snd_pcm_unlink(multi->slaves[i].pcm);
 		multi->slaves[i].linked = NULL;
@@ -770,6 +1605,7 @@ static int snd_pcm_multi_unlink(snd_pcm_t *pcm)
 	snd_pcm_multi_t *multi = pcm->private_data;
 	unsigned int i;
 
+	snd_pcm_multi_sync(pcm);
 	for (i = 0; i < multi->slaves_count; ++i) {
 		if (multi->slaves[i].linked)
 			snd_pcm_unlink(multi->slaves[i].linked);
@@ -787,7 +1623,20 @@ static snd_pcm_sframes_t snd_pcm_multi_mmap_commit(snd_pcm_t *pcm,
 	unsigned int i;
 	snd_pcm_sframes_t result;
 
+	if (multi->workers) {
+		/* publish the pointer, the workers commit to the slaves */
+		result = snd_pcm_multi_workers_error(multi);
+		if (result < 0)
+			return result;
+		snd_pcm_mmap_appl_forward(pcm, size);
+		__atomic_store_n(&multi->published, multi->appl_ptr,
+				 __ATOMIC_RELEASE);
+		snd_pcm_multi_workers_kick(multi);
+		return size;
+	}
 	for (i = 0; i < multi->slaves_count; ++i) {
+		if (multi->slaves[i].drift)
+			continue;
 		slave = multi->slaves[i].pcm;
 		result = snd_pcm_mmap_commit(slave, offset, size);
 		if (result < 0)
@@ -796,11 +1645,27 @@ static snd_pcm_sframes_t snd_pcm_multi_mmap_commit(snd_pcm_t *pcm,
 			return -EIO;
 	}
 	snd_pcm_mmap_appl_forward(pcm, size);
+	for (i = 0; i < multi->slaves_count; ++i) {
+		if (!multi->slaves[i].drift)
+			continue;
+		result = snd_pcm_multi_drift_pump(pcm, &multi->slaves[i],
+						  multi->appl_ptr);
+		if (result < 0)
+			return result;
+	}
 	return size;
 }
 
 static int snd_pcm_multi_munmap(snd_pcm_t *pcm)
 {
+	snd_pcm_multi_t *multi = pcm->private_data;
+	unsigned int i;
+
+	snd_pcm_multi_sync(pcm);
+	for (i = 0; i < multi->slaves_count; ++i) {
+		if (multi->slaves[i].drift)
+			snd_pcm_multi_drift_done(multi->slaves[i].drift);
+	}
 	free(pcm->mmap_channels);
 	free(pcm->running_areas);
 	pcm->mmap_channels = NULL;
@@ -811,7 +1676,9 @@ static int snd_pcm_multi_munmap(snd_pcm_t *pcm)
 static int snd_pcm_multi_mmap(snd_pcm_t *pcm)
 {
 	snd_pcm_multi_t *multi = pcm->private_data;
-	unsigned int c;
+	snd_pcm_multi_drift_t *drift;
+	unsigned int c, i;
+	int err;
 
 	pcm->mmap_channels = calloc(pcm->channels,
 				    sizeof(pcm->mmap_channels[0]));
@@ -822,6 +1689,17 @@ static int snd_pcm_multi_mmap(snd_pcm_t *pcm)
 		return -ENOMEM;
 	}
 
+	for (i = 0; i < multi->slaves_count; ++i) {
+		if (!multi->slaves[i].drift)
+			continue;
+		err = snd_pcm_multi_drift_init(pcm, &multi->slaves[i]);
+		if (err < 0) {
+			snd_error(PCM, "Cannot set up drift compensation for slave #%u", i);
+			snd_pcm_multi_munmap(pcm);
+			return err;
+		}
+	}
+
 	/* Copy the slave mmapped buffer data */
 	for (c = 0; c < pcm->channels; c++) {
 		snd_pcm_multi_channel_t *chan = &multi->channels[c];
@@ -830,6 +1708,18 @@ static int snd_pcm_multi_mmap(snd_pcm_t *pcm)
 			snd_pcm_multi_munmap(pcm);
 			return -ENXIO;
 		}
+		drift = multi->slaves[chan->slave_idx].drift;
+		if (drift) {
+			/* written to the local ring, resampled later */
+			snd_pcm_channel_info_t *info = &pcm->mmap_channels[c];
+			pcm->running_areas[c] = drift->areas[chan->slave_channel];
+			info->channel = c;
+			info->addr = pcm->running_areas[c].addr;
+			info->first = pcm->running_areas[c].first;
+			info->step = pcm->running_areas[c].step;
+			info->type = SND_PCM_AREA_LOCAL;
+			continue;
+		}
 		slave = multi->slaves[chan->slave_idx].pcm;
 		pcm->mmap_channels[c] =
 			slave->mmap_channels[chan->slave_channel];
@@ -844,6 +1734,7 @@ static int snd_pcm_multi_may_wait_for_avail_min(snd_pcm_t *pcm, snd_pcm_uframes_
 {
 	snd_pcm_multi_t *multi = pcm->private_data;
 	unsigned int i;
+	snd_pcm_multi_sync(pcm);
 	for (i = 0; i < multi->slaves_count; ++i) {
 		if (snd_pcm_may_wait_for_avail_min(multi->slaves[i].pcm, avail))
 			return 1;
@@ -1001,7 +1892,14 @@ static void snd_pcm_multi_dump(snd_pcm_t *pcm, snd_output_t *out)
 		snd_pcm_dump_setup(pcm, out);
 	}
 	for (k = 0; k < multi->slaves_count; ++k) {
+		snd_pcm_multi_drift_t *drift = multi->slaves[k].drift;
 		snd_output_printf(out, "Slave #%d: ", k);
+		if (drift) {
+			snd_output_printf(out, "drift compensated, ratio %.6f\n",
+					  drift->applied);
+			if (drift->ops.dump)
+				drift->ops.dump(drift->obj[drift->expand > 0], out);
+		}
 		snd_pcm_dump(multi->slaves[k].pcm, out);
 	}
 }
@@ -1056,6 +1954,32 @@ static const snd_pcm_fast_ops_t snd_pcm_multi_fast_ops = {
 	.may_wait_for_avail_min = snd_pcm_multi_may_wait_for_avail_min,
 };
 
+/* resample every slave but the master to the master clock */
+static int snd_pcm_multi_drift_setup(snd_pcm_t *pcm, const char *converter)
+{
+	snd_pcm_multi_t *multi = pcm->private_data;
+	unsigned int i;
+	int err;
+
+	if (pcm->stream != SND_PCM_STREAM_PLAYBACK) {
+		snd_error(PCM, "Drift compensation is supported only for playback");
+		return -EINVAL;
+	}
+	for (i = 0; i < multi->slaves_count; ++i) {
+		snd_pcm_multi_slave_t *slave = &multi->slaves[i];
+		if (i == multi->master_slave)
+			continue;
+		slave->drift = calloc(1, sizeof(*slave->drift));
+		if (!slave->drift)
+			return -ENOMEM;
+		err = snd_pcm_multi_drift_open(slave->drift, converter);
+		if (err < 0)
+			return err;
+		multi->drift = 1;
+	}
+	return 0;
+}
+
 /**
  * \brief Creates a new Multi PCM
  * \param pcmp Returns created PCM handle
@@ -1178,9 +2102,39 @@ pcm.name {
 		}
 	}
 	[master INT]		# Define the master slave
+	[drift BOOL]		# Resample the other slaves to the master clock
+	[drift_converter STR]	# Rate converter for drift (default "linear")
+	[workers BOOL]		# Service each slave from an own thread
+	[worker_priority INT]	# SCHED_FIFO priority of the workers
+				# (default 0 = scheduling of the opener)
 }
 \endcode
 
+When the slaves do not share a clock, e.g. separate USB interfaces,
+set <code>drift</code> to keep them in step with the master slave.
+The channels of the other slaves are written to a local buffer and
+resampled into their slaves.  The ratio is measured from the position
+timestamps of each slave against the master, and corrected by the
+difference of the played positions, so all slaves play the same
+frames.  <code>drift_converter</code> names a rate converter as for
+the \ref pcm_plugins_rate "rate plugin"; it has to support
+adjust_pitch.  This mode is available only for playback, and rewind
+and forward are not possible.
+
+With <code>workers</code> set, every slave gets a thread which commits
+the client frames to it.  The client thread only publishes its pointer
+on commit and returns without taking a lock; a worker is woken through
+an eventfd only when it sleeps.  The avail update is the point where
+the streams meet: it wakes all workers and waits for the slowest of
+them, so the client blocks there for one pass over the slowest slave,
+while the slaves themselves are serviced in parallel instead of one
+after another.  Errors of the slaves are reported by the following
+commit or avail update.  All other operations, including the state
+query, wait for the workers to go idle before they touch the slaves.
+The workers run with the scheduling of the thread opening the PCM, or
+with SCHED_FIFO at <code>worker_priority</code> when given and
+permitted.
+
 For example, to bind two PCM streams with two-channel stereo (hw:0,0 and
 hw:0,1) as one 4-channel stereo PCM stream, define like this:
 \code
@@ -1258,6 +2212,10 @@ int _snd_pcm_multi_open(snd_pcm_t **pcmp, const char *name,
 	unsigned int slaves_count = 0;
 	long master_slave = 0;
 	unsigned int channels_count = 0;
+	int drift = 0;
+	const char *drift_converter = "linear";
+	int workers = 0;
+	long worker_priority = 0;
 	snd_config_for_each(i, inext, conf) {
 		snd_config_t *n = snd_config_iterator_entry(i);
 		const char *id;
@@ -1288,6 +2246,38 @@ int _snd_pcm_multi_open(snd_pcm_t **pcmp, const char *name,
 			}
 			continue;
 		}
+		if (strcmp(id, "drift") == 0) {
+			err = snd_config_get_bool(n);
+			if (err < 0)
+				return err;
+			drift = err;
+			continue;
+		}
+		if (strcmp(id, "drift_converter") == 0) {
+			if (snd_config_get_string(n, &drift_converter) < 0) {
+				snd_error(PCM, "Invalid type for %s", id);
+				return -EINVAL;
+			}
+			continue;
+		}
+		if (strcmp(id, "workers") == 0) {
+			err = snd_config_get_bool(n);
+			if (err < 0)
+				return err;
+			workers = err;
+			continue;
+		}
+		if (strcmp(id, "worker_priority") == 0) {
+			if (snd_config_get_integer(n, &worker_priority) < 0) {
+				snd_error(PCM, "Invalid type for %s", id);
+				return -EINVAL;
+			}
+			if (worker_priority < 0) {
+				snd_error(PCM, "Invalid value for %s", id);
+				return -EINVAL;
+			}
+			continue;
+		}
 		snd_error(PCM, "Unknown field %s", id);
 		return -EINVAL;
 	}
@@ -1436,6 +2426,21 @@ int _snd_pcm_multi_open(snd_pcm_t **pcmp, const char *name,
 				 channels_count,
 				 channels_sidx, channels_schannel,
 				 1);
+	if (err >= 0 && drift) {
+		err = snd_pcm_multi_drift_setup(*pcmp, drift_converter);
+		if (err < 0) {
+			/* the slaves are closed with the multi PCM */
+			snd_pcm_close(*pcmp);
+			slaves_count = 0;
+		}
+	}
+	if (err >= 0 && workers) {
+		err = snd_pcm_multi_workers_setup(*pcmp, worker_priority);
+		if (err < 0) {
+			snd_pcm_close(*pcmp);
+			slaves_count = 0;
+		}
+	}
 _free:
 	if (err < 0) {
 		for (idx = 0; idx < slaves_count; ++idx) {
@@ -20,6 +20,9 @@
  */
 
 #include "pcm_local.h"
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #ifndef NDEBUG
 static void dump_hw_params(snd_pcm_hw_params_t *params, const char *type,
@@ -1085,7 +1088,7 @@ int snd_pcm_hw_param_never_eq(const snd_pcm_hw_params_t *params,
    max buffer size
    min tick time
 */
-static int snd_pcm_hw_params_choose(snd_pcm_t *pcm, snd_pcm_hw_params_t *params)
+int snd_pcm_hw_params_choose(snd_pcm_t *pcm, snd_pcm_hw_params_t *params)
 {
 	int err;
 #ifdef CHOOSE_DEBUG
@@ -1946,6 +1949,8 @@ static const snd_pcm_hw_rule_t refine_rules[] = {
 };
 
 #define RULES (sizeof(refine_rules) / sizeof(refine_rules[0]))
+/* snd_pcm_hw_refine_soft() keeps one bit per rule in an unsigned int */
+typedef char snd_pcm_refine_rules_fit_mask[RULES <= 32 ? 1 : -1];
 #define PCM_BIT(x) \
 	(1U << ((x) < 32 ? (x) : ((x) - 32)))
 
@@ -2086,10 +2091,9 @@ int snd_pcm_hw_refine_soft(snd_pcm_t *pcm ATTRIBUTE_UNUSED, snd_pcm_hw_params_t
 	unsigned int k;
 	snd_interval_t *i;
 	snd_mask_t *m;
-	unsigned int rstamps[RULES];
-	unsigned int vstamps[SND_PCM_HW_PARAM_LAST_INTERVAL + 1];
-	unsigned int stamp = 2;
-	int changed, again;
+	unsigned int var_rules[SND_PCM_HW_PARAM_LAST_INTERVAL + 1];
+	unsigned int dirty, pass;
+	int changed;
 #ifdef RULES_DEBUG
 	snd_output_t *log;
 	snd_output_stdio_attach(&log, stderr, 0);
@@ -2119,24 +2123,33 @@ int snd_pcm_hw_refine_soft(snd_pcm_t *pcm ATTRIBUTE_UNUSED, snd_pcm_hw_params_t
 			goto _err;
 	}
 
-	for (k = 0; k < RULES; k++)
-		rstamps[k] = 0;
+	/* one bit per rule (at most 32 of them, checked above): the rules to
+	 * run because one of their dependencies changed since they ran
+	 * the last time
+	 */
+	memset(var_rules, 0, sizeof(var_rules));
+	for (k = 0; k < RULES; k++) {
+		const snd_pcm_hw_rule_t *r = &refine_rules[k];
+		unsigned int d;
+		for (d = 0; r->deps[d] >= 0; d++)
+			var_rules[r->deps[d]] |= 1U << k;
+	}
+	dirty = 0;
 	for (k = 0; k <= SND_PCM_HW_PARAM_LAST_INTERVAL; k++)
-		vstamps[k] = (params->rmask & (1 << k)) ? 1 : 0;
-	do {
-		again = 0;
-		for (k = 0; k < RULES; k++) {
-			const snd_pcm_hw_rule_t *r = &refine_rules[k];
-			unsigned int d;
-			int doit = 0;
-			for (d = 0; r->deps[d] >= 0; d++) {
-				if (vstamps[r->deps[d]] > rstamps[k]) {
-					doit = 1;
-					break;
-				}
-			}
-			if (!doit)
-				continue;
+		if (params->rmask & (1 << k))
+			dirty |= var_rules[k];
+	/* run in passes in the rule order, a rule dirtied by a later one
+	 * is run in the next pass
+	 */
+	while (dirty) {
+		pass = dirty;
+		while (pass) {
+			const snd_pcm_hw_rule_t *r;
+			unsigned int bit;
+			k = __builtin_ctz(pass);
+			bit = 1U << k;
+			r = &refine_rules[k];
+			dirty &= ~bit;
 #ifdef RULES_DEBUG
 			snd_output_printf(log, "Rule %d (%p): ", k, r->func);
 			if (r->var >= 0) {
@@ -2149,23 +2162,25 @@ int snd_pcm_hw_refine_soft(snd_pcm_t *pcm ATTRIBUTE_UNUSED, snd_pcm_hw_params_t
 #ifdef RULES_DEBUG
 			if (r->var >= 0)
 				snd_pcm_hw_param_dump(params, r->var, log);
-			for (d = 0; r->deps[d] >= 0; d++) {
-				snd_output_printf(log, " %s=", snd_pcm_hw_param_name(r->deps[d]));
-				snd_pcm_hw_param_dump(params, r->deps[d], log);
+			{
+				unsigned int d;
+				for (d = 0; r->deps[d] >= 0; d++) {
+					snd_output_printf(log, " %s=", snd_pcm_hw_param_name(r->deps[d]));
+					snd_pcm_hw_param_dump(params, r->deps[d], log);
+				}
 			}
 			snd_output_putc(log, '\n');
 #endif
-			rstamps[k] = stamp;
 			if (changed && r->var >= 0) {
 				params->cmask |= 1 << r->var;
-				vstamps[r->var] = stamp;
-				again = 1;
+				dirty |= var_rules[r->var] & ~bit;
 			}
 			if (changed < 0)
 				goto _err;
-			stamp++;
+			/* continue with the following rules of this pass */
+			pass = dirty & ~((bit << 1) - 1);
 		}
-	} while (again);
+	}
 	if (!params->msbits) {
 		i = hw_param_interval(params, SND_PCM_HW_PARAM_SAMPLE_BITS);
 		if (snd_interval_single(i))
@@ -2366,9 +2381,386 @@ static int snd_pcm_sw_params_default(snd_pcm_t *pcm, snd_pcm_sw_params_t *params
 #define REFINE_DEBUG
 #endif
 
+/*
+ * Memoized refine results
+ *
+ * The configuration negotiation (especially through the plug plugin)
+ * refines the same parameters repeatedly and each refine walks the whole
+ * plugin chain down to the kernel. The results are remembered per PCM
+ * (each slave in the chain has its own cache) until the configuration is
+ * installed or freed.
+ *
+ * The refine of the hw and the direct plugins depends also on the driver
+ * or the shared state, which other streams may change at any time (e.g.
+ * the rate locked by an open stream). Such results, and the results of
+ * all PCMs above them, are trusted only within the application call which
+ * obtained them (one epoch); the plug plugin issues most of its refines
+ * from a single call. Only the results of plugins without such a slave
+ * are kept until the setup.
+ *
+ * Optionally the results are also kept on disk (see
+ * snd_pcm_hw_refine_cache_attach()), so the next process opening the same
+ * PCM with the same configuration skips the negotiation as well. A stored
+ * set is used only when the refine of the whole configuration space still
+ * gives the same result as when it was stored, and an entry only when its
+ * result narrows its input and, for a successful refine, lies non-empty
+ * within that space.
+ *
+ * Only the refine results are stored, not the plugin chain built by the
+ * plug plugin nor the slave setup of the direct plugins. Both are live
+ * objects (converter instances, an installed hw_params, the shared memory
+ * of the direct plugins) which have to be created again anyway; what
+ * takes the time is the search through the refines, and that is what a
+ * stored set skips. The results of volatile PCMs (see above) are loaded
+ * into the epoch of the opening call only, so a stale driver state cannot
+ * outlive it.
+ */
+#define REFINE_CACHE_SIZE	32
+#define REFINE_CACHE_MAGIC	0x43524c41	/* "ALRC" */
+#define REFINE_CACHE_VERSION	2
+
+struct _snd_pcm_refine_cache {
+	unsigned int next;		/* next entry to replace */
+	unsigned int count;		/* valid entries */
+	unsigned int modified: 1;	/* entries added since load */
+	int any_result;			/* refine of the whole space */
+	snd_pcm_hw_params_t any;
+	struct {
+		unsigned int hash;
+		unsigned int epoch;	/* 0 = pure, valid only in this epoch otherwise */
+		int result;
+		snd_pcm_hw_params_t in;
+		snd_pcm_hw_params_t out;
+	} entry[REFINE_CACHE_SIZE];
+};
+
+#ifdef HAVE___THREAD
+/* refines in progress in this thread, the outermost one opens an epoch */
+static __thread unsigned int refine_depth;
+static __thread unsigned int refine_epoch;
+static __thread int refine_volatile;	/* a volatile PCM answered */
+
+static void refine_enter(void)
+{
+	if (refine_depth++ == 0 && ++refine_epoch == 0)
+		refine_epoch = 1;
+}
+
+static void refine_leave(void)
+{
+	refine_depth--;
+}
+
+static inline unsigned int refine_current_epoch(void)
+{
+	return refine_epoch;
+}
+#define REFINE_CACHE_USABLE	1
+#else
+/* the volatility cannot be tracked per thread, so nothing is memoized */
+static int refine_volatile;
+#define REFINE_CACHE_USABLE	0
+
+static void refine_enter(void)
+{
+}
+
+static void refine_leave(void)
+{
+}
+
+static inline unsigned int refine_current_epoch(void)
+{
+	return 0;
+}
+#endif
+
+static unsigned int refine_cache_hash(const snd_pcm_hw_params_t *params)
+{
+	const unsigned int *p = (const unsigned int *)params;
+	unsigned int i, hash = 2166136261U;
+
+	for (i = 0; i < sizeof(*params) / sizeof(*p); i++)
+		hash = (hash ^ p[i]) * 16777619U;
+	return hash;
+}
+
+static int refine_cache_lookup(snd_pcm_t *pcm, snd_pcm_hw_params_t *params,
+			       unsigned int hash)
+{
+	snd_pcm_refine_cache_t *cache = pcm->refine_cache;
+	unsigned int i;
+
+	for (i = 0; i < cache->count; i++) {
+		if (cache->entry[i].epoch &&
+		    cache->entry[i].epoch != refine_current_epoch())
+			continue;
+		if (cache->entry[i].hash == hash &&
+		    !memcmp(&cache->entry[i].in, params, sizeof(*params))) {
+			*params = cache->entry[i].out;
+			return i;
+		}
+	}
+	return -ENOENT;
+}
+
+static void refine_cache_store(snd_pcm_t *pcm, const snd_pcm_hw_params_t *in,
+			       unsigned int hash, const snd_pcm_hw_params_t *out,
+			       int result)
+{
+	snd_pcm_refine_cache_t *cache = pcm->refine_cache;
+	unsigned int i = cache->next;
+	unsigned int epoch = 0;
+
+	if (refine_volatile) {
+		epoch = refine_current_epoch();
+		if (!epoch)
+			return;
+	}
+	cache->entry[i].hash = hash;
+	cache->entry[i].epoch = epoch;
+	cache->entry[i].result = result;
+	cache->entry[i].in = *in;
+	cache->entry[i].out = *out;
+	cache->next = (i + 1) % REFINE_CACHE_SIZE;
+	if (cache->count < REFINE_CACHE_SIZE)
+		cache->count++;
+	cache->modified = 1;
+}
+
+struct refine_cache_header {
+	unsigned int magic;
+	unsigned int version;
+	unsigned int params_size;
+	unsigned int count;
+	int any_result;
+};
+
+static int refine_cache_read(int fd, void *buf, size_t size)
+{
+	return read(fd, buf, size) == (ssize_t)size ? 0 : -EIO;
+}
+
+/*
+ * check that out is a refinement of in: refining out by in changes
+ * nothing; an empty parameter is fine only for a failed refine
+ */
+static int refine_cache_narrows(const snd_pcm_hw_params_t *in,
+				const snd_pcm_hw_params_t *out, int result)
+{
+	snd_pcm_hw_param_t k;
+	int err;
+
+	for (k = SND_PCM_HW_PARAM_FIRST_MASK; k <= SND_PCM_HW_PARAM_LAST_MASK; k++) {
+		snd_mask_t m = *hw_param_mask_c(out, k);
+		err = snd_mask_refine(&m, hw_param_mask_c(in, k));
+		if (err > 0 || (err < 0 && result >= 0))
+			return 0;
+	}
+	for (k = SND_PCM_HW_PARAM_FIRST_INTERVAL; k <= SND_PCM_HW_PARAM_LAST_INTERVAL; k++) {
+		snd_interval_t i = *hw_param_interval_c(out, k);
+		err = snd_interval_refine(&i, hw_param_interval_c(in, k));
+		if (err > 0 || (err < 0 && result >= 0))
+			return 0;
+	}
+	return 1;
+}
+
+/* a stored entry must be a possible refine result of this PCM */
+static int refine_cache_entry_valid(snd_pcm_t *pcm, unsigned int n)
+{
+	snd_pcm_refine_cache_t *cache = pcm->refine_cache;
+	int result = cache->entry[n].result;
+
+	if (result > 0)
+		return 0;
+	if (!refine_cache_narrows(&cache->entry[n].in, &cache->entry[n].out,
+				  result))
+		return 0;
+	return result < 0 ||
+		refine_cache_narrows(&cache->any, &cache->entry[n].out, result);
+}
+
+/* load the stored entries when the whole space refines the same way */
+static void refine_cache_load(snd_pcm_t *pcm)
+{
+	snd_pcm_refine_cache_t *cache = pcm->refine_cache;
+	struct refine_cache_header hdr;
+	snd_pcm_hw_params_t any;
+	unsigned int i;
+	int fd;
+
+	_snd_pcm_hw_params_any(&cache->any);
+	cache->any_result = pcm->ops->hw_refine(pcm->op_arg, &cache->any);
+	_snd_pcm_hw_params_any(&any);
+	refine_cache_store(pcm, &any, refine_cache_hash(&any), &cache->any,
+			   cache->any_result);
+	cache->modified = 0;
+	if (cache->any_result < 0)
+		return;
+	fd = open(pcm->refine_cache_file, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return;
+	if (refine_cache_read(fd, &hdr, sizeof(hdr)) < 0 ||
+	    hdr.magic != REFINE_CACHE_MAGIC ||
+	    hdr.version != REFINE_CACHE_VERSION ||
+	    hdr.params_size != sizeof(snd_pcm_hw_params_t) ||
+	    hdr.count > REFINE_CACHE_SIZE ||
+	    hdr.any_result != cache->any_result ||
+	    refine_cache_read(fd, &any, sizeof(any)) < 0 ||
+	    memcmp(&any, &cache->any, sizeof(any))) {
+		snd_check(PCM, "refine cache %s is stale", pcm->refine_cache_file);
+		goto out;
+	}
+	cache->count = 0;
+	for (i = 0; i < hdr.count; i++) {
+		unsigned int n = cache->count;
+		int vol;
+		if (refine_cache_read(fd, &vol, sizeof(int)) < 0 ||
+		    refine_cache_read(fd, &cache->entry[n].result, sizeof(int)) < 0 ||
+		    refine_cache_read(fd, &cache->entry[n].in, sizeof(any)) < 0 ||
+		    refine_cache_read(fd, &cache->entry[n].out, sizeof(any)) < 0)
+			break;
+		if (!refine_cache_entry_valid(pcm, n)) {
+			snd_check(PCM, "refine cache %s has a bad entry", pcm->refine_cache_file);
+			continue;
+		}
+		/* the driver state was just checked by the probe above */
+		cache->entry[n].epoch = vol ? refine_current_epoch() : 0;
+		if (vol && !cache->entry[n].epoch)
+			continue;
+		cache->entry[n].hash = refine_cache_hash(&cache->entry[n].in);
+		cache->count++;
+	}
+	cache->next = cache->count % REFINE_CACHE_SIZE;
+ out:
+	close(fd);
+}
+
+/* replace the stored entries atomically */
+static void refine_cache_save(snd_pcm_t *pcm)
+{
+	snd_pcm_refine_cache_t *cache = pcm->refine_cache;
+	struct refine_cache_header hdr;
+	size_t len = strlen(pcm->refine_cache_file) + 8;
+	char *tmp;
+	unsigned int i;
+	FILE *f;
+	int fd, err = 0;
+
+	if (cache->any_result < 0)
+		return;
+	tmp = malloc(len);
+	if (!tmp)
+		return;
+	snprintf(tmp, len, "%s.XXXXXX", pcm->refine_cache_file);
+	fd = mkstemp(tmp);
+	if (fd < 0)
+		goto out;
+	f = fdopen(fd, "w");
+	if (!f) {
+		close(fd);
+		unlink(tmp);
+		goto out;
+	}
+	hdr.magic = REFINE_CACHE_MAGIC;
+	hdr.version = REFINE_CACHE_VERSION;
+	hdr.params_size = sizeof(snd_pcm_hw_params_t);
+	hdr.count = cache->count;
+	hdr.any_result = cache->any_result;
+	if (fwrite(&hdr, sizeof(hdr), 1, f) != 1 ||
+	    fwrite(&cache->any, sizeof(cache->any), 1, f) != 1)
+		err = -EIO;
+	for (i = 0; !err && i < cache->count; i++) {
+		int vol = cache->entry[i].epoch != 0;
+		if (fwrite(&vol, sizeof(int), 1, f) != 1 ||
+		    fwrite(&cache->entry[i].result, sizeof(int), 1, f) != 1 ||
+		    fwrite(&cache->entry[i].in, sizeof(cache->any), 1, f) != 1 ||
+		    fwrite(&cache->entry[i].out, sizeof(cache->any), 1, f) != 1)
+			err = -EIO;
+	}
+	if (fclose(f) || err < 0 || rename(tmp, pcm->refine_cache_file) < 0) {
+		snd_checknum(PCM, "cannot write refine cache %s", pcm->refine_cache_file);
+		unlink(tmp);
+	}
+ out:
+	free(tmp);
+}
+
+#define REFINE_HASH_INIT	0xcbf29ce484222325ULL
+
+static uint64_t refine_hash(uint64_t hash, const void *data, size_t size)
+{
+	const unsigned char *p = data;
+
+	while (size--)
+		hash = (hash ^ *p++) * 0x100000001b3ULL;
+	return hash;
+}
+
+/* enable the on-disk cache for a PCM opened from the given definition;
+ * the key covers the definition, the open parameters and the identity
+ * of the device behind the PCM
+ */
+int snd_pcm_hw_refine_cache_attach(snd_pcm_t *pcm, const char *dir,
+				   snd_config_t *conf)
+{
+	uint64_t hash = REFINE_HASH_INIT;
+	snd_output_t *out;
+	snd_pcm_info_t info;
+	char *text, *path;
+	size_t len;
+	int compat = pcm->compat;
+	int err;
+
+	err = snd_output_buffer_open(&out);
+	if (err < 0)
+		return err;
+	snd_config_save(conf, out);
+	len = snd_output_buffer_string(out, &text);
+	hash = refine_hash(hash, text, len);
+	snd_output_close(out);
+	if (pcm->name)
+		hash = refine_hash(hash, pcm->name, strlen(pcm->name) + 1);
+	hash = refine_hash(hash, &pcm->stream, sizeof(pcm->stream));
+	hash = refine_hash(hash, &pcm->mode, sizeof(pcm->mode));
+	hash = refine_hash(hash, &compat, sizeof(compat));
+	hash = refine_hash(hash, &pcm->minperiodtime, sizeof(pcm->minperiodtime));
+	memset(&info, 0, sizeof(info));
+	if (snd_pcm_info(pcm, &info) >= 0) {
+		hash = refine_hash(hash, &info.card, sizeof(info.card));
+		hash = refine_hash(hash, &info.device, sizeof(info.device));
+		hash = refine_hash(hash, &info.subdevice, sizeof(info.subdevice));
+		hash = refine_hash(hash, info.id, sizeof(info.id));
+		hash = refine_hash(hash, info.name, sizeof(info.name));
+		hash = refine_hash(hash, info.subname, sizeof(info.subname));
+	}
+	len = strlen(dir) + 32;
+	path = malloc(len);
+	if (!path)
+		return -ENOMEM;
+	snprintf(path, len, "%s/pcm-%016llx.refine", dir,
+		 (unsigned long long)hash);
+	free(pcm->refine_cache_file);
+	pcm->refine_cache_file = path;
+	return 0;
+}
+
+/* drop the memoized results, e.g. when the configuration changes */
+void snd_pcm_hw_refine_cache_clear(snd_pcm_t *pcm)
+{
+	if (pcm->refine_cache && pcm->refine_cache->modified &&
+	    pcm->refine_cache_file)
+		refine_cache_save(pcm);
+	free(pcm->refine_cache);
+	pcm->refine_cache = NULL;
+}
+
 int snd_pcm_hw_refine(snd_pcm_t *pcm, snd_pcm_hw_params_t *params)
 {
-	int res;
+	snd_pcm_hw_params_t in;
+	unsigned int hash = 0;
+	int res, cache, outer_volatile;
 #ifdef REFINE_DEBUG
 	snd_output_t *log;
 	snd_output_stdio_attach(&log, stderr, 0);
@@ -2378,10 +2770,38 @@ int snd_pcm_hw_refine(snd_pcm_t *pcm, snd_pcm_hw_params_t *params)
 	snd_output_printf(log, "REFINE called:\n");
 	snd_pcm_hw_params_dump(params, log);
 #endif
+	refine_enter();
+	outer_volatile = refine_volatile;
+	refine_volatile = pcm->volatile_refine;
+	cache = REFINE_CACHE_USABLE && !pcm->no_refine_cache && !pcm->setup;
+	if (cache && !pcm->refine_cache) {
+		pcm->refine_cache = calloc(1, sizeof(*pcm->refine_cache));
+		cache = pcm->refine_cache != NULL;
+		if (cache && pcm->refine_cache_file && pcm->ops->hw_refine)
+			refine_cache_load(pcm);
+	}
+	if (cache) {
+		hash = refine_cache_hash(params);
+		res = refine_cache_lookup(pcm, params, hash);
+		if (res >= 0) {
+			if (pcm->refine_cache->entry[res].epoch)
+				refine_volatile = 1;
+			res = pcm->refine_cache->entry[res].result;
+			goto done;
+		}
+		in = *params;
+	}
 	if (pcm->ops->hw_refine)
 		res = pcm->ops->hw_refine(pcm->op_arg, params);
 	else
 		res = -ENOSYS;
+	/* transient errors (busy, disconnected...) are not remembered */
+	if (cache && (res >= 0 || res == -EINVAL))
+		refine_cache_store(pcm, &in, hash, params, res);
+ done:
+	/* the callers depend on the volatile state as well */
+	refine_volatile |= outer_volatile;
+	refine_leave();
 #ifdef REFINE_DEBUG
 	snd_output_printf(log, "refine done - result = %i\n", res);
 	snd_pcm_hw_params_dump(params, log);
@@ -2424,6 +2844,7 @@ int _snd_pcm_hw_params_internal(snd_pcm_t *pcm, snd_pcm_hw_params_t *params)
 		return err;
 
 	pcm->setup = 1;
+	snd_pcm_hw_refine_cache_clear(pcm);
 	INTERNAL(snd_pcm_hw_params_get_access)(params, &pcm->access);
 	INTERNAL(snd_pcm_hw_params_get_format)(params, &pcm->format);
 	INTERNAL(snd_pcm_hw_params_get_subformat)(params, &pcm->subformat);
@@ -255,6 +255,8 @@ static snd_pcm_sframes_t snd_pcm_plugin_write_areas(snd_pcm_t *pcm,
 			break;
 		frames = plugin->write(pcm, areas, offset, frames,
 				       slave_areas, slave_offset, &slave_frames);
+		snd_pcm_stats_add(pcm, SND_PCM_STATS_BYTES_CONVERTED,
+				  snd_pcm_frames_to_bytes(pcm, frames));
 		if (CHECK_SANITY(slave_frames > snd_pcm_mmap_playback_avail(slave))) {
 			snd_check(PCM, "write overflow %ld > %ld", slave_frames,
 				       snd_pcm_mmap_playback_avail(slave));
@@ -310,6 +312,8 @@ static snd_pcm_sframes_t snd_pcm_plugin_read_areas(snd_pcm_t *pcm,
 			break;
 		frames = (plugin->read)(pcm, areas, offset, frames,
 				      slave_areas, slave_offset, &slave_frames);
+		snd_pcm_stats_add(pcm, SND_PCM_STATS_BYTES_CONVERTED,
+				  snd_pcm_frames_to_bytes(pcm, frames));
 		if (CHECK_SANITY(slave_frames > snd_pcm_mmap_capture_avail(slave))) {
 			snd_check(PCM, "read overflow %ld > %ld", slave_frames,
 				       snd_pcm_mmap_playback_avail(slave));
@@ -411,6 +415,8 @@ snd_pcm_plugin_mmap_commit(snd_pcm_t *pcm,
 			frames = cont;
 		frames = plugin->write(pcm, areas, appl_offset, frames,
 				       slave_areas, slave_offset, &slave_frames);
+		snd_pcm_stats_add(pcm, SND_PCM_STATS_BYTES_CONVERTED,
+				  snd_pcm_frames_to_bytes(pcm, frames));
 		err = result = snd_pcm_mmap_commit(slave, slave_offset, slave_frames);
 		if (err <= 0)
 			goto error;
@@ -474,6 +480,10 @@ snd_pcm_plugin_sync_hw_ptr_capture(snd_pcm_t *pcm,
 			frames = cont;
 		frames = (plugin->read)(pcm, areas, hw_offset, frames,
 					slave_areas, slave_offset, &slave_frames);
+		snd_pcm_stats_add(pcm, SND_PCM_STATS_BYTES_CONVERTED,
+				  snd_pcm_frames_to_bytes(pcm, frames));
+		if (!frames && !slave_frames)
+			break;		/* the conversion failed */
 		err = snd_pcm_mmap_commit(slave, slave_offset, slave_frames);
 		if (err < 0)
 			goto error;
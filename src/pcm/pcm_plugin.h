@@ -100,6 +100,8 @@ snd_pcm_sframes_t snd_pcm_plugin_undo_write_generic
 #define snd_pcm_mulaw_encode	snd1_pcm_mulaw_encode
 #define snd_pcm_adpcm_decode	snd1_pcm_adpcm_decode
 #define snd_pcm_adpcm_encode	snd1_pcm_adpcm_encode
+#define snd_pcm_lfloat_put_s32_index	snd1_pcm_lfloat_put_s32_index
+#define snd_pcm_lfloat_convert_integer_float	snd1_pcm_lfloat_convert_integer_float
 
 int snd_pcm_linear_get_index(snd_pcm_format_t src_format, snd_pcm_format_t dst_format);
 int snd_pcm_linear_put_index(snd_pcm_format_t src_format, snd_pcm_format_t dst_format);
@@ -137,6 +139,11 @@ void snd_pcm_mulaw_encode(const snd_pcm_channel_area_t *dst_areas,
 			  snd_pcm_uframes_t src_offset,
 			  unsigned int channels, snd_pcm_uframes_t frames,
 			  unsigned int getidx);
+int snd_pcm_lfloat_put_s32_index(snd_pcm_format_t format);
+void snd_pcm_lfloat_convert_integer_float(const snd_pcm_channel_area_t *dst_areas, snd_pcm_uframes_t dst_offset,
+					  const snd_pcm_channel_area_t *src_areas, snd_pcm_uframes_t src_offset,
+					  unsigned int channels, snd_pcm_uframes_t frames,
+					  unsigned int get32idx, unsigned int put32floatidx);
 
 typedef struct _snd_pcm_adpcm_state {
 	int pred_val;		/* Calculated predicted value */
@@ -29,7 +29,7 @@
  */
 #include "pcm_local.h"
 #include "pcm_plugin.h"
-#include "pcm_rate.h"
+#include "pcm_rate_converter.h"
 #include "plugin_ops.h"
 #include "bswap.h"
 #include <inttypes.h>
@@ -1410,12 +1410,18 @@ static int is_builtin_plugin(const char *type)
 static const char *const default_rate_plugins[] = {
 	"speexrate", "linear", NULL
 };
+#endif
 
-static int rate_open_func(snd_pcm_rate_t *rate, const char *type, const snd_config_t *converter_conf, int verbose)
+int snd_pcm_rate_open_converter(const char *type,
+				const snd_config_t *converter_conf,
+				int verbose, void **objp,
+				snd_pcm_rate_ops_t *ops, void **open_func,
+				unsigned int *plugin_version)
 {
+#ifdef PIC
 	char open_name[64], open_conf_name[64], lib_name[64], *lib = NULL;
-	snd_pcm_rate_open_func_t open_func;
-	snd_pcm_rate_open_conf_func_t open_conf_func;
+	snd_pcm_rate_open_func_t func;
+	snd_pcm_rate_open_conf_func_t conf_func;
 	int err;
 
 	snprintf(open_name, sizeof(open_name), "_snd_pcm_rate_%s_open", type);
@@ -1426,39 +1432,60 @@ static int rate_open_func(snd_pcm_rate_t *rate, const char *type, const snd_conf
 		lib = lib_name;
 	}
 
-	open_conf_func = snd_dlobj_cache_get(lib, open_conf_name, NULL, verbose && converter_conf != NULL);
-	if (open_conf_func) {
-		err = open_conf_func(SND_PCM_RATE_PLUGIN_VERSION,
-				     &rate->obj, &rate->ops, converter_conf);
+	*plugin_version = SND_PCM_RATE_PLUGIN_VERSION;
+	conf_func = snd_dlobj_cache_get(lib, open_conf_name, NULL, verbose && converter_conf != NULL);
+	if (conf_func) {
+		err = conf_func(SND_PCM_RATE_PLUGIN_VERSION,
+				objp, ops, converter_conf);
 		if (!err) {
-			rate->open_func = open_conf_func;
+			*open_func = conf_func;
 			return 0;
 		} else {
-			snd_dlobj_cache_put(open_conf_func);
+			snd_dlobj_cache_put(conf_func);
 			return err;
 		}
 	}
 
-	open_func = snd_dlobj_cache_get(lib, open_name, NULL, verbose);
-	if (!open_func)
+	func = snd_dlobj_cache_get(lib, open_name, NULL, verbose);
+	if (!func)
 		return -ENOENT;
 
-	rate->open_func = open_func;
-
-	err = open_func(SND_PCM_RATE_PLUGIN_VERSION, &rate->obj, &rate->ops);
-	if (!err)
+	err = func(SND_PCM_RATE_PLUGIN_VERSION, objp, ops);
+	if (!err) {
+		*open_func = func;
 		return 0;
+	}
 
 	/* try to open with the old protocol version */
-	rate->plugin_version = SND_PCM_RATE_PLUGIN_VERSION_OLD;
-	err = open_func(SND_PCM_RATE_PLUGIN_VERSION_OLD,
-			&rate->obj, &rate->ops);
-	if (!err)
+	*plugin_version = SND_PCM_RATE_PLUGIN_VERSION_OLD;
+	err = func(SND_PCM_RATE_PLUGIN_VERSION_OLD, objp, ops);
+	if (!err) {
+		*open_func = func;
 		return 0;
+	}
 
-	snd_dlobj_cache_put(open_func);
-	rate->open_func = NULL;
+	snd_dlobj_cache_put(func);
 	return err;
+#else
+	extern int SND_PCM_RATE_PLUGIN_ENTRY(linear) (unsigned int version, void **objp, snd_pcm_rate_ops_t *ops);
+
+	/* only the builtin converter is linked in */
+	if (strcmp(type, "linear") != 0)
+		return -ENOENT;
+	*open_func = NULL;
+	*plugin_version = SND_PCM_RATE_PLUGIN_VERSION;
+	return SND_PCM_RATE_PLUGIN_ENTRY(linear)(SND_PCM_RATE_PLUGIN_VERSION,
+						 objp, ops);
+#endif
+}
+
+#ifdef PIC
+static int rate_open_func(snd_pcm_rate_t *rate, const char *type, const snd_config_t *converter_conf, int verbose)
+{
+	return snd_pcm_rate_open_converter(type, converter_conf, verbose,
+					   &rate->obj, &rate->ops,
+					   &rate->open_func,
+					   &rate->plugin_version);
 }
 #endif
 
@@ -1510,10 +1537,6 @@ int snd_pcm_rate_open(snd_pcm_t **pcmp, const char *name,
 	snd_pcm_rate_t *rate;
 	const char *type = NULL;
 	int err;
-#ifndef PIC
-	snd_pcm_rate_open_func_t open_func;
-	extern int SND_PCM_RATE_PLUGIN_ENTRY(linear) (unsigned int version, void **objp, snd_pcm_rate_ops_t *ops);
-#endif
 
 	assert(pcmp && slave);
 	if (sformat != SND_PCM_FORMAT_UNKNOWN &&
@@ -1599,8 +1622,9 @@ int snd_pcm_rate_open(snd_pcm_t **pcmp, const char *name,
 	}
 #else
 	type = "linear";
-	open_func = SND_PCM_RATE_PLUGIN_ENTRY(linear);
-	err = open_func(SND_PCM_RATE_PLUGIN_VERSION, &rate->obj, &rate->ops);
+	err = snd_pcm_rate_open_converter(type, NULL, 1, &rate->obj,
+					  &rate->ops, &rate->open_func,
+					  &rate->plugin_version);
 	if (err < 0) {
 		snd_pcm_free(pcm);
 		free(rate);
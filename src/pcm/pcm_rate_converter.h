@@ -0,0 +1,36 @@
+/*
+ *  PCM - Rate converter loader
+ *
+ *   This library is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as
+ *   published by the Free Software Foundation; either version 2.1 of
+ *   the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "pcm_rate.h"
+
+/* make local functions really local */
+#define snd_pcm_rate_open_converter \
+	snd1_pcm_rate_open_converter
+
+/*
+ * Open one instance of the rate converter type, with converter_conf
+ * passed to its _open_conf entry when there is one.  *open_func gets
+ * the reference to release with snd_dlobj_cache_put() (NULL for a
+ * statically linked converter), *plugin_version the protocol used.
+ */
+int snd_pcm_rate_open_converter(const char *type,
+				const snd_config_t *converter_conf,
+				int verbose, void **objp,
+				snd_pcm_rate_ops_t *ops, void **open_func,
+				unsigned int *plugin_version);
@@ -36,7 +36,11 @@
 #include <math.h>
 #include <sys/socket.h>
 #include <poll.h>
+#include <fcntl.h>
 #include <pthread.h>
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
 
 #ifndef PIC
 /* entry for static linking */
@@ -88,14 +92,19 @@ typedef struct {
 	snd_pcm_uframes_t silence_frames;
 	snd_pcm_sw_params_t sw_params;
 	snd_pcm_uframes_t hw_ptr;
-	int poll[2];
-	int polling;
+	int wake_fd[2];			/* eventfd (both) or pipe */
+	int polling;			/* thread waits for wake_ptr */
+	snd_pcm_uframes_t wake_ptr;	/* slave hw_ptr the thread waits for */
+	snd_pcm_uframes_t wake_appl;	/* slave appl_ptr when it was set */
+	int resched;			/* re-evaluate all clients */
+	int priority;			/* SCHED_FIFO priority of the thread */
+	int base_policy;		/* scheduling before the first raise */
+	struct sched_param base_param;
 	pthread_t thread;
 	pthread_mutex_t mutex;
 #ifdef MUTEX_DEBUG
 	char *mutex_holder;
 #endif
-	pthread_cond_t poll_cond;
 } snd_pcm_share_slave_t;
 
 typedef struct {
@@ -110,8 +119,11 @@ typedef struct {
 	snd_pcm_uframes_t hw_ptr;
 	snd_pcm_uframes_t appl_ptr;
 	int ready;
+	int scheduled;			/* event_ptr is valid */
+	snd_pcm_uframes_t event_ptr;	/* slave hw_ptr of the next event */
 	int client_socket;
 	int slave_socket;
+	int priority;			/* SCHED_FIFO priority asked for */
 } snd_pcm_share_t;
 
 #endif /* DOC_HIDDEN */
@@ -343,19 +355,121 @@ static snd_pcm_uframes_t _snd_pcm_share_missing(snd_pcm_t *pcm)
 	return missing;
 }
 
+static int snd_pcm_share_wake_open(snd_pcm_share_slave_t *slave)
+{
+#ifdef HAVE_SYS_EVENTFD_H
+	int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+	slave->wake_fd[0] = slave->wake_fd[1] = fd;
+#else
+	if (pipe(slave->wake_fd) < 0)
+		return -errno;
+	fcntl(slave->wake_fd[0], F_SETFL, O_NONBLOCK);
+	fcntl(slave->wake_fd[1], F_SETFL, O_NONBLOCK);
+#endif
+	return 0;
+}
+
+static void snd_pcm_share_wake_close(snd_pcm_share_slave_t *slave)
+{
+	close(slave->wake_fd[0]);
+	if (slave->wake_fd[1] != slave->wake_fd[0])
+		close(slave->wake_fd[1]);
+}
+
+static void snd_pcm_share_wake(snd_pcm_share_slave_t *slave)
+{
+	uint64_t val = 1;
+	ssize_t s;
+	/* a full pipe or counter has a wakeup pending anyway */
+#ifdef HAVE_SYS_EVENTFD_H
+	s = write(slave->wake_fd[1], &val, sizeof(val));
+#else
+	s = write(slave->wake_fd[1], &val, 1);
+#endif
+	(void)s;
+}
+
+static void snd_pcm_share_wake_clear(snd_pcm_share_slave_t *slave)
+{
+	uint64_t val;
+	while (read(slave->wake_fd[0], &val, sizeof(val)) > 0)
+		;
+}
+
+/* slave hw_ptr on the period boundary at or after missing frames */
+static snd_pcm_uframes_t snd_pcm_share_slave_wake_ptr(snd_pcm_share_slave_t *slave,
+						      snd_pcm_uframes_t missing)
+{
+	snd_pcm_t *spcm = slave->pcm;
+	snd_pcm_uframes_t hw_ptr;
+	hw_ptr = slave->hw_ptr + missing;
+	hw_ptr += spcm->period_size - 1;
+	if (hw_ptr >= spcm->boundary)
+		hw_ptr -= spcm->boundary;
+	hw_ptr -= hw_ptr % spcm->period_size;
+	return hw_ptr;
+}
+
+/* frames from the current slave hw_ptr to ptr */
+static snd_pcm_sframes_t snd_pcm_share_slave_distance(snd_pcm_share_slave_t *slave,
+						      snd_pcm_uframes_t ptr)
+{
+	snd_pcm_sframes_t d = ptr - slave->hw_ptr;
+	if (d < 0)
+		d += slave->pcm->boundary;
+	if ((snd_pcm_uframes_t)d >= slave->pcm->boundary / 2)
+		d -= slave->pcm->boundary;
+	return d;
+}
+
+/* Warning: take the mutex before to call this */
+/* Evaluate the client and keep its next event as slave position */
+static snd_pcm_uframes_t _snd_pcm_share_schedule(snd_pcm_t *pcm)
+{
+	snd_pcm_share_t *share = pcm->private_data;
+	snd_pcm_share_slave_t *slave = share->slave;
+	snd_pcm_uframes_t missing = _snd_pcm_share_missing(pcm);
+	share->scheduled = missing < INT_MAX;
+	if (share->scheduled) {
+		share->event_ptr = slave->hw_ptr + missing;
+		if (share->event_ptr >= slave->pcm->boundary)
+			share->event_ptr -= slave->pcm->boundary;
+	}
+	return missing;
+}
+
+/* Warning: take the mutex before to call this */
+/* The clients are evaluated only when their event is reached, or when
+ * the slave pointer was moved back under them
+ */
 static snd_pcm_uframes_t _snd_pcm_share_slave_missing(snd_pcm_share_slave_t *slave)
 {
-	snd_pcm_uframes_t missing = INT_MAX;
+	snd_pcm_uframes_t missing;
 	struct list_head *i;
+	int all;
 	/* snd_pcm_sframes_t avail = */ snd_pcm_avail_update(slave->pcm);
 	slave->hw_ptr = *slave->pcm->hw.ptr;
-	list_for_each(i, &slave->clients) {
-		snd_pcm_share_t *share = list_entry(i, snd_pcm_share_t, list);
-		snd_pcm_t *pcm = share->pcm;
-		snd_pcm_uframes_t m = _snd_pcm_share_missing(pcm);
-		if (m < missing)
-			missing = m;
-	}
+	do {
+		all = slave->resched;
+		slave->resched = 0;
+		missing = INT_MAX;
+		list_for_each(i, &slave->clients) {
+			snd_pcm_share_t *share = list_entry(i, snd_pcm_share_t, list);
+			snd_pcm_uframes_t m;
+			snd_pcm_sframes_t left;
+			if (!all && !share->scheduled)
+				continue;
+			left = snd_pcm_share_slave_distance(slave, share->event_ptr);
+			if (!all && left > 0)
+				m = left;
+			else
+				m = _snd_pcm_share_schedule(share->pcm);
+			if (m < missing)
+				missing = m;
+		}
+	} while (slave->resched);
 	return missing;
 }
 
@@ -367,7 +481,7 @@ static void *snd_pcm_share_thread(void *data)
 	int err;
 
 	Pthread_mutex_lock(&slave->mutex);
-	pfd[0].fd = slave->poll[0];
+	pfd[0].fd = slave->wake_fd[0];
 	pfd[0].events = POLLIN;
 	err = snd_pcm_poll_descriptors(spcm, &pfd[1], 1);
 	if (err != 1) {
@@ -375,25 +489,16 @@ static void *snd_pcm_share_thread(void *data)
 		Pthread_mutex_unlock(&slave->mutex);
 		return NULL;
 	}
-	err = pipe(slave->poll);
-	if (err < 0) {
-		snd_errornum(PCM, "can't create a pipe");
-		Pthread_mutex_unlock(&slave->mutex);
-		return NULL;
-	}
 	while (slave->open_count > 0) {
 		snd_pcm_uframes_t missing;
+		int nfds = 1;
 		// printf("begin min_missing\n");
 		missing = _snd_pcm_share_slave_missing(slave);
 		// printf("min_missing=%ld\n", missing);
 		if (missing < INT_MAX) {
 			snd_pcm_uframes_t hw_ptr;
 			snd_pcm_sframes_t avail_min;
-			hw_ptr = slave->hw_ptr + missing;
-			hw_ptr += spcm->period_size - 1;
-			if (hw_ptr >= spcm->boundary)
-				hw_ptr -= spcm->boundary;
-			hw_ptr -= hw_ptr % spcm->period_size;
+			hw_ptr = snd_pcm_share_slave_wake_ptr(slave, missing);
 			avail_min = hw_ptr - *spcm->appl.ptr;
 			if (spcm->stream == SND_PCM_STREAM_PLAYBACK)
 				avail_min += spcm->buffer_size;
@@ -409,23 +514,27 @@ static void *snd_pcm_share_thread(void *data)
 					return NULL;
 				}
 			}
+			slave->wake_ptr = hw_ptr;
+			slave->wake_appl = *spcm->appl.ptr;
 			slave->polling = 1;
-			Pthread_mutex_unlock(&slave->mutex);
-			err = poll(pfd, 2, -1);
-			Pthread_mutex_lock(&slave->mutex);
-			if (err > 0 && (pfd[0].revents & POLLIN) != 0) {
-				char buf[1];
-				(void)read(pfd[0].fd, buf, 1);
-			}
+			nfds = 2;
 		} else {
 			slave->polling = 0;
-			pthread_cond_wait(&slave->poll_cond, &slave->mutex);
 		}
+		Pthread_mutex_unlock(&slave->mutex);
+		err = poll(pfd, nfds, -1);
+		Pthread_mutex_lock(&slave->mutex);
+		if (err > 0 && (pfd[0].revents & POLLIN) != 0)
+			snd_pcm_share_wake_clear(slave);
 	}
 	Pthread_mutex_unlock(&slave->mutex);
 	return NULL;
 }
 
+/* Warning: take the mutex before to call this */
+/* The client changed, wake the thread only when it would sleep past
+ * the new event of the client
+ */
 static void _snd_pcm_share_update(snd_pcm_t *pcm)
 {
 	snd_pcm_share_t *share = pcm->private_data;
@@ -434,35 +543,28 @@ static void _snd_pcm_share_update(snd_pcm_t *pcm)
 	snd_pcm_uframes_t missing;
 	/* snd_pcm_sframes_t avail = */ snd_pcm_avail_update(spcm);
 	slave->hw_ptr = *slave->pcm->hw.ptr;
-	missing = _snd_pcm_share_missing(pcm);
+	missing = _snd_pcm_share_schedule(pcm);
 	// printf("missing %ld\n", missing);
-	if (!slave->polling) {
-		pthread_cond_signal(&slave->poll_cond);
-		return;
-	}
-	if (missing < INT_MAX) {
-		snd_pcm_uframes_t hw_ptr;
-		snd_pcm_sframes_t avail_min;
-		hw_ptr = slave->hw_ptr + missing;
-		hw_ptr += spcm->period_size - 1;
-		if (hw_ptr >= spcm->boundary)
-			hw_ptr -= spcm->boundary;
-		hw_ptr -= hw_ptr % spcm->period_size;
-		avail_min = hw_ptr - *spcm->appl.ptr;
-		if (spcm->stream == SND_PCM_STREAM_PLAYBACK)
-			avail_min += spcm->buffer_size;
-		if (avail_min < 0)
-			avail_min += spcm->boundary;
-		if ((snd_pcm_uframes_t)avail_min < spcm->avail_min) {
-			int err;
-			snd_pcm_sw_params_set_avail_min(spcm, &slave->sw_params, avail_min);
-			err = snd_pcm_sw_params(spcm, &slave->sw_params);
-			if (err < 0) {
-				snd_errornum(PCM, "snd_pcm_sw_params error");
+	if (!slave->resched) {
+		snd_pcm_uframes_t wake_ptr, event_ptr;
+		snd_pcm_sframes_t shift;
+		if (missing >= INT_MAX)
+			return;
+		if (slave->polling) {
+			/* the slave avail_min follows its appl_ptr */
+			shift = *spcm->appl.ptr - slave->wake_appl;
+			if (shift < 0)
+				shift += spcm->boundary;
+			wake_ptr = slave->wake_ptr + shift;
+			if (wake_ptr >= spcm->boundary)
+				wake_ptr -= spcm->boundary;
+			event_ptr = snd_pcm_share_slave_wake_ptr(slave, missing);
+			if (snd_pcm_share_slave_distance(slave, wake_ptr) <=
+			    snd_pcm_share_slave_distance(slave, event_ptr))
 				return;
-			}
 		}
 	}
+	snd_pcm_share_wake(slave);
 }
 
 static int snd_pcm_share_nonblock(snd_pcm_t *pcm ATTRIBUTE_UNUSED, int nonblock ATTRIBUTE_UNUSED)
@@ -844,6 +946,7 @@ static snd_pcm_sframes_t _snd_pcm_share_mmap_commit(snd_pcm_t *pcm,
 			ret = snd_pcm_rewind(spcm, frames);
 			if (ret < 0)
 				return ret;
+			slave->resched = 1;
 		}
 	}
 	snd_pcm_mmap_appl_forward(pcm, size);
@@ -922,6 +1025,8 @@ static int snd_pcm_share_reset(snd_pcm_t *pcm)
 	snd_pcm_areas_silence(pcm->running_areas, 0, pcm->channels, pcm->buffer_size, pcm->format);
 	share->hw_ptr = *slave->pcm->hw.ptr;
 	share->appl_ptr = share->hw_ptr;
+	slave->resched = 1;
+	snd_pcm_share_wake(slave);
 	Pthread_mutex_unlock(&slave->mutex);
 	return err;
 }
@@ -954,6 +1059,7 @@ static int snd_pcm_share_start(snd_pcm_t *pcm)
 			err = snd_pcm_rewind(spcm, sd);
 			if (err < 0)
 				goto _end;
+			slave->resched = 1;
 		}
 		assert(share->hw_ptr == 0);
 		share->hw_ptr = *spcm->hw.ptr;
@@ -1048,6 +1154,7 @@ static snd_pcm_sframes_t _snd_pcm_share_rewind(snd_pcm_t *pcm, snd_pcm_uframes_t
 		if (ret < 0)
 			return ret;
 		frames = ret;
+		slave->resched = 1;
 	}
 	snd_pcm_mmap_appl_backward(pcm, frames);
 	_snd_pcm_share_update(pcm);
@@ -1162,6 +1269,7 @@ static void _snd_pcm_share_stop(snd_pcm_t *pcm, snd_pcm_state_t state)
 				errno = -err;
 				snd_errornum(PCM, "rewind failed");
 			}
+			slave->resched = 1;
 		}
 		share->drain_silenced = 0;
 	}
@@ -1269,6 +1377,46 @@ static int snd_pcm_share_drop(snd_pcm_t *pcm)
 	return err;
 }
 
+/* follow the highest priority of the open clients, slave->mutex held */
+static void snd_pcm_share_slave_priority(snd_pcm_share_slave_t *slave)
+{
+	struct list_head *i;
+	struct sched_param param;
+	int priority = 0;
+	int err;
+
+	list_for_each(i, &slave->clients) {
+		snd_pcm_share_t *share = list_entry(i, snd_pcm_share_t, list);
+		if (share->priority > priority)
+			priority = share->priority;
+	}
+	if (priority == slave->priority)
+		return;
+	if (!slave->priority) {
+		err = pthread_getschedparam(slave->thread, &slave->base_policy,
+					    &slave->base_param);
+		if (err) {
+			snd_warn(PCM, "Cannot get the scheduling of the share thread: %s",
+				 strerror(err));
+			return;
+		}
+	}
+	if (priority) {
+		param.sched_priority = priority;
+		err = pthread_setschedparam(slave->thread, SCHED_FIFO, &param);
+	} else {
+		/* the last client asking for a priority is gone */
+		err = pthread_setschedparam(slave->thread, slave->base_policy,
+					    &slave->base_param);
+	}
+	if (err) {
+		snd_warn(PCM, "Cannot set SCHED_FIFO priority %d for the share thread: %s",
+			 priority, strerror(err));
+		return;
+	}
+	slave->priority = priority;
+}
+
 static int snd_pcm_share_close(snd_pcm_t *pcm)
 {
 	snd_pcm_share_t *share = pcm->private_data;
@@ -1279,18 +1427,20 @@ static int snd_pcm_share_close(snd_pcm_t *pcm)
 	Pthread_mutex_lock(&slave->mutex);
 	slave->open_count--;
 	if (slave->open_count == 0) {
-		pthread_cond_signal(&slave->poll_cond);
+		snd_pcm_share_wake(slave);
 		Pthread_mutex_unlock(&slave->mutex);
 		err = pthread_join(slave->thread, 0);
 		assert(err == 0);
 		err = snd_pcm_close(slave->pcm);
+		snd_pcm_share_wake_close(slave);
 		pthread_mutex_destroy(&slave->mutex);
-		pthread_cond_destroy(&slave->poll_cond);
 		list_del(&slave->list);
 		free(slave);
 		list_del(&share->list);
 	} else {
 		list_del(&share->list);
+		if (share->priority)
+			snd_pcm_share_slave_priority(slave);
 		Pthread_mutex_unlock(&slave->mutex);
 	}
 	Pthread_mutex_unlock(&snd_pcm_share_slaves_mutex);
@@ -1511,8 +1661,19 @@ int snd_pcm_share_open(snd_pcm_t **pcmp, const char *name, const char *sname,
 		slave->rate = srate;
 		slave->period_time = speriod_time;
 		slave->buffer_time = sbuffer_time;
+		err = snd_pcm_share_wake_open(slave);
+		if (err < 0) {
+			Pthread_mutex_unlock(&snd_pcm_share_slaves_mutex);
+			snd_pcm_close(spcm);
+			free(slave);
+			close(sd[0]);
+			close(sd[1]);
+			snd_pcm_free(pcm);
+			free(share->slave_channels);
+			free(share);
+			return err;
+		}
 		pthread_mutex_init(&slave->mutex, NULL);
-		pthread_cond_init(&slave->poll_cond, NULL);
 		list_add_tail(&slave->list, &snd_pcm_share_slaves);
 		Pthread_mutex_lock(&slave->mutex);
 		err = pthread_create(&slave->thread, NULL, snd_pcm_share_thread, slave);
@@ -1544,6 +1705,7 @@ int snd_pcm_share_open(snd_pcm_t **pcmp, const char *name, const char *sname,
 	share->slave_socket = sd[1];
 
 	pcm->mmap_rw = 1;
+	pcm->volatile_refine = 1; /* follows the setup of the other clients */
 	pcm->ops = &snd_pcm_share_ops;
 	pcm->fast_ops = &snd_pcm_share_fast_ops;
 	pcm->private_data = share;
@@ -1562,6 +1724,18 @@ int snd_pcm_share_open(snd_pcm_t **pcmp, const char *name, const char *sname,
 	return 0;
 }
 
+/* raise the slave thread to the highest priority asked by the clients */
+static void snd_pcm_share_thread_priority(snd_pcm_t *pcm, int priority)
+{
+	snd_pcm_share_t *share = pcm->private_data;
+	snd_pcm_share_slave_t *slave = share->slave;
+
+	Pthread_mutex_lock(&slave->mutex);
+	share->priority = priority;
+	snd_pcm_share_slave_priority(slave);
+	Pthread_mutex_unlock(&slave->mutex);
+}
+
 /*! \page pcm_plugins
 
 \section pcm_plugins_share Plugin: Share
@@ -1592,9 +1766,20 @@ pcm.name {
 	bindings {
 		N INT		# Slave channel INT for client channel N
 	}
+	[priority INT]		# SCHED_FIFO priority of the slave thread
 }
 \endcode
 
+One thread per slave moves the data of all its clients.  It sleeps on
+the slave and on an eventfd the clients signal, and wakes only for the
+nearest event of the clients (avail_min, xrun, drain).  Each client
+keeps its next event as a slave position, so a wakeup evaluates only
+the clients which reached it.  With <code>priority</code> the thread
+runs as SCHED_FIFO; the highest priority of the open clients wins, and
+it is lowered again when that client closes.  Values above the SCHED_FIFO
+maximum (99 on Linux) are rejected.  When the privilege is missing, the
+thread keeps its normal scheduling.
+
 \subsection pcm_plugins_share_funcref Function reference
 
 <UL>
@@ -1633,6 +1818,7 @@ int _snd_pcm_share_open(snd_pcm_t **pcmp, const char *name,
 	int srate = -1;
 	int speriod_time= -1, sbuffer_time = -1;
 	unsigned int schannel_max = 0;
+	long priority = 0;
 
 	snd_config_for_each(i, next, conf) {
 		snd_config_t *n = snd_config_iterator_entry(i);
@@ -1653,6 +1839,18 @@ int _snd_pcm_share_open(snd_pcm_t **pcmp, const char *name,
 			bindings = n;
 			continue;
 		}
+		if (strcmp(id, "priority") == 0) {
+			if (snd_config_get_integer(n, &priority) < 0) {
+				snd_error(PCM, "Invalid type for %s", id);
+				return -EINVAL;
+			}
+			if (priority < 0 ||
+			    priority > sched_get_priority_max(SCHED_FIFO)) {
+				snd_error(PCM, "Invalid value for %s", id);
+				return -EINVAL;
+			}
+			continue;
+		}
 		snd_error(PCM, "Unknown field %s", id);
 		return -EINVAL;
 	}
@@ -1733,6 +1931,8 @@ int _snd_pcm_share_open(snd_pcm_t **pcmp, const char *name,
 				 (unsigned int) schannels,
 				 speriod_time, sbuffer_time,
 				 channels, channels_map, stream, mode);
+	if (err >= 0 && priority > 0)
+		snd_pcm_share_thread_priority(*pcmp, priority);
 _free:
 	free(channels_map);
 	free((char *)sname);
@@ -15,6 +15,9 @@
  * (0-9).  In addition, it puts the mode suffix ('a' for avail, 'd' for
  * delay, etc) for the random mode, as well as the suffix '!' indicating
  * the error from the called function.
+ *
+ * With the -S option, the status queries are served from the lock-free
+ * snapshot (see snd_pcm_status_snapshot_enable()).
  */
 
 #include <stdio.h>
@@ -49,6 +52,7 @@ static snd_pcm_format_t format = SND_PCM_FORMAT_S16_LE;
 static int running_mode = MODE_AVAIL_UPDATE;
 static int show_value = 0;
 static int quiet = 0;
+static int snapshot = 0;
 
 static pthread_t peeper_threads[MAX_THREADS];
 static int running = 1;
@@ -118,13 +122,14 @@ static void usage(void)
 	fprintf(stderr, "  -m str  Running mode (avail, status, hwsync, timestamp, delay, random)\n");
 	fprintf(stderr, "  -v      Show value\n");
 	fprintf(stderr, "  -q      Quiet mode\n");
+	fprintf(stderr, "  -S      Lock-free status snapshot\n");
 }
 
 static int parse_options(int argc, char **argv)
 {
 	int c, i;
 
-	while ((c = getopt(argc, argv, "D:r:f:p:b:s:t:m:vq")) >= 0) {
+	while ((c = getopt(argc, argv, "D:r:f:p:b:s:t:m:vqS")) >= 0) {
 		switch (c) {
 		case 'D':
 			pcmdev = optarg;
@@ -177,6 +182,9 @@ static int parse_options(int argc, char **argv)
 		case 'q':
 			quiet = 1;
 			break;
+		case 'S':
+			snapshot = 1;
+			break;
 		default:
 			usage();
 			return 1;
@@ -219,6 +227,11 @@ int main(int argc, char **argv)
 		return 1;
 	}
 
+	if (snapshot && snd_pcm_status_snapshot_enable(pcm, 1) < 0) {
+		fprintf(stderr, "cannot enable the status snapshot\n");
+		return 1;
+	}
+
 	if (setup_params())
 		return 1;
 
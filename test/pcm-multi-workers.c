@@ -0,0 +1,257 @@
+/*
+ * stress test for the worker threads of the multi PCM
+ *
+ * A four channel multi PCM is built over two file PCMs, each writing two
+ * channels of a null PCM into a raw file, with a worker thread for each
+ * slave.  The main thread writes a counting sequence in random chunks.
+ * Meanwhile, the peeper threads query avail, delay, state and status,
+ * and the dropper thread stops and restarts the stream at random times.
+ *
+ * Every frame accepted by the multi PCM has to reach both files exactly
+ * once and in order, so at the end each file is compared with the frames
+ * written.  The exit status is zero when both files match.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <getopt.h>
+#include "../include/asoundlib.h"
+
+#define CHANNELS	4
+#define MAX_CHUNK	1000
+#define MAX_THREADS	10
+
+static long total_frames = 1000000;
+static int num_threads = 2;
+static int drops = 1;
+static int verbose = 0;
+
+static snd_pcm_t *pcm;
+static int running = 1;
+static unsigned long long peeps, dropped;
+
+static void *peeper(void *data)
+{
+	snd_pcm_status_t *stat;
+	snd_pcm_sframes_t delay;
+	unsigned int seed = (long)data;
+	unsigned long long n = 0;
+
+	snd_pcm_status_alloca(&stat);
+	while (__atomic_load_n(&running, __ATOMIC_RELAXED)) {
+		switch (rand_r(&seed) % 4) {
+		case 0:
+			snd_pcm_avail_update(pcm);
+			break;
+		case 1:
+			snd_pcm_delay(pcm, &delay);
+			break;
+		case 2:
+			snd_pcm_state(pcm);
+			break;
+		default:
+			snd_pcm_status(pcm, stat);
+			break;
+		}
+		n++;
+	}
+	__atomic_add_fetch(&peeps, n, __ATOMIC_RELAXED);
+	return NULL;
+}
+
+static void *dropper(void *data)
+{
+	unsigned int seed = (long)data;
+
+	while (__atomic_load_n(&running, __ATOMIC_RELAXED)) {
+		usleep(rand_r(&seed) % 500);
+		if (snd_pcm_drop(pcm) < 0)
+			continue;
+		snd_pcm_prepare(pcm);
+		__atomic_add_fetch(&dropped, 1, __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+static int check_file(const char *path, int first, long frames)
+{
+	FILE *f = fopen(path, "rb");
+	int32_t v[2];
+	long n;
+	int c;
+
+	if (!f) {
+		printf("cannot open %s\n", path);
+		return -1;
+	}
+	for (n = 0; n < frames; n++) {
+		if (fread(v, sizeof(v), 1, f) != 1) {
+			printf("%s: short by %ld frames\n", path, frames - n);
+			fclose(f);
+			return -1;
+		}
+		for (c = 0; c < 2; c++) {
+			if (v[c] != (int32_t)(n * CHANNELS + first + c)) {
+				printf("%s: frame %ld channel %d is %d\n",
+				       path, n, c, v[c]);
+				fclose(f);
+				return -1;
+			}
+		}
+	}
+	if (fread(v, 1, 1, f) != 0) {
+		printf("%s: more frames than written\n", path);
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
+	return 0;
+}
+
+static void usage(void)
+{
+	printf("usage: pcm-multi-workers [-n frames][-t threads][-D][-v]\n");
+	printf("  -n frames     frames to write (default 1000000)\n");
+	printf("  -t threads    number of peeper threads (default 2)\n");
+	printf("  -D            no concurrent drop and prepare\n");
+	printf("  -v            verbose\n");
+}
+
+int main(int argc, char **argv)
+{
+	char dir[] = "/tmp/pcm-multi-workers.XXXXXX";
+	char path[2][64], conf_text[1024];
+	pthread_t peeper_threads[MAX_THREADS], drop_thread;
+	snd_config_t *conf;
+	snd_input_t *in;
+	int32_t buf[MAX_CHUNK * CHANNELS];
+	unsigned int seed = 1;
+	long written = 0;
+	int i, c, err, ret = 1;
+
+	while ((c = getopt(argc, argv, "n:t:Dv")) >= 0) {
+		switch (c) {
+		case 'n':
+			total_frames = atol(optarg);
+			break;
+		case 't':
+			num_threads = atoi(optarg);
+			if (num_threads < 0 || num_threads > MAX_THREADS) {
+				printf("invalid thread numbers %d\n", num_threads);
+				return 1;
+			}
+			break;
+		case 'D':
+			drops = 0;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage();
+			return 1;
+		}
+	}
+
+	if (!mkdtemp(dir)) {
+		perror("mkdtemp");
+		return 1;
+	}
+	for (i = 0; i < 2; i++)
+		snprintf(path[i], sizeof(path[i]), "%s/%c.raw", dir, 'a' + i);
+	snprintf(conf_text, sizeof(conf_text),
+		 "pcm.stress {\n"
+		 "	type multi\n"
+		 "	workers true\n"
+		 "	slaves.a.pcm { type file slave.pcm { type null } file \"%s\" format raw }\n"
+		 "	slaves.a.channels 2\n"
+		 "	slaves.b.pcm { type file slave.pcm { type null } file \"%s\" format raw }\n"
+		 "	slaves.b.channels 2\n"
+		 "	bindings.0 { slave a channel 0 }\n"
+		 "	bindings.1 { slave a channel 1 }\n"
+		 "	bindings.2 { slave b channel 0 }\n"
+		 "	bindings.3 { slave b channel 1 }\n"
+		 "}\n", path[0], path[1]);
+
+	err = snd_config_top(&conf);
+	if (err < 0)
+		goto _rmdir;
+	err = snd_input_buffer_open(&in, conf_text, -1);
+	if (err < 0) {
+		snd_config_delete(conf);
+		goto _rmdir;
+	}
+	err = snd_config_load(conf, in);
+	snd_input_close(in);
+	if (err < 0) {
+		printf("config error: %s\n", snd_strerror(err));
+		snd_config_delete(conf);
+		goto _rmdir;
+	}
+	err = snd_pcm_open_lconf(&pcm, "stress", SND_PCM_STREAM_PLAYBACK, 0, conf);
+	snd_config_delete(conf);
+	if (err < 0) {
+		printf("open error: %s\n", snd_strerror(err));
+		goto _rmdir;
+	}
+	err = snd_pcm_set_params(pcm, SND_PCM_FORMAT_S32, SND_PCM_ACCESS_RW_INTERLEAVED,
+				 CHANNELS, 48000, 0, 100000);
+	if (err < 0) {
+		printf("set_params error: %s\n", snd_strerror(err));
+		goto _close;
+	}
+
+	for (i = 0; i < num_threads; i++)
+		pthread_create(&peeper_threads[i], NULL, peeper, (void *)(long)i + 1);
+	if (drops)
+		pthread_create(&drop_thread, NULL, dropper, (void *)(long)num_threads + 1);
+
+	while (written < total_frames) {
+		snd_pcm_sframes_t frames = 1 + rand_r(&seed) % MAX_CHUNK;
+		snd_pcm_sframes_t result;
+
+		if (frames > total_frames - written)
+			frames = total_frames - written;
+		for (i = 0; i < frames; i++)
+			for (c = 0; c < CHANNELS; c++)
+				buf[i * CHANNELS + c] = (written + i) * CHANNELS + c;
+		result = snd_pcm_writei(pcm, buf, frames);
+		if (result == -EPIPE || result == -EBADFD) {
+			/* stopped by the dropper */
+			snd_pcm_prepare(pcm);
+			continue;
+		}
+		if (result < 0) {
+			printf("write error: %s\n", snd_strerror(result));
+			break;
+		}
+		/* a partial write is continued by the next chunk */
+		written += result;
+	}
+
+	__atomic_store_n(&running, 0, __ATOMIC_RELAXED);
+	for (i = 0; i < num_threads; i++)
+		pthread_join(peeper_threads[i], NULL);
+	if (drops)
+		pthread_join(drop_thread, NULL);
+	snd_pcm_drop(pcm);
+
+ _close:
+	snd_pcm_close(pcm);
+	if (written == total_frames &&
+	    !check_file(path[0], 0, written) &&
+	    !check_file(path[1], 2, written))
+		ret = 0;
+	if (verbose || ret)
+		printf("written %ld frames, %llu queries, %llu drops: %s\n",
+		       written, peeps, dropped, ret ? "FAILED" : "ok");
+	unlink(path[0]);
+	unlink(path[1]);
+ _rmdir:
+	rmdir(dir);
+	return ret;
+}